@@ -0,0 +1,469 @@
+#include "BatchMachine.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#if defined(__AVX2__)
+#define VM_BATCH_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VM_BATCH_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace RiscV;
+
+namespace {
+
+	// one vector of lanes, comparisons return all bits set for true
+#if defined(VM_BATCH_AVX2)
+	typedef __m256i Vec;
+	size_t const cVecLanes = 8;
+	inline Vec Load(WORD const* p) { return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p)); }
+	inline void Store(WORD* p, Vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	inline Vec Set1(WORD v) { return _mm256_set1_epi32(v); }
+	inline Vec Add(Vec a, Vec b) { return _mm256_add_epi32(a, b); }
+	inline Vec Sub(Vec a, Vec b) { return _mm256_sub_epi32(a, b); }
+	inline Vec And(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+	inline Vec Or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+	inline Vec Xor(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+	inline Vec CmpEq(Vec a, Vec b) { return _mm256_cmpeq_epi32(a, b); }
+	inline Vec CmpLt(Vec a, Vec b) { return _mm256_cmpgt_epi32(b, a); }
+	inline Vec Sll(Vec a, WORD n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+	inline Vec Srl(Vec a, WORD n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+	inline Vec Sra(Vec a, WORD n) { return _mm256_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+	// lanes of mask take a, the others b
+	inline Vec Select(Vec mask, Vec a, Vec b) { return _mm256_blendv_epi8(b, a, mask); }
+#elif defined(VM_BATCH_SSE2)
+	typedef __m128i Vec;
+	size_t const cVecLanes = 4;
+	inline Vec Load(WORD const* p) { return _mm_loadu_si128(reinterpret_cast<__m128i const*>(p)); }
+	inline void Store(WORD* p, Vec v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+	inline Vec Set1(WORD v) { return _mm_set1_epi32(v); }
+	inline Vec Add(Vec a, Vec b) { return _mm_add_epi32(a, b); }
+	inline Vec Sub(Vec a, Vec b) { return _mm_sub_epi32(a, b); }
+	inline Vec And(Vec a, Vec b) { return _mm_and_si128(a, b); }
+	inline Vec Or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+	inline Vec Xor(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+	inline Vec CmpEq(Vec a, Vec b) { return _mm_cmpeq_epi32(a, b); }
+	inline Vec CmpLt(Vec a, Vec b) { return _mm_cmplt_epi32(a, b); }
+	inline Vec Sll(Vec a, WORD n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+	inline Vec Srl(Vec a, WORD n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+	inline Vec Sra(Vec a, WORD n) { return _mm_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+	inline Vec Select(Vec mask, Vec a, Vec b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+#else
+	typedef WORD Vec;
+	size_t const cVecLanes = 1;
+	inline Vec Load(WORD const* p) { return *p; }
+	inline void Store(WORD* p, Vec v) { *p = v; }
+	inline Vec Set1(WORD v) { return v; }
+	inline Vec Add(Vec a, Vec b) { return static_cast<WORD>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b)); }
+	inline Vec Sub(Vec a, Vec b) { return static_cast<WORD>(static_cast<uint32_t>(a) - static_cast<uint32_t>(b)); }
+	inline Vec And(Vec a, Vec b) { return a & b; }
+	inline Vec Or(Vec a, Vec b) { return a | b; }
+	inline Vec Xor(Vec a, Vec b) { return a ^ b; }
+	inline Vec CmpEq(Vec a, Vec b) { return a == b ? -1 : 0; }
+	inline Vec CmpLt(Vec a, Vec b) { return a < b ? -1 : 0; }
+	inline Vec Sll(Vec a, WORD n) { return static_cast<WORD>(static_cast<uint32_t>(a) << n); }
+	inline Vec Srl(Vec a, WORD n) { return static_cast<WORD>(static_cast<uint32_t>(a) >> n); }
+	inline Vec Sra(Vec a, WORD n) { return a < 0 ? ~(~a >> n) : a >> n; }
+	inline Vec Select(Vec mask, Vec a, Vec b) { return (mask & a) | (~mask & b); }
+#endif
+
+	inline Vec CmpLtUnsigned(Vec a, Vec b) {
+		Vec const bias = Set1(INT32_MIN);
+		return CmpLt(Xor(a, bias), Xor(b, bias));
+	}
+	inline Vec Not(Vec a) { return Xor(a, Set1(-1)); }
+	// comparison results as 1 or 0
+	inline Vec Bool(Vec a) { return And(a, Set1(1)); }
+}
+
+BatchMachine::BatchMachine(std::vector<INSTRUCTION> const& image, size_t lanes, CodeLayout const& layout) :
+	mLanes(lanes)
+{
+	mStride = (lanes + cVecLanes - 1) / cVecLanes * cVecLanes;
+	mDecodedInstructions.reserve(image.size());
+	for (INSTRUCTION const instruction : image) {
+		mDecodedInstructions.push_back(Decode(instruction));
+	}
+	if (!layout.offsets.empty()) {
+		Relocate(mDecodedInstructions, layout);
+	}
+	mInstructionSize = mDecodedInstructions.size();
+
+	mRegisters.assign(cRegCount * mStride, 0);
+	mMask.assign(mStride, 0);
+	mPcs.assign(mStride, static_cast<WORD>(cDone));
+	std::fill(mPcs.begin(), mPcs.begin() + mLanes, mInstructionSize != 0 ? 0 : cDone);
+	mMemory.assign(mLanes * cMemorySize, 0);
+}
+
+bool BatchMachine::is_ready() const {
+	return mLanes != 0 && mInstructionSize != 0;
+}
+
+size_t BatchMachine::Lanes() const {
+	return mLanes;
+}
+
+void BatchMachine::SetRegister(size_t lane, size_t idx, WORD value) {
+	mRegisters[idx * mStride + lane] = value;
+}
+
+WORD BatchMachine::Register(size_t lane, size_t idx) const {
+	return mRegisters[idx * mStride + lane];
+}
+
+bool BatchMachine::ReadBlock(size_t lane, ADDRESS address, void* buffer, size_t size) const {
+	if (address < 0 || static_cast<size_t>(address) + size > cMemorySize) return false;
+	std::memcpy(buffer, &mMemory[lane * cMemorySize + address], size);
+	return true;
+}
+
+bool BatchMachine::WriteBlock(size_t lane, ADDRESS address, void const* buffer, size_t size) {
+	if (address < 0 || static_cast<size_t>(address) + size > cMemorySize) return false;
+	std::memcpy(&mMemory[lane * cMemorySize + address], buffer, size);
+	return true;
+}
+
+bool BatchMachine::Finished(size_t lane) const {
+	return mPcs[lane] == cDone;
+}
+
+uint64_t BatchMachine::ExecutedInstructions() const {
+	return mExecutedInstructions;
+}
+
+uint64_t BatchMachine::Dispatches() const {
+	return mDispatches;
+}
+
+inline WORD* BatchMachine::Row(size_t idx) {
+	return &mRegisters[idx * mStride];
+}
+
+void BatchMachine::Run() {
+	WORD pc = NextPc();
+	size_t active = BuildMask(pc);
+	while (pc != cDone) {
+		mExecutedInstructions += active;
+		++mDispatches;
+		if (Execute(pc, mDecodedInstructions[pc])) {
+			bool const inRange = static_cast<size_t>(pc) + 1 < mInstructionSize;
+			// while all running lanes are at the same pc neither the mask nor their pcs change
+			// in straight line code, the pcs are written again by the next jump
+			if (mConverged && inRange) {
+				++pc;
+				continue;
+			}
+			Advance(pc);
+			if (inRange) {
+				// the lanes that were at pc are now the ones at pc + 1, waiting lanes there join them
+				++pc;
+				active = BuildMask(pc);
+				continue;
+			}
+		}
+		pc = NextPc();
+		active = BuildMask(pc);
+	}
+}
+
+size_t BatchMachine::BuildMask(WORD pc) {
+	Vec const current = Set1(pc);
+	WORD const* const pcs = mPcs.data();
+	WORD* const mask = mMask.data();
+	for (size_t l = 0; l < mStride; l += cVecLanes) {
+		Store(mask + l, CmpEq(Load(pcs + l), current));
+	}
+	size_t active = 0;
+	for (size_t l = 0; l < mLanes; ++l) {
+		active += mask[l] & 1;
+	}
+	return active;
+}
+
+WORD BatchMachine::NextPc() {
+	WORD next = cDone;
+	size_t running = 0;
+	size_t atNext = 0;
+	for (size_t l = 0; l < mLanes; ++l) {
+		WORD const pc = mPcs[l];
+		if (pc == cDone) continue;
+		if (static_cast<uint32_t>(pc) >= mInstructionSize) {
+			PrintWarning(l, pc, "program counter went out of range (0d" + std::to_string(pc) + "), stopping lane");
+			mPcs[l] = cDone;
+			continue;
+		}
+		++running;
+		if (pc < next) {
+			next = pc;
+			atNext = 0;
+		}
+		if (pc == next) ++atNext;
+	}
+	mConverged = running == atNext;
+	return next;
+}
+
+template <class Op>
+inline void BatchMachine::Alu(BYTE rd, BYTE rs1, BYTE rs2, Op op) {
+	WORD* const d = Row(rd);
+	WORD const* const a = Row(rs1);
+	WORD const* const b = Row(rs2);
+	WORD const* const mask = mMask.data();
+	for (size_t l = 0; l < mStride; l += cVecLanes) {
+		// all loads of a vector happen before its store, rd may be rs1 or rs2
+		Vec const res = op(Load(a + l), Load(b + l));
+		Store(d + l, Select(Load(mask + l), res, Load(d + l)));
+	}
+}
+
+template <class Op>
+inline void BatchMachine::AluImmediate(BYTE rd, BYTE rs1, WORD imm, Op op) {
+	WORD* const d = Row(rd);
+	WORD const* const a = Row(rs1);
+	WORD const* const mask = mMask.data();
+	Vec const immediate = Set1(imm);
+	for (size_t l = 0; l < mStride; l += cVecLanes) {
+		Vec const res = op(Load(a + l), immediate);
+		Store(d + l, Select(Load(mask + l), res, Load(d + l)));
+	}
+}
+
+template <class Op>
+inline void BatchMachine::Branch(WORD pc, BYTE rs1, BYTE rs2, WORD target, Op condition) {
+	WORD const* const a = Row(rs1);
+	WORD const* const b = Row(rs2);
+	WORD const* const mask = mMask.data();
+	WORD* const pcs = mPcs.data();
+	Vec const taken = Set1(target);
+	Vec const next = Set1(pc + 1);
+	for (size_t l = 0; l < mStride; l += cVecLanes) {
+		Vec const active = Load(mask + l);
+		Vec const jump = And(active, condition(Load(a + l), Load(b + l)));
+		Store(pcs + l, Select(jump, taken, Select(active, next, Load(pcs + l))));
+	}
+}
+
+template <class Op>
+inline void BatchMachine::ForActive(Op op) {
+	WORD const* const mask = mMask.data();
+	for (size_t l = 0; l < mLanes; ++l) {
+		if (mask[l] != 0) op(l);
+	}
+}
+
+bool BatchMachine::Execute(WORD pc, DecodedInstruction const& inst) {
+	BYTE const rd = inst.rd;
+	BYTE const rs1 = inst.rs1;
+	BYTE const rs2 = inst.rs2;
+	WORD const imm = inst.imm;
+
+	switch (inst.handler) {
+	case Handler::SLEEP: {
+		PrintInfo(pc, "sleep instruction reached, ending execution of the lanes at this pc");
+		ForActive([&](size_t l) { mPcs[l] = cDone; });
+		return false;
+	}
+	case Handler::PRINT: {
+		// one line per lane, prefixed with the lane
+		std::ostringstream oss;
+		ForActive([&](size_t l) { oss << "[" << l << "] " << Row(rs1)[l] << "\n"; });
+		std::cout << oss.str() << std::flush;
+		break;
+	}
+	case Handler::ADD: Alu(rd, rs1, rs2, [](Vec a, Vec b) { return Add(a, b); }); break;
+	case Handler::SUB: Alu(rd, rs1, rs2, [](Vec a, Vec b) { return Sub(a, b); }); break;
+	case Handler::SLT: Alu(rd, rs1, rs2, [](Vec a, Vec b) { return Bool(CmpLt(a, b)); }); break;
+	case Handler::SLTU: Alu(rd, rs1, rs2, [](Vec a, Vec b) { return Bool(CmpLtUnsigned(a, b)); }); break;
+	case Handler::XOR: Alu(rd, rs1, rs2, [](Vec a, Vec b) { return Xor(a, b); }); break;
+	case Handler::OR: Alu(rd, rs1, rs2, [](Vec a, Vec b) { return Or(a, b); }); break;
+	case Handler::AND: Alu(rd, rs1, rs2, [](Vec a, Vec b) { return And(a, b); }); break;
+	case Handler::ADDI: AluImmediate(rd, rs1, imm, [](Vec a, Vec i) { return Add(a, i); }); break;
+	case Handler::SLTI: AluImmediate(rd, rs1, imm, [](Vec a, Vec i) { return Bool(CmpLt(a, i)); }); break;
+	case Handler::SLTIU: AluImmediate(rd, rs1, imm, [](Vec a, Vec i) { return Bool(CmpLtUnsigned(a, i)); }); break;
+	case Handler::XORI: AluImmediate(rd, rs1, imm, [](Vec a, Vec i) { return Xor(a, i); }); break;
+	case Handler::ORI: AluImmediate(rd, rs1, imm, [](Vec a, Vec i) { return Or(a, i); }); break;
+	case Handler::ANDI: AluImmediate(rd, rs1, imm, [](Vec a, Vec i) { return And(a, i); }); break;
+	case Handler::SLLI: AluImmediate(rd, rs1, imm, [imm](Vec a, Vec) { return Sll(a, imm); }); break;
+	case Handler::SRLI: AluImmediate(rd, rs1, imm, [imm](Vec a, Vec) { return Srl(a, imm); }); break;
+	case Handler::SRAI: AluImmediate(rd, rs1, imm, [imm](Vec a, Vec) { return Sra(a, imm); }); break;
+	case Handler::LUI: AluImmediate(rd, rs1, imm, [](Vec, Vec i) { return i; }); break;
+	case Handler::AUIPC: AluImmediate(rd, rs1, pc + imm, [](Vec, Vec i) { return i; }); break;
+	case Handler::SHIFT_ILLEGAL: {
+		ForActive([&](size_t l) { PrintWarning(l, pc, "illegal shift amount, rd=rs1"); });
+		AluImmediate(rd, rs1, 0, [](Vec a, Vec) { return a; });
+		break;
+	}
+
+	// no vector shifts by register in SSE2 and no 32 bit multiplication, these go lane by lane
+	case Handler::SLL: ForActive([&](size_t l) { Row(rd)[l] = Row(rs1)[l] << (Row(rs2)[l] & 0x1F); }); break;
+	case Handler::SRL: ForActive([&](size_t l) { Row(rd)[l] = static_cast<uint32_t>(Row(rs1)[l]) >> (Row(rs2)[l] & 0x1F); }); break;
+	case Handler::SRA: ForActive([&](size_t l) { Row(rd)[l] = Row(rs1)[l] >> (Row(rs2)[l] & 0x1F); }); break;
+	case Handler::MUL: {
+		ForActive([&](size_t l) { Row(rd)[l] = static_cast<WORD>(static_cast<int64_t>(Row(rs1)[l]) * Row(rs2)[l] & 0xFFFFFFFF); });
+		break;
+	}
+	case Handler::MULH: {
+		ForActive([&](size_t l) { Row(rd)[l] = static_cast<WORD>((static_cast<int64_t>(Row(rs1)[l]) * Row(rs2)[l]) >> 32); });
+		break;
+	}
+	case Handler::MULHSU: {
+		ForActive([&](size_t l) {
+			Row(rd)[l] = static_cast<WORD>((static_cast<int64_t>(Row(rs1)[l]) * static_cast<int64_t>(static_cast<uint32_t>(Row(rs2)[l]))) >> 32);
+		});
+		break;
+	}
+	case Handler::MULHU: {
+		ForActive([&](size_t l) {
+			Row(rd)[l] = static_cast<WORD>((static_cast<uint64_t>(static_cast<uint32_t>(Row(rs1)[l])) * static_cast<uint32_t>(Row(rs2)[l])) >> 32);
+		});
+		break;
+	}
+	// the same division by zero rules as VirtualMachine
+	case Handler::DIV: {
+		ForActive([&](size_t l) {
+			WORD const divisor = Row(rs2)[l];
+			if (divisor == 0) {
+				PrintWarning(l, pc, "trying to divide through 0, not executing instruction");
+				return;
+			}
+			Row(rd)[l] = Row(rs1)[l] / divisor;
+		});
+		break;
+	}
+	case Handler::DIVU: {
+		ForActive([&](size_t l) {
+			uint32_t divisor = Row(rs2)[l];
+			if (divisor == 0) {
+				PrintWarning(l, pc, "trying to divide through 0, setting value to 1 instead");
+				divisor = 1;
+			}
+			Row(rd)[l] = static_cast<uint32_t>(Row(rs1)[l]) / divisor;
+		});
+		break;
+	}
+	case Handler::REM: {
+		ForActive([&](size_t l) {
+			WORD divisor = Row(rs2)[l];
+			if (divisor == 0) {
+				PrintWarning(l, pc, "trying to modulo through 0, setting value to 1 instead");
+				divisor = 1;
+			}
+			Row(rd)[l] = Row(rs1)[l] % divisor;
+		});
+		break;
+	}
+	case Handler::REMU: {
+		ForActive([&](size_t l) {
+			uint32_t divisor = Row(rs2)[l];
+			if (divisor == 0) {
+				PrintWarning(l, pc, "trying to modulo through 0, setting value to 1 instead");
+				divisor = 1;
+			}
+			Row(rd)[l] = static_cast<uint32_t>(Row(rs1)[l]) % divisor;
+		});
+		break;
+	}
+
+	// every lane has its own memory, loads and stores are a gather and a scatter
+	case Handler::LB: ForActive([&](size_t l) { Row(rd)[l] = static_cast<int8_t>(ReadMemory(l, pc, Row(rs1)[l] + imm, 1)); }); break;
+	case Handler::LH: ForActive([&](size_t l) { Row(rd)[l] = static_cast<int16_t>(ReadMemory(l, pc, Row(rs1)[l] + imm, 2)); }); break;
+	case Handler::LW: ForActive([&](size_t l) { Row(rd)[l] = ReadMemory(l, pc, Row(rs1)[l] + imm, 4); }); break;
+	case Handler::LBU: ForActive([&](size_t l) { Row(rd)[l] = ReadMemory(l, pc, Row(rs1)[l] + imm, 1); }); break;
+	case Handler::LHU: ForActive([&](size_t l) { Row(rd)[l] = ReadMemory(l, pc, Row(rs1)[l] + imm, 2); }); break;
+	case Handler::SB: ForActive([&](size_t l) { WriteMemory(l, pc, Row(rs1)[l] + imm, Row(rs2)[l], 1); }); break;
+	case Handler::SH: ForActive([&](size_t l) { WriteMemory(l, pc, Row(rs1)[l] + imm, Row(rs2)[l], 2); }); break;
+	case Handler::SW: ForActive([&](size_t l) { WriteMemory(l, pc, Row(rs1)[l] + imm, Row(rs2)[l], 4); }); break;
+
+	case Handler::JAL: {
+		AluImmediate(rd, rd, pc + 1, [](Vec, Vec i) { return i; });
+		ForActive([&](size_t l) { mPcs[l] = imm; });
+		return false;
+	}
+	case Handler::JALR: {
+		// the target is read before rd is written, rs1 may be rd
+		ForActive([&](size_t l) {
+			WORD const target = Row(rs1)[l] + imm;
+			Row(rd)[l] = pc + 1;
+			mPcs[l] = target;
+		});
+		return false;
+	}
+	case Handler::JR: ForActive([&](size_t l) { mPcs[l] = Row(rs1)[l] + imm; }); return false;
+	case Handler::BEQ: Branch(pc, rs1, rs2, imm, [](Vec a, Vec b) { return CmpEq(a, b); }); return false;
+	case Handler::BNEQ: Branch(pc, rs1, rs2, imm, [](Vec a, Vec b) { return Not(CmpEq(a, b)); }); return false;
+	case Handler::BLT: Branch(pc, rs1, rs2, imm, [](Vec a, Vec b) { return CmpLt(a, b); }); return false;
+	case Handler::BGE: Branch(pc, rs1, rs2, imm, [](Vec a, Vec b) { return Not(CmpLt(a, b)); }); return false;
+	case Handler::BLTU: Branch(pc, rs1, rs2, imm, [](Vec a, Vec b) { return CmpLtUnsigned(a, b); }); return false;
+	case Handler::BGEU: Branch(pc, rs1, rs2, imm, [](Vec a, Vec b) { return Not(CmpLtUnsigned(a, b)); }); return false;
+
+	// the lanes share one dispatch loop, the counters are not kept per lane
+	case Handler::CSRR: {
+		ForActive([&](size_t l) { PrintWarning(l, pc, "counters are not kept per lane, reading 0"); });
+		AluImmediate(rd, rs1, 0, [](Vec, Vec i) { return i; });
+		break;
+	}
+	case Handler::CSR_ILLEGAL:
+		ForActive([&](size_t l) { PrintWarning(l, pc, "illegal csr access, only reading the counters is supported"); });
+		break;
+
+	case Handler::NOP:
+		break;
+	default:
+		ForActive([&](size_t l) { PrintWarning(l, pc, "unknown opcode"); });
+		break;
+	}
+
+	return true;
+}
+
+void BatchMachine::Advance(WORD pc) {
+	WORD const* const mask = mMask.data();
+	WORD* const pcs = mPcs.data();
+	Vec const next = Set1(pc + 1);
+	for (size_t l = 0; l < mStride; l += cVecLanes) {
+		Store(pcs + l, Select(Load(mask + l), next, Load(pcs + l)));
+	}
+}
+
+WORD BatchMachine::ReadMemory(size_t lane, WORD pc, ADDRESS address, size_t size) {
+	if (address < 0 || static_cast<size_t>(address) + size > cMemorySize) {
+		std::ostringstream oss;
+		oss << "read from undefined memory address 0x" << std::setfill('0') << std::setw(4) << std::hex << address;
+		PrintWarning(lane, pc, oss.str());
+		return 0;
+	}
+	// guest and host are both little endian
+	uint32_t data = 0;
+	std::memcpy(&data, &mMemory[lane * cMemorySize + address], size);
+	return static_cast<WORD>(data);
+}
+
+void BatchMachine::WriteMemory(size_t lane, WORD pc, ADDRESS address, WORD data, size_t size) {
+	if (address < 0 || static_cast<size_t>(address) + size > cMemorySize) {
+		std::ostringstream oss;
+		oss << "write to undefined memory address 0x" << std::setfill('0') << std::setw(4) << std::hex << address;
+		PrintWarning(lane, pc, oss.str());
+		return;
+	}
+	uint32_t const value = static_cast<uint32_t>(data);
+	std::memcpy(&mMemory[lane * cMemorySize + address], &value, size);
+}
+
+void BatchMachine::PrintWarning(size_t lane, WORD pc, std::string const& message) {
+	std::ostringstream oss;
+	oss << "warning at pc 0x" << std::setfill('0') << std::setw(4) << std::hex << pc << std::dec << ", lane " << lane << ": " << message << std::endl;
+	std::cerr << oss.str();
+}
+
+void BatchMachine::PrintInfo(WORD pc, std::string const& message) {
+	std::ostringstream oss;
+	oss << "info at pc 0x" << std::setfill('0') << std::setw(4) << std::hex << pc << ": " << message << std::endl;
+	std::cerr << oss.str();
+}
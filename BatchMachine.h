@@ -0,0 +1,86 @@
+#pragma once
+#include "RiscV.h"
+#include "Decoder.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Runs many independent instances ("lanes") of one program in lockstep.
+//
+// The image is decoded once and every instruction is dispatched once for all lanes that are at
+// its pc. Registers are a structure of arrays, register r of every lane is one contiguous row, so
+// the ALU, compare and branch handlers work on a vector of lanes at a time (AVX2 or SSE2 where the
+// compiler targets it). Multiplication, division, register shifts and memory accesses go lane by lane.
+//
+// Lanes whose paths diverge are masked: the machine always executes the smallest pc of all running
+// lanes, the lanes at that pc are active, and the others wait until control flow joins them again.
+//
+// Every lane has its own 64 KiB of plain memory at address 0 and no devices. Registers are not
+// checked for reads before writes, run a single VirtualMachine for those warnings.
+class BatchMachine
+{
+public:
+	// layout as for the VirtualMachine, for toolchain code
+	BatchMachine(std::vector<RiscV::INSTRUCTION> const& image, size_t lanes, RiscV::CodeLayout const& layout = RiscV::CodeLayout());
+	BatchMachine(BatchMachine const&) = delete;
+	BatchMachine& operator=(BatchMachine const&) = delete;
+	bool is_ready() const;
+
+	size_t Lanes() const;
+	// inputs and results of one lane, before and after Run
+	void SetRegister(size_t lane, size_t idx, RiscV::WORD value);
+	RiscV::WORD Register(size_t lane, size_t idx) const;
+	bool ReadBlock(size_t lane, RiscV::ADDRESS address, void* buffer, size_t size) const;
+	bool WriteBlock(size_t lane, RiscV::ADDRESS address, void const* buffer, size_t size);
+
+	// runs until every lane reached sleep or left the program
+	void Run();
+	bool Finished(size_t lane) const;
+	// instructions summed over all lanes
+	uint64_t ExecutedInstructions() const;
+	// instructions dispatched for a group of lanes, ExecutedInstructions / Dispatches is the
+	// average number of lanes that shared an instruction
+	uint64_t Dispatches() const;
+
+private:
+	// pc of a lane that has ended, larger than any pc so that it never becomes the smallest one
+	static RiscV::WORD const cDone = INT32_MAX;
+	static size_t const cMemorySize = RiscV::cMemDataSize * RiscV::cDataIncrement;
+
+	size_t const mLanes;
+	size_t mStride = 0;		// lanes rounded up to whole vectors, the padding lanes are never active
+	std::vector<RiscV::DecodedInstruction> mDecodedInstructions;
+	size_t mInstructionSize = 0;
+
+	std::vector<RiscV::WORD> mRegisters;	// cRegCount rows of mStride lanes
+	std::vector<RiscV::WORD> mPcs;
+	std::vector<RiscV::WORD> mMask;		// all bits set for the lanes at the current pc
+	std::vector<uint8_t> mMemory;		// cMemorySize bytes per lane
+	uint64_t mExecutedInstructions = 0;
+	uint64_t mDispatches = 0;
+	bool mConverged = false;		// every running lane is at the current pc
+
+	RiscV::WORD* Row(size_t idx);
+	// sets the mask of the lanes at pc, returns how many there are
+	size_t BuildMask(RiscV::WORD pc);
+	// smallest pc of all running lanes, lanes that left the program end here
+	RiscV::WORD NextPc();
+	// executes the instruction at pc for the active lanes, false if it set their pcs,
+	// true if they simply move on to pc + 1
+	bool Execute(RiscV::WORD pc, RiscV::DecodedInstruction const& inst);
+	// the pcs of the active lanes to pc + 1
+	void Advance(RiscV::WORD pc);
+
+	template <class Op> void Alu(RiscV::BYTE rd, RiscV::BYTE rs1, RiscV::BYTE rs2, Op op);
+	template <class Op> void AluImmediate(RiscV::BYTE rd, RiscV::BYTE rs1, RiscV::WORD imm, Op op);
+	template <class Op> void Branch(RiscV::WORD pc, RiscV::BYTE rs1, RiscV::BYTE rs2, RiscV::WORD target, Op condition);
+	// calls op with the index of every active lane
+	template <class Op> void ForActive(Op op);
+
+	RiscV::WORD ReadMemory(size_t lane, RiscV::WORD pc, RiscV::ADDRESS address, size_t size);
+	void WriteMemory(size_t lane, RiscV::WORD pc, RiscV::ADDRESS address, RiscV::WORD data, size_t size);
+
+	void PrintWarning(size_t lane, RiscV::WORD pc, std::string const& message);
+	void PrintInfo(RiscV::WORD pc, std::string const& message);
+};
@@ -0,0 +1,515 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include "BatchMachine.h"
+#include "Encoder.h"
+#include "RiscV.h"
+#include "VirtualMachine.h"
+#include "VirtualMemory.h"
+
+// Benchmark suite: guest kernels built with RiscV::Encoder, run repeatedly with every engine.
+// batch64 runs 64 copies of the kernel in lockstep on a BatchMachine, its MIPS count all lanes.
+//
+// Output is CSV on stdout (or -out <file>), one line per workload and engine:
+//   workload,engine,runs,instructions,mips_mean,mips_stddev,mips_min,mips_max,result
+// result is the value the kernel stores at cResultAddress, it has to be the same for every engine.
+// Before the workloads every engine runs a kernel that faults inside a hot loop with Step, all of
+// them have to stop at the same instruction, a difference makes the exit code -1 like a wrong result.
+// With -baseline <csv> the mean of every line is compared to a previous output of the benchmark,
+// a drop of more than -tolerance percent (default 5) is reported and makes the exit code 2.
+
+namespace {
+
+	using RiscV::Encoder;
+
+	RiscV::ADDRESS const cResultAddress = 0;
+	// x0 is an ordinary register in this virtual machine, the kernels write it once and use it as zero
+	RiscV::BYTE const cZero = 0;
+
+	struct Workload {
+		char const* name;
+		std::vector<RiscV::INSTRUCTION>(*build)(uint32_t scale);
+	};
+
+	void Begin(Encoder& enc) {
+		enc.Lui(cZero, 0);
+	}
+
+	void End(Encoder& enc, RiscV::BYTE result) {
+		enc.Sw(result, cZero, cResultAddress);
+		enc.Sleep();
+	}
+
+	// add/xor/shift chain, no memory access, one branch per nine instructions
+	std::vector<RiscV::INSTRUCTION> IntegerLoop(uint32_t scale) {
+		Encoder enc;
+		Begin(enc);
+		enc.Li(10, 1000000 * scale);
+		enc.Li(5, 1);
+		enc.Li(6, 0x12345);
+		enc.Li(7, 0);
+		Encoder::Label const loop = enc.Here();
+		enc.Add(7, 7, 5);
+		enc.Xor(6, 6, 7);
+		enc.Slli(8, 6, 5);
+		enc.Srli(9, 6, 27);
+		enc.Or(6, 8, 9);
+		enc.Sub(5, 6, 10);
+		enc.Andi(5, 5, 0x7ff);
+		enc.Addi(10, 10, -1);
+		enc.Bneq(10, cZero, loop);
+		enc.Xor(11, 6, 7);
+		End(enc, 11);
+		return enc.Finish();
+	}
+
+	// fills a 32 KiB buffer, then streams over it as a running sum with word and byte accesses
+	std::vector<RiscV::INSTRUCTION> MemoryStream(uint32_t scale) {
+		RiscV::WORD const base = 0x1000;
+		RiscV::WORD const size = 0x8000;
+		Encoder enc;
+		Begin(enc);
+		enc.Li(11, base);
+		enc.Li(12, base + size);
+		enc.Li(5, base);
+		enc.Li(6, 0);
+		Encoder::Label const fill = enc.Here();
+		enc.Sw(6, 5, 0);
+		enc.Addi(6, 6, 7);
+		enc.Addi(5, 5, 4);
+		enc.Bltu(5, 12, fill);
+
+		enc.Li(10, 250 * scale);
+		Encoder::Label const pass = enc.Here();
+		enc.Addi(5, 11, 0);
+		Encoder::Label const inner = enc.Here();
+		enc.Lw(7, 5, 0);
+		enc.Add(6, 6, 7);
+		enc.Sw(6, 5, 0);
+		enc.Lbu(8, 5, 5);
+		enc.Add(6, 6, 8);
+		enc.Sw(6, 5, 4);
+		enc.Addi(5, 5, 8);
+		enc.Bltu(5, 12, inner);
+		enc.Addi(10, 10, -1);
+		enc.Bneq(10, cZero, pass);
+		End(enc, 6);
+		return enc.Finish();
+	}
+
+	// xorshift32 random bits decide four conditional branches per iteration
+	std::vector<RiscV::INSTRUCTION> BranchHeavy(uint32_t scale) {
+		Encoder enc;
+		Begin(enc);
+		enc.Li(10, 400000 * scale);
+		enc.Li(5, 0x2545f491);
+		enc.Li(6, 0);
+		enc.Li(7, 0);
+		enc.Li(11, 0x40000000);
+		Encoder::Label const loop = enc.Here();
+		enc.Slli(8, 5, 13);
+		enc.Xor(5, 5, 8);
+		enc.Srli(8, 5, 17);
+		enc.Xor(5, 5, 8);
+		enc.Slli(8, 5, 5);
+		enc.Xor(5, 5, 8);
+
+		Encoder::Label const skip1 = enc.NewLabel();
+		Encoder::Label const skip2 = enc.NewLabel();
+		Encoder::Label const skip3 = enc.NewLabel();
+		Encoder::Label const skip4 = enc.NewLabel();
+		enc.Andi(9, 5, 1);
+		enc.Beq(9, cZero, skip1);
+		enc.Addi(6, 6, 1);
+		enc.Bind(skip1);
+		enc.Andi(9, 5, 2);
+		enc.Bneq(9, cZero, skip2);
+		enc.Addi(7, 7, 3);
+		enc.Bind(skip2);
+		enc.Blt(5, cZero, skip3);
+		enc.Xor(6, 6, 5);
+		enc.Bind(skip3);
+		enc.Bltu(5, 11, skip4);
+		enc.Addi(7, 7, -1);
+		enc.Bind(skip4);
+
+		enc.Addi(10, 10, -1);
+		enc.Bneq(10, cZero, loop);
+		enc.Add(6, 6, 7);
+		End(enc, 6);
+		return enc.Finish();
+	}
+
+	// linear congruential generator feeding every multiply, divide and remainder variant
+	std::vector<RiscV::INSTRUCTION> MulDiv(uint32_t scale) {
+		Encoder enc;
+		Begin(enc);
+		enc.Li(10, 500000 * scale);
+		enc.Li(5, 1);
+		enc.Li(6, 0);
+		enc.Li(11, 1103515245);
+		enc.Li(12, 7);
+		enc.Li(13, -3);
+		Encoder::Label const loop = enc.Here();
+		enc.Mul(5, 5, 11);
+		enc.Addi(5, 5, 1234);
+		enc.Mulhu(7, 5, 11);
+		enc.Mulh(8, 5, 13);
+		enc.Divu(9, 5, 12);
+		enc.Remu(14, 5, 12);
+		enc.Div(15, 5, 13);
+		enc.Rem(16, 5, 13);
+		enc.Add(6, 6, 7);
+		enc.Xor(6, 6, 9);
+		enc.Add(6, 6, 15);
+		enc.Sub(6, 6, 16);
+		enc.Add(6, 6, 14);
+		enc.Add(6, 6, 8);
+		enc.Addi(10, 10, -1);
+		enc.Bneq(10, cZero, loop);
+		End(enc, 6);
+		return enc.Finish();
+	}
+
+	// recursive fib(20) with a stack frame per call, x1 is the link register
+	std::vector<RiscV::INSTRUCTION> CallHeavy(uint32_t scale) {
+		Encoder enc;
+		Encoder::Label const fib = enc.NewLabel();
+		Encoder::Label const recurse = enc.NewLabel();
+		Begin(enc);
+		enc.Li(2, RiscV::cMemDataSize * RiscV::cDataIncrement - 16);
+		enc.Li(20, 30 * scale);
+		enc.Li(12, 0);
+		Encoder::Label const loop = enc.Here();
+		enc.Addi(10, cZero, 20);
+		enc.Jal(1, fib);
+		enc.Add(12, 12, 10);
+		enc.Addi(20, 20, -1);
+		enc.Bneq(20, cZero, loop);
+		End(enc, 12);
+
+		// returns write the link into x4, nothing reads it
+		enc.Bind(fib);
+		enc.Slti(5, 10, 2);
+		enc.Beq(5, cZero, recurse);
+		enc.Jalr(4, 1, 0);
+		enc.Bind(recurse);
+		enc.Addi(2, 2, -12);
+		enc.Sw(1, 2, 0);
+		enc.Sw(10, 2, 4);
+		enc.Addi(10, 10, -1);
+		enc.Jal(1, fib);
+		enc.Sw(10, 2, 8);
+		enc.Lw(10, 2, 4);
+		enc.Addi(10, 10, -2);
+		enc.Jal(1, fib);
+		enc.Lw(5, 2, 8);
+		enc.Add(10, 10, 5);
+		enc.Lw(1, 2, 0);
+		enc.Addi(2, 2, 12);
+		enc.Jalr(4, 1, 0);
+		return enc.Finish();
+	}
+
+	Workload const cWorkloads[] = {
+		{ "integer", IntegerLoop },
+		{ "memory", MemoryStream },
+		{ "branch", BranchHeavy },
+		{ "muldiv", MulDiv },
+		{ "call", CallHeavy },
+	};
+
+	struct EngineEntry {
+		VirtualMachine::Engine engine;
+		char const* name;
+		size_t lanes;		// run that many copies on a BatchMachine instead of one VirtualMachine
+	};
+
+	EngineEntry const cEngines[] = {
+		{ VirtualMachine::Engine::Switch, "switch", 0 },
+		{ VirtualMachine::Engine::Threaded, "threaded", 0 },
+		{ VirtualMachine::Engine::Jit, "jit", 0 },
+		{ VirtualMachine::Engine::Switch, "batch64", 64 },
+	};
+
+	struct Measurement {
+		uint64_t instructions = 0;
+		double mean = 0;
+		double stddev = 0;
+		double min = 0;
+		double max = 0;
+		uint32_t result = 0;
+	};
+
+	// one run on a fresh VirtualMachine, false if it could not be set up
+	bool RunSingle(std::vector<RiscV::INSTRUCTION> const& image, VirtualMachine::Engine engine,
+		double& seconds, uint64_t& instructions, uint32_t& result) {
+		VirtualMachine vm(image, RiscV::cRegCount, false);
+		VirtualMemory memory(RiscV::cMemDataSize * RiscV::cDataIncrement);
+		if (!vm.is_ready() || !vm.RegisterDevice(&memory, 0x0000, RiscV::cMemDataSize * RiscV::cDataIncrement - 1)) {
+			return false;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		vm.Run(engine);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		seconds = elapsed.count();
+		instructions = vm.ExecutedInstructions();
+		return vm.ReadBlock(cResultAddress, &result, sizeof(result));
+	}
+
+	// one run of identical lanes, every lane has to compute the same result
+	bool RunBatch(std::vector<RiscV::INSTRUCTION> const& image, size_t lanes,
+		double& seconds, uint64_t& instructions, uint32_t& result) {
+		BatchMachine batch(image, lanes);
+		if (!batch.is_ready()) {
+			return false;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		batch.Run();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		seconds = elapsed.count();
+		instructions = batch.ExecutedInstructions();
+		for (size_t lane = 0; lane < lanes; ++lane) {
+			uint32_t value = 0;
+			if (!batch.ReadBlock(lane, cResultAddress, &value, sizeof(value))) {
+				return false;
+			}
+			if (lane != 0 && value != result) {
+				std::cerr << "Lanes of the same workload differ" << std::endl;
+				return false;
+			}
+			result = value;
+		}
+		return true;
+	}
+
+	// one fresh machine per run so that every run starts from the same state
+	bool Measure(std::vector<RiscV::INSTRUCTION> const& image, EngineEntry const& engine, size_t runs, Measurement& measurement) {
+		std::vector<double> mips;
+		for (size_t run = 0; run < runs; ++run) {
+			double seconds = 0;
+			uint64_t instructions = 0;
+			uint32_t result = 0;
+			bool const ok = engine.lanes != 0
+				? RunBatch(image, engine.lanes, seconds, instructions, result)
+				: RunSingle(image, engine.engine, seconds, instructions, result);
+			if (!ok) {
+				return false;
+			}
+			if (run != 0 && (result != measurement.result || instructions != measurement.instructions)) {
+				std::cerr << "Runs of the same workload differ" << std::endl;
+				return false;
+			}
+			measurement.result = result;
+			measurement.instructions = instructions;
+			mips.push_back(instructions / seconds / 1e6);
+		}
+
+		double sum = 0;
+		for (double value : mips) sum += value;
+		measurement.mean = sum / mips.size();
+		double squares = 0;
+		for (double value : mips) squares += (value - measurement.mean) * (value - measurement.mean);
+		measurement.stddev = mips.size() > 1 ? std::sqrt(squares / (mips.size() - 1)) : 0;
+		measurement.min = *std::min_element(mips.begin(), mips.end());
+		measurement.max = *std::max_element(mips.begin(), mips.end());
+		return true;
+	}
+
+	// counts down from 8000 and loads from ever higher addresses, the first load behind the end of
+	// memory faults in the middle of the loop once it is hot enough to be compiled and chained
+	std::vector<RiscV::INSTRUCTION> FaultInLoop() {
+		RiscV::WORD const end = RiscV::cMemDataSize * RiscV::cDataIncrement;
+		Encoder enc;
+		Begin(enc);
+		enc.Li(10, 8000);
+		enc.Li(12, end + 5 * 4);
+		enc.Li(7, 0);
+		Encoder::Label const loop = enc.Here();
+		enc.Addi(10, 10, -1);
+		enc.Slli(11, 10, 2);
+		enc.Sub(11, 12, 11);
+		enc.Lw(6, 11, 0);
+		enc.Addi(7, 7, 1);
+		enc.Bneq(10, cZero, loop);
+		End(enc, 7);
+		return enc.Finish();
+	}
+
+	// Step ends the program at the first fault with every engine, at the same load and without
+	// running on into the next iteration of the loop
+	bool CheckStepFault() {
+		std::vector<RiscV::INSTRUCTION> const image = FaultInLoop();
+		VirtualMachine::Engine const engines[] = { VirtualMachine::Engine::Switch, VirtualMachine::Engine::Threaded,
+			VirtualMachine::Engine::Jit, VirtualMachine::Engine::Translated };
+		char const* const names[] = { "switch", "threaded", "jit", "translated" };
+
+		bool ok = true;
+		RiscV::ADDRESS expectedPc = 0;
+		RiscV::WORD expectedCounter = 0;
+		for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); ++i) {
+			VirtualMachine vm(image, RiscV::cRegCount, false);
+			VirtualMemory memory(RiscV::cMemDataSize * RiscV::cDataIncrement);
+			if (!vm.is_ready() || !vm.RegisterDevice(&memory, 0x0000, RiscV::cMemDataSize * RiscV::cDataIncrement - 1)) {
+				return false;
+			}
+
+			VirtualMachine::StepResult result;
+			do {
+				result = vm.Step(1000, engines[i]);
+			} while (result.reason == VirtualMachine::StopReason::Budget);
+
+			if (result.reason != VirtualMachine::StopReason::Fault) {
+				std::cerr << "fault: " << names[i] << " did not stop at the fault" << std::endl;
+				ok = false;
+			}
+			else if (i == 0) {
+				expectedPc = result.pc;
+				expectedCounter = vm.Register(10);
+			}
+			else if (result.pc != expectedPc || vm.Register(10) != expectedCounter) {
+				std::cerr << "fault: " << names[i] << " stopped at pc 0x" << std::hex << result.pc << " with counter " << std::dec
+					<< vm.Register(10) << ", switch at pc 0x" << std::hex << expectedPc << " with counter " << std::dec << expectedCounter << std::endl;
+				ok = false;
+			}
+		}
+		return ok;
+	}
+
+	// mips_mean of a previous run by "workload,engine"
+	bool LoadBaseline(std::string const& fileName, std::map<std::string, double>& baseline) {
+		std::ifstream ifs(fileName);
+		if (!ifs.is_open()) {
+			std::cerr << "Could not open file: " << fileName << std::endl;
+			return false;
+		}
+		std::string line;
+		std::getline(ifs, line);	// header
+		while (std::getline(ifs, line)) {
+			std::vector<std::string> fields;
+			std::istringstream iss(line);
+			std::string field;
+			while (std::getline(iss, field, ',')) fields.push_back(field);
+			if (fields.size() < 5) continue;
+			try {
+				baseline[fields[0] + "," + fields[1]] = std::stod(fields[4]);
+			}
+			catch (...) {
+				std::cerr << "Invalid baseline line: " << line << std::endl;
+			}
+		}
+		return true;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	size_t runs = 5;
+	uint32_t scale = 4;
+	double tolerance = 5;
+	std::string outFile;
+	std::string baselineFile;
+
+	for (int i = 1; i < argc; i++) {
+		char* currArg = argv[i];
+		try {
+			if (strcmp(currArg, "-runs") == 0 && i + 1 < argc) {
+				runs = std::stoul(argv[++i]);
+			}
+			else if (strcmp(currArg, "-scale") == 0 && i + 1 < argc) {
+				scale = static_cast<uint32_t>(std::stoul(argv[++i]));
+			}
+			else if (strcmp(currArg, "-out") == 0 && i + 1 < argc) {
+				outFile = argv[++i];
+			}
+			else if (strcmp(currArg, "-baseline") == 0 && i + 1 < argc) {
+				baselineFile = argv[++i];
+			}
+			else if (strcmp(currArg, "-tolerance") == 0 && i + 1 < argc) {
+				tolerance = std::stod(argv[++i]);
+			}
+			else {
+				throw std::invalid_argument(currArg);
+			}
+		}
+		catch (...) {
+			std::cerr << "Usage:" << std::endl;
+			std::cerr << "\t" << argv[0] << " [-runs <n>] [-scale <n>] [-out <csv>] [-baseline <csv> [-tolerance <percent>]]" << std::endl;
+			std::cerr << "\t-runs\truns per workload and engine, default 5" << std::endl;
+			std::cerr << "\t-scale\twork per run, about 8 million instructions per unit, default 4" << std::endl;
+			std::cerr << "\t-out\twrite the results to a file instead of stdout" << std::endl;
+			std::cerr << "\t-baseline\tcompare with a previous output, a drop of the mean beyond the tolerance fails" << std::endl;
+			return 1;
+		}
+	}
+	if (runs < 1 || scale < 1) {
+		std::cerr << "Runs and scale must be at least 1" << std::endl;
+		return 3;
+	}
+
+	std::map<std::string, double> baseline;
+	if (!baselineFile.empty() && !LoadBaseline(baselineFile, baseline)) {
+		return -1;
+	}
+
+	std::ofstream ofs;
+	if (!outFile.empty()) {
+		ofs.open(outFile, std::ios::trunc);
+		if (!ofs.is_open()) {
+			std::cerr << "Could not open file: " << outFile << std::endl;
+			return -1;
+		}
+	}
+	std::ostream& os = outFile.empty() ? std::cout : ofs;
+
+	os << "workload,engine,runs,instructions,mips_mean,mips_stddev,mips_min,mips_max,result" << std::endl;
+	bool mismatch = !CheckStepFault();
+	bool regression = false;
+	for (Workload const& workload : cWorkloads) {
+		std::vector<RiscV::INSTRUCTION> const image = workload.build(scale);
+		bool first = true;
+		uint32_t expected = 0;
+		for (EngineEntry const& engine : cEngines) {
+			Measurement measurement;
+			if (!Measure(image, engine, runs, measurement)) {
+				std::cerr << "Could not run workload: " << workload.name << std::endl;
+				return -1;
+			}
+			os << workload.name << "," << engine.name << "," << runs << "," << measurement.instructions << std::fixed << std::setprecision(3)
+				<< "," << measurement.mean << "," << measurement.stddev << "," << measurement.min << "," << measurement.max
+				<< ",0x" << std::hex << std::setfill('0') << std::setw(8) << measurement.result << std::dec << std::setfill(' ') << std::endl;
+
+			// the engines have to agree on the result
+			if (!first && measurement.result != expected) {
+				std::cerr << workload.name << ": " << engine.name << " computes a different result" << std::endl;
+				mismatch = true;
+			}
+			first = false;
+			expected = measurement.result;
+
+			auto previous = baseline.find(std::string(workload.name) + "," + engine.name);
+			if (previous != baseline.end() && previous->second > 0) {
+				double const change = (measurement.mean / previous->second - 1) * 100;
+				if (change < -tolerance) {
+					std::cerr << workload.name << "," << engine.name << ": " << std::fixed << std::setprecision(1)
+						<< change << "% MIPS against the baseline" << std::endl;
+					regression = true;
+				}
+			}
+		}
+	}
+
+	if (mismatch) {
+		return -1;
+	}
+	return regression ? 2 : 0;
+}
@@ -0,0 +1,134 @@
+#include "ConsoleDevice.h"
+
+#include <iostream>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+	// write until everything is out, partial writes happen on pipes and terminals
+	bool WriteAll(int fd, char const* data, size_t size) {
+		while (size > 0) {
+#if defined(_WIN32)
+			int const written = _write(fd, data, static_cast<unsigned int>(size));
+#else
+			ssize_t const written = ::write(fd, data, size);
+#endif
+			if (written <= 0) return false;
+			data += written;
+			size -= static_cast<size_t>(written);
+		}
+		return true;
+	}
+}
+
+ConsoleDevice::ConsoleDevice(FlushPolicy policy, size_t threshold, int fd) :
+	mPolicy(policy), mThreshold(threshold), mFd(fd), mRing(cRingSize, 0), mLastFlush(std::chrono::steady_clock::now())
+{
+	mBuffer.reserve(policy == FlushPolicy::Size ? threshold + 64 : 4096);
+}
+
+ConsoleDevice::~ConsoleDevice() {
+	Flush();
+}
+
+RiscV::WORD ConsoleDevice::Read(RiscV::ADDRESS const& address, size_t size) {
+	if (address >= cRing && static_cast<size_t>(address - cRing) + size <= cRingSize) {
+		uint32_t data = 0;
+		for (size_t i = 0; i < size; ++i) {
+			data |= static_cast<uint32_t>(mRing[address - cRing + i]) << (8 * i);
+		}
+		return static_cast<RiscV::WORD>(data);
+	}
+	switch (address) {
+	case cHead:
+		return static_cast<RiscV::WORD>(mHead);
+	case cPending:
+		return static_cast<RiscV::WORD>(mBuffer.size());
+	default:
+		return 0;
+	}
+}
+
+void ConsoleDevice::Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t size) {
+	if (address >= cRing && static_cast<size_t>(address - cRing) + size <= cRingSize) {
+		// plain stores, the text only counts once the guest moves the head
+		for (size_t i = 0; i < size; ++i) {
+			mRing[address - cRing + i] = static_cast<uint8_t>(static_cast<uint32_t>(data) >> (8 * i));
+		}
+		return;
+	}
+	switch (address) {
+	case cHead: {
+		uint32_t const head = static_cast<uint32_t>(data) % cRingSize;
+		if (head >= mHead) {
+			mBuffer.append(reinterpret_cast<char const*>(&mRing[mHead]), head - mHead);
+		}
+		else {
+			// the text wraps around the end of the ring
+			mBuffer.append(reinterpret_cast<char const*>(&mRing[mHead]), cRingSize - mHead);
+			mBuffer.append(reinterpret_cast<char const*>(&mRing[0]), head);
+		}
+		mHead = head;
+		Written();
+		break;
+	}
+	case cChar:
+		mBuffer.push_back(static_cast<char>(data));
+		Written();
+		break;
+	case cInt:
+		Print(data);
+		break;
+	case cFlush:
+		Flush();
+		break;
+	default:
+		break;
+	}
+}
+
+void ConsoleDevice::Print(RiscV::WORD value) {
+	mBuffer.append(std::to_string(value));
+	mBuffer.push_back('\n');
+	Written();
+}
+
+void ConsoleDevice::Written() {
+	switch (mPolicy) {
+	case FlushPolicy::Size:
+		if (mBuffer.size() >= mThreshold) Flush();
+		break;
+	case FlushPolicy::Time:
+		Poll();
+		break;
+	case FlushPolicy::Exit:
+		break;
+	}
+}
+
+bool ConsoleDevice::FlushesOnTime() const {
+	return mPolicy == FlushPolicy::Time;
+}
+
+void ConsoleDevice::Poll() {
+	if (mPolicy == FlushPolicy::Time && !mBuffer.empty() &&
+		std::chrono::steady_clock::now() - mLastFlush >= std::chrono::milliseconds(mThreshold)) {
+		Flush();
+	}
+}
+
+void ConsoleDevice::Flush() {
+	mLastFlush = std::chrono::steady_clock::now();
+	if (mBuffer.empty()) return;
+	// whatever the host wrote to std::cout so far comes first
+	std::cout.flush();
+	if (!WriteAll(mFd, mBuffer.data(), mBuffer.size())) {
+		std::cerr << "Could not write console output" << std::endl;
+	}
+	mBuffer.clear();
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "IVirtualDevice.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Buffered console output, memory mapped for the guest and behind the print instruction.
+//
+// Text collects in a host buffer and goes to the file descriptor in one write call per flush
+// instead of one flushed stream insertion per print. Register layout, byte offsets from the start
+// of the device:
+//   cHead   write: the guest placed text in the ring up to this index, the device takes the bytes
+//           from the previous head up to it (modulo the ring size); read: the current head
+//   cChar   write: one byte
+//   cInt    write: the word as a signed decimal number and a newline, like the print instruction
+//   cFlush  write: flush now
+//   cPending read: bytes waiting in the host buffer
+//   cRing   cRingSize bytes of ring buffer the guest fills with ordinary stores
+class ConsoleDevice : public IVirtualDevice
+{
+public:
+	enum class FlushPolicy {
+		Size,	// once the buffer holds threshold bytes
+		Time,	// about threshold milliseconds after the last flush, checked on output and by Poll
+		Exit	// only on an explicit flush, at the end of the program and when the device goes away
+	};
+
+	static RiscV::ADDRESS const cHead = 0x00;
+	static RiscV::ADDRESS const cChar = 0x04;
+	static RiscV::ADDRESS const cInt = 0x08;
+	static RiscV::ADDRESS const cFlush = 0x0c;
+	static RiscV::ADDRESS const cPending = 0x10;
+	static RiscV::ADDRESS const cRing = 0x100;
+	static size_t const cRingSize = 0x1000;
+	// bytes of address space to register the device with
+	static size_t const cSize = cRing + cRingSize;
+
+	// fd 1 is stdout
+	ConsoleDevice(FlushPolicy policy = FlushPolicy::Size, size_t threshold = 4096, int fd = 1);
+	ConsoleDevice(ConsoleDevice const&) = delete;
+	ConsoleDevice& operator=(ConsoleDevice const&) = delete;
+	~ConsoleDevice();
+
+	virtual RiscV::WORD Read(RiscV::ADDRESS const& address, size_t size);
+	virtual void Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t size);
+
+	// the print instruction
+	void Print(RiscV::WORD value);
+	void Flush();
+	// the virtual machine polls a console with the Time policy between slices of execution, so that
+	// output also goes out while the guest computes or waits without printing
+	bool FlushesOnTime() const;
+	void Poll();
+
+private:
+	FlushPolicy const mPolicy;
+	size_t const mThreshold;
+	int const mFd;
+
+	std::string mBuffer;
+	std::vector<uint8_t> mRing;
+	uint32_t mHead = 0;
+	std::chrono::steady_clock::time_point mLastFlush;
+
+	// flushes if the policy says so, after every output
+	void Written();
+};
@@ -0,0 +1,609 @@
+#include "Decoder.h"
+
+#include <algorithm>
+
+// interpret the lowest "bits" bits of value as a two's complement number
+static RiscV::WORD SignExtend(uint32_t value, unsigned bits)
+{
+    uint32_t const signBit = 1u << (bits - 1);
+    value &= (signBit << 1) - 1;
+    return static_cast<RiscV::WORD>((value ^ signBit) - signBit);
+}
+
+// the csrs that exist, all of them read-only
+static bool IsCounter(uint32_t csr)
+{
+    using namespace RiscV::CsrType;
+    switch (csr) {
+    case CSR_CYCLE: case CSR_TIME: case CSR_INSTRET:
+    case CSR_CYCLEH: case CSR_TIMEH: case CSR_INSTRETH:
+    case CSR_LOADS: case CSR_STORES: case CSR_BRANCHES:
+    case CSR_LOADSH: case CSR_STORESH: case CSR_BRANCHESH:
+        return true;
+    default:
+        return false;
+    }
+}
+
+RiscV::DecodedInstruction RiscV::Decode(INSTRUCTION instruction)
+{
+    uint32_t const inst = static_cast<uint32_t>(instruction);
+
+    DecodedInstruction decoded;
+    decoded.handler = Handler::UNKNOWN;
+    decoded.rd = MaskRd(instruction);
+    decoded.rs1 = MaskRs1(instruction);
+    decoded.rs2 = MaskRs2(instruction);
+    decoded.imm = 0;
+
+    BYTE const f3 = MaskFunct3(instruction);
+    BYTE const f7 = MaskFunct7(instruction);
+
+    switch (MaskOpcode(instruction)) {
+    case RType::OP_TYPE_REGISTER: {
+        if (f7 == RType::FUNC7_ADD) {
+            switch (f3) {
+            case RType::FUNC3_ADD:  decoded.handler = Handler::ADD; break;
+            case RType::FUNC3_SLL:  decoded.handler = Handler::SLL; break;
+            case RType::FUNC3_SLT:  decoded.handler = Handler::SLT; break;
+            case RType::FUNC3_SLTU: decoded.handler = Handler::SLTU; break;
+            case RType::FUNC3_XOR:  decoded.handler = Handler::XOR; break;
+            case RType::FUNC3_SRL:  decoded.handler = Handler::SRL; break;
+            case RType::FUNC3_OR:   decoded.handler = Handler::OR; break;
+            case RType::FUNC3_AND:  decoded.handler = Handler::AND; break;
+            }
+        }
+        else if (f7 == RType::FUNC7_SUB) {
+            if (f3 == RType::FUNC3_SUB) decoded.handler = Handler::SUB;
+            else if (f3 == RType::FUNC3_SRA) decoded.handler = Handler::SRA;
+            else decoded.handler = Handler::NOP;
+        }
+        else if (f7 == RType::FUNC7_MUL) {
+            switch (f3) {
+            case RType::FUNC3_MUL:    decoded.handler = Handler::MUL; break;
+            case RType::FUNC3_MULH:   decoded.handler = Handler::MULH; break;
+            case RType::FUNC3_MULHSU: decoded.handler = Handler::MULHSU; break;
+            case RType::FUNC3_MULHU:  decoded.handler = Handler::MULHU; break;
+            case RType::FUNC3_DIV:    decoded.handler = Handler::DIV; break;
+            case RType::FUNC3_DIVU:   decoded.handler = Handler::DIVU; break;
+            case RType::FUNC3_REM:    decoded.handler = Handler::REM; break;
+            case RType::FUNC3_REMU:   decoded.handler = Handler::REMU; break;
+            }
+        }
+        else {
+            decoded.handler = Handler::NOP;
+        }
+        break;
+    }
+
+    case IType::OP_TYPE_IMMEDIATE: {
+        if (f3 == IType::FUNC3_SLLI || f3 == IType::FUNC3_SRLI || f3 == IType::FUNC3_SRAI) {
+            BYTE const f6 = (inst & 0xfc000000) >> 26;
+            decoded.imm = (inst & 0x3f00000) >> 20;     // shamt
+
+            if (f3 == IType::FUNC3_SLLI && f6 == IType::FUNC6_SLLI) decoded.handler = Handler::SLLI;
+            else if (f3 == IType::FUNC3_SRLI && f6 == IType::FUNC6_SRLI) decoded.handler = Handler::SRLI;
+            else if (f3 == IType::FUNC3_SRAI && f6 == IType::FUNC6_SRAI) decoded.handler = Handler::SRAI;
+            else decoded.handler = Handler::NOP;
+
+            // for rv32I, instruction is only legal when shamt[5]==0
+            if (decoded.handler != Handler::NOP && (decoded.imm & 0x20) != 0) {
+                decoded.handler = Handler::SHIFT_ILLEGAL;
+            }
+        }
+        else {
+            decoded.imm = SignExtend(inst >> 20, 12);
+
+            switch (f3) {
+            case IType::FUNC3_ADDI:  decoded.handler = Handler::ADDI; break;
+            case IType::FUNC3_SLTI:  decoded.handler = Handler::SLTI; break;
+            case IType::FUNC3_SLTIU: decoded.handler = Handler::SLTIU; break;
+            case IType::FUNC3_XORI:  decoded.handler = Handler::XORI; break;
+            case IType::FUNC3_ORI:   decoded.handler = Handler::ORI; break;
+            case IType::FUNC3_ANDI:  decoded.handler = Handler::ANDI; break;
+            }
+        }
+        break;
+    }
+
+    case IType::OP_TYPE_LOAD: {
+        decoded.imm = SignExtend(inst >> 20, 12);
+
+        switch (f3) {
+        case IType::FUNC3_LB:  decoded.handler = Handler::LB; break;
+        case IType::FUNC3_LH:  decoded.handler = Handler::LH; break;
+        case IType::FUNC3_LW:  decoded.handler = Handler::LW; break;
+        case IType::FUNC3_LBU: decoded.handler = Handler::LBU; break;
+        case IType::FUNC3_LHU: decoded.handler = Handler::LHU; break;
+        default:               decoded.handler = Handler::NOP; break;
+        }
+        break;
+    }
+
+    case SType::OP_TYPE_STORE: {
+        decoded.imm = SignExtend(((inst & 0xfe000000) >> 20) | ((inst & 0xf80) >> 7), 12);
+
+        switch (f3) {
+        case SType::FUNC3_SB: decoded.handler = Handler::SB; break;
+        case SType::FUNC3_SH: decoded.handler = Handler::SH; break;
+        case SType::FUNC3_SW: decoded.handler = Handler::SW; break;
+        default:              decoded.handler = Handler::NOP; break;
+        }
+        break;
+    }
+
+    case IType::OP_JALR: {
+        decoded.handler = (f3 == IType::FUNC3_JALR) ? Handler::JALR : Handler::NOP;
+        decoded.imm = SignExtend(inst >> 20, 12);
+        break;
+    }
+
+    case BType::OP_TYPE_BRANCH: {
+        // recreate the immediate by moving the bits to the correct position,
+        // the result is the target instruction index, unsigned as it is absolute
+        uint32_t const imm12 = (inst & (1u << 31)) >> 20;   // move from 31 to 11
+        uint32_t const imm11 = (inst & (1u << 7)) << 3;     // move from 7 to 10
+        uint32_t const imm105 = (inst & 0x7E000000) >> 21;  // move from 30:25 to 9:4
+        uint32_t const imm41 = (inst & 0xF00) >> 8;         // move from 11:8 to 3:0
+        decoded.imm = static_cast<WORD>(imm12 | imm11 | imm105 | imm41);
+
+        switch (f3) {
+        case BType::FUNC3_BEQ:  decoded.handler = Handler::BEQ; break;
+        case BType::FUNC3_BNEQ: decoded.handler = Handler::BNEQ; break;
+        case BType::FUNC3_BLT:  decoded.handler = Handler::BLT; break;
+        case BType::FUNC3_BGE:  decoded.handler = Handler::BGE; break;
+        case BType::FUNC3_BLTU: decoded.handler = Handler::BLTU; break;
+        case BType::FUNC3_BGEU: decoded.handler = Handler::BGEU; break;
+        default:                decoded.handler = Handler::NOP; break;
+        }
+        break;
+    }
+
+    case UType::OP_LUI: {
+        decoded.handler = Handler::LUI;
+        decoded.imm = static_cast<WORD>(inst & 0xfffff000);
+        break;
+    }
+
+    case UType::OP_AUIPC: {
+        decoded.handler = Handler::AUIPC;
+        decoded.imm = static_cast<WORD>(inst & 0xfffff000);
+        break;
+    }
+
+    case JType::OP_JAL: {
+        // J-Type has a 20-bit immediate, the result is the target instruction index, unsigned as well
+        uint32_t const imm20 = (inst & (1u << 31)) >> 12;   // move from 31 to 19
+        uint32_t const imm1912 = (inst & 0xFF000) >> 1;     // move from 19:12 to 18:11
+        uint32_t const imm11 = (inst & (1u << 20)) >> 10;   // move from 20 to 10
+        uint32_t const imm101 = (inst & 0x7FE00000) >> 21;  // move from 30:21 to 9:0
+        decoded.handler = Handler::JAL;
+        decoded.imm = static_cast<WORD>(imm20 | imm1912 | imm11 | imm101);
+        break;
+    }
+
+    case PType::OP_TYPE_PRINT: {
+        decoded.handler = (f3 == PType::FUNC3_INT || f3 == PType::FUNC3_STRING) ? Handler::PRINT : Handler::NOP;
+        break;
+    }
+
+    case PType::OP_TYPE_SLEEP: {
+        decoded.handler = Handler::SLEEP;
+        break;
+    }
+
+    case CsrType::OP_TYPE_CSR: {
+        // funct3 0 are ecall and ebreak, 4 is reserved
+        if (f3 == 0b000 || f3 == 0b100) break;
+        // csrrs/csrrc with rs1 = x0 and csrrsi/csrrci with uimm = 0 only read,
+        // every csrrw/csrrwi writes, and writing a read-only counter is illegal
+        uint32_t const csr = inst >> 20;
+        bool const writes = f3 == CsrType::FUNC3_CSRRW || f3 == CsrType::FUNC3_CSRRWI || decoded.rs1 != 0;
+        decoded.handler = (!writes && IsCounter(csr)) ? Handler::CSRR : Handler::CSR_ILLEGAL;
+        decoded.imm = static_cast<WORD>(csr);
+        break;
+    }
+    }
+
+    return decoded;
+}
+
+namespace {
+
+    // 32 bit encodings for the expansion of compressed instructions, immediates are taken modulo their width
+    uint32_t EncodeR(uint32_t f7, uint32_t rs2, uint32_t rs1, uint32_t f3, uint32_t rd)
+    {
+        return f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | RiscV::RType::OP_TYPE_REGISTER;
+    }
+
+    uint32_t EncodeI(uint32_t opcode, uint32_t imm, uint32_t rs1, uint32_t f3, uint32_t rd)
+    {
+        return (imm & 0xfff) << 20 | rs1 << 15 | f3 << 12 | rd << 7 | opcode;
+    }
+
+    uint32_t EncodeS(uint32_t imm, uint32_t rs2, uint32_t rs1, uint32_t f3)
+    {
+        return ((imm >> 5) & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | (imm & 0x1f) << 7 | RiscV::SType::OP_TYPE_STORE;
+    }
+
+    // offset as in the standard encoding, bit 0 is dropped
+    uint32_t EncodeB(uint32_t offset, uint32_t rs2, uint32_t rs1, uint32_t f3)
+    {
+        return ((offset >> 12) & 1) << 31 | ((offset >> 5) & 0x3f) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 |
+            ((offset >> 1) & 0xf) << 8 | ((offset >> 11) & 1) << 7 | RiscV::BType::OP_TYPE_BRANCH;
+    }
+
+    uint32_t EncodeJ(uint32_t offset, uint32_t rd)
+    {
+        return ((offset >> 20) & 1) << 31 | ((offset >> 1) & 0x3ff) << 21 | ((offset >> 11) & 1) << 20 |
+            ((offset >> 12) & 0xff) << 12 | rd << 7 | RiscV::JType::OP_JAL;
+    }
+
+    // the three bit register fields of compressed instructions address x8 to x15
+    uint32_t CompressedRegister(uint32_t field)
+    {
+        return 8 + (field & 0x7);
+    }
+
+    // c.addi, c.li, c.andi: imm[5] in bit 12, imm[4:0] in bits 6:2
+    uint32_t Immediate6(uint32_t c)
+    {
+        return static_cast<uint32_t>(SignExtend((c >> 7 & 0x20) | (c >> 2 & 0x1f), 6));
+    }
+
+    // c.j and c.jal: offset[11|4|9:8|10|6|7|3:1|5] in bits 12:2
+    uint32_t JumpOffset(uint32_t c)
+    {
+        return static_cast<uint32_t>(SignExtend((c >> 1 & 0x800) | (c >> 7 & 0x10) | (c >> 1 & 0x300) | (c << 2 & 0x400) |
+            (c >> 1 & 0x40) | (c << 1 & 0x80) | (c >> 2 & 0xe) | (c << 3 & 0x20), 12));
+    }
+
+    // c.beqz and c.bnez: offset[8|4:3] in bits 12:10, offset[7:6|2:1|5] in bits 6:2
+    uint32_t BranchOffset(uint32_t c)
+    {
+        return static_cast<uint32_t>(SignExtend((c >> 4 & 0x100) | (c >> 7 & 0x18) | (c << 1 & 0xc0) | (c >> 2 & 0x6) |
+            (c << 3 & 0x20), 9));
+    }
+}
+
+bool RiscV::IsCompressed(uint16_t parcel)
+{
+    return (parcel & 0x3) != 0x3;
+}
+
+RiscV::INSTRUCTION RiscV::Expand(uint16_t parcel)
+{
+    uint32_t const c = parcel;
+    uint32_t const f3 = c >> 13;
+    uint32_t const rd = c >> 7 & 0x1f;             // also rs1 of the full register forms
+    uint32_t const rs2 = c >> 2 & 0x1f;
+    uint32_t const rdShort = CompressedRegister(c >> 2);    // rd' or rs2' in bits 4:2
+    uint32_t const rs1Short = CompressedRegister(c >> 7);   // rs1' or rd' in bits 9:7
+    uint32_t const shamt = (c >> 7 & 0x20) | rs2;  // shamt[5] set is reserved in RV32 and decodes as SHIFT_ILLEGAL
+    uint32_t expanded = 0;
+
+    switch ((c & 0x3) << 3 | f3) {
+    // quadrant 0
+    case 0x00: {    // c.addi4spn: nzuimm[5:4|9:6|2|3] in bits 12:5
+        uint32_t const imm = (c >> 7 & 0x30) | (c >> 1 & 0x3c0) | (c >> 4 & 0x4) | (c >> 2 & 0x8);
+        if (imm != 0) expanded = EncodeI(IType::OP_TYPE_IMMEDIATE, imm, 2, IType::FUNC3_ADDI, rdShort);
+        break;
+    }
+    case 0x02: {    // c.lw: uimm[5:3] in bits 12:10, uimm[2|6] in bits 6:5
+        uint32_t const imm = (c >> 7 & 0x38) | (c >> 4 & 0x4) | (c << 1 & 0x40);
+        expanded = EncodeI(IType::OP_TYPE_LOAD, imm, rs1Short, IType::FUNC3_LW, rdShort);
+        break;
+    }
+    case 0x06: {    // c.sw
+        uint32_t const imm = (c >> 7 & 0x38) | (c >> 4 & 0x4) | (c << 1 & 0x40);
+        expanded = EncodeS(imm, rdShort, rs1Short, SType::FUNC3_SW);
+        break;
+    }
+
+    // quadrant 1
+    case 0x08:      // c.addi, c.nop
+        expanded = EncodeI(IType::OP_TYPE_IMMEDIATE, Immediate6(c), rd, IType::FUNC3_ADDI, rd);
+        break;
+    case 0x09:      // c.jal
+        expanded = EncodeJ(JumpOffset(c), 1);
+        break;
+    case 0x0a:      // c.li
+        expanded = EncodeI(IType::OP_TYPE_IMMEDIATE, Immediate6(c), 0, IType::FUNC3_ADDI, rd);
+        break;
+    case 0x0b: {
+        if (rd == 2) {
+            // c.addi16sp: nzimm[9] in bit 12, nzimm[4|6|8:7|5] in bits 6:2
+            uint32_t const imm = static_cast<uint32_t>(SignExtend((c >> 3 & 0x200) | (c >> 2 & 0x10) | (c << 1 & 0x40) |
+                (c << 4 & 0x180) | (c << 3 & 0x20), 10));
+            if (imm != 0) expanded = EncodeI(IType::OP_TYPE_IMMEDIATE, imm, 2, IType::FUNC3_ADDI, 2);
+        }
+        else {
+            // c.lui: nzimm[17] in bit 12, nzimm[16:12] in bits 6:2
+            uint32_t const imm = static_cast<uint32_t>(SignExtend((c << 5 & 0x20000) | (c << 10 & 0x1f000), 18));
+            if (imm != 0) expanded = (imm & 0xfffff000) | rd << 7 | UType::OP_LUI;
+        }
+        break;
+    }
+    case 0x0c: {
+        switch (c >> 10 & 0x3) {
+        case 0:     // c.srli
+            expanded = EncodeI(IType::OP_TYPE_IMMEDIATE, IType::FUNC6_SRLI << 6 | shamt, rs1Short, IType::FUNC3_SRLI, rs1Short);
+            break;
+        case 1:     // c.srai
+            expanded = EncodeI(IType::OP_TYPE_IMMEDIATE, IType::FUNC6_SRAI << 6 | shamt, rs1Short, IType::FUNC3_SRAI, rs1Short);
+            break;
+        case 2:     // c.andi
+            expanded = EncodeI(IType::OP_TYPE_IMMEDIATE, Immediate6(c), rs1Short, IType::FUNC3_ANDI, rs1Short);
+            break;
+        case 3: {
+            // c.sub, c.xor, c.or, c.and; bit 12 set are the RV64 word operations
+            static uint32_t const cFunct3[4] = { RType::FUNC3_SUB, RType::FUNC3_XOR, RType::FUNC3_OR, RType::FUNC3_AND };
+            static uint32_t const cFunct7[4] = { RType::FUNC7_SUB, RType::FUNC7_XOR, RType::FUNC7_OR, RType::FUNC7_AND };
+            uint32_t const op = c >> 5 & 0x3;
+            if ((c & 0x1000) == 0) expanded = EncodeR(cFunct7[op], rdShort, rs1Short, cFunct3[op], rs1Short);
+            break;
+        }
+        }
+        break;
+    }
+    case 0x0d:      // c.j
+        expanded = EncodeJ(JumpOffset(c), 0);
+        break;
+    case 0x0e:      // c.beqz
+        expanded = EncodeB(BranchOffset(c), 0, rs1Short, BType::FUNC3_BEQ);
+        break;
+    case 0x0f:      // c.bnez
+        expanded = EncodeB(BranchOffset(c), 0, rs1Short, BType::FUNC3_BNEQ);
+        break;
+
+    // quadrant 2
+    case 0x10:      // c.slli
+        expanded = EncodeI(IType::OP_TYPE_IMMEDIATE, IType::FUNC6_SLLI << 6 | shamt, rd, IType::FUNC3_SLLI, rd);
+        break;
+    case 0x12: {    // c.lwsp: uimm[5] in bit 12, uimm[4:2|7:6] in bits 6:2
+        uint32_t const imm = (c >> 7 & 0x20) | (c >> 2 & 0x1c) | (c << 4 & 0xc0);
+        if (rd != 0) expanded = EncodeI(IType::OP_TYPE_LOAD, imm, 2, IType::FUNC3_LW, rd);
+        break;
+    }
+    case 0x14: {
+        bool const bit12 = (c & 0x1000) != 0;
+        if (rs2 == 0) {
+            // c.jr, c.jalr; with rd 0 the reserved encoding and c.ebreak
+            if (rd != 0) expanded = EncodeI(IType::OP_JALR, 0, rd, IType::FUNC3_JALR, bit12 ? 1 : 0);
+            else if (bit12) expanded = 0x00100073;      // ebreak, the virtual machine does not implement it
+        }
+        else {
+            // c.mv, c.add
+            expanded = EncodeR(RType::FUNC7_ADD, rs2, bit12 ? rd : 0, RType::FUNC3_ADD, rd);
+        }
+        break;
+    }
+    case 0x16: {    // c.swsp: uimm[5:2|7:6] in bits 12:7
+        uint32_t const imm = (c >> 7 & 0x3c) | (c >> 1 & 0xc0);
+        expanded = EncodeS(imm, rs2, 2, SType::FUNC3_SW);
+        break;
+    }
+
+    default:
+        // 32 bit instructions, reserved encodings and the F and D extensions
+        break;
+    }
+
+    // computations into x0 are HINTs without any effect, but the virtual machine does not hardwire x0
+    uint32_t const opcode = expanded & 0x7f;
+    if ((expanded >> 7 & 0x1f) == 0 &&
+        (opcode == IType::OP_TYPE_IMMEDIATE || opcode == RType::OP_TYPE_REGISTER || opcode == UType::OP_LUI)) {
+        expanded = EncodeI(IType::OP_TYPE_IMMEDIATE, 0, 0, IType::FUNC3_ADDI, 0);
+    }
+    return static_cast<INSTRUCTION>(expanded);
+}
+
+bool RiscV::ExpandCompressed(uint8_t const* code, size_t size, std::vector<INSTRUCTION>& image, std::vector<uint32_t>& offsets)
+{
+    image.clear();
+    offsets.clear();
+    size_t offset = 0;
+    while (offset + 2 <= size) {
+        uint16_t const parcel = static_cast<uint16_t>(code[offset] | code[offset + 1] << 8);
+        uint16_t const next = offset + 4 <= size ? static_cast<uint16_t>(code[offset + 2] | code[offset + 3] << 8) : 0xffff;
+        offsets.push_back(static_cast<uint32_t>(offset));
+        if (parcel == PType::OP_TYPE_SLEEP && next == 0) {
+            image.push_back(PType::OP_TYPE_SLEEP);
+            offset += 4;
+        }
+        else if (IsCompressed(parcel)) {
+            image.push_back(Expand(parcel));
+            offset += 2;
+        }
+        else {
+            if (offset + 4 > size) return false;
+            image.push_back(static_cast<INSTRUCTION>(parcel | static_cast<uint32_t>(next) << 16));
+            offset += 4;
+        }
+    }
+    return offset == size;
+}
+
+void RiscV::Relocate(std::vector<DecodedInstruction>& decoded, CodeLayout const& layout)
+{
+    size_t const count = std::min(decoded.size(), layout.offsets.size());
+    auto const begin = layout.offsets.begin();
+    auto const end = begin + count;
+    // index of the instruction at a byte offset, count if no instruction starts there
+    auto const indexAt = [&](int64_t offset) {
+        if (offset < 0 || offset > UINT32_MAX) return static_cast<WORD>(count);
+        auto const found = std::lower_bound(begin, end, static_cast<uint32_t>(offset));
+        return static_cast<WORD>(found != end && *found == offset ? found - begin : count);
+    };
+
+    // the decoded immediates of branches and jal are the unsigned fields, offset / 2 in toolchain code
+    bool auipcBefore = false;
+    DecodedInstruction auipc = {};
+    for (size_t i = 0; i < count; ++i) {
+        DecodedInstruction& inst = decoded[i];
+        int64_t const offset = layout.offsets[i];
+        bool const isAuipc = inst.handler == Handler::AUIPC;
+        switch (inst.handler) {
+        case Handler::BEQ:
+        case Handler::BNEQ:
+        case Handler::BLT:
+        case Handler::BGE:
+        case Handler::BLTU:
+        case Handler::BGEU:
+            inst.imm = indexAt(offset + static_cast<int64_t>(SignExtend(static_cast<uint32_t>(inst.imm), 12)) * 2);
+            break;
+        case Handler::JAL:
+            inst.imm = indexAt(offset + static_cast<int64_t>(SignExtend(static_cast<uint32_t>(inst.imm), 20)) * 2);
+            break;
+        case Handler::JALR:
+            if (auipcBefore && auipc.rd == inst.rs1) {
+                int64_t const target = static_cast<int64_t>(layout.offsets[i - 1]) + auipc.imm + inst.imm;
+                inst.handler = Handler::JAL;
+                inst.rs1 = 0;
+                inst.imm = indexAt(target);
+            }
+            break;
+        case Handler::AUIPC:
+            auipc = inst;
+            inst.handler = Handler::LUI;
+            inst.imm = static_cast<WORD>(static_cast<uint32_t>(layout.base) + static_cast<uint32_t>(offset) + static_cast<uint32_t>(inst.imm));
+            break;
+        default:
+            break;
+        }
+        if (inst.rd == 0 && inst.handler == Handler::JAL) {
+            inst.handler = Handler::BEQ;
+            inst.rs1 = 0;
+            inst.rs2 = 0;
+        }
+        else if (inst.rd == 0 && inst.handler == Handler::JALR) {
+            inst.handler = Handler::JR;
+        }
+        else if (UsedRegisters(inst).rd == 0) {
+            inst = DecodedInstruction{ Handler::NOP, 0, 0, 0, 0 };
+        }
+        auipcBefore = isAuipc;
+    }
+}
+
+bool RiscV::EndsBasicBlock(Handler handler)
+{
+    switch (handler) {
+    case Handler::JAL:
+    case Handler::JALR:
+    case Handler::JR:
+    case Handler::BEQ:
+    case Handler::BNEQ:
+    case Handler::BLT:
+    case Handler::BGE:
+    case Handler::BLTU:
+    case Handler::BGEU:
+    case Handler::SLEEP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+RiscV::RegisterUse RiscV::UsedRegisters(DecodedInstruction const& inst)
+{
+    RegisterUse use = { -1, -1, -1 };
+    switch (inst.handler) {
+    case Handler::LUI:
+    case Handler::AUIPC:
+    case Handler::JAL:
+    case Handler::CSRR:
+        use.rd = inst.rd;
+        break;
+    case Handler::ADDI:
+    case Handler::SLTI:
+    case Handler::SLTIU:
+    case Handler::XORI:
+    case Handler::ORI:
+    case Handler::ANDI:
+    case Handler::SLLI:
+    case Handler::SRLI:
+    case Handler::SRAI:
+    case Handler::SHIFT_ILLEGAL:
+    case Handler::LB:
+    case Handler::LH:
+    case Handler::LW:
+    case Handler::LBU:
+    case Handler::LHU:
+    case Handler::JALR:
+        use.rs1 = inst.rs1;
+        use.rd = inst.rd;
+        break;
+    case Handler::JR:
+        use.rs1 = inst.rs1;
+        break;
+    case Handler::SB:
+    case Handler::SH:
+    case Handler::SW:
+    case Handler::BEQ:
+    case Handler::BNEQ:
+    case Handler::BLT:
+    case Handler::BGE:
+    case Handler::BLTU:
+    case Handler::BGEU:
+        use.rs1 = inst.rs1;
+        use.rs2 = inst.rs2;
+        break;
+    case Handler::PRINT:
+        use.rs1 = inst.rs1;
+        break;
+    case Handler::SLEEP:
+    case Handler::CSR_ILLEGAL:
+    case Handler::NOP:
+    case Handler::UNKNOWN:
+    case Handler::COUNT:
+        break;
+    default:
+        // register-register
+        use.rs1 = inst.rs1;
+        use.rs2 = inst.rs2;
+        use.rd = inst.rd;
+        break;
+    }
+    return use;
+}
+
+RiscV::Fusion RiscV::MatchFusion(DecodedInstruction const& first, DecodedInstruction const& second)
+{
+    switch (first.handler) {
+    case Handler::LUI:
+        if (second.handler == Handler::ADDI && second.rs1 == first.rd) return Fusion::LUI_ADDI;
+        break;
+    case Handler::SLT:
+    case Handler::SLTU: {
+        bool const sltu = first.handler == Handler::SLTU;
+        if (second.rs1 != first.rd && second.rs2 != first.rd) break;
+        if (second.handler == Handler::BEQ) return sltu ? Fusion::SLTU_BEQ : Fusion::SLT_BEQ;
+        if (second.handler == Handler::BNEQ) return sltu ? Fusion::SLTU_BNEQ : Fusion::SLT_BNEQ;
+        break;
+    }
+    case Handler::ADDI:
+        if (second.handler == Handler::LW && second.rs1 == first.rd) return Fusion::ADDI_LW;
+        break;
+    case Handler::AUIPC:
+        if (second.handler == Handler::JALR && second.rs1 == first.rd) return Fusion::AUIPC_JALR;
+        break;
+    default:
+        break;
+    }
+    return Fusion::NONE;
+}
+
+char const* RiscV::FusionName(Fusion fusion)
+{
+    switch (fusion) {
+    case Fusion::LUI_ADDI:   return "lui+addi";
+    case Fusion::SLT_BEQ:    return "slt+beq";
+    case Fusion::SLT_BNEQ:   return "slt+bneq";
+    case Fusion::SLTU_BEQ:   return "sltu+beq";
+    case Fusion::SLTU_BNEQ:  return "sltu+bneq";
+    case Fusion::ADDI_LW:    return "addi+lw";
+    case Fusion::AUIPC_JALR: return "auipc+jalr";
+    default:                 return "none";
+    }
+}
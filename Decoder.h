@@ -0,0 +1,108 @@
+#pragma once
+#include "RiscV.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace RiscV {
+
+    // one entry per operation the virtual machine can execute,
+    // the decoder resolves opcode, funct3 and funct7/funct6 into exactly one of these
+    enum class Handler : uint8_t {
+        // RV32I register-register
+        ADD, SUB, SLL, SLT, SLTU, XOR, SRL, SRA, OR, AND,
+        // RV32M
+        MUL, MULH, MULHSU, MULHU, DIV, DIVU, REM, REMU,
+        // RV32I register-immediate
+        ADDI, SLTI, SLTIU, XORI, ORI, ANDI, SLLI, SRLI, SRAI, SHIFT_ILLEGAL,
+        // memory
+        LB, LH, LW, LBU, LHU, SB, SH, SW,
+        // control flow; JR is a jalr without link, Relocate makes it from the jalr x0 of toolchain code
+        JAL, JALR, JR, BEQ, BNEQ, BLT, BGE, BLTU, BGEU,
+        LUI, AUIPC,
+        // custom
+        PRINT, SLEEP,
+        // Zicsr: a read of a counter, imm is the csr number; anything else a csr instruction can do
+        CSRR, CSR_ILLEGAL,
+        // valid opcode with unused funct bits, does nothing
+        NOP,
+        // opcode the virtual machine does not know
+        UNKNOWN,
+
+        COUNT
+    };
+
+    // compact, pre-decoded form of an instruction
+    // imm holds the fully sign-extended immediate of whatever format the instruction has
+    // (shift amount for shifts, absolute target for branches and jal, see Relocate for toolchain code)
+    struct DecodedInstruction {
+        Handler handler;
+        BYTE rd;
+        BYTE rs1;
+        BYTE rs2;
+        WORD imm;
+    };
+
+    DecodedInstruction Decode(INSTRUCTION instruction);
+
+    // RV32C: a 16 bit instruction has lowest bits other than 11
+    bool IsCompressed(uint16_t parcel);
+    // the 32 bit instruction a compressed one stands for, so that everything after loading only
+    // sees 32 bit instructions. Branch and jump offsets stay pc relative byte offsets as in any
+    // RISC-V code, Relocate turns them into instruction indices. Reserved encodings and the F and
+    // D instructions expand to 0, an unknown opcode.
+    INSTRUCTION Expand(uint16_t parcel);
+    // Splits code of mixed 16 and 32 bit instructions into one expanded instruction per index,
+    // offsets gets the byte offset of every instruction. The 32 bit sleep is recognised as well,
+    // its upper half is the illegal parcel 0. False if the code ends inside an instruction.
+    bool ExpandCompressed(uint8_t const* code, size_t size, std::vector<INSTRUCTION>& image, std::vector<uint32_t>& offsets);
+
+    // Code built by a RISC-V toolchain (ELF executables, RV32C images) addresses branch and jump
+    // targets in bytes relative to the pc, this machine by instruction index. The layout of such
+    // code: the address of its first instruction and the byte offset of every instruction from
+    // there, ascending. Images of this machine's own encoding have no offsets.
+    struct CodeLayout {
+        ADDRESS base = 0;
+        std::vector<uint32_t> offsets;
+    };
+    // Gives decoded toolchain code the meaning this machine executes: branches and jal get the
+    // index of their target, auipc becomes the lui of the address it computes, and a jalr right
+    // behind an auipc of its base register becomes a jal to the index the pair addresses. A target
+    // that is not an instruction of the code gets the index behind it, taking the jump faults.
+    // Toolchain code takes x0 for the zero register, which this machine does not hardwire, so
+    // nothing may write it: jal x0 becomes an always taken beq x0, x0, jalr x0 becomes jr and any
+    // other instruction into x0 a nop (loads into x0 skip their access).
+    // Link registers hold indices, so jumps through code addresses computed any other way
+    // (function pointers, jump tables) are not supported.
+    void Relocate(std::vector<DecodedInstruction>& decoded, CodeLayout const& layout);
+
+    // pairs of instructions the threaded engine executes with a single dispatch
+    enum class Fusion : uint8_t {
+        NONE,
+        LUI_ADDI,       // constant materialisation
+        SLT_BEQ,        // compare and branch
+        SLT_BNEQ,
+        SLTU_BEQ,
+        SLTU_BNEQ,
+        ADDI_LW,        // address arithmetic
+        AUIPC_JALR,     // pc relative jump
+
+        COUNT
+    };
+
+    // idiom formed by first and the instruction directly following it,
+    // the second instruction has to consume the result of the first one
+    Fusion MatchFusion(DecodedInstruction const& first, DecodedInstruction const& second);
+    char const* FusionName(Fusion fusion);
+
+    // true for instructions after which execution does not simply continue with the next one
+    bool EndsBasicBlock(Handler handler);
+
+    // registers an instruction reads and writes, -1 where it has none
+    struct RegisterUse {
+        int rs1;
+        int rs2;
+        int rd;
+    };
+    RegisterUse UsedRegisters(DecodedInstruction const& inst);
+}
@@ -0,0 +1,168 @@
+#include "ElfFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VM_ELF_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+	// the parts of the ELF32 headers the loader needs, all fields little endian
+	struct Elf32Header {
+		uint8_t ident[16];
+		uint16_t type;
+		uint16_t machine;
+		uint32_t version;
+		uint32_t entry;
+		uint32_t phoff;
+		uint32_t shoff;
+		uint32_t flags;
+		uint16_t ehsize;
+		uint16_t phentsize;
+		uint16_t phnum;
+		uint16_t shentsize;
+		uint16_t shnum;
+		uint16_t shstrndx;
+	};
+
+	struct Elf32ProgramHeader {
+		uint32_t type;
+		uint32_t offset;
+		uint32_t vaddr;
+		uint32_t paddr;
+		uint32_t filesz;
+		uint32_t memsz;
+		uint32_t flags;
+		uint32_t align;
+	};
+
+	uint8_t const cElfMagic[4] = { 0x7f, 'E', 'L', 'F' };
+	uint8_t const cElfClass32 = 1;
+	uint8_t const cElfDataLittleEndian = 1;
+	uint16_t const cElfTypeExecutable = 2;
+	uint16_t const cElfMachineRiscV = 243;
+	uint32_t const cSegmentLoad = 1;
+	uint32_t const cSegmentFlagExecute = 1;
+	uint32_t const cSegmentFlagWrite = 2;
+	uint32_t const cFlagRvc = 1;
+}
+
+ElfFile::ElfFile(std::string const& fileName) : mFileName(fileName)
+{
+#ifdef VM_ELF_MMAP
+	int const fd = open(fileName.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd >= 0 && fstat(fd, &info) == 0 && info.st_size > 0) {
+		void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			mData = static_cast<uint8_t const*>(data);
+			mSize = static_cast<size_t>(info.st_size);
+			mMapped = true;
+		}
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+#else
+	std::ifstream ifs(fileName, std::ios::binary | std::ios::ate);
+	if (ifs.is_open()) {
+		std::streamoff const fileByteCount = ifs.tellg();
+		uint8_t* data = new uint8_t[static_cast<size_t>(fileByteCount)];
+		ifs.seekg(0, std::ios::beg);
+		ifs.read(reinterpret_cast<char*>(data), fileByteCount);
+		mData = data;
+		mSize = static_cast<size_t>(fileByteCount);
+	}
+#endif
+	if (mData == nullptr) {
+		std::cerr << "Could not open file: " << fileName << std::endl;
+		return;
+	}
+	if (!Parse()) {
+		std::cerr << "Invalid RISC-V ELF32 executable: " << fileName << std::endl;
+		mSegments.clear();
+	}
+}
+
+ElfFile::~ElfFile() {
+#ifdef VM_ELF_MMAP
+	if (mMapped) {
+		munmap(const_cast<uint8_t*>(mData), mSize);
+	}
+#else
+	delete[] mData;
+#endif
+}
+
+bool ElfFile::IsElf(std::string const& fileName) {
+	std::ifstream ifs(fileName, std::ios::binary);
+	char magic[sizeof(cElfMagic)] = {};
+	ifs.read(magic, sizeof(magic));
+	return ifs && std::memcmp(magic, cElfMagic, sizeof(cElfMagic)) == 0;
+}
+
+bool ElfFile::Parse() {
+	Elf32Header header;
+	if (mSize < sizeof(header)) return false;
+	std::memcpy(&header, mData, sizeof(header));
+	if (std::memcmp(header.ident, cElfMagic, sizeof(cElfMagic)) != 0 || header.ident[4] != cElfClass32 ||
+		header.ident[5] != cElfDataLittleEndian || header.type != cElfTypeExecutable || header.machine != cElfMachineRiscV) {
+		return false;
+	}
+	if (header.phentsize < sizeof(Elf32ProgramHeader) ||
+		header.phoff + static_cast<uint64_t>(header.phnum) * header.phentsize > mSize) {
+		return false;
+	}
+
+	for (uint16_t i = 0; i < header.phnum; ++i) {
+		Elf32ProgramHeader program;
+		std::memcpy(&program, mData + header.phoff + static_cast<size_t>(i) * header.phentsize, sizeof(program));
+		if (program.type != cSegmentLoad || program.memsz == 0) continue;
+		if (program.filesz > program.memsz || static_cast<uint64_t>(program.offset) + program.filesz > mSize) {
+			return false;
+		}
+
+		Segment segment;
+		segment.address = static_cast<RiscV::ADDRESS>(program.vaddr);
+		segment.offset = program.offset;
+		segment.fileSize = program.filesz;
+		segment.memorySize = program.memsz;
+		segment.executable = (program.flags & cSegmentFlagExecute) != 0;
+		segment.writable = (program.flags & cSegmentFlagWrite) != 0;
+		mSegments.push_back(segment);
+	}
+	mEntry = static_cast<RiscV::ADDRESS>(header.entry);
+	mCompressed = (header.flags & cFlagRvc) != 0;
+	return !mSegments.empty();
+}
+
+bool ElfFile::is_ready() const {
+	return !mSegments.empty();
+}
+
+std::string const& ElfFile::FileName() const {
+	return mFileName;
+}
+
+RiscV::ADDRESS ElfFile::Entry() const {
+	return mEntry;
+}
+
+bool ElfFile::Compressed() const {
+	return mCompressed;
+}
+
+std::vector<ElfFile::Segment> const& ElfFile::Segments() const {
+	return mSegments;
+}
+
+uint8_t const* ElfFile::Data(Segment const& segment) const {
+	return mData + segment.offset;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "RiscV.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only view of an ELF32 little endian RISC-V executable.
+//
+// The file is mapped into memory as a whole (read into memory where mmap is not available),
+// segment contents are handed out as pointers into that mapping without copying them.
+class ElfFile
+{
+public:
+	struct Segment {
+		RiscV::ADDRESS address;		// guest address of the first byte
+		uint32_t offset;			// file offset of the first byte
+		uint32_t fileSize;			// bytes present in the file
+		uint32_t memorySize;		// bytes in memory, the rest behind fileSize is zero (.bss)
+		bool executable;
+		bool writable;
+	};
+
+	explicit ElfFile(std::string const& fileName);
+	~ElfFile();
+	ElfFile(ElfFile const&) = delete;
+	ElfFile& operator=(ElfFile const&) = delete;
+
+	// true if the file starts with the ELF magic, no further checks
+	static bool IsElf(std::string const& fileName);
+
+	bool is_ready() const;
+	std::string const& FileName() const;
+	RiscV::ADDRESS Entry() const;
+	// the code uses RV32C compressed instructions (EF_RISCV_RVC)
+	bool Compressed() const;
+	// loadable (PT_LOAD) segments in file order
+	std::vector<Segment> const& Segments() const;
+	// contents of the segment as stored in the file, fileSize bytes
+	uint8_t const* Data(Segment const& segment) const;
+
+private:
+	std::string const mFileName;
+	uint8_t const* mData = nullptr;
+	size_t mSize = 0;
+	bool mMapped = false;
+	RiscV::ADDRESS mEntry = 0;
+	bool mCompressed = false;
+	std::vector<Segment> mSegments;
+
+	bool Parse();
+};
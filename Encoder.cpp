@@ -0,0 +1,173 @@
+#include "Encoder.h"
+
+#include <cassert>
+
+namespace {
+
+    // branch target index back into the B-type immediate bits, the inverse of Decode
+    uint32_t BranchBits(uint32_t target)
+    {
+        return ((target >> 11) & 1u) << 31 |     // 11 to 31
+            ((target >> 10) & 1u) << 7 |         // 10 to 7
+            ((target >> 4) & 0x3fu) << 25 |      // 9:4 to 30:25
+            (target & 0xfu) << 8;                // 3:0 to 11:8
+    }
+
+    // jal target index back into the J-type immediate bits
+    uint32_t JumpBits(uint32_t target)
+    {
+        return ((target >> 19) & 1u) << 31 |     // 19 to 31
+            ((target >> 11) & 0xffu) << 12 |     // 18:11 to 19:12
+            ((target >> 10) & 1u) << 20 |        // 10 to 20
+            (target & 0x3ffu) << 21;             // 9:0 to 30:21
+    }
+}
+
+RiscV::Encoder::Label RiscV::Encoder::NewLabel()
+{
+    mLabels.push_back(-1);
+    return mLabels.size() - 1;
+}
+
+void RiscV::Encoder::Bind(Label label)
+{
+    assert(mLabels[label] < 0);
+    mLabels[label] = static_cast<int64_t>(mImage.size());
+}
+
+RiscV::Encoder::Label RiscV::Encoder::Here()
+{
+    Label const label = NewLabel();
+    Bind(label);
+    return label;
+}
+
+void RiscV::Encoder::R(uint32_t f3, uint32_t f7, BYTE rd, BYTE rs1, BYTE rs2)
+{
+    mImage.push_back(static_cast<INSTRUCTION>(f7 << 25 | uint32_t(rs2) << 20 | uint32_t(rs1) << 15 | f3 << 12 |
+        uint32_t(rd) << 7 | RType::OP_TYPE_REGISTER));
+}
+
+void RiscV::Encoder::I(uint32_t opcode, uint32_t f3, BYTE rd, BYTE rs1, WORD imm)
+{
+    mImage.push_back(static_cast<INSTRUCTION>((static_cast<uint32_t>(imm) & 0xfffu) << 20 | uint32_t(rs1) << 15 |
+        f3 << 12 | uint32_t(rd) << 7 | opcode));
+}
+
+void RiscV::Encoder::S(uint32_t f3, BYTE rs2, BYTE rs1, WORD imm)
+{
+    uint32_t const bits = static_cast<uint32_t>(imm) & 0xfffu;
+    mImage.push_back(static_cast<INSTRUCTION>((bits >> 5) << 25 | uint32_t(rs2) << 20 | uint32_t(rs1) << 15 |
+        f3 << 12 | (bits & 0x1fu) << 7 | SType::OP_TYPE_STORE));
+}
+
+void RiscV::Encoder::B(uint32_t f3, BYTE rs1, BYTE rs2, Label target)
+{
+    mFixups.push_back(Fixup{ mImage.size(), target });
+    mImage.push_back(static_cast<INSTRUCTION>(uint32_t(rs2) << 20 | uint32_t(rs1) << 15 | f3 << 12 | BType::OP_TYPE_BRANCH));
+}
+
+void RiscV::Encoder::U(uint32_t opcode, BYTE rd, WORD imm20)
+{
+    mImage.push_back(static_cast<INSTRUCTION>((static_cast<uint32_t>(imm20) & 0xfffffu) << 12 | uint32_t(rd) << 7 | opcode));
+}
+
+void RiscV::Encoder::Add(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_ADD, RType::FUNC7_ADD, rd, rs1, rs2); }
+void RiscV::Encoder::Sub(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_SUB, RType::FUNC7_SUB, rd, rs1, rs2); }
+void RiscV::Encoder::Sll(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_SLL, RType::FUNC7_SLL, rd, rs1, rs2); }
+void RiscV::Encoder::Slt(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_SLT, RType::FUNC7_SLT, rd, rs1, rs2); }
+void RiscV::Encoder::Sltu(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_SLTU, RType::FUNC7_SLTU, rd, rs1, rs2); }
+void RiscV::Encoder::Xor(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_XOR, RType::FUNC7_XOR, rd, rs1, rs2); }
+void RiscV::Encoder::Srl(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_SRL, RType::FUNC7_SRL, rd, rs1, rs2); }
+void RiscV::Encoder::Sra(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_SRA, RType::FUNC7_SRA, rd, rs1, rs2); }
+void RiscV::Encoder::Or(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_OR, RType::FUNC7_OR, rd, rs1, rs2); }
+void RiscV::Encoder::And(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_AND, RType::FUNC7_AND, rd, rs1, rs2); }
+
+void RiscV::Encoder::Mul(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_MUL, RType::FUNC7_MUL, rd, rs1, rs2); }
+void RiscV::Encoder::Mulh(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_MULH, RType::FUNC7_MULH, rd, rs1, rs2); }
+void RiscV::Encoder::Mulhsu(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_MULHSU, RType::FUNC7_MULHSU, rd, rs1, rs2); }
+void RiscV::Encoder::Mulhu(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_MULHU, RType::FUNC7_MULHU, rd, rs1, rs2); }
+void RiscV::Encoder::Div(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_DIV, RType::FUNC7_DIV, rd, rs1, rs2); }
+void RiscV::Encoder::Divu(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_DIVU, RType::FUNC7_DIVU, rd, rs1, rs2); }
+void RiscV::Encoder::Rem(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_REM, RType::FUNC7_REM, rd, rs1, rs2); }
+void RiscV::Encoder::Remu(BYTE rd, BYTE rs1, BYTE rs2) { R(RType::FUNC3_REMU, RType::FUNC7_REMU, rd, rs1, rs2); }
+
+void RiscV::Encoder::Addi(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_IMMEDIATE, IType::FUNC3_ADDI, rd, rs1, imm); }
+void RiscV::Encoder::Slti(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_IMMEDIATE, IType::FUNC3_SLTI, rd, rs1, imm); }
+void RiscV::Encoder::Sltiu(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_IMMEDIATE, IType::FUNC3_SLTIU, rd, rs1, imm); }
+void RiscV::Encoder::Xori(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_IMMEDIATE, IType::FUNC3_XORI, rd, rs1, imm); }
+void RiscV::Encoder::Ori(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_IMMEDIATE, IType::FUNC3_ORI, rd, rs1, imm); }
+void RiscV::Encoder::Andi(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_IMMEDIATE, IType::FUNC3_ANDI, rd, rs1, imm); }
+void RiscV::Encoder::Slli(BYTE rd, BYTE rs1, WORD shamt) { I(IType::OP_TYPE_IMMEDIATE, IType::FUNC3_SLLI, rd, rs1, IType::FUNC6_SLLI << 6 | (shamt & 0x1f)); }
+void RiscV::Encoder::Srli(BYTE rd, BYTE rs1, WORD shamt) { I(IType::OP_TYPE_IMMEDIATE, IType::FUNC3_SRLI, rd, rs1, IType::FUNC6_SRLI << 6 | (shamt & 0x1f)); }
+void RiscV::Encoder::Srai(BYTE rd, BYTE rs1, WORD shamt) { I(IType::OP_TYPE_IMMEDIATE, IType::FUNC3_SRAI, rd, rs1, IType::FUNC6_SRAI << 6 | (shamt & 0x1f)); }
+
+void RiscV::Encoder::Lb(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_LOAD, IType::FUNC3_LB, rd, rs1, imm); }
+void RiscV::Encoder::Lh(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_LOAD, IType::FUNC3_LH, rd, rs1, imm); }
+void RiscV::Encoder::Lw(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_LOAD, IType::FUNC3_LW, rd, rs1, imm); }
+void RiscV::Encoder::Lbu(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_LOAD, IType::FUNC3_LBU, rd, rs1, imm); }
+void RiscV::Encoder::Lhu(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_TYPE_LOAD, IType::FUNC3_LHU, rd, rs1, imm); }
+void RiscV::Encoder::Sb(BYTE rs2, BYTE rs1, WORD imm) { S(SType::FUNC3_SB, rs2, rs1, imm); }
+void RiscV::Encoder::Sh(BYTE rs2, BYTE rs1, WORD imm) { S(SType::FUNC3_SH, rs2, rs1, imm); }
+void RiscV::Encoder::Sw(BYTE rs2, BYTE rs1, WORD imm) { S(SType::FUNC3_SW, rs2, rs1, imm); }
+
+void RiscV::Encoder::Jal(BYTE rd, Label target)
+{
+    mFixups.push_back(Fixup{ mImage.size(), target });
+    mImage.push_back(static_cast<INSTRUCTION>(uint32_t(rd) << 7 | JType::OP_JAL));
+}
+
+void RiscV::Encoder::Jalr(BYTE rd, BYTE rs1, WORD imm) { I(IType::OP_JALR, IType::FUNC3_JALR, rd, rs1, imm); }
+void RiscV::Encoder::Beq(BYTE rs1, BYTE rs2, Label target) { B(BType::FUNC3_BEQ, rs1, rs2, target); }
+void RiscV::Encoder::Bneq(BYTE rs1, BYTE rs2, Label target) { B(BType::FUNC3_BNEQ, rs1, rs2, target); }
+void RiscV::Encoder::Blt(BYTE rs1, BYTE rs2, Label target) { B(BType::FUNC3_BLT, rs1, rs2, target); }
+void RiscV::Encoder::Bge(BYTE rs1, BYTE rs2, Label target) { B(BType::FUNC3_BGE, rs1, rs2, target); }
+void RiscV::Encoder::Bltu(BYTE rs1, BYTE rs2, Label target) { B(BType::FUNC3_BLTU, rs1, rs2, target); }
+void RiscV::Encoder::Bgeu(BYTE rs1, BYTE rs2, Label target) { B(BType::FUNC3_BGEU, rs1, rs2, target); }
+
+void RiscV::Encoder::Lui(BYTE rd, WORD imm20) { U(UType::OP_LUI, rd, imm20); }
+void RiscV::Encoder::Auipc(BYTE rd, WORD imm20) { U(UType::OP_AUIPC, rd, imm20); }
+
+void RiscV::Encoder::Print(BYTE rs1)
+{
+    mImage.push_back(static_cast<INSTRUCTION>(uint32_t(rs1) << 15 | PType::FUNC3_INT << 12 | PType::OP_TYPE_PRINT));
+}
+
+void RiscV::Encoder::Sleep()
+{
+    mImage.push_back(static_cast<INSTRUCTION>(PType::OP_TYPE_SLEEP));
+}
+
+void RiscV::Encoder::Csrr(BYTE rd, uint32_t csr) { I(CsrType::OP_TYPE_CSR, CsrType::FUNC3_CSRRS, rd, 0, static_cast<WORD>(csr)); }
+
+void RiscV::Encoder::Li(BYTE rd, WORD value)
+{
+    // addi sign-extends its immediate, the upper part compensates for that
+    WORD const low = static_cast<WORD>(static_cast<uint32_t>(value) << 20) >> 20;
+    WORD const high = static_cast<WORD>((static_cast<uint32_t>(value) - static_cast<uint32_t>(low)) >> 12);
+    if (high == 0) {
+        // rd is written first so that addi does not read an unused register
+        Lui(rd, 0);
+    }
+    else {
+        Lui(rd, high);
+    }
+    if (low != 0) {
+        Addi(rd, rd, low);
+    }
+}
+
+std::vector<RiscV::INSTRUCTION> RiscV::Encoder::Finish()
+{
+    for (Fixup const& fixup : mFixups) {
+        assert(mLabels[fixup.label] >= 0);
+        uint32_t const target = static_cast<uint32_t>(mLabels[fixup.label]);
+        uint32_t const inst = static_cast<uint32_t>(mImage[fixup.index]);
+        bool const jump = (inst & 0x7f) == JType::OP_JAL;
+        // targets are absolute, 12 bits for branches and 20 bits for jal
+        assert(target < (jump ? 1u << 20 : 1u << 12));
+        uint32_t const bits = jump ? JumpBits(target) : BranchBits(target);
+        mImage[fixup.index] = static_cast<INSTRUCTION>(inst | bits);
+    }
+    return mImage;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "RiscV.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace RiscV {
+
+    // builds an instruction image from the constants in RiscV.h, the counterpart of Decode
+    // branch and jal targets are labels that resolve to instruction indices, like the VM expects
+    class Encoder {
+    public:
+        typedef size_t Label;
+
+        // a label that is bound later with Bind, or one bound to the next instruction with Here
+        Label NewLabel();
+        void Bind(Label label);
+        Label Here();
+
+        // RV32I register-register
+        void Add(BYTE rd, BYTE rs1, BYTE rs2);
+        void Sub(BYTE rd, BYTE rs1, BYTE rs2);
+        void Sll(BYTE rd, BYTE rs1, BYTE rs2);
+        void Slt(BYTE rd, BYTE rs1, BYTE rs2);
+        void Sltu(BYTE rd, BYTE rs1, BYTE rs2);
+        void Xor(BYTE rd, BYTE rs1, BYTE rs2);
+        void Srl(BYTE rd, BYTE rs1, BYTE rs2);
+        void Sra(BYTE rd, BYTE rs1, BYTE rs2);
+        void Or(BYTE rd, BYTE rs1, BYTE rs2);
+        void And(BYTE rd, BYTE rs1, BYTE rs2);
+        // RV32M
+        void Mul(BYTE rd, BYTE rs1, BYTE rs2);
+        void Mulh(BYTE rd, BYTE rs1, BYTE rs2);
+        void Mulhsu(BYTE rd, BYTE rs1, BYTE rs2);
+        void Mulhu(BYTE rd, BYTE rs1, BYTE rs2);
+        void Div(BYTE rd, BYTE rs1, BYTE rs2);
+        void Divu(BYTE rd, BYTE rs1, BYTE rs2);
+        void Rem(BYTE rd, BYTE rs1, BYTE rs2);
+        void Remu(BYTE rd, BYTE rs1, BYTE rs2);
+        // RV32I register-immediate, imm is 12 bit signed, shamt 0..31
+        void Addi(BYTE rd, BYTE rs1, WORD imm);
+        void Slti(BYTE rd, BYTE rs1, WORD imm);
+        void Sltiu(BYTE rd, BYTE rs1, WORD imm);
+        void Xori(BYTE rd, BYTE rs1, WORD imm);
+        void Ori(BYTE rd, BYTE rs1, WORD imm);
+        void Andi(BYTE rd, BYTE rs1, WORD imm);
+        void Slli(BYTE rd, BYTE rs1, WORD shamt);
+        void Srli(BYTE rd, BYTE rs1, WORD shamt);
+        void Srai(BYTE rd, BYTE rs1, WORD shamt);
+        // memory, address is x[rs1] + imm
+        void Lb(BYTE rd, BYTE rs1, WORD imm);
+        void Lh(BYTE rd, BYTE rs1, WORD imm);
+        void Lw(BYTE rd, BYTE rs1, WORD imm);
+        void Lbu(BYTE rd, BYTE rs1, WORD imm);
+        void Lhu(BYTE rd, BYTE rs1, WORD imm);
+        void Sb(BYTE rs2, BYTE rs1, WORD imm);
+        void Sh(BYTE rs2, BYTE rs1, WORD imm);
+        void Sw(BYTE rs2, BYTE rs1, WORD imm);
+        // control flow
+        void Jal(BYTE rd, Label target);
+        void Jalr(BYTE rd, BYTE rs1, WORD imm);
+        void Beq(BYTE rs1, BYTE rs2, Label target);
+        void Bneq(BYTE rs1, BYTE rs2, Label target);
+        void Blt(BYTE rs1, BYTE rs2, Label target);
+        void Bge(BYTE rs1, BYTE rs2, Label target);
+        void Bltu(BYTE rs1, BYTE rs2, Label target);
+        void Bgeu(BYTE rs1, BYTE rs2, Label target);
+        // imm20 is the upper immediate, bits 31:12 of the result
+        void Lui(BYTE rd, WORD imm20);
+        void Auipc(BYTE rd, WORD imm20);
+        // custom
+        void Print(BYTE rs1);
+        void Sleep();
+        // Zicsr: csrrs rd, csr, x0, reads one of the counters in RiscV::CsrType
+        void Csrr(BYTE rd, uint32_t csr);
+
+        // rd = value, one or two instructions
+        void Li(BYTE rd, WORD value);
+
+        // resolves all label references, every label has to be bound
+        std::vector<INSTRUCTION> Finish();
+
+    private:
+        struct Fixup {
+            size_t index;
+            Label label;
+        };
+
+        std::vector<INSTRUCTION> mImage;
+        std::vector<int64_t> mLabels;   // instruction index, -1 while unbound
+        std::vector<Fixup> mFixups;
+
+        void R(uint32_t f3, uint32_t f7, BYTE rd, BYTE rs1, BYTE rs2);
+        void I(uint32_t opcode, uint32_t f3, BYTE rd, BYTE rs1, WORD imm);
+        void S(uint32_t f3, BYTE rs2, BYTE rs1, WORD imm);
+        void B(uint32_t f3, BYTE rs1, BYTE rs2, Label target);
+        void U(uint32_t opcode, BYTE rd, WORD imm20);
+    };
+}
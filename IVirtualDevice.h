@@ -1,8 +1,53 @@
 #pragma once
 #include "RiscV.h"
 
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+// addresses passed to a device are byte offsets from the start of its range
 class IVirtualDevice {
 public:
-	virtual RiscV::WORD Read(RiscV::ADDRESS const& address) = 0;
-	virtual void Write(RiscV::ADDRESS const& address, RiscV::WORD const& data) = 0;
+	virtual ~IVirtualDevice() {}
+
+	// size is 1, 2 or 4 bytes, reads return the value zero-extended to a word
+	virtual RiscV::WORD Read(RiscV::ADDRESS const& address, size_t size) = 0;
+	virtual void Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t size) = 0;
+
+	// bulk transfers, by default split into byte accesses
+	virtual void ReadBlock(RiscV::ADDRESS const& address, void* buffer, size_t size) {
+		uint8_t* bytes = static_cast<uint8_t*>(buffer);
+		for (size_t i = 0; i < size; ++i) {
+			bytes[i] = static_cast<uint8_t>(Read(address + static_cast<RiscV::ADDRESS>(i), 1));
+		}
+	}
+	virtual void WriteBlock(RiscV::ADDRESS const& address, void const* buffer, size_t size) {
+		uint8_t const* bytes = static_cast<uint8_t const*>(buffer);
+		for (size_t i = 0; i < size; ++i) {
+			Write(address + static_cast<RiscV::ADDRESS>(i), bytes[i], 1);
+		}
+	}
+
+	// plain memory without side effects can hand out its storage (size in bytes),
+	// the virtual machine then accesses it directly instead of calling Read/Write
+	virtual uint8_t* HostMemory(size_t& size) { size = 0; return nullptr; }
+	// host memory that is only committed on first use reports the parts never touched,
+	// they read as zero and snapshots leave them out
+	virtual bool HostMemoryCommitted(size_t /*offset*/, size_t /*size*/) { return true; }
+
+	// devices with state of their own opt in to VirtualMachine snapshots, host memory is
+	// saved by the virtual machine itself; SaveState returns false when there is nothing to save
+	virtual bool SaveState(std::ostream& /*os*/) { return false; }
+	virtual bool LoadState(std::istream& /*is*/) { return false; }
+
+	// the bytes left to read in is, LoadState checks counts it reads against it before it
+	// allocates anything for them, a corrupt state must not ask for gigabytes
+	static uint64_t BytesLeft(std::istream& is) {
+		std::streampos const here = is.tellg();
+		if (!is || here < 0) return 0;
+		is.seekg(0, std::ios::end);
+		std::streampos const end = is.tellg();
+		is.seekg(here);
+		return (is && end >= here) ? static_cast<uint64_t>(end - here) : 0;
+	}
 };
\ No newline at end of file
@@ -0,0 +1,587 @@
+#include "Jit.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define VM_JIT_X64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace RiscV;
+
+#ifdef VM_JIT_X64
+
+namespace {
+
+	// size of the executable code buffer
+	size_t const cCodeCapacity = 16 << 20;
+
+	enum Reg : uint8_t {
+		RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+		R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+	};
+
+	enum Cond : uint8_t {
+		CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD
+	};
+
+	// opcodes of "op r/m32, r32" and the /digit of "op r/m32, imm32"
+	enum Alu : uint8_t { ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_XOR = 0x31, ALU_CMP = 0x39 };
+	enum AluImm : uint8_t { IMM_ADD = 0, IMM_OR = 1, IMM_AND = 4, IMM_SUB = 5, IMM_XOR = 6, IMM_CMP = 7 };
+	enum Shift : uint8_t { SHIFT_SHL = 4, SHIFT_SHR = 5, SHIFT_SAR = 7 };
+
+	// r14 holds the Jit::Context, r15 the guest register file,
+	// the remaining callee-saved registers cache guest registers within a block
+	Reg const cContextReg = R14;
+	Reg const cRegisterFileReg = R15;
+	Reg const cCacheRegs[] = { RBX, RBP, R12, R13 };
+	size_t const cCacheRegCount = sizeof(cCacheRegs) / sizeof(cCacheRegs[0]);
+
+	// minimal x86-64 machine code emitter, all register operations are 32 bit unless stated otherwise
+	class Emitter {
+	public:
+		std::vector<uint8_t> code;
+
+		size_t Size() const { return code.size(); }
+
+		void Byte(uint8_t b) { code.push_back(b); }
+		void Dword(uint32_t d) { for (int i = 0; i < 4; ++i) Byte(static_cast<uint8_t>(d >> (8 * i))); }
+		void Qword(uint64_t q) { for (int i = 0; i < 8; ++i) Byte(static_cast<uint8_t>(q >> (8 * i))); }
+
+		void Rex(bool w, uint8_t reg, uint8_t rm, bool force = false) {
+			uint8_t rex = 0x40 | (w ? 0x08 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+			if (rex != 0x40 || force) Byte(rex);
+		}
+		void ModRM(uint8_t mod, uint8_t reg, uint8_t rm) { Byte(static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (rm & 7))); }
+		void MemOperand(uint8_t reg, Reg base, int32_t disp) {
+			ModRM(2, reg, base);
+			if ((base & 7) == RSP) Byte(0x24);	// rsp/r12 need a SIB byte
+			Dword(static_cast<uint32_t>(disp));
+		}
+
+		void AluRR(Alu op, Reg dst, Reg src, bool w = false) { Rex(w, src, dst); Byte(op); ModRM(3, src, dst); }
+		void AluRI(AluImm op, Reg dst, int32_t imm) { Rex(false, 0, dst); Byte(0x81); ModRM(3, op, dst); Dword(static_cast<uint32_t>(imm)); }
+		void MovRR(Reg dst, Reg src, bool w = false) { Rex(w, src, dst); Byte(0x89); ModRM(3, src, dst); }
+		void MovRI(Reg dst, int32_t imm) { Rex(false, 0, dst); Byte(0xB8 + (dst & 7)); Dword(static_cast<uint32_t>(imm)); }
+		void MovRI64(Reg dst, uint64_t imm) { Rex(true, 0, dst); Byte(0xB8 + (dst & 7)); Qword(imm); }
+		void Load(Reg dst, Reg base, int32_t disp, bool w = false) { Rex(w, dst, base); Byte(0x8B); MemOperand(dst, base, disp); }
+		void Store(Reg base, int32_t disp, Reg src) { Rex(false, src, base); Byte(0x89); MemOperand(src, base, disp); }
+		// [base + index * (1 << scale)], base must not be rbp/r13
+		void IndexOperand(uint8_t reg, Reg base, Reg index, uint8_t scale) {
+			ModRM(0, reg, RSP);
+			Byte(static_cast<uint8_t>((scale << 6) | ((index & 7) << 3) | (base & 7)));
+		}
+		void LoadIndexed(Reg dst, Reg base, Reg index, uint8_t scale, bool w = false) {
+			Byte(static_cast<uint8_t>(0x40 | (w ? 0x08 : 0) | ((dst >> 3) << 2) | ((index >> 3) << 1) | (base >> 3)));
+			Byte(0x8B); IndexOperand(dst, base, index, scale);
+		}
+		// 1, 2 or 4 byte accesses to [base + index], loads are zero- or sign-extended to 32 bit
+		void LoadSized(Reg dst, Reg base, Reg index, size_t size, bool sign) {
+			Byte(static_cast<uint8_t>(0x40 | ((dst >> 3) << 2) | ((index >> 3) << 1) | (base >> 3)));
+			if (size == 4) Byte(0x8B);
+			else { Byte(0x0F); Byte(size == 1 ? (sign ? 0xBE : 0xB6) : (sign ? 0xBF : 0xB7)); }
+			IndexOperand(dst, base, index, 0);
+		}
+		void StoreSized(Reg base, Reg index, Reg src, size_t size) {
+			if (size == 2) Byte(0x66);
+			Byte(static_cast<uint8_t>(0x40 | ((src >> 3) << 2) | ((index >> 3) << 1) | (base >> 3)));
+			Byte(size == 1 ? 0x88 : 0x89);
+			IndexOperand(src, base, index, 0);
+		}
+		void StoreByteImm(Reg base, Reg index, uint8_t imm) {
+			Byte(static_cast<uint8_t>(0x40 | ((index >> 3) << 1) | (base >> 3)));
+			Byte(0xC6); IndexOperand(0, base, index, 0); Byte(imm);
+		}
+		void CmpByteImm(Reg base, Reg index, uint8_t imm) {
+			Byte(static_cast<uint8_t>(0x40 | ((index >> 3) << 1) | (base >> 3)));
+			Byte(0x80); IndexOperand(IMM_CMP, base, index, 0); Byte(imm);
+		}
+		// sign-extend the lowest 1 or 2 bytes of reg
+		void Movsx(Reg reg, size_t size) { Rex(false, reg, reg); Byte(0x0F); Byte(size == 1 ? 0xBE : 0xBF); ModRM(3, reg, reg); }
+		void TestRI(Reg reg, int32_t imm) { Rex(false, 0, reg); Byte(0xF7); ModRM(3, 0, reg); Dword(static_cast<uint32_t>(imm)); }
+		void CmpMem64(Reg reg, Reg base, int32_t disp) { Rex(true, reg, base); Byte(0x3B); MemOperand(reg, base, disp); }
+		void Test64(Reg a, Reg b) { Rex(true, b, a); Byte(0x85); ModRM(3, b, a); }
+		void AddMem64(Reg base, int32_t disp, int32_t imm) { Rex(true, 0, base); Byte(0x81); MemOperand(0, base, disp); Dword(static_cast<uint32_t>(imm)); }
+		void ShiftCl(Shift op, Reg dst) { Rex(false, 0, dst); Byte(0xD3); ModRM(3, op, dst); }
+		void ShiftRI(Shift op, Reg dst, uint8_t imm, bool w = false) { Rex(w, 0, dst); Byte(0xC1); ModRM(3, op, dst); Byte(imm); }
+		// dst = (condition) ? 1 : 0, dst has to be one of al/cl/dl/bl
+		void SetCC(Cond cc, Reg dst) { Byte(0x0F); Byte(0x90 + cc); ModRM(3, 0, dst); Byte(0x0F); Byte(0xB6); ModRM(3, dst, dst); }
+		void Imul(Reg dst, Reg src, bool w = false) { Rex(w, dst, src); Byte(0x0F); Byte(0xAF); ModRM(3, dst, src); }
+		void Movsxd(Reg dst, Reg src) { Rex(true, dst, src); Byte(0x63); ModRM(3, dst, src); }
+		void Push(Reg r) { Rex(false, 0, r); Byte(0x50 + (r & 7)); }
+		void Pop(Reg r) { Rex(false, 0, r); Byte(0x58 + (r & 7)); }
+		void CallAbsolute(void const* function) { MovRI64(RAX, reinterpret_cast<uint64_t>(function)); Byte(0xFF); ModRM(3, 2, RAX); }
+		void Ret() { Byte(0xC3); }
+
+		// jumps with a rel32 operand, return the offset of the operand for patching
+		size_t Jcc(Cond cc) { Byte(0x0F); Byte(0x80 + cc); Dword(0); return Size() - 4; }
+		size_t Jmp() { Byte(0xE9); Dword(0); return Size() - 4; }
+		void PatchRel32(size_t at, size_t target) {
+			int32_t rel = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+			std::memcpy(&code[at], &rel, sizeof(rel));
+		}
+
+		void Prologue() {
+			Push(RBX); Push(RBP); Push(R12); Push(R13); Push(R14); Push(R15);
+			Rex(true, 0, RSP); Byte(0x83); ModRM(3, IMM_SUB, RSP); Byte(8);		// sub rsp, 8 (keeps calls 16 byte aligned)
+			MovRR(cContextReg, RDI, true);
+			Load(cRegisterFileReg, RDI, offsetof(Jit::Context, registers), true);
+		}
+		void Epilogue() {
+			Rex(true, 0, RSP); Byte(0x83); ModRM(3, IMM_ADD, RSP); Byte(8);		// add rsp, 8
+			Pop(R15); Pop(R14); Pop(R13); Pop(R12); Pop(RBP); Pop(RBX);
+			Ret();
+		}
+	};
+
+	size_t PrologueSize() {
+		Emitter emitter;
+		emitter.Prologue();
+		return emitter.Size();
+	}
+
+	// number of bytes a load or store accesses
+	size_t AccessSize(Handler handler) {
+		switch (handler) {
+		case Handler::LB: case Handler::LBU: case Handler::SB: return 1;
+		case Handler::LH: case Handler::LHU: case Handler::SH: return 2;
+		default: return 4;
+		}
+	}
+}
+
+size_t const Jit::cPrologueSize = PrologueSize();
+
+Jit::Jit(std::vector<DecodedInstruction> const& decoded, ReadMemoryHelper readMemory, WriteMemoryHelper writeMemory) :
+	mDecoded(decoded), mReadMemory(readMemory), mWriteMemory(writeMemory),
+	mBlocks(decoded.size(), nullptr), mCounters(decoded.size(), 0)
+{
+	void* code = mmap(nullptr, cCodeCapacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED) {
+		return;
+	}
+	mCode = static_cast<uint8_t*>(code);
+	mCodeCapacity = cCodeCapacity;
+	// code pages are either writable or executable, never both
+	SetWritable(0, mCodeCapacity, false);
+}
+
+Jit::~Jit() {
+	if (mCode != nullptr) {
+		munmap(mCode, mCodeCapacity);
+	}
+}
+
+bool Jit::IsSupported() {
+	return true;
+}
+
+bool Jit::SetWritable(size_t offset, size_t size, bool writable) {
+	size_t const pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t begin = offset & ~(pageSize - 1);
+	size_t end = (offset + size + pageSize - 1) & ~(pageSize - 1);
+	int protection = writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC);
+	return mprotect(mCode + begin, end - begin, protection) == 0;
+}
+
+Jit::Block Jit::Compile(ADDRESS pc, bool const* registerWritten, size_t regCount) {
+	size_t const imageSize = mDecoded.size();
+	size_t const begin = static_cast<size_t>(pc);
+
+	// find the end of the block
+	size_t end = begin;
+	bool endsWithTransfer = false;
+	while (end < imageSize && end - begin < cMaxBlockLength) {
+		DecodedInstruction const& inst = mDecoded[end];
+		if (!IsSupportedInstruction(inst)) break;
+
+		RegisterUse const use = UsedRegisters(inst);
+		bool registersClean = true;
+		for (int reg : { use.rs1, use.rs2, use.rd }) {
+			if (reg >= 0 && (static_cast<size_t>(reg) >= regCount || !registerWritten[reg])) registersClean = false;
+		}
+		if (!registersClean) break;
+
+		++end;
+		if (EndsBasicBlock(inst.handler)) {
+			endsWithTransfer = true;
+			break;
+		}
+	}
+	if (end == begin) {
+		// nothing to compile yet, try again once it became hot again
+		mCounters[begin] = 0;
+		return nullptr;
+	}
+	size_t const blockLength = end - begin;
+
+	// cache the most used guest registers of the block in host registers
+	int useCount[cRegCount] = {};
+	for (size_t i = begin; i < end; ++i) {
+		RegisterUse const use = UsedRegisters(mDecoded[i]);
+		for (int reg : { use.rs1, use.rs2, use.rd }) {
+			if (reg >= 0) ++useCount[reg];
+		}
+	}
+	int cached[cRegCount];
+	for (size_t i = 0; i < cRegCount; ++i) cached[i] = -1;
+	std::vector<BYTE> cachedRegisters;
+	for (size_t slot = 0; slot < cCacheRegCount; ++slot) {
+		int best = -1;
+		for (size_t reg = 0; reg < cRegCount; ++reg) {
+			if (cached[reg] < 0 && useCount[reg] >= 2 && (best < 0 || useCount[reg] > useCount[best])) best = static_cast<int>(reg);
+		}
+		if (best < 0) break;
+		cached[best] = static_cast<int>(slot);
+		cachedRegisters.push_back(static_cast<BYTE>(best));
+	}
+
+	Emitter e;
+	auto loadGuest = [&](Reg dst, BYTE reg) {
+		if (cached[reg] >= 0) e.MovRR(dst, cCacheRegs[cached[reg]]);
+		else e.Load(dst, cRegisterFileReg, reg * sizeof(WORD));
+	};
+	auto storeGuest = [&](BYTE reg, Reg src) {
+		if (cached[reg] >= 0) e.MovRR(cCacheRegs[cached[reg]], src);
+		else e.Store(cRegisterFileReg, reg * sizeof(WORD), src);
+	};
+
+	std::vector<size_t> epilogueJumps;
+	std::vector<std::pair<ADDRESS, size_t>> links;
+
+	// leaves the block towards target, static targets are chained to their block once it exists
+	auto emitExit = [&](ADDRESS target, bool isStatic) {
+		for (BYTE reg : cachedRegisters) {
+			e.Store(cRegisterFileReg, reg * sizeof(WORD), cCacheRegs[cached[reg]]);
+		}
+		e.AddMem64(cContextReg, offsetof(Context, executed), static_cast<int32_t>(blockLength));
+		if (isStatic && target >= 0 && static_cast<size_t>(target) < imageSize) {
+			// only chain while the instruction budget lasts
+			e.Load(RAX, cContextReg, offsetof(Context, executed), true);
+			e.CmpMem64(RAX, cContextReg, offsetof(Context, limit));
+			size_t leave = e.Jcc(CC_AE);
+			size_t link = e.Jmp();
+			links.push_back(std::make_pair(target, link));
+			e.PatchRel32(link, e.Size());
+			e.PatchRel32(leave, e.Size());
+		}
+		if (isStatic) e.MovRI(RAX, target);
+		epilogueJumps.push_back(e.Jmp());
+	};
+
+	// esi holds the guest address, leaves the host page in rax and the byte offset in rcx,
+	// collects the jumps taken for accesses that are unaligned or not plain memory
+	auto emitPageLookup = [&](size_t size, bool store, std::vector<size_t>& slow) {
+		if (size > 1) {
+			// aligned accesses never cross a page
+			e.TestRI(RSI, static_cast<int32_t>(size - 1));
+			slow.push_back(e.Jcc(CC_NE));
+		}
+		e.MovRR(RAX, RSI);
+		e.ShiftRI(SHIFT_SHR, RAX, static_cast<uint8_t>(cPageBits));
+		e.CmpMem64(RAX, cContextReg, offsetof(Context, pageCount));
+		slow.push_back(e.Jcc(CC_AE));
+		if (store) e.MovRR(RDI, RAX, true);
+		e.Load(RCX, cContextReg, offsetof(Context, pageMemory), true);
+		e.LoadIndexed(RAX, RCX, RAX, 3, true);
+		e.Test64(RAX, RAX);
+		slow.push_back(e.Jcc(CC_E));
+		if (store) {
+			// the helper invalidates the decoded instructions of code pages
+			e.Load(RCX, cContextReg, offsetof(Context, pageCode), true);
+			e.CmpByteImm(RCX, RDI, 0);
+			slow.push_back(e.Jcc(CC_NE));
+			e.Load(RCX, cContextReg, offsetof(Context, pageDirty), true);
+			e.StoreByteImm(RCX, RDI, 1);
+		}
+		e.MovRR(RCX, RSI);
+		e.AluRI(IMM_AND, RCX, cPageMask);
+	};
+
+	e.Prologue();
+	for (BYTE reg : cachedRegisters) {
+		e.Load(cCacheRegs[cached[reg]], cRegisterFileReg, reg * sizeof(WORD));
+	}
+
+	for (size_t i = begin; i < end; ++i) {
+		DecodedInstruction const& inst = mDecoded[i];
+		ADDRESS const instPc = static_cast<ADDRESS>(i);
+
+		switch (inst.handler) {
+		case Handler::ADD: case Handler::SUB: case Handler::XOR: case Handler::OR: case Handler::AND: {
+			Alu op = inst.handler == Handler::ADD ? ALU_ADD : inst.handler == Handler::SUB ? ALU_SUB :
+				inst.handler == Handler::XOR ? ALU_XOR : inst.handler == Handler::OR ? ALU_OR : ALU_AND;
+			loadGuest(RAX, inst.rs1);
+			loadGuest(RCX, inst.rs2);
+			e.AluRR(op, RAX, RCX);
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::SLL: case Handler::SRL: case Handler::SRA: {
+			// x86 masks the shift count in cl to 5 bits just like RISC-V
+			loadGuest(RAX, inst.rs1);
+			loadGuest(RCX, inst.rs2);
+			e.ShiftCl(inst.handler == Handler::SLL ? SHIFT_SHL : inst.handler == Handler::SRL ? SHIFT_SHR : SHIFT_SAR, RAX);
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::SLT: case Handler::SLTU: {
+			loadGuest(RAX, inst.rs1);
+			loadGuest(RCX, inst.rs2);
+			e.AluRR(ALU_CMP, RAX, RCX);
+			e.SetCC(inst.handler == Handler::SLT ? CC_L : CC_B, RAX);
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::MUL: {
+			loadGuest(RAX, inst.rs1);
+			loadGuest(RCX, inst.rs2);
+			e.Imul(RAX, RCX);
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::MULH: case Handler::MULHSU: case Handler::MULHU: {
+			// 32 bit loads zero extend, sign extend where the operand is signed
+			loadGuest(RAX, inst.rs1);
+			loadGuest(RCX, inst.rs2);
+			if (inst.handler != Handler::MULHU) e.Movsxd(RAX, RAX);
+			if (inst.handler == Handler::MULH) e.Movsxd(RCX, RCX);
+			e.Imul(RAX, RCX, true);
+			e.ShiftRI(SHIFT_SHR, RAX, 32, true);
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::ADDI: case Handler::XORI: case Handler::ORI: case Handler::ANDI: {
+			AluImm op = inst.handler == Handler::ADDI ? IMM_ADD : inst.handler == Handler::XORI ? IMM_XOR :
+				inst.handler == Handler::ORI ? IMM_OR : IMM_AND;
+			loadGuest(RAX, inst.rs1);
+			e.AluRI(op, RAX, inst.imm);
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::SLTI: case Handler::SLTIU: {
+			loadGuest(RAX, inst.rs1);
+			e.AluRI(IMM_CMP, RAX, inst.imm);
+			e.SetCC(inst.handler == Handler::SLTI ? CC_L : CC_B, RAX);
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::SLLI: case Handler::SRLI: case Handler::SRAI: {
+			loadGuest(RAX, inst.rs1);
+			e.ShiftRI(inst.handler == Handler::SLLI ? SHIFT_SHL : inst.handler == Handler::SRLI ? SHIFT_SHR : SHIFT_SAR,
+				RAX, static_cast<uint8_t>(inst.imm));
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::LUI: {
+			e.MovRI(RAX, inst.imm);
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::AUIPC: {
+			e.MovRI(RAX, static_cast<WORD>(instPc + inst.imm));
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::LB: case Handler::LH: case Handler::LW: case Handler::LBU: case Handler::LHU: {
+			// plain memory is accessed inline, everything else calls the helper,
+			// guest registers cached in callee-saved host registers survive the call
+			size_t const size = AccessSize(inst.handler);
+			bool const sign = inst.handler == Handler::LB || inst.handler == Handler::LH;
+			std::vector<size_t> slow;
+			loadGuest(RSI, inst.rs1);
+			e.AluRI(IMM_ADD, RSI, inst.imm);
+			emitPageLookup(size, false, slow);
+			e.LoadSized(RAX, RAX, RCX, size, sign);
+			size_t const done = e.Jmp();
+			for (size_t jump : slow) e.PatchRel32(jump, e.Size());
+			e.Load(RDI, cContextReg, offsetof(Context, vm), true);
+			e.MovRI(RDX, static_cast<int32_t>(size));
+			e.MovRI(RCX, instPc);
+			e.CallAbsolute(reinterpret_cast<void const*>(mReadMemory));
+			if (sign) e.Movsx(RAX, size);
+			e.PatchRel32(done, e.Size());
+			storeGuest(inst.rd, RAX);
+			break;
+		}
+		case Handler::SB: case Handler::SH: case Handler::SW: {
+			size_t const size = AccessSize(inst.handler);
+			std::vector<size_t> slow;
+			loadGuest(RSI, inst.rs1);
+			e.AluRI(IMM_ADD, RSI, inst.imm);
+			loadGuest(RDX, inst.rs2);
+			emitPageLookup(size, true, slow);
+			e.StoreSized(RAX, RCX, RDX, size);
+			size_t const done = e.Jmp();
+			for (size_t jump : slow) e.PatchRel32(jump, e.Size());
+			e.Load(RDI, cContextReg, offsetof(Context, vm), true);
+			e.MovRI(RCX, static_cast<int32_t>(size));
+			e.MovRI(R8, instPc);
+			e.CallAbsolute(reinterpret_cast<void const*>(mWriteMemory));
+			e.PatchRel32(done, e.Size());
+			break;
+		}
+		case Handler::JAL: {
+			e.MovRI(RAX, instPc + 1);
+			storeGuest(inst.rd, RAX);
+			emitExit(inst.imm, true);
+			break;
+		}
+		case Handler::JALR: {
+			loadGuest(RAX, inst.rs1);
+			e.AluRI(IMM_ADD, RAX, inst.imm);
+			e.MovRI(RCX, instPc + 1);
+			storeGuest(inst.rd, RCX);
+			emitExit(0, false);		// target stays in eax
+			break;
+		}
+		case Handler::JR: {
+			loadGuest(RAX, inst.rs1);
+			e.AluRI(IMM_ADD, RAX, inst.imm);
+			emitExit(0, false);
+			break;
+		}
+		case Handler::BEQ: case Handler::BNEQ: case Handler::BLT: case Handler::BGE: case Handler::BLTU: case Handler::BGEU: {
+			Cond cc = inst.handler == Handler::BEQ ? CC_E : inst.handler == Handler::BNEQ ? CC_NE :
+				inst.handler == Handler::BLT ? CC_L : inst.handler == Handler::BGE ? CC_GE :
+				inst.handler == Handler::BLTU ? CC_B : CC_AE;
+			loadGuest(RAX, inst.rs1);
+			loadGuest(RCX, inst.rs2);
+			e.AluRR(ALU_CMP, RAX, RCX);
+			size_t taken = e.Jcc(cc);
+			emitExit(instPc + 1, true);
+			e.PatchRel32(taken, e.Size());
+			emitExit(inst.imm, true);
+			break;
+		}
+		case Handler::NOP:
+		default:
+			break;
+		}
+	}
+	if (!endsWithTransfer) {
+		emitExit(static_cast<ADDRESS>(end), true);
+	}
+
+	size_t const epilogue = e.Size();
+	e.Epilogue();
+	for (size_t jump : epilogueJumps) {
+		e.PatchRel32(jump, epilogue);
+	}
+
+	// copy to the executable buffer
+	if (mCode == nullptr || mCodeSize + e.Size() > mCodeCapacity) {
+		mCounters[begin] = 0;
+		return nullptr;
+	}
+	size_t const offset = mCodeSize;
+	uint8_t* const entry = mCode + offset;
+	if (!SetWritable(offset, e.Size(), true)) {
+		return nullptr;
+	}
+	std::memcpy(entry, e.code.data(), e.Size());
+	mCodeSize += e.Size();
+	mBlocks[begin] = reinterpret_cast<Block>(entry);
+
+	for (auto const& link : links) {
+		if (mBlocks[link.first] != nullptr) {
+			uint8_t* target = reinterpret_cast<uint8_t*>(mBlocks[link.first]) + cPrologueSize;
+			int32_t rel = static_cast<int32_t>(target - (entry + link.second + 4));
+			std::memcpy(entry + link.second, &rel, sizeof(rel));
+		}
+		else {
+			mPendingLinks.insert(std::make_pair(link.first, offset + link.second));
+		}
+	}
+	SetWritable(offset, e.Size(), false);
+
+	Link(pc, entry + cPrologueSize);
+	return mBlocks[begin];
+}
+
+void Jit::Link(ADDRESS target, uint8_t* blockEntry) {
+	auto range = mPendingLinks.equal_range(target);
+	for (auto iter = range.first; iter != range.second; ++iter) {
+		uint8_t* field = mCode + iter->second;
+		int32_t rel = static_cast<int32_t>(blockEntry - (field + 4));
+		SetWritable(iter->second, sizeof(rel), true);
+		std::memcpy(field, &rel, sizeof(rel));
+		SetWritable(iter->second, sizeof(rel), false);
+	}
+	mPendingLinks.erase(range.first, range.second);
+}
+
+#else
+
+// no native code generation on this platform, the dispatcher never gets a block
+
+size_t const Jit::cPrologueSize = 0;
+
+Jit::Jit(std::vector<DecodedInstruction> const& decoded, ReadMemoryHelper readMemory, WriteMemoryHelper writeMemory) :
+	mDecoded(decoded), mReadMemory(readMemory), mWriteMemory(writeMemory)
+{
+}
+
+Jit::~Jit() {
+}
+
+bool Jit::IsSupported() {
+	return false;
+}
+
+bool Jit::SetWritable(size_t, size_t, bool) {
+	return false;
+}
+
+Jit::Block Jit::Compile(ADDRESS, bool const*, size_t) {
+	return nullptr;
+}
+
+void Jit::Link(ADDRESS, uint8_t*) {
+}
+
+#endif
+
+bool Jit::is_ready() const {
+	return mCode != nullptr;
+}
+
+Jit::Block Jit::Lookup(ADDRESS pc) const {
+	return mBlocks.empty() ? nullptr : mBlocks[pc];
+}
+
+bool Jit::CountEntry(ADDRESS pc) {
+	return !mCounters.empty() && ++mCounters[pc] == cHotThreshold;
+}
+
+bool Jit::Invalidate(ADDRESS begin, ADDRESS end) {
+	if (mBlocks.empty()) return true;
+	std::fill(mCounters.begin() + begin, mCounters.begin() + end, 0);
+	// a block reaches up to cMaxBlockLength instructions behind its start
+	ADDRESS const first = std::max<ADDRESS>(begin - static_cast<ADDRESS>(cMaxBlockLength) + 1, 0);
+	return std::all_of(mBlocks.begin() + first, mBlocks.begin() + end, [](Block block) { return block == nullptr; });
+}
+
+bool Jit::IsSupportedInstruction(DecodedInstruction const& inst) const {
+	switch (inst.handler) {
+	case Handler::ADD: case Handler::SUB: case Handler::SLL: case Handler::SLT: case Handler::SLTU:
+	case Handler::XOR: case Handler::SRL: case Handler::SRA: case Handler::OR: case Handler::AND:
+	case Handler::MUL: case Handler::MULH: case Handler::MULHSU: case Handler::MULHU:
+	case Handler::ADDI: case Handler::SLTI: case Handler::SLTIU: case Handler::XORI: case Handler::ORI:
+	case Handler::ANDI: case Handler::SLLI: case Handler::SRLI: case Handler::SRAI:
+	case Handler::LUI: case Handler::AUIPC:
+	case Handler::LB: case Handler::LH: case Handler::LW: case Handler::LBU: case Handler::LHU:
+	case Handler::SB: case Handler::SH: case Handler::SW:
+	case Handler::JAL: case Handler::JALR: case Handler::JR:
+	case Handler::BEQ: case Handler::BNEQ: case Handler::BLT: case Handler::BGE: case Handler::BLTU: case Handler::BGEU:
+	case Handler::NOP:
+		return true;
+	default:
+		// division warnings, print, sleep and unknown instructions stay with the interpreter
+		return false;
+	}
+}
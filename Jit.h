@@ -0,0 +1,83 @@
+#pragma once
+#include "RiscV.h"
+#include "Decoder.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class VirtualMachine;
+
+// Basic-block compiler from decoded RISC-V instructions to native x86-64 code.
+//
+// Blocks start at the pc the dispatcher arrives at and run up to and including the next
+// branch or jump, or up to the first instruction the compiler does not support. Static
+// exits (jal, conditional branches, fall through) are chained directly to the target block
+// once that one is compiled. Only available on x86-64 Linux, IsSupported() is false elsewhere.
+class Jit
+{
+public:
+	// state shared between the dispatcher and the compiled code
+	struct Context {
+		RiscV::WORD* registers;
+		VirtualMachine* vm;
+		uint64_t executed;		// instructions executed by compiled code since the last call
+		uint8_t* const* pageMemory;	// host storage per page of plain memory, see VirtualMachine
+		size_t pageCount;
+		uint64_t limit;			// chained exits return to the dispatcher once executed reaches it
+		uint8_t* pageDirty;		// stores to plain memory mark their page
+		uint8_t const* pageCode;	// stores to pages that hold instructions take the helper
+	};
+
+	// runs compiled code starting at a block, returns the pc to continue at
+	typedef RiscV::ADDRESS (*Block)(Context* context);
+
+	// callbacks for memory accesses that do not hit plain memory, pc is the address of the accessing instruction
+	// size is 1, 2 or 4 bytes, reads return the value zero-extended
+	typedef RiscV::WORD (*ReadMemoryHelper)(VirtualMachine* vm, RiscV::ADDRESS address, uint32_t size, RiscV::ADDRESS pc);
+	typedef void (*WriteMemoryHelper)(VirtualMachine* vm, RiscV::ADDRESS address, RiscV::WORD data, uint32_t size, RiscV::ADDRESS pc);
+
+	// number of entries after which a block gets compiled
+	static uint32_t const cHotThreshold = 32;
+	// maximum number of guest instructions in one block
+	static size_t const cMaxBlockLength = 64;
+
+	Jit(std::vector<RiscV::DecodedInstruction> const& decoded, ReadMemoryHelper readMemory, WriteMemoryHelper writeMemory);
+	~Jit();
+	Jit(Jit const&) = delete;
+	Jit& operator=(Jit const&) = delete;
+
+	static bool IsSupported();
+	bool is_ready() const;
+
+	Block Lookup(RiscV::ADDRESS pc) const;
+	// counts one entry into the block at pc, returns true when the block just became hot
+	bool CountEntry(RiscV::ADDRESS pc);
+	// compiles the block at pc, registers that are out of range or not written yet are
+	// left to the interpreter so that its warnings stay intact
+	Block Compile(RiscV::ADDRESS pc, bool const* registerWritten, size_t regCount);
+	bool IsSupportedInstruction(RiscV::DecodedInstruction const& inst) const;
+	// the decoded instructions in [begin, end) changed, restarts their entry counts; false if a
+	// compiled block may contain one of them, the caller then needs a new Jit
+	bool Invalidate(RiscV::ADDRESS begin, RiscV::ADDRESS end);
+
+private:
+	std::vector<RiscV::DecodedInstruction> const& mDecoded;
+	ReadMemoryHelper const mReadMemory;
+	WriteMemoryHelper const mWriteMemory;
+
+	std::vector<Block> mBlocks;
+	std::vector<uint32_t> mCounters;
+
+	uint8_t* mCode = nullptr;
+	size_t mCodeCapacity = 0;
+	size_t mCodeSize = 0;
+
+	// rel32 fields of exits waiting for their target block to be compiled
+	std::unordered_multimap<RiscV::ADDRESS, size_t> mPendingLinks;
+
+	static size_t const cPrologueSize;
+
+	void Link(RiscV::ADDRESS target, uint8_t* blockEntry);
+	bool SetWritable(size_t offset, size_t size, bool writable);
+};
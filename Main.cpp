@@ -1,16 +1,162 @@
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include "BatchMachine.h"
+#include "ConsoleDevice.h"
 #include "VirtualMachine.h"
 #include "VirtualMemory.h"
+#include "SparseMemory.h"
 #include "RiscV.h"
+#include "Scheduler.h"
+#include "TimerDevice.h"
 
+// 64 KiB of plain memory at address 0, or with sparse the whole 32-bit address space committed on first touch
+static bool MapMemory(VirtualMachine& vm, bool sparse, bool hugePages, std::vector<std::unique_ptr<IVirtualDevice>>& devices) {
+	if (!sparse) {
+		devices.emplace_back(new VirtualMemory(RiscV::cMemDataSize * RiscV::cDataIncrement));
+		return vm.RegisterDevice(devices.back().get(), 0x0000, RiscV::cMemDataSize * RiscV::cDataIncrement - 1);
+	}
+	// addresses are signed, the upper half of the address space is a range of its own
+	size_t const half = size_t(1) << 31;
+	SparseMemory* low = new SparseMemory(half, hugePages);
+	devices.emplace_back(low);
+	SparseMemory* high = new SparseMemory(half, hugePages);
+	devices.emplace_back(high);
+	return low->is_ready() && high->is_ready() &&
+		vm.RegisterDevice(low, 0, INT32_MAX) && vm.RegisterDevice(high, INT32_MIN, -1);
+}
+
+// devices beside the memory need addresses above the 64 KiB of plain memory, -m maps all of the address space
+static bool OutsideMemory(RiscV::ADDRESS address, bool sparse) {
+	return !sparse && (address < 0 || address >= static_cast<RiscV::ADDRESS>(RiscV::cMemDataSize * RiscV::cDataIncrement));
+}
+
+// runs the binary once with every execution engine and reports the achieved MIPS
+static int RunBenchmark(std::string const& fileName, size_t numRegisters, bool compressed, bool sparse, bool hugePages) {
+	struct {
+		VirtualMachine::Engine engine;
+		char const* name;
+	} const engines[] = {
+		{ VirtualMachine::Engine::Switch, "switch" },
+		{ VirtualMachine::Engine::Threaded, "threaded" },
+		{ VirtualMachine::Engine::Jit, "jit" },
+	};
+
+	for (auto const& entry : engines) {
+		VirtualMachine RiscVvm(fileName, numRegisters, false, compressed);
+		if (!RiscVvm.is_ready()) {
+			return -1;
+		}
+		std::vector<std::unique_ptr<IVirtualDevice>> memory;
+		if (!MapMemory(RiscVvm, sparse, hugePages, memory)) {
+			return -1;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		RiscVvm.Run(entry.engine);
+		std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+		double mips = RiscVvm.ExecutedInstructions() / seconds.count() / 1e6;
+		std::cout << std::dec << "benchmark " << entry.name << ": " << RiscVvm.ExecutedInstructions() << " instructions in "
+			<< seconds.count() << " s, " << mips << " MIPS" << std::endl;
+
+		for (size_t i = 1; i < static_cast<size_t>(RiscV::Fusion::COUNT); ++i) {
+			RiscV::Fusion const fusion = static_cast<RiscV::Fusion>(i);
+			if (RiscVvm.FusionHits(fusion) != 0) {
+				std::cout << "\tfused " << RiscV::FusionName(fusion) << ": " << RiscVvm.FusionHits(fusion) << std::endl;
+			}
+		}
+	}
+	return 0;
+}
+
+// runs many instances of the binary on all cores and reports every instance and the total throughput
+static int RunParallel(std::string const& fileName, size_t numRegisters, bool compressed, size_t instances, VirtualMachine::Engine engine,
+	bool sparse, bool hugePages, bool mapTimer, RiscV::ADDRESS timerAddress) {
+	Scheduler scheduler(0, 100000, engine, sparse, hugePages);
+	if (mapTimer) {
+		scheduler.MapTimer(timerAddress);
+	}
+	for (size_t i = 0; i < instances; ++i) {
+		if (!scheduler.Add(fileName, numRegisters, compressed)) {
+			return -1;
+		}
+	}
+	scheduler.Run();
+
+	std::vector<Scheduler::Result> const& results = scheduler.Results();
+	std::cout << std::dec;
+	for (size_t i = 0; i < results.size(); ++i) {
+		std::cout << "instance " << i << ": " << results[i].instructions << " instructions in " << results[i].slices
+			<< " slices, finished after " << results[i].seconds << " s" << std::endl;
+	}
+	double mips = scheduler.TotalInstructions() / scheduler.Seconds() / 1e6;
+	std::cout << "scheduler: " << results.size() << " instances on " << scheduler.WorkerCount() << " workers, "
+		<< scheduler.TotalInstructions() << " instructions in " << scheduler.Seconds() << " s, " << mips << " MIPS" << std::endl;
+	return 0;
+}
+
+// runs that many instances of a raw binary in lockstep on one core, lane i starts with i in x10
+static int RunBatch(std::string const& fileName, bool compressed, size_t lanes) {
+	if (ElfFile::IsElf(fileName)) {
+		std::cerr << "Batch mode runs raw instruction images only" << std::endl;
+		return -1;
+	}
+	std::vector<RiscV::INSTRUCTION> image;
+	RiscV::CodeLayout layout;
+	if (!VirtualMachine::LoadImage(fileName, image, layout, compressed)) {
+		return -1;
+	}
+	BatchMachine batch(image, lanes, layout);
+	if (!batch.is_ready()) {
+		return -1;
+	}
+	for (size_t lane = 0; lane < lanes; ++lane) {
+		batch.SetRegister(lane, 10, static_cast<RiscV::WORD>(lane));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	batch.Run();
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+	double mips = batch.ExecutedInstructions() / seconds.count() / 1e6;
+	std::cout << std::dec << "batch: " << lanes << " lanes, " << batch.ExecutedInstructions() << " instructions in "
+		<< batch.Dispatches() << " dispatches, " << seconds.count() << " s, " << mips << " MIPS" << std::endl;
+	return 0;
+}
 
 int main(int argc, char* argv[]) {
 
-	if (argc < 2 || argc > 4) {
+	if (argc < 2 || argc > 30) {
 		std::cerr << "Usage:" << std::endl;
-		std::cerr << "\t" << argv[0] << " <riscv binaryfile> [number of registers] [-v]" << std::endl;
+		std::cerr << "\t" << argv[0] << " <riscv binaryfile> [number of registers] [-c] [-v] [-t | -j | -b] [-p <instances>] [-batch <lanes>] [-m | -M]"
+			<< " [-restore <snapshot>] [-save <snapshot>] [-profile <report> [-symbols <file>]]"
+			<< " [-trace <file> [-sample <n>] [-trace-last <n>]] [-console <address>] [-flush size | time | exit] [-timer <address>]"
+			<< " [-code <address> [-code-size <n>]]" << std::endl;
+		std::cerr << "\t-profile\tcount executions per instruction, branch and device, write a hot block report"
+			<< ", <report>.json and collapsed call stacks <report>.folded when the run ends (uses the switch engine)" << std::endl;
+		std::cerr << "\t-symbols\tfunction names for the profile, one \"<instruction index> <name>\" per line" << std::endl;
+		std::cerr << "\t-trace\twrite a binary trace of every executed instruction, VMRiscVTrace turns it into text (uses the switch engine)" << std::endl;
+		std::cerr << "\t-sample\ttrace only every n-th instruction" << std::endl;
+		std::cerr << "\t-trace-last\tkeep the last n traced instructions in memory, write them only when the program faults" << std::endl;
+		std::cerr << "\t-console\tmap the buffered console device at that address, the print instruction shares its buffer" << std::endl;
+		std::cerr << "\t-flush\twrite console output once 4 KiB are buffered (default), about every 50 ms or only when the program ends" << std::endl;
+		std::cerr << "\t-timer\tmap the timer device at that address, waiting guests skip ahead on a virtual clock" << std::endl;
+		std::cerr << "\t-code\tcopy the instructions into memory at that address, stores to them change the running code" << std::endl;
+		std::cerr << "\t-code-size\tinstructions from that address on that are executable, by default the image" << std::endl;
+		std::cerr << "\tthe binary is a raw instruction image or an ELF32 RISC-V executable" << std::endl;
+		std::cerr << "\t-c\tthe raw image is RV32C code linked at address 0, 16 and 32 bit instructions mixed" << std::endl;
+		std::cerr << "\t-v\tverbose, print every executed instruction" << std::endl;
+		std::cerr << "\t-t\tuse the threaded execution engine" << std::endl;
+		std::cerr << "\t-j\tcompile hot basic blocks to native code (x86-64 Linux only)" << std::endl;
+		std::cerr << "\t-b\tbenchmark, run the binary with every execution engine and report MIPS" << std::endl;
+		std::cerr << "\t-p\trun that many instances of the binary in parallel on all cores" << std::endl;
+		std::cerr << "\t-batch\trun that many instances of a raw binary in lockstep on one core, lane i starts with i in x10" << std::endl;
+		std::cerr << "\t-m\tmap the whole 32-bit address space, memory is committed on first touch" << std::endl;
+		std::cerr << "\t-M\tlike -m, backed by transparent huge pages" << std::endl;
+		std::cerr << "\t-restore\tcontinue from a snapshot instead of starting the binary from the beginning" << std::endl;
+		std::cerr << "\t-save\twrite a snapshot when the run ends, a run that ended at sleep continues behind it" << std::endl;
 		return 1;
 	}
 
@@ -21,6 +167,28 @@ int main(int argc, char* argv[]) {
 	// get and check optional parameters
 	size_t numRegisters = RiscV::cRegCount;
 	bool verboseMode = false;
+	bool compressed = false;
+	bool benchmarkMode = false;
+	bool sparseMemory = false;
+	bool hugePages = false;
+	size_t instances = 0;
+	size_t lanes = 0;
+	std::string restoreFile;
+	std::string saveFile;
+	std::string profileFile;
+	std::string symbolFile;
+	std::string traceFile;
+	uint64_t traceSample = 1;
+	size_t traceLast = 0;
+	bool mapConsole = false;
+	RiscV::ADDRESS consoleAddress = 0;
+	ConsoleDevice::FlushPolicy flushPolicy = ConsoleDevice::FlushPolicy::Size;
+	bool mapTimer = false;
+	RiscV::ADDRESS timerAddress = 0;
+	bool mapCode = false;
+	RiscV::ADDRESS codeAddress = 0;
+	size_t codeSize = 0;
+	VirtualMachine::Engine engine = VirtualMachine::Engine::Switch;
 
 	for (int i = 2; i < argc; i++)
 	{
@@ -28,6 +196,113 @@ int main(int argc, char* argv[]) {
 		if (strcmp(currArg, "-v") == 0) {
 			verboseMode = true;
 		}
+		else if (strcmp(currArg, "-c") == 0) {
+			compressed = true;
+		}
+		else if (strcmp(currArg, "-t") == 0) {
+			engine = VirtualMachine::Engine::Threaded;
+		}
+		else if (strcmp(currArg, "-j") == 0) {
+			engine = VirtualMachine::Engine::Jit;
+		}
+		else if (strcmp(currArg, "-b") == 0) {
+			benchmarkMode = true;
+		}
+		else if (strcmp(currArg, "-m") == 0) {
+			sparseMemory = true;
+		}
+		else if (strcmp(currArg, "-M") == 0) {
+			sparseMemory = true;
+			hugePages = true;
+		}
+		else if (strcmp(currArg, "-restore") == 0 && i + 1 < argc) {
+			restoreFile = argv[++i];
+		}
+		else if (strcmp(currArg, "-save") == 0 && i + 1 < argc) {
+			saveFile = argv[++i];
+		}
+		else if (strcmp(currArg, "-profile") == 0 && i + 1 < argc) {
+			profileFile = argv[++i];
+		}
+		else if (strcmp(currArg, "-symbols") == 0 && i + 1 < argc) {
+			symbolFile = argv[++i];
+		}
+		else if (strcmp(currArg, "-trace") == 0 && i + 1 < argc) {
+			traceFile = argv[++i];
+		}
+		else if ((strcmp(currArg, "-sample") == 0 || strcmp(currArg, "-trace-last") == 0) && i + 1 < argc) {
+			try {
+				size_t const value = std::stoul(argv[++i]);
+				if (strcmp(currArg, "-sample") == 0) traceSample = value;
+				else traceLast = value;
+			}
+			catch (...) {
+				std::cerr << "Trace sample and record counts must be a int number" << std::endl;
+				return 3;
+			}
+		}
+		else if (strcmp(currArg, "-console") == 0 && i + 1 < argc) {
+			try {
+				consoleAddress = static_cast<RiscV::ADDRESS>(std::stoul(argv[++i], nullptr, 0));
+				mapConsole = true;
+			}
+			catch (...) {
+				std::cerr << "Console address must be a int number" << std::endl;
+				return 3;
+			}
+		}
+		else if (strcmp(currArg, "-timer") == 0 && i + 1 < argc) {
+			try {
+				timerAddress = static_cast<RiscV::ADDRESS>(std::stoul(argv[++i], nullptr, 0));
+				mapTimer = true;
+			}
+			catch (...) {
+				std::cerr << "Timer address must be a int number" << std::endl;
+				return 3;
+			}
+		}
+		else if ((strcmp(currArg, "-code") == 0 || strcmp(currArg, "-code-size") == 0) && i + 1 < argc) {
+			try {
+				unsigned long const value = std::stoul(argv[++i], nullptr, 0);
+				if (strcmp(currArg, "-code") == 0) {
+					codeAddress = static_cast<RiscV::ADDRESS>(value);
+					mapCode = true;
+				}
+				else codeSize = value;
+			}
+			catch (...) {
+				std::cerr << "Code address and size must be a int number" << std::endl;
+				return 3;
+			}
+		}
+		else if (strcmp(currArg, "-flush") == 0 && i + 1 < argc) {
+			std::string const policy(argv[++i]);
+			if (policy == "size") flushPolicy = ConsoleDevice::FlushPolicy::Size;
+			else if (policy == "time") flushPolicy = ConsoleDevice::FlushPolicy::Time;
+			else if (policy == "exit") flushPolicy = ConsoleDevice::FlushPolicy::Exit;
+			else {
+				std::cerr << "Flush policy must be size, time or exit" << std::endl;
+				return 3;
+			}
+		}
+		else if (strcmp(currArg, "-p") == 0 && i + 1 < argc) {
+			try {
+				instances = std::stoul(argv[++i]);
+			}
+			catch (...) {
+				std::cerr << "Instance count must be a int number" << std::endl;
+				return 3;
+			}
+		}
+		else if (strcmp(currArg, "-batch") == 0 && i + 1 < argc) {
+			try {
+				lanes = std::stoul(argv[++i]);
+			}
+			catch (...) {
+				std::cerr << "Lane count must be a int number" << std::endl;
+				return 3;
+			}
+		}
 		else {
 			try {
 				numRegisters = std::stoi(currArg);
@@ -43,14 +318,56 @@ int main(int argc, char* argv[]) {
 		}
 	}
 	
+	if ((mapConsole && !OutsideMemory(consoleAddress, sparseMemory)) || (mapTimer && !OutsideMemory(timerAddress, sparseMemory))) {
+		std::cerr << "Device address overlaps the memory" << std::endl;
+		return 3;
+	}
+
+	if (benchmarkMode) {
+		return RunBenchmark(fileName, numRegisters, compressed, sparseMemory, hugePages);
+	}
+	if (instances > 0) {
+		return RunParallel(fileName, numRegisters, compressed, instances, engine, sparseMemory, hugePages, mapTimer, timerAddress);
+	}
+	if (lanes > 0) {
+		return RunBatch(fileName, compressed, lanes);
+	}
 
-	VirtualMachine RiscVvm(std::string(argv[1]), numRegisters, verboseMode);
+	VirtualMachine RiscVvm(std::string(argv[1]), numRegisters, verboseMode, compressed);
 	if (RiscVvm.is_ready()) {
 
-		VirtualMemory* virtualMemory = new VirtualMemory(RiscV::cMemDataSize);
-		RiscVvm.RegisterDevice(virtualMemory, 0x0000, 0x7fff);
-		RiscVvm.Run();
-		delete virtualMemory;
+		std::vector<std::unique_ptr<IVirtualDevice>> memory;
+		if (!MapMemory(RiscVvm, sparseMemory, hugePages, memory)) {
+			return -1;
+		}
+		ConsoleDevice console(flushPolicy, flushPolicy == ConsoleDevice::FlushPolicy::Time ? 50 : 4096);
+		if (mapConsole && !RiscVvm.RegisterDevice(&console, consoleAddress, consoleAddress + static_cast<RiscV::ADDRESS>(ConsoleDevice::cSize) - 1)) {
+			return -1;
+		}
+		RiscVvm.SetConsole(&console);
+		TimerDevice timer(RiscVvm);
+		if (mapTimer && !RiscVvm.RegisterDevice(&timer, timerAddress, timerAddress + static_cast<RiscV::ADDRESS>(TimerDevice::cSize) - 1)) {
+			return -1;
+		}
+		if (mapCode && !RiscVvm.MapInstructions(codeAddress, codeSize)) {
+			return -1;
+		}
+		if (!restoreFile.empty() && !RiscVvm.LoadSnapshot(restoreFile)) {
+			return -1;
+		}
+		if (!profileFile.empty() && !RiscVvm.EnableProfiling(symbolFile)) {
+			return -1;
+		}
+		if (!traceFile.empty() && !RiscVvm.EnableTrace(traceFile, traceSample, traceLast)) {
+			return -1;
+		}
+		RiscVvm.Run(engine);
+		if (!profileFile.empty() && !RiscVvm.WriteProfile(profileFile)) {
+			return -1;
+		}
+		if (!saveFile.empty() && !RiscVvm.SaveSnapshot(saveFile, false)) {
+			return -1;
+		}
 	}
 	else {
 		return -1;
@@ -0,0 +1,86 @@
+#include "MappedMemory.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VM_ELF_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+MappedMemory::MappedMemory(ElfFile const& file, ElfFile::Segment const& segment) : mSize(segment.memorySize)
+{
+#ifdef VM_ELF_MMAP
+	// file mappings start at a host page, the segment starts somewhere inside the first one
+	size_t const hostPage = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t const lead = segment.offset % hostPage;
+	mMappingSize = (lead + mSize + hostPage - 1) / hostPage * hostPage;
+
+	// reserve the whole segment as zero pages, then put the file contents over the front part
+	void* mapping = mmap(nullptr, mMappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) {
+		mMappingSize = 0;
+		return;
+	}
+	mMapping = static_cast<uint8_t*>(mapping);
+	if (segment.fileSize != 0) {
+		int const fd = open(file.FileName().c_str(), O_RDONLY);
+		size_t const fileMappingSize = (lead + segment.fileSize + hostPage - 1) / hostPage * hostPage;
+		if (fd < 0 || mmap(mMapping, fileMappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+			static_cast<off_t>(segment.offset - lead)) == MAP_FAILED) {
+			if (fd >= 0) close(fd);
+			munmap(mMapping, mMappingSize);
+			mMapping = nullptr;
+			mMappingSize = 0;
+			return;
+		}
+		close(fd);
+		// the last file page continues with whatever follows the segment in the file
+		size_t const fileEnd = lead + segment.fileSize;
+		std::memset(mMapping + fileEnd, 0, std::min(fileMappingSize, lead + mSize) - std::min(fileEnd, lead + mSize));
+	}
+	mMemory = mMapping + lead;
+#else
+	mMemory = new uint8_t[mSize]();
+	std::memcpy(mMemory, file.Data(segment), segment.fileSize);
+#endif
+}
+
+MappedMemory::~MappedMemory() {
+#ifdef VM_ELF_MMAP
+	if (mMapping != nullptr) {
+		munmap(mMapping, mMappingSize);
+	}
+#else
+	delete[] mMemory;
+#endif
+}
+
+bool MappedMemory::is_ready() const {
+	return mMemory != nullptr;
+}
+
+RiscV::WORD MappedMemory::Read(RiscV::ADDRESS const& address, size_t size) {
+	uint32_t data = 0;
+	std::memcpy(&data, mMemory + address, size);
+	return static_cast<RiscV::WORD>(data);
+}
+
+void MappedMemory::Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t size) {
+	std::memcpy(mMemory + address, &data, size);
+}
+
+void MappedMemory::ReadBlock(RiscV::ADDRESS const& address, void* buffer, size_t size) {
+	std::memcpy(buffer, mMemory + address, size);
+}
+
+void MappedMemory::WriteBlock(RiscV::ADDRESS const& address, void const* buffer, size_t size) {
+	std::memcpy(mMemory + address, buffer, size);
+}
+
+uint8_t* MappedMemory::HostMemory(size_t& size) {
+	size = mSize;
+	return mMemory;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "IVirtualDevice.h"
+#include "ElfFile.h"
+
+// Plain memory backed by a segment of an ELF file.
+//
+// The file contents are mapped copy-on-write, pages are only read from the file when the guest
+// touches them and only copied once it writes to them. The zero-filled tail (.bss) is anonymous
+// memory that the host commits page by page on first use. Without mmap the segment is copied.
+class MappedMemory : public IVirtualDevice
+{
+public:
+	MappedMemory(ElfFile const& file, ElfFile::Segment const& segment);
+	~MappedMemory();
+	MappedMemory(MappedMemory const&) = delete;
+	MappedMemory& operator=(MappedMemory const&) = delete;
+
+	bool is_ready() const;
+	virtual RiscV::WORD Read(RiscV::ADDRESS const& address, size_t size);
+	virtual void Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t size);
+	virtual void ReadBlock(RiscV::ADDRESS const& address, void* buffer, size_t size);
+	virtual void WriteBlock(RiscV::ADDRESS const& address, void const* buffer, size_t size);
+	virtual uint8_t* HostMemory(size_t& size);
+private:
+	uint8_t* mMapping = nullptr;
+	size_t mMappingSize = 0;
+	uint8_t* mMemory = nullptr;
+	size_t const mSize;
+};
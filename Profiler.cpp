@@ -0,0 +1,337 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using RiscV::Handler;
+
+namespace {
+
+	// pc in the same form as the warnings of the virtual machine
+	std::string Pc(size_t pc) {
+		std::ostringstream oss;
+		oss << "0x" << std::setfill('0') << std::setw(4) << std::hex << pc;
+		return oss.str();
+	}
+
+	std::string Percent(uint64_t part, uint64_t total) {
+		std::ostringstream oss;
+		oss << std::fixed << std::setprecision(1) << (total != 0 ? 100.0 * part / total : 0.0) << "%";
+		return oss.str();
+	}
+
+	bool IsBranch(Handler handler) {
+		return handler >= Handler::BEQ && handler <= Handler::BGEU;
+	}
+
+	// x1 (ra) and x5 (t0) hold return addresses by convention
+	bool IsLink(RiscV::BYTE reg) {
+		return reg == 1 || reg == 5;
+	}
+}
+
+Profiler::Profiler(size_t instructionCount) : mExecuted(instructionCount, 0), mTaken(instructionCount, 0)
+{
+}
+
+void Profiler::Count(RiscV::ADDRESS pc, RiscV::DecodedInstruction const& inst, RiscV::WORD const* registers) {
+	++mExecuted[pc];
+	if (mCallNodes.empty()) {
+		// the first instruction executed is the root of all call paths
+		mCallNodes.push_back(CallNode{ pc, 0, 1, 0, {} });
+	}
+	++mCallNodes[mCurrent].self;
+
+	bool read;
+	switch (inst.handler) {
+	case Handler::LB: case Handler::LH: case Handler::LW: case Handler::LBU: case Handler::LHU:
+		read = true;
+		break;
+	case Handler::SB: case Handler::SH: case Handler::SW:
+		read = false;
+		break;
+	default:
+		return;
+	}
+	uint32_t const address = static_cast<uint32_t>(registers[inst.rs1]) + static_cast<uint32_t>(inst.imm);
+	size_t const page = address >> RiscV::cPageBits;
+	if (page >= mPages.size()) {
+		mPages.resize(page + 1);
+	}
+	++(read ? mPages[page].reads : mPages[page].writes);
+}
+
+void Profiler::CountJump(RiscV::ADDRESS pc, RiscV::DecodedInstruction const& inst, RiscV::ADDRESS target) {
+	++mTaken[pc];
+
+	// return address stack hints of the RISC-V specification
+	if (inst.handler == Handler::JAL) {
+		if (IsLink(inst.rd)) Call(target, pc + 1);
+	}
+	else if (inst.handler == Handler::JALR) {
+		bool const linkRd = IsLink(inst.rd);
+		bool const linkRs1 = IsLink(inst.rs1);
+		if (linkRs1 && (!linkRd || inst.rd != inst.rs1)) Return(target);
+		if (linkRd) Call(target, pc + 1);
+	}
+	else if (inst.handler == Handler::JR) {
+		if (IsLink(inst.rs1)) Return(target);
+	}
+}
+
+void Profiler::Call(RiscV::ADDRESS target, RiscV::ADDRESS returnPc) {
+	if (mCallNodes.empty()) return;
+	auto child = mCallNodes[mCurrent].children.find(target);
+	if (child == mCallNodes[mCurrent].children.end()) {
+		mCallNodes.push_back(CallNode{ target, mCurrent, 0, 0, {} });
+		child = mCallNodes[mCurrent].children.insert(std::make_pair(target, mCallNodes.size() - 1)).first;
+	}
+	mCurrent = child->second;
+	++mCallNodes[mCurrent].calls;
+	mReturns.push_back(returnPc);
+}
+
+void Profiler::Return(RiscV::ADDRESS target) {
+	// unwinds to the innermost call that returns there, anything else is a plain jump
+	for (size_t depth = mReturns.size(); depth > 0; --depth) {
+		if (mReturns[depth - 1] != target) continue;
+		while (mReturns.size() >= depth) {
+			mReturns.pop_back();
+			mCurrent = mCallNodes[mCurrent].parent;
+		}
+		return;
+	}
+}
+
+bool Profiler::LoadSymbols(std::string const& fileName) {
+	std::ifstream ifs(fileName);
+	if (!ifs.is_open()) {
+		std::cerr << "Could not open file: " << fileName << std::endl;
+		return false;
+	}
+	std::string address;
+	std::string name;
+	while (ifs >> address >> name) {
+		try {
+			mSymbols[static_cast<RiscV::ADDRESS>(std::stoul(address, nullptr, 0))] = name;
+		}
+		catch (...) {
+			std::cerr << "Invalid symbol address " << address << " in " << fileName << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string Profiler::FunctionName(RiscV::ADDRESS function) const {
+	auto symbol = mSymbols.upper_bound(function);
+	if (symbol == mSymbols.begin()) return Pc(function);
+	--symbol;
+	return function == symbol->first ? symbol->second : symbol->second + "+" + std::to_string(function - symbol->first);
+}
+
+std::vector<Profiler::Function> Profiler::Functions() const {
+	// children are always created after their parent
+	std::vector<uint64_t> total(mCallNodes.size(), 0);
+	for (size_t node = mCallNodes.size(); node-- > 0;) {
+		total[node] += mCallNodes[node].self;
+		if (node != 0) total[mCallNodes[node].parent] += total[node];
+	}
+
+	std::map<RiscV::ADDRESS, Function> functions;
+	for (size_t node = 0; node < mCallNodes.size(); ++node) {
+		CallNode const& callNode = mCallNodes[node];
+		Function& function = functions[callNode.function];
+		function.function = callNode.function;
+		function.calls += callNode.calls;
+		function.exclusive += callNode.self;
+
+		// recursive calls are already part of the outer call
+		bool recursive = false;
+		for (size_t outer = node; outer != 0 && !recursive;) {
+			outer = mCallNodes[outer].parent;
+			recursive = mCallNodes[outer].function == callNode.function;
+		}
+		if (!recursive) function.inclusive += total[node];
+	}
+
+	std::vector<Function> result;
+	for (auto const& entry : functions) result.push_back(entry.second);
+	std::sort(result.begin(), result.end(), [](Function const& a, Function const& b) { return a.inclusive > b.inclusive; });
+	return result;
+}
+
+bool Profiler::WriteCollapsedStacks(std::string const& fileName) const {
+	std::ofstream ofs(fileName, std::ios::trunc);
+	if (!ofs.is_open()) {
+		std::cerr << "Could not open file: " << fileName << std::endl;
+		return false;
+	}
+	for (size_t node = 0; node < mCallNodes.size(); ++node) {
+		if (mCallNodes[node].self == 0) continue;
+		std::string path = FunctionName(mCallNodes[node].function);
+		for (size_t outer = node; outer != 0;) {
+			outer = mCallNodes[outer].parent;
+			path = FunctionName(mCallNodes[outer].function) + ";" + path;
+		}
+		ofs << path << " " << mCallNodes[node].self << "\n";
+	}
+	return static_cast<bool>(ofs);
+}
+
+std::vector<Profiler::Block> Profiler::Blocks(std::vector<RiscV::DecodedInstruction> const& decoded) const {
+	size_t const count = decoded.size();
+	std::vector<bool> leader(count + 1, false);
+	leader[0] = true;
+	leader[count] = true;
+	for (size_t i = 0; i < count; ++i) {
+		Handler const handler = decoded[i].handler;
+		if (IsBranch(handler) || handler == Handler::JAL) {
+			size_t const target = static_cast<size_t>(decoded[i].imm);
+			if (decoded[i].imm >= 0 && target < count) leader[target] = true;
+		}
+		if (RiscV::EndsBasicBlock(handler)) leader[i + 1] = true;
+		// jalr targets are only known at run time, they show as a change of the execution count
+		if (i > 0 && mExecuted[i] != mExecuted[i - 1]) leader[i] = true;
+	}
+
+	std::vector<Block> blocks;
+	for (size_t begin = 0; begin < count;) {
+		Block block{ begin, begin + 1, mExecuted[begin], mExecuted[begin] };
+		while (!leader[block.end]) {
+			block.instructions += mExecuted[block.end++];
+		}
+		if (block.instructions != 0) blocks.push_back(block);
+		begin = block.end;
+	}
+	std::sort(blocks.begin(), blocks.end(), [](Block const& a, Block const& b) { return a.instructions > b.instructions; });
+	return blocks;
+}
+
+bool Profiler::Write(std::string const& fileName, RiscV::INSTRUCTION const* instructions,
+	std::vector<RiscV::DecodedInstruction> const& decoded, std::vector<AddressRange> const& devices) const {
+	std::ofstream text(fileName, std::ios::trunc);
+	std::ofstream json(fileName + ".json", std::ios::trunc);
+	if (!text.is_open() || !json.is_open()) {
+		std::cerr << "Could not open file: " << fileName << std::endl;
+		return false;
+	}
+
+	uint64_t total = 0;
+	for (uint64_t executed : mExecuted) total += executed;
+
+	// executions per decoded operation, named after the first instruction that has it
+	struct OpcodeClass {
+		uint64_t executed = 0;
+		size_t example = 0;
+	};
+	std::vector<OpcodeClass> classes(static_cast<size_t>(Handler::COUNT));
+	for (size_t pc = 0; pc < decoded.size(); ++pc) {
+		OpcodeClass& opcodeClass = classes[static_cast<size_t>(decoded[pc].handler)];
+		if (opcodeClass.executed == 0) opcodeClass.example = pc;
+		opcodeClass.executed += mExecuted[pc];
+	}
+	std::vector<size_t> order;
+	for (size_t i = 0; i < classes.size(); ++i) {
+		if (classes[i].executed != 0) order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&classes](size_t a, size_t b) { return classes[a].executed > classes[b].executed; });
+
+	text << "profile: " << total << " instructions" << std::endl << std::endl;
+	text << "opcode classes:" << std::endl;
+	json << "{\n  \"instructions\": " << total << ",\n  \"opcodes\": [";
+	for (size_t i = 0; i < order.size(); ++i) {
+		OpcodeClass const& opcodeClass = classes[order[i]];
+		RiscV::INSTRUCTION const instruction = instructions[opcodeClass.example];
+		char mnemonic[RiscV::cDisassemblyLength];
+		RiscV::Disassemble(instruction, mnemonic, sizeof(mnemonic));
+		mnemonic[std::strcspn(mnemonic, " ")] = 0;
+		int const opcode = RiscV::MaskOpcode(instruction);
+		int const funct3 = RiscV::MaskFunct3(instruction);
+		text << "  " << std::setw(14) << opcodeClass.executed << "  " << std::setw(6) << Percent(opcodeClass.executed, total)
+			<< "  " << std::setw(8) << std::left << mnemonic << std::right << " opcode 0x" << std::hex << std::setw(2) << std::setfill('0')
+			<< opcode << std::setfill(' ') << std::dec << " funct3 " << funct3 << std::endl;
+		json << (i == 0 ? "\n" : ",\n") << "    { \"mnemonic\": \"" << mnemonic << "\", \"opcode\": " << opcode
+			<< ", \"funct3\": " << funct3 << ", \"count\": " << opcodeClass.executed << " }";
+	}
+	json << "\n  ],\n  \"blocks\": [";
+
+	std::vector<Block> const blocks = Blocks(decoded);
+	text << std::endl << "hot basic blocks:" << std::endl;
+	for (size_t i = 0; i < blocks.size() && i < cHotBlocks; ++i) {
+		Block const& block = blocks[i];
+		text << "block " << Pc(block.begin) << "-" << Pc(block.end - 1) << ": " << block.entries << " entries, "
+			<< block.instructions << " instructions (" << Percent(block.instructions, total) << ")" << std::endl;
+		json << (i == 0 ? "\n" : ",\n") << "    { \"begin\": " << block.begin << ", \"end\": " << block.end
+			<< ", \"entries\": " << block.entries << ", \"instructions\": " << block.instructions << ", \"code\": [";
+		for (size_t pc = block.begin; pc < block.end; ++pc) {
+			char disassembly[RiscV::cDisassemblyLength];
+			RiscV::Disassemble(instructions[pc], disassembly, sizeof(disassembly));
+			text << "  " << Pc(pc) << "  " << std::setw(14) << mExecuted[pc] << "  " << disassembly;
+			json << (pc == block.begin ? "\n" : ",\n") << "      { \"pc\": " << pc << ", \"count\": " << mExecuted[pc]
+				<< ", \"text\": \"" << disassembly << "\"";
+			if (IsBranch(decoded[pc].handler)) {
+				text << "    ; taken " << mTaken[pc] << " (" << Percent(mTaken[pc], mExecuted[pc]) << ")";
+				json << ", \"taken\": " << mTaken[pc];
+			}
+			text << std::endl;
+			json << " }";
+		}
+		json << "\n    ] }";
+	}
+
+	std::vector<Function> const functions = Functions();
+	text << std::endl << "functions (inclusive, exclusive instructions, calls):" << std::endl;
+	json << "\n  ],\n  \"functions\": [";
+	for (size_t i = 0; i < functions.size(); ++i) {
+		Function const& function = functions[i];
+		std::string const name = FunctionName(function.function);
+		text << "  " << std::setw(14) << function.inclusive << "  " << std::setw(6) << Percent(function.inclusive, total)
+			<< "  " << std::setw(14) << function.exclusive << "  " << std::setw(10) << function.calls
+			<< "  " << name << " (" << Pc(function.function) << ")" << std::endl;
+		json << (i == 0 ? "\n" : ",\n") << "    { \"name\": \"" << name << "\", \"pc\": " << function.function
+			<< ", \"inclusive\": " << function.inclusive << ", \"exclusive\": " << function.exclusive
+			<< ", \"calls\": " << function.calls << " }";
+	}
+
+	// accesses are attributed to the device holding the start of their page
+	std::vector<PageAccesses> perDevice(devices.size() + 1);
+	for (size_t page = 0; page < mPages.size(); ++page) {
+		RiscV::ADDRESS const address = static_cast<RiscV::ADDRESS>(static_cast<uint32_t>(page << RiscV::cPageBits));
+		size_t device = 0;
+		while (device < devices.size() && (address < devices[device].Begin() || address > devices[device].End())) ++device;
+		perDevice[device].reads += mPages[page].reads;
+		perDevice[device].writes += mPages[page].writes;
+	}
+	text << std::endl << "memory accesses per device:" << std::endl;
+	json << "\n  ],\n  \"devices\": [";
+	bool first = true;
+	for (size_t device = 0; device < perDevice.size(); ++device) {
+		PageAccesses const& accesses = perDevice[device];
+		if (accesses.reads == 0 && accesses.writes == 0) continue;
+		if (device < devices.size()) {
+			text << "  0x" << std::hex << std::setfill('0') << std::setw(8) << static_cast<uint32_t>(devices[device].Begin()) << "-0x"
+				<< std::setw(8) << static_cast<uint32_t>(devices[device].End()) << std::setfill(' ') << std::dec;
+			json << (first ? "\n" : ",\n") << "    { \"begin\": " << static_cast<uint32_t>(devices[device].Begin())
+				<< ", \"end\": " << static_cast<uint32_t>(devices[device].End());
+		}
+		else {
+			text << "  no device             ";
+			json << (first ? "\n" : ",\n") << "    { \"begin\": null, \"end\": null";
+		}
+		text << ": " << accesses.reads << " reads, " << accesses.writes << " writes" << std::endl;
+		json << ", \"reads\": " << accesses.reads << ", \"writes\": " << accesses.writes << " }";
+		first = false;
+	}
+	json << "\n  ]\n}\n";
+
+	if (!text || !json || !WriteCollapsedStacks(fileName + ".folded")) {
+		std::cerr << "Could not write profile: " << fileName << std::endl;
+		return false;
+	}
+	return true;
+}
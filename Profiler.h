@@ -0,0 +1,86 @@
+#pragma once
+#include "RiscV.h"
+#include "AddressRange.h"
+#include "Decoder.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Execution counts of one virtual machine run, collected by the switch engine.
+//
+// Only what cannot be derived later is counted while running: executions per pc, taken branches
+// per pc and memory accesses per page. Opcode classes, basic blocks and per device numbers are
+// computed from those when the report is written.
+//
+// A shadow call stack follows the link register conventions of jal/jalr (x1 or x5 as link register)
+// and counts every instruction for the current call path. Functions are named after the symbol
+// at or before their entry pc.
+class Profiler
+{
+public:
+	explicit Profiler(size_t instructionCount);
+
+	// before the instruction at pc executes, registers still hold its operands
+	void Count(RiscV::ADDRESS pc, RiscV::DecodedInstruction const& inst, RiscV::WORD const* registers);
+	// after a branch or jump at pc changed the control flow to target
+	void CountJump(RiscV::ADDRESS pc, RiscV::DecodedInstruction const& inst, RiscV::ADDRESS target);
+
+	// one symbol per line: instruction index (decimal or 0x hex) and name
+	bool LoadSymbols(std::string const& fileName);
+
+	// writes the text report to fileName, the same numbers as JSON to fileName + ".json" and the
+	// call paths as collapsed stacks for flamegraph tools to fileName + ".folded",
+	// devices are the ranges the memory accesses are attributed to
+	bool Write(std::string const& fileName, RiscV::INSTRUCTION const* instructions,
+		std::vector<RiscV::DecodedInstruction> const& decoded, std::vector<AddressRange> const& devices) const;
+
+private:
+	struct PageAccesses {
+		uint64_t reads = 0;
+		uint64_t writes = 0;
+	};
+	struct Block {
+		size_t begin;
+		size_t end;			// exclusive
+		uint64_t entries;	// executions of the first instruction
+		uint64_t instructions;
+	};
+
+	// one node per distinct call path
+	struct CallNode {
+		RiscV::ADDRESS function;	// entry pc
+		size_t parent;
+		uint64_t calls;
+		uint64_t self;				// instructions executed with exactly this call path
+		std::map<RiscV::ADDRESS, size_t> children;
+	};
+	struct Function {
+		RiscV::ADDRESS function;
+		uint64_t calls = 0;
+		uint64_t inclusive = 0;
+		uint64_t exclusive = 0;
+	};
+
+	// number of blocks in the report
+	static size_t const cHotBlocks = 20;
+
+	std::vector<uint64_t> mExecuted;
+	std::vector<uint64_t> mTaken;
+	std::vector<PageAccesses> mPages;
+
+	std::vector<CallNode> mCallNodes;
+	size_t mCurrent = 0;
+	// return pc of every active call
+	std::vector<RiscV::ADDRESS> mReturns;
+	std::map<RiscV::ADDRESS, std::string> mSymbols;
+
+	void Call(RiscV::ADDRESS target, RiscV::ADDRESS returnPc);
+	void Return(RiscV::ADDRESS target);
+	std::string FunctionName(RiscV::ADDRESS function) const;
+
+	std::vector<Block> Blocks(std::vector<RiscV::DecodedInstruction> const& decoded) const;
+	std::vector<Function> Functions() const;
+	bool WriteCollapsedStacks(std::string const& fileName) const;
+};
@@ -0,0 +1,133 @@
+#include "RegisterCheck.h"
+
+namespace {
+
+    // bit n set: register n holds a written value
+    typedef uint32_t RegisterSet;
+
+    RegisterSet Bit(int reg)
+    {
+        return reg >= 0 ? RegisterSet(1) << reg : 0;
+    }
+}
+
+RiscV::RegisterCheck RiscV::CheckRegisters(std::vector<DecodedInstruction> const& decoded, ADDRESS entry,
+    bool const* written, size_t regCount)
+{
+    RegisterCheck result;
+    std::vector<RegisterFinding>& findings = result.findings;
+    size_t const size = decoded.size();
+    result.indirectTargets.assign(size, 0);
+    if (entry < 0 || static_cast<size_t>(entry) >= size) {
+        return result;
+    }
+
+    // return addresses and pc relative jumps
+    std::vector<size_t> returns;
+    for (size_t pc = 0; pc < size; ++pc) {
+        Handler const handler = decoded[pc].handler;
+        if ((handler == Handler::JAL || handler == Handler::JALR) && pc + 1 < size) {
+            returns.push_back(pc + 1);
+        }
+        if (handler == Handler::JALR && pc > 0 && MatchFusion(decoded[pc - 1], decoded[pc]) == Fusion::AUIPC_JALR) {
+            int64_t const target = static_cast<int64_t>(pc - 1) + decoded[pc - 1].imm + decoded[pc].imm;
+            if (target >= 0 && static_cast<size_t>(target) < size) returns.push_back(static_cast<size_t>(target));
+        }
+    }
+
+    RegisterSet initial = 0;
+    for (size_t i = 0; i < cRegCount; ++i) {
+        if (written[i]) initial |= RegisterSet(1) << i;
+    }
+
+    std::vector<RegisterSet> in(size, 0);
+    std::vector<uint8_t> reached(size, 0);
+    std::vector<uint8_t> queued(size, 0);
+    std::vector<size_t> worklist;
+
+    // lowers the state at target to what is written on every path seen so far
+    auto merge = [&](size_t target, RegisterSet state) {
+        if (!reached[target]) {
+            reached[target] = 1;
+            in[target] = state;
+        }
+        else if ((in[target] & state) != in[target]) {
+            in[target] &= state;
+        }
+        else {
+            return;
+        }
+        if (!queued[target]) {
+            queued[target] = 1;
+            worklist.push_back(target);
+        }
+    };
+
+    bool jalrReached = false;
+    RegisterSet jalrState = 0;
+    merge(static_cast<size_t>(entry), initial);
+    while (!worklist.empty()) {
+        size_t const pc = worklist.back();
+        worklist.pop_back();
+        queued[pc] = 0;
+
+        DecodedInstruction const& inst = decoded[pc];
+        RegisterSet out = in[pc];
+        if (inst.handler != Handler::DIV) {
+            out |= Bit(UsedRegisters(inst).rd);
+        }
+
+        switch (inst.handler) {
+        case Handler::SLEEP:
+            break;
+        case Handler::JAL:
+            if (inst.imm >= 0 && static_cast<size_t>(inst.imm) < size) merge(static_cast<size_t>(inst.imm), out);
+            break;
+        case Handler::JALR:
+        case Handler::JR:
+            if (!jalrReached || (jalrState & out) != jalrState) {
+                jalrState = jalrReached ? (jalrState & out) : out;
+                jalrReached = true;
+                for (size_t target : returns) {
+                    merge(target, jalrState);
+                }
+            }
+            break;
+        case Handler::BEQ:
+        case Handler::BNEQ:
+        case Handler::BLT:
+        case Handler::BGE:
+        case Handler::BLTU:
+        case Handler::BGEU:
+            if (inst.imm >= 0 && static_cast<size_t>(inst.imm) < size) merge(static_cast<size_t>(inst.imm), out);
+            if (pc + 1 < size) merge(pc + 1, out);
+            break;
+        default:
+            if (pc + 1 < size) merge(pc + 1, out);
+            break;
+        }
+    }
+
+    for (size_t pc = 0; pc < size; ++pc) {
+        if (!reached[pc]) continue;
+        // every register the analysis counts on here is also written when coming from a jalr
+        result.indirectTargets[pc] = jalrReached && (in[pc] & ~jalrState) == 0;
+
+        RegisterUse const use = UsedRegisters(decoded[pc]);
+        int const reads[2] = { use.rs1, use.rs2 };
+        for (int i = 0; i < 2; ++i) {
+            int const reg = reads[i];
+            if (reg < 0 || (i == 1 && reg == use.rs1)) continue;
+            if (static_cast<size_t>(reg) >= regCount) {
+                findings.push_back(RegisterFinding{ static_cast<ADDRESS>(pc), reg, true });
+            }
+            else if ((in[pc] & Bit(reg)) == 0) {
+                findings.push_back(RegisterFinding{ static_cast<ADDRESS>(pc), reg, false });
+            }
+        }
+        if (use.rd >= 0 && static_cast<size_t>(use.rd) >= regCount && use.rd != use.rs1 && use.rd != use.rs2) {
+            findings.push_back(RegisterFinding{ static_cast<ADDRESS>(pc), use.rd, true });
+        }
+    }
+    return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "RiscV.h"
+#include "Decoder.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace RiscV {
+
+    // a register access that may warn at run time
+    struct RegisterFinding {
+        ADDRESS pc;
+        int reg;
+        bool outOfRange;    // index >= register count, otherwise a read that may come before any write
+    };
+
+    struct RegisterCheck {
+        std::vector<RegisterFinding> findings;
+        // 1 where a jalr may land without invalidating the result; a jalr that lands anywhere
+        // else has to turn the run time checks back on
+        std::vector<uint8_t> indirectTargets;
+    };
+
+    // Forward dataflow over the decoded image, starting at entry with the registers in written.
+    // Every instruction gets the set of registers that are written on every path to it (intersection
+    // over its predecessors). jalr and jr are assumed to return behind a jal or jalr, or to continue at
+    // the target of an auipc+jalr pair; the state after every reachable one flows into all of those.
+    // div leaves rd alone when dividing by zero and does not count as a write.
+    // No findings means the register checks of the interpreter can never fire.
+    RegisterCheck CheckRegisters(std::vector<DecodedInstruction> const& decoded, ADDRESS entry,
+        bool const* written, size_t regCount);
+}
@@ -1,203 +1,207 @@
 #include "RiscV.h"
 
+#include <algorithm>
 #include <string>
-#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    // mnemonics by funct3, nullptr where the combination does not exist
+    char const* const cRegister[8] = { "add", "sll", "slt", "sltu", "xor", "srl", "or", "and" };
+    char const* const cRegisterAlternate[8] = { "sub", nullptr, nullptr, nullptr, nullptr, "sra", nullptr, nullptr };    // funct7 0100000
+    char const* const cMultiply[8] = { "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu" };               // funct7 0000001
+    char const* const cImmediate[8] = { "addi", nullptr, "slti", "sltiu", "xori", nullptr, "ori", "andi" };
+    char const* const cLoad[8] = { "lb", "lh", "lw", nullptr, "lbu", "lhu", nullptr, nullptr };
+    char const* const cStore[8] = { "sb", "sh", "sw", nullptr, nullptr, nullptr, nullptr, nullptr };
+    char const* const cBranch[8] = { "beq", "bneq", nullptr, nullptr, "blt", "bge", "bltu", "bgeu" };
+    char const* const cPrint[8] = { "pint", "pstr", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+    char const* const cCsr[8] = { nullptr, "csrrw", "csrrs", "csrrc", nullptr, "csrrwi", "csrrsi", "csrrci" };
+
+    // appends to a fixed buffer, counts what did not fit so that the caller learns the full length
+    class LineWriter {
+    public:
+        LineWriter(char* buffer, size_t size) : mBuffer(buffer), mSize(size) {}
+
+        void Text(char const* text) {
+            while (*text != 0) Char(*text++);
+        }
+        void Number(int64_t value) {
+            char digits[24];
+            size_t count = 0;
+            uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+            do {
+                digits[count++] = static_cast<char>('0' + magnitude % 10);
+                magnitude /= 10;
+            } while (magnitude != 0);
+            if (value < 0) Char('-');
+            while (count > 0) Char(digits[--count]);
+        }
+        // mnemonic and comma separated operands
+        void Line(char const* mnemonic, int64_t first) {
+            Text(mnemonic != nullptr ? mnemonic : "unknown");
+            Char(' ');
+            Number(first);
+        }
+        void Line(char const* mnemonic, int64_t first, int64_t second) {
+            Line(mnemonic, first);
+            Char(',');
+            Number(second);
+        }
+        void Line(char const* mnemonic, int64_t first, int64_t second, int64_t third) {
+            Line(mnemonic, first, second);
+            Char(',');
+            Number(third);
+        }
+        size_t Finish() {
+            if (mSize != 0) mBuffer[mLength < mSize ? mLength : mSize - 1] = 0;
+            return mLength;
+        }
 
-void RiscV::Disassemble(WORD machinecode)
+    private:
+        char* const mBuffer;
+        size_t const mSize;
+        size_t mLength = 0;
+
+        void Char(char c) {
+            if (mLength + 1 < mSize) mBuffer[mLength] = c;
+            ++mLength;
+        }
+    };
+}
+
+std::string RiscV::Disassemble(WORD machinecode)
 {
-    WORD opcode = (machinecode & 0x7F);
-    //char instruction[10] = "";
-    std::string instruction = "";
+    char line[cDisassemblyLength];
+    Disassemble(machinecode, line, sizeof(line));
+    return line;
+}
 
+size_t RiscV::Disassemble(INSTRUCTION machinecode, char* buffer, size_t size)
+{
+    uint32_t const code = static_cast<uint32_t>(machinecode);
+    uint32_t const opcode = code & 0x7F;
+    uint32_t const rd = (code >> 7) & 0x1F;
+    uint32_t const f3 = (code >> 12) & 0x7;
+    uint32_t const rs1 = (code >> 15) & 0x1F;
+    uint32_t const rs2 = (code >> 20) & 0x1F;
+    uint32_t const f7 = code >> 25;
+    WORD const imm12 = machinecode >> 20;   // sign-extended I-type immediate
+
+    LineWriter line(buffer, size);
     switch (opcode)
     {
     case RType::OP_TYPE_REGISTER: {
-        WORD rd = (machinecode & 0xf80) >> 7;
-        WORD f3 = (machinecode & 0x7000) >> 12;
-        WORD rs1 = (machinecode & 0xf8000) >> 15;
-        WORD rs2 = (machinecode & 0x1f00000) >> 20;
-        WORD f7 = (machinecode & 0xfe000000) >> 25;
-        //wprintf(L"disassembled R-Type instruction:\n");
-
-        if (f3 == RType::FUNC3_ADD && f7 == RType::FUNC7_ADD) instruction = "add"; //strcpy(instruction, "add");
-        else if (f3 == RType::FUNC3_SUB && f7 == RType::FUNC7_SUB) instruction = "sub"; //strcpy(instruction, "sub");
-        else if (f3 == RType::FUNC3_SLL && f7 == RType::FUNC7_SLL) instruction = "sll"; //strcpy(instruction, "sll");
-        else if (f3 == RType::FUNC3_SLT && f7 == RType::FUNC7_SLT) instruction = "slt"; //strcpy(instruction, "slt");
-        else if (f3 == RType::FUNC3_SLTU && f7 == RType::FUNC7_SLTU) instruction = "sltu"; //strcpy(instruction, "sltu");
-        else if (f3 == RType::FUNC3_XOR && f7 == RType::FUNC7_XOR) instruction = "xor"; //strcpy(instruction, "xor");
-        else if (f3 == RType::FUNC3_SRL && f7 == RType::FUNC7_SRL) instruction = "srl"; //strcpy(instruction, "srl");
-        else if (f3 == RType::FUNC3_SRA && f7 == RType::FUNC7_SRA) instruction = "sra"; //strcpy(instruction, "sra");
-        else if (f3 == RType::FUNC3_OR && f7 == RType::FUNC7_OR) instruction = "or"; //strcpy(instruction, "or");
-        else if (f3 == RType::FUNC3_AND && f7 == RType::FUNC7_AND) instruction = "and"; //strcpy(instruction, "and");
-        else if (f3 == RType::FUNC3_DIV && f7 == RType::FUNC7_DIV) instruction = "div"; //strcpy(instruction, "div");
-        else if (f3 == RType::FUNC3_MUL && f7 == RType::FUNC7_MUL) instruction = "mul"; //strcpy(instruction, "mul");
-        else if (f3 == RType::FUNC3_MULH && f7 == RType::FUNC7_MULH) instruction = "mulh"; //strcpy(instruction, "mulh");
-        else instruction = "unknown"; //strcpy(instruction, "unknown");
-
-        wprintf(L"%S %d,%d,%d\n", instruction.c_str(), rd, rs1, rs2);
-        disasm << instruction << " " << rd << "," << rs1 << "," << rs2 << std::endl;
+        char const* mnemonic = nullptr;
+        if (f7 == RType::FUNC7_ADD) mnemonic = cRegister[f3];
+        else if (f7 == RType::FUNC7_SUB) mnemonic = cRegisterAlternate[f3];
+        else if (f7 == RType::FUNC7_MUL) mnemonic = cMultiply[f3];
+        line.Line(mnemonic, rd, rs1, rs2);
         break;
     }
 
     case IType::OP_TYPE_IMMEDIATE: {
-        WORD rd = (machinecode & 0xf80) >> 7;
-        WORD f3 = (machinecode & 0x7000) >> 12;
-        WORD rs1 = (machinecode & 0xf8000) >> 15;
-        //wprintf(L"disassembled I-Type IMM instruction:\n");
-
-        if (f3 == IType::FUNC3_SLLI || f3 == IType::FUNC3_SRLI || f3 == IType::FUNC3_SRAI) {
-            WORD f6 = (machinecode & 0xfc000000) >> 26;
-            WORD shamt = (machinecode & 0x3f00000) >> 20;
-
-            if (f3 == IType::FUNC3_SLLI && f6 == IType::FUNC6_SLLI) instruction = "slli";
-            else if (f3 == IType::FUNC3_SRLI && f6 == IType::FUNC6_SRLI) instruction = "srli";
-            else if (f3 == IType::FUNC3_SRAI && f6 == IType::FUNC6_SRAI) instruction = "srai";
-
-            wprintf(L"%S %d,%d,%d\n", instruction.c_str(), rd, rs1, shamt);
-            disasm << instruction << " " << rd << "," << rs1 << "," << shamt << std::endl;
+        if (f3 == IType::FUNC3_SLLI || f3 == IType::FUNC3_SRLI) {
+            uint32_t const f6 = code >> 26;
+            uint32_t const shamt = (code >> 20) & 0x3F;
+            char const* mnemonic = nullptr;
+            if (f3 == IType::FUNC3_SLLI && f6 == IType::FUNC6_SLLI) mnemonic = "slli";
+            else if (f3 == IType::FUNC3_SRLI && f6 == IType::FUNC6_SRLI) mnemonic = "srli";
+            else if (f3 == IType::FUNC3_SRAI && f6 == IType::FUNC6_SRAI) mnemonic = "srai";
+            line.Line(mnemonic, rd, rs1, shamt);
         }
         else {
-            WORD imm12 = (machinecode & 0xfff00000) >> 20;
-
-            if (f3 == IType::FUNC3_ADDI) instruction = "addi"; //strcpy(instruction, "addi");
-            else if (f3 == IType::FUNC3_SLTI) instruction = "slti"; //strcpy(instruction, "slti");
-            else if (f3 == IType::FUNC3_SLTIU) instruction = "sltiu"; //strcpy(instruction, "sltiu");
-            else if (f3 == IType::FUNC3_XORI) instruction = "xori"; //strcpy(instruction, "xori");
-            else if (f3 == IType::FUNC3_ORI) instruction = "ori"; //strcpy(instruction, "ori");
-            else if (f3 == IType::FUNC3_ANDI) instruction = "andi"; //strcpy(instruction, "andi");
-            else instruction = "unknown"; //strcpy(instruction, "unknown");
-
-            wprintf(L"%S %d,%d\n", instruction.c_str(), rd, rs1);
-            disasm << instruction << " " << rd << "," << rs1 << std::endl;
+            line.Line(cImmediate[f3], rd, rs1, imm12);
         }
         break;
     }
 
-    case IType::OP_TYPE_LOAD: {
-        WORD rd = (machinecode & 0xf80) >> 7;
-        WORD f3 = (machinecode & 0x7000) >> 12;
-        WORD rs1 = (machinecode & 0xf8000) >> 15;
-        WORD imm12 = (machinecode & 0xfff00000) >> 20;
-        //wprintf(L"disassembled I-Type LOAD instruction:\n");
-
-        if (f3 == IType::FUNC3_LB) instruction = "lb"; //strcpy(instruction, "lb");
-        else if (f3 == IType::FUNC3_LH) instruction = "lh"; //strcpy(instruction, "lh");
-        else if (f3 == IType::FUNC3_LW) instruction = "lw"; //strcpy(instruction, "lw");
-        else if (f3 == IType::FUNC3_LBU) instruction = "lbu"; //strcpy(instruction, "lbu");
-        else if (f3 == IType::FUNC3_LHU) instruction = "lhu"; //strcpy(instruction, "lhu");
-        else instruction = "unknown"; //strcpy(instruction, "unknown");
-
-        wprintf(L"%S %d,%d\n", instruction.c_str(), rd, rs1);
-        disasm << instruction << " " << rd << "," << rs1 << std::endl;
+    case IType::OP_TYPE_LOAD:
+        line.Line(cLoad[f3], rd, rs1, imm12);
         break;
-    }
 
-    case IType::OP_JALR: {
-        WORD rd = (machinecode & 0xf80) >> 7;
-        WORD f3 = (machinecode & 0x7000) >> 12;
-        WORD rs1 = (machinecode & 0xf8000) >> 15;
-        WORD imm12 = (machinecode & 0xfff00000) >> 20;
-        //wprintf(L"disassembled I-Type JALR instruction:\n");
-
-        if (f3 == IType::FUNC3_JALR) instruction = "jalr"; //strcpy(instruction, "jalr");
-        else instruction = "unknown"; //strcpy(instruction, "unknown");
-
-        wprintf(L"%S %d,%d\n", instruction.c_str(), rd, rs1);
-        disasm << instruction << " " << rd << "," << rs1 << std::endl;
+    case IType::OP_JALR:
+        line.Line(f3 == IType::FUNC3_JALR ? "jalr" : nullptr, rd, rs1, imm12);
         break;
-    }
 
     case SType::OP_TYPE_STORE: {
-
-        WORD f3 = (machinecode & 0x7000) >> 12;
-        WORD rs1 = (machinecode & 0xf8000) >> 15;
-        WORD rs2 = (machinecode & 0x1f00000) >> 20;
-
-        WORD imm5 = (machinecode & 0xf80) >> 7;
-        WORD imm7 = (machinecode & 0xfe000000) >> 25;
-        WORD imm = (imm7 << 5) | imm5;
-
-        //wprintf(L"disassembled S-Type instruction:\n");
-
-        if (f3 == SType::FUNC3_SB) instruction = "sb"; //strcpy(instruction, "sb");
-        else if (f3 == SType::FUNC3_SH) instruction = "sh"; //strcpy(instruction, "sh");
-        else if (f3 == SType::FUNC3_SW) instruction = "sw"; //strcpy(instruction, "sw");
-        else instruction = "unknown"; //strcpy(instruction, "unknown");
-
-        wprintf(L"%S %d,%d\n", instruction.c_str(), rs2, rs1);
-        disasm << instruction << " " << rs2 << "," << rs1 << std::endl;
+        WORD const imm = (static_cast<WORD>(code & 0xFE000000) >> 20) | static_cast<WORD>(rd);
+        line.Line(cStore[f3], rs2, rs1, imm);
         break;
     }
 
     case BType::OP_TYPE_BRANCH: {
-
-        // first get bits for registers and f3
-        WORD f3 = (machinecode & 0x7000) >> 12;
-        WORD rs1 = (machinecode & 0xf8000) >> 15;
-        WORD rs2 = (machinecode & 0x1f00000) >> 20;
-
-        // then recreate the immediate correctly by moving the bits to correct position
-        WORD imm12 = (machinecode & (1 << 31)) >> 20;       // move from 31 to 12
-        WORD imm11 = (machinecode & (1 << 7)) << 4;         // move from 7 to 11
-        WORD imm105 = (machinecode & 0x7E000000) >> 20;     // move from 30:25 to 10:5
-        WORD imm41 = (machinecode & 0xF00) >> 5;             // move from 11:8 to 4:1
-        WORD imm = imm12 | imm11 | imm105 | imm41;          // assemble all bits to the immediate
-        //wprintf(L"disassembled B-Type instruction:\n");
-
-        // check which instruction was done
-        if (f3 == BType::FUNC3_BEQ) instruction = "beq"; //strcpy(instruction, "beq");
-        else if (f3 == BType::FUNC3_BNEQ) instruction = "bneq"; //strcpy(instruction, "bneq");
-        else if (f3 == BType::FUNC3_BLT) instruction = "blt"; //strcpy(instruction, "blt");
-        else if (f3 == BType::FUNC3_BGE) instruction = "bge"; //strcpy(instruction, "bge");
-        else if (f3 == BType::FUNC3_BLTU) instruction = "bltu"; //strcpy(instruction, "bltu");
-        else if (f3 == BType::FUNC3_BGEU) instruction = "bgeu"; //strcpy(instruction, "bgeu");
-        else instruction = "unknown"; //strcpy(instruction, "unknown");
-
-        wprintf(L"%S %d,%d,%d\n", instruction.c_str(), rs1, rs2, imm);
-        disasm << instruction << " " << rs1 << "," << rs2 << "," << imm << std::endl;
+        // recreate the immediate by moving the bits to their position, bit 0 is always zero,
+        // the target is an absolute instruction index and not sign-extended
+        WORD const imm12 = static_cast<WORD>((code & 0x80000000u) >> 19);      // from 31 to 12
+        WORD const imm11 = static_cast<WORD>((code & 0x80) << 4);              // from 7 to 11
+        WORD const imm105 = static_cast<WORD>((code & 0x7E000000) >> 20);      // from 30:25 to 10:5
+        WORD const imm41 = static_cast<WORD>((code & 0xF00) >> 7);             // from 11:8 to 4:1
+        line.Line(cBranch[f3], rs1, rs2, (imm12 | imm11 | imm105 | imm41) >> 1);
         break;
     }
 
-    case UType::OP_LUI: {
-        WORD rd = (machinecode & 0xf80) >> 7;
-        WORD imm20 = (machinecode & 0xfffff000) >> 12;
-        //wprintf(L"disassemble U-Type LUI instruction:\n31 | %d | %d | %d | 0\n", imm20, rd, opcode);
-        instruction = "lui";
-        wprintf(L"%S %d,%d\n", instruction.c_str(), rd, imm20);
-        disasm << instruction << " " << rd << "," << imm20 << std::endl;
+    case UType::OP_LUI:
+        line.Line("lui", rd, code >> 12);
+        break;
+
+    case UType::OP_AUIPC:
+        line.Line("auipc", rd, code >> 12);
         break;
-    }
 
     case JType::OP_JAL: {
-        WORD rd = (machinecode & 0xf80) >> 7;
-
-        WORD imm20 = (machinecode & (1 << 31)) >> 31;
-        WORD imm1912 = (machinecode & 0xFF000) >> 12;
-        WORD imm11 = (machinecode & (1 << 20)) >> 20;
-        WORD imm101 = (machinecode & 0x7FE00000) >> 21;
-        WORD imm = (imm20 << 19) | (imm1912 << 12) | (imm11 << 11) | (imm101 << 1);
-
-        //wprintf(L"disassemble J-Type JAL instruction:\n31 | %d | %d | %d | 0\n", imm20, rd, opcode);
-        instruction = "jal";
-        wprintf(L"%S %d,%d\n", instruction.c_str(), rd, imm);
-        disasm << instruction << " " << rd << "," << imm << std::endl;
+        WORD const imm20 = static_cast<WORD>((code & 0x80000000u) >> 11);      // from 31 to 20
+        WORD const imm1912 = static_cast<WORD>(code & 0xFF000);               // 19:12 stay
+        WORD const imm11 = static_cast<WORD>((code & 0x100000) >> 9);          // from 20 to 11
+        WORD const imm101 = static_cast<WORD>((code & 0x7FE00000) >> 20);      // from 30:21 to 10:1
+        line.Line("jal", rd, (imm20 | imm1912 | imm11 | imm101) >> 1);
         break;
     }
-    case PType::OP_TYPE_PRINT: {
-        WORD f3 = (machinecode & 0x7000) >> 12;
-        WORD rs1 = (machinecode & 0xf8000) >> 15;
 
-        if (f3 == PType::FUNC3_INT) instruction = "pint"; //strcpy(instruction, "pint");
-        else if (f3 == PType::FUNC3_STRING) instruction = "pstr"; //strcpy(instruction, "pstr");
+    case PType::OP_TYPE_PRINT:
+        line.Line(cPrint[f3], rs1);
+        break;
 
-        wprintf(L"%S %d\n", instruction.c_str(), rs1);
-        disasm << instruction << " " << rs1 << std::endl;
+    case PType::OP_TYPE_SLEEP:
+        line.Text("sleep");
         break;
-    }
+
+    case CsrType::OP_TYPE_CSR:
+        // rd, csr number, rs1 or uimm
+        line.Line(cCsr[f3], rd, code >> 20, rs1);
+        break;
+
     default:
-        wprintf(L"unknown opcode");
+        line.Text("unknown opcode");
         break;
     }
+    return line.Finish();
+}
+
+void RiscV::DisassembleImage(INSTRUCTION const* image, size_t count, char* lines, size_t threads)
+{
+    // below this many instructions per thread, starting threads costs more than it saves
+    size_t const cMinimumPerThread = 1 << 14;
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max<size_t>(1, std::min(threads, count / cMinimumPerThread));
+
+    auto disassembleRange = [image, lines](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Disassemble(image[i], lines + i * cDisassemblyLength, cDisassemblyLength);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    size_t const perThread = (count + threads - 1) / threads;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(disassembleRange, std::min(count, t * perThread), std::min(count, (t + 1) * perThread));
+    }
+    disassembleRange(0, std::min(count, perThread));
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
 }
 
 RiscV::BYTE RiscV::MaskOpcode(INSTRUCTION instruction)
@@ -1,6 +1,8 @@
 #pragma once
 
-#include <sstream>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 
 namespace RiscV {
 
@@ -14,6 +16,10 @@ namespace RiscV {
 	size_t const cRegCount = 32;
     size_t const cDataIncrement = 4;
     size_t const cMemDataSize = (1 << 16) / cDataIncrement;
+    // granularity of the memory dispatch table, in bytes
+    unsigned const cPageBits = 12;
+    size_t const cPageSize = size_t(1) << cPageBits;
+    ADDRESS const cPageMask = (1 << cPageBits) - 1;
 
 
     namespace UType {
@@ -97,7 +103,33 @@ namespace RiscV {
         // currently not needed and implemented, but exist in RV32I
         constexpr auto OP_TYPE_FENCE = 0b0001111;   // for I/O
         constexpr auto OP_TYPE_E = 0b1110011;       // for exceptions
-        constexpr auto OP_TYPE_CSR = 0b1110011;     // for controls and status register
+    }
+
+    // Zicsr, the only control and status registers are read-only counters
+    namespace CsrType {
+        constexpr auto OP_TYPE_CSR = 0b1110011;
+        constexpr auto FUNC3_CSRRW = 0b001;
+        constexpr auto FUNC3_CSRRS = 0b010;
+        constexpr auto FUNC3_CSRRC = 0b011;
+        constexpr auto FUNC3_CSRRWI = 0b101;
+        constexpr auto FUNC3_CSRRSI = 0b110;
+        constexpr auto FUNC3_CSRRCI = 0b111;
+
+        // instret counts the instructions executed before the reading one, cycle and time the
+        // virtual clock before it (VirtualMachine::Cycles), which also holds the skipped cycles
+        constexpr auto CSR_CYCLE = 0xc00;
+        constexpr auto CSR_TIME = 0xc01;
+        constexpr auto CSR_INSTRET = 0xc02;
+        constexpr auto CSR_CYCLEH = 0xc80;
+        constexpr auto CSR_TIMEH = 0xc81;
+        constexpr auto CSR_INSTRETH = 0xc82;
+        // custom: loads, stores and taken conditional branches executed so far
+        constexpr auto CSR_LOADS = 0xcc0;
+        constexpr auto CSR_STORES = 0xcc1;
+        constexpr auto CSR_BRANCHES = 0xcc2;
+        constexpr auto CSR_LOADSH = 0xcc8;
+        constexpr auto CSR_STORESH = 0xcc9;
+        constexpr auto CSR_BRANCHESH = 0xcca;
     }
 
     namespace SType {
@@ -126,8 +158,18 @@ namespace RiscV {
         constexpr auto OP_TYPE_SLEEP = 0b1111110;
     }
 
-    static std::stringstream disasm;
-    void Disassemble(WORD machinecode);
+    // one line of assembly, branch and jal targets are instruction indices like everywhere in the VM
+    std::string Disassemble(WORD machinecode);
+
+    // no line of assembly is longer, including the terminating zero
+    size_t const cDisassemblyLength = 40;
+    // Disassemble into buffer without allocating, for hot paths and any number of threads.
+    // At most size bytes are written including the terminating zero, the return value is the
+    // length of the whole line like snprintf.
+    size_t Disassemble(INSTRUCTION machinecode, char* buffer, size_t size);
+    // one zero terminated line of cDisassemblyLength bytes per instruction, large images are
+    // split across threads (0 uses one per hardware thread)
+    void DisassembleImage(INSTRUCTION const* image, size_t count, char* lines, size_t threads = 0);
 
 	BYTE MaskOpcode(INSTRUCTION instruction);
 	BYTE MaskFunct3(INSTRUCTION instruction);
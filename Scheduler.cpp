@@ -0,0 +1,179 @@
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+Scheduler::Scheduler(size_t workerCount, uint64_t sliceBudget, VirtualMachine::Engine engine, bool sparseMemory, bool hugePages) :
+	mWorkerCount(workerCount != 0 ? workerCount : std::max(1u, std::thread::hardware_concurrency())),
+	mSliceBudget(sliceBudget), mEngine(engine), mSparseMemory(sparseMemory), mHugePages(hugePages), mWorkers(new Worker[mWorkerCount]), mRemaining(0), mQueued(0)
+{
+}
+
+bool Scheduler::Add(std::string const& fileName, size_t regCount, bool compressed) {
+	Instance instance;
+	if (ElfFile::IsElf(fileName)) {
+		// ELF segments are file mappings, the instances share them through the page cache
+		instance.vm.reset(new VirtualMachine(fileName, regCount, false));
+		if (!instance.vm->is_ready()) {
+			return false;
+		}
+	}
+	else {
+		auto image = mImages.find(fileName);
+		if (image == mImages.end()) {
+			Image loaded;
+			if (!VirtualMachine::LoadImage(fileName, loaded.code, loaded.layout, compressed)) {
+				return false;
+			}
+			image = mImages.insert(std::make_pair(fileName, std::move(loaded))).first;
+		}
+		instance.vm.reset(new VirtualMachine(image->second.code, regCount, false, image->second.layout));
+	}
+	if (mSparseMemory) {
+		// addresses are signed, the upper half of the address space is a range of its own
+		size_t const half = size_t(1) << 31;
+		SparseMemory* low = new SparseMemory(half, mHugePages);
+		instance.memory.emplace_back(low);
+		SparseMemory* high = new SparseMemory(half, mHugePages);
+		instance.memory.emplace_back(high);
+		if (!low->is_ready() || !high->is_ready() ||
+			!instance.vm->RegisterDevice(low, 0, INT32_MAX) || !instance.vm->RegisterDevice(high, INT32_MIN, -1)) {
+			return false;
+		}
+	}
+	else {
+		instance.memory.emplace_back(new VirtualMemory(RiscV::cMemDataSize * RiscV::cDataIncrement));
+		instance.vm->RegisterDevice(instance.memory.back().get(), 0x0000, RiscV::cMemDataSize * RiscV::cDataIncrement - 1);
+	}
+	if (mMapTimer) {
+		// an instance that waits for its timer skips ahead instead of taking worker time
+		TimerDevice* timer = new TimerDevice(*instance.vm);
+		instance.memory.emplace_back(timer);
+		if (!instance.vm->RegisterDevice(timer, mTimerAddress, mTimerAddress + static_cast<RiscV::ADDRESS>(TimerDevice::cSize) - 1)) {
+			return false;
+		}
+	}
+	mInstances.push_back(std::move(instance));
+
+	Result result;
+	result.fileName = fileName;
+	mResults.push_back(result);
+	return true;
+}
+
+void Scheduler::MapTimer(RiscV::ADDRESS address) {
+	mMapTimer = true;
+	mTimerAddress = address;
+}
+
+void Scheduler::Run() {
+	// spread the instances evenly, stealing evens out whatever imbalance remains
+	size_t pending = 0;
+	for (size_t i = 0; i < mInstances.size(); ++i) {
+		if (mInstances[i].vm) {
+			mWorkers[i % mWorkerCount].queue.push_back(i);
+			++pending;
+		}
+	}
+	mRemaining = pending;
+	mQueued = pending;
+	mStart = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < mWorkerCount; ++i) {
+		threads.emplace_back(&Scheduler::WorkerLoop, this, i);
+	}
+	WorkerLoop(0);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - mStart;
+	mSeconds = seconds.count();
+}
+
+void Scheduler::WorkerLoop(size_t self) {
+	while (mRemaining > 0) {
+		size_t index;
+		if (!Pop(self, index) && !Steal(self, index)) {
+			std::unique_lock<std::mutex> lock(mIdleMutex);
+			mWakeUp.wait(lock, [this] { return mQueued > 0 || mRemaining == 0; });
+			continue;
+		}
+
+		Instance& instance = mInstances[index];
+		Result& result = mResults[index];
+		++result.slices;
+		if (instance.vm->RunSlice(mEngine, mSliceBudget)) {
+			Push(self, index);
+			continue;
+		}
+
+		std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - mStart;
+		result.instructions = instance.vm->ExecutedInstructions();
+		result.seconds = seconds.count();
+		// free the memory of finished instances right away
+		instance.vm.reset();
+		instance.memory.clear();
+		if (--mRemaining == 0) {
+			// the idle workers leave
+			std::lock_guard<std::mutex> lock(mIdleMutex);
+			mWakeUp.notify_all();
+		}
+	}
+}
+
+void Scheduler::Push(size_t worker, size_t instance) {
+	{
+		std::lock_guard<std::mutex> lock(mWorkers[worker].mutex);
+		mWorkers[worker].queue.push_back(instance);
+		++mQueued;
+	}
+	// an idle worker checks mQueued under mIdleMutex, taking it here cannot miss a sleeper
+	std::lock_guard<std::mutex> lock(mIdleMutex);
+	mWakeUp.notify_one();
+}
+
+bool Scheduler::Pop(size_t worker, size_t& instance) {
+	std::lock_guard<std::mutex> lock(mWorkers[worker].mutex);
+	if (mWorkers[worker].queue.empty()) return false;
+	// oldest first, the instances of a worker take turns
+	instance = mWorkers[worker].queue.front();
+	mWorkers[worker].queue.pop_front();
+	--mQueued;
+	return true;
+}
+
+bool Scheduler::Steal(size_t thief, size_t& instance) {
+	for (size_t i = 1; i < mWorkerCount; ++i) {
+		Worker& victim = mWorkers[(thief + i) % mWorkerCount];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.queue.empty()) {
+			instance = victim.queue.back();
+			victim.queue.pop_back();
+			--mQueued;
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t Scheduler::WorkerCount() const {
+	return mWorkerCount;
+}
+
+std::vector<Scheduler::Result> const& Scheduler::Results() const {
+	return mResults;
+}
+
+uint64_t Scheduler::TotalInstructions() const {
+	uint64_t total = 0;
+	for (Result const& result : mResults) {
+		total += result.instructions;
+	}
+	return total;
+}
+
+double Scheduler::Seconds() const {
+	return mSeconds;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include "RiscV.h"
+#include "ElfFile.h"
+#include "VirtualMachine.h"
+#include "VirtualMemory.h"
+#include "SparseMemory.h"
+#include "TimerDevice.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Runs many independent virtual machines in one process.
+//
+// Every instance gets its own registers and memory, raw binaries are loaded once per file name.
+// A pool of worker threads time-slices the instances by instruction budget: each worker takes
+// instances from the front of its own deque and puts unfinished ones back at its end, so they
+// take turns. A worker whose deque is empty steals from the back of the other deques, and sleeps
+// while there is nothing to steal.
+class Scheduler
+{
+public:
+	struct Result {
+		std::string fileName;
+		uint64_t instructions = 0;
+		size_t slices = 0;
+		double seconds = 0;		// from the start of Run until the instance finished
+	};
+
+	// workerCount 0 uses one worker per hardware thread, sparseMemory gives every instance
+	// the whole 32-bit address space as SparseMemory instead of 64 KiB of VirtualMemory
+	Scheduler(size_t workerCount, uint64_t sliceBudget, VirtualMachine::Engine engine,
+		bool sparseMemory = false, bool hugePages = false);
+	Scheduler(Scheduler const&) = delete;
+	Scheduler& operator=(Scheduler const&) = delete;
+
+	// every instance added afterwards gets a TimerDevice at address
+	void MapTimer(RiscV::ADDRESS address);
+	// adds one instance of the binary, false if the file could not be loaded;
+	// compressed as for the VirtualMachine constructor
+	bool Add(std::string const& fileName, size_t regCount, bool compressed = false);
+	// runs every instance to completion
+	void Run();
+
+	size_t WorkerCount() const;
+	// one entry per added instance, in the order they were added
+	std::vector<Result> const& Results() const;
+	uint64_t TotalInstructions() const;
+	double Seconds() const;
+
+private:
+	struct Instance {
+		std::unique_ptr<VirtualMachine> vm;
+		std::vector<std::unique_ptr<IVirtualDevice>> memory;
+	};
+	struct Worker {
+		std::mutex mutex;
+		std::deque<size_t> queue;
+	};
+	// a raw image loaded once for all of its instances
+	struct Image {
+		std::vector<RiscV::INSTRUCTION> code;
+		RiscV::CodeLayout layout;
+	};
+
+	size_t const mWorkerCount;
+	uint64_t const mSliceBudget;
+	VirtualMachine::Engine const mEngine;
+	bool const mSparseMemory;
+	bool const mHugePages;
+	bool mMapTimer = false;
+	RiscV::ADDRESS mTimerAddress = 0;
+
+	std::map<std::string, Image> mImages;
+	std::vector<Instance> mInstances;
+	std::vector<Result> mResults;
+	std::unique_ptr<Worker[]> mWorkers;
+
+	std::atomic<size_t> mRemaining;
+	// instances waiting in any deque, idle workers sleep on mWakeUp while there are none
+	std::atomic<size_t> mQueued;
+	std::mutex mIdleMutex;
+	std::condition_variable mWakeUp;
+	std::chrono::steady_clock::time_point mStart;
+	double mSeconds = 0;
+
+	void WorkerLoop(size_t self);
+	void Push(size_t worker, size_t instance);
+	bool Pop(size_t worker, size_t& instance);
+	bool Steal(size_t thief, size_t& instance);
+};
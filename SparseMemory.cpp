@@ -0,0 +1,274 @@
+#include "SparseMemory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VM_SPARSE_MMAP
+#include <signal.h>
+#include <sys/mman.h>
+#endif
+
+namespace {
+	size_t const cCommitSize = 64 * 1024;
+	size_t const cHugeCommitSize = 2 * 1024 * 1024;
+}
+
+#ifdef VM_SPARSE_MMAP
+
+// every reservation of the process, the signal handler looks faulting addresses up in here
+struct SparseMemory::Faults {
+	static size_t const cMaxRegions = 4096;
+	static std::atomic<SparseMemory*> sRegions[cMaxRegions];
+	static struct sigaction sPreviousSegv;
+	static struct sigaction sPreviousBus;
+	static std::once_flag sInstalled;
+
+	static void Install() {
+		std::call_once(sInstalled, []() {
+			struct sigaction action;
+			std::memset(&action, 0, sizeof(action));
+			action.sa_sigaction = &Faults::OnSignal;
+			action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+			sigemptyset(&action.sa_mask);
+			sigaction(SIGSEGV, &action, &sPreviousSegv);
+			sigaction(SIGBUS, &action, &sPreviousBus);
+		});
+	}
+
+	static bool Add(SparseMemory* memory) {
+		for (std::atomic<SparseMemory*>& region : sRegions) {
+			SparseMemory* expected = nullptr;
+			if (region.compare_exchange_strong(expected, memory)) return true;
+		}
+		return false;
+	}
+
+	static void Remove(SparseMemory* memory) {
+		for (std::atomic<SparseMemory*>& region : sRegions) {
+			SparseMemory* expected = memory;
+			if (region.compare_exchange_strong(expected, nullptr)) return;
+		}
+	}
+
+	// commits the chunk around address if it belongs to a reservation and is not committed yet
+	static bool Commit(uint8_t* address) {
+		for (std::atomic<SparseMemory*>& region : sRegions) {
+			SparseMemory* memory = region.load(std::memory_order_acquire);
+			if (memory == nullptr || address < memory->mMemory || address >= memory->mMemory + memory->mSize) continue;
+
+			size_t const chunk = static_cast<size_t>(address - memory->mMemory) / memory->mCommitSize;
+			if (memory->IsCommitted(chunk) ||
+				mprotect(memory->mMemory + chunk * memory->mCommitSize, memory->mCommitSize, PROT_READ | PROT_WRITE) != 0) {
+				return false;
+			}
+			memory->SetCommitted(chunk);
+			return true;
+		}
+		return false;
+	}
+
+	static void OnSignal(int signal, siginfo_t* info, void* context) {
+		if (Commit(static_cast<uint8_t*>(info->si_addr))) return;
+
+		// not ours, hand it on; the default action takes effect when the access faults again
+		struct sigaction const& previous = signal == SIGBUS ? sPreviousBus : sPreviousSegv;
+		if ((previous.sa_flags & SA_SIGINFO) != 0) {
+			previous.sa_sigaction(signal, info, context);
+		}
+		else if (previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN) {
+			sigaction(signal, &previous, nullptr);
+		}
+		else {
+			previous.sa_handler(signal);
+		}
+	}
+};
+
+std::atomic<SparseMemory*> SparseMemory::Faults::sRegions[SparseMemory::Faults::cMaxRegions];
+struct sigaction SparseMemory::Faults::sPreviousSegv;
+struct sigaction SparseMemory::Faults::sPreviousBus;
+std::once_flag SparseMemory::Faults::sInstalled;
+
+SparseMemory::SparseMemory(size_t size, bool hugePages) :
+	mSize(size), mCommitSize(hugePages ? cHugeCommitSize : cCommitSize),
+	mCommitted((size / mCommitSize + 1 + 63) / 64, 0)
+{
+	// chunks are aligned to their size, reserve enough to align the start
+	mReservedSize = (size + mCommitSize - 1) / mCommitSize * mCommitSize + mCommitSize;
+	void* reserved = mmap(nullptr, mReservedSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (reserved == MAP_FAILED) {
+		std::cerr << "Could not reserve " << size << " bytes of sparse memory" << std::endl;
+		mReservedSize = 0;
+		return;
+	}
+	mReservedBase = static_cast<uint8_t*>(reserved);
+	uintptr_t const start = reinterpret_cast<uintptr_t>(reserved);
+	mMemory = mReservedBase + ((start + mCommitSize - 1) / mCommitSize * mCommitSize - start);
+#ifdef MADV_HUGEPAGE
+	if (hugePages) {
+		madvise(mMemory, mSize, MADV_HUGEPAGE);
+	}
+#endif
+
+	Faults::Install();
+	if (!Faults::Add(this)) {
+		std::cerr << "Too many sparse memories in one process" << std::endl;
+		munmap(mReservedBase, mReservedSize);
+		mMemory = nullptr;
+		mReservedSize = 0;
+	}
+}
+
+SparseMemory::~SparseMemory() {
+	if (mMemory != nullptr) {
+		Faults::Remove(this);
+		munmap(mReservedBase, mReservedSize);
+	}
+}
+
+#else
+
+SparseMemory::SparseMemory(size_t size, bool hugePages) :
+	mSize(size), mCommitSize(hugePages ? cHugeCommitSize : cCommitSize),
+	mCommitted((size / mCommitSize + 1 + 63) / 64, 0), mChunks(size / mCommitSize + 1)
+{
+}
+
+SparseMemory::~SparseMemory() {
+}
+
+// start of the chunk holding offset, nullptr for a chunk that was never written unless create is set
+uint8_t* SparseMemory::Chunk(size_t offset, bool create) {
+	size_t const chunk = offset / mCommitSize;
+	if (!mChunks[chunk] && create) {
+		mChunks[chunk].reset(new uint8_t[mCommitSize]());
+		SetCommitted(chunk);
+	}
+	return mChunks[chunk].get();
+}
+
+#endif
+
+bool SparseMemory::is_ready() const {
+#ifdef VM_SPARSE_MMAP
+	return mMemory != nullptr;
+#else
+	return true;
+#endif
+}
+
+bool SparseMemory::IsCommitted(size_t chunk) const {
+	return (mCommitted[chunk / 64] & (uint64_t(1) << (chunk % 64))) != 0;
+}
+
+void SparseMemory::SetCommitted(size_t chunk) {
+	mCommitted[chunk / 64] |= uint64_t(1) << (chunk % 64);
+}
+
+size_t SparseMemory::CommittedBytes() const {
+	size_t chunks = 0;
+	for (size_t chunk = 0; chunk * mCommitSize < mSize; ++chunk) {
+		chunks += IsCommitted(chunk) ? 1 : 0;
+	}
+	return chunks * mCommitSize;
+}
+
+RiscV::WORD SparseMemory::Read(RiscV::ADDRESS const& address, size_t size) {
+	uint32_t data = 0;
+	ReadBlock(address, &data, size);
+	return static_cast<RiscV::WORD>(data);
+}
+
+void SparseMemory::Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t size) {
+	WriteBlock(address, &data, size);
+}
+
+void SparseMemory::ReadBlock(RiscV::ADDRESS const& address, void* buffer, size_t size) {
+#ifdef VM_SPARSE_MMAP
+	std::memcpy(buffer, mMemory + static_cast<uint32_t>(address), size);
+#else
+	uint8_t* bytes = static_cast<uint8_t*>(buffer);
+	size_t offset = static_cast<uint32_t>(address);
+	while (size != 0) {
+		size_t const inChunk = std::min(size, mCommitSize - offset % mCommitSize);
+		uint8_t const* chunk = Chunk(offset, false);
+		if (chunk != nullptr) {
+			std::memcpy(bytes, chunk + offset % mCommitSize, inChunk);
+		}
+		else {
+			std::memset(bytes, 0, inChunk);
+		}
+		bytes += inChunk;
+		offset += inChunk;
+		size -= inChunk;
+	}
+#endif
+}
+
+void SparseMemory::WriteBlock(RiscV::ADDRESS const& address, void const* buffer, size_t size) {
+#ifdef VM_SPARSE_MMAP
+	std::memcpy(mMemory + static_cast<uint32_t>(address), buffer, size);
+#else
+	uint8_t const* bytes = static_cast<uint8_t const*>(buffer);
+	size_t offset = static_cast<uint32_t>(address);
+	while (size != 0) {
+		size_t const inChunk = std::min(size, mCommitSize - offset % mCommitSize);
+		std::memcpy(Chunk(offset, true) + offset % mCommitSize, bytes, inChunk);
+		bytes += inChunk;
+		offset += inChunk;
+		size -= inChunk;
+	}
+#endif
+}
+
+uint8_t* SparseMemory::HostMemory(size_t& size) {
+#ifdef VM_SPARSE_MMAP
+	size = mSize;
+	return mMemory;
+#else
+	size = 0;
+	return nullptr;
+#endif
+}
+
+bool SparseMemory::HostMemoryCommitted(size_t offset, size_t size) {
+	for (size_t chunk = offset / mCommitSize; chunk * mCommitSize < offset + size; ++chunk) {
+		if (IsCommitted(chunk)) return true;
+	}
+	return false;
+}
+
+// without host memory the virtual machine cannot save the chunks itself
+bool SparseMemory::SaveState(std::ostream& os) {
+#ifdef VM_SPARSE_MMAP
+	(void)os;
+	return false;
+#else
+	for (size_t chunk = 0; chunk < mChunks.size(); ++chunk) {
+		if (!mChunks[chunk]) continue;
+		uint32_t const index = static_cast<uint32_t>(chunk);
+		os.write(reinterpret_cast<char const*>(&index), sizeof(index));
+		os.write(reinterpret_cast<char const*>(mChunks[chunk].get()), mCommitSize);
+	}
+	return true;
+#endif
+}
+
+bool SparseMemory::LoadState(std::istream& is) {
+#ifdef VM_SPARSE_MMAP
+	(void)is;
+	return false;
+#else
+	uint32_t index = 0;
+	while (is.read(reinterpret_cast<char*>(&index), sizeof(index))) {
+		if (index >= mChunks.size() || !is.read(reinterpret_cast<char*>(Chunk(index * mCommitSize, true)), mCommitSize)) {
+			return false;
+		}
+	}
+	return true;
+#endif
+}
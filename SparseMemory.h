@@ -0,0 +1,51 @@
+#pragma once
+#include "IVirtualDevice.h"
+
+#include <memory>
+#include <vector>
+
+// Plain memory for large, mostly unused guest ranges, e.g. a whole half of the 32-bit address space.
+//
+// The range is only reserved up front (mmap with PROT_NONE), a chunk of it is committed the first
+// time the guest touches it, the host fault is resolved by a process wide signal handler.
+// Resident memory therefore follows the working set, untouched chunks read as zero.
+// With hugePages the chunks are 2 MiB and backed by transparent huge pages where the host supports it.
+// Without mmap the chunks are allocated on first access and the device has no host memory.
+class SparseMemory : public IVirtualDevice
+{
+public:
+	// size in bytes
+	SparseMemory(size_t size, bool hugePages = false);
+	~SparseMemory();
+	SparseMemory(SparseMemory const&) = delete;
+	SparseMemory& operator=(SparseMemory const&) = delete;
+
+	bool is_ready() const;
+	size_t CommittedBytes() const;
+
+	virtual RiscV::WORD Read(RiscV::ADDRESS const& address, size_t size);
+	virtual void Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t size);
+	virtual void ReadBlock(RiscV::ADDRESS const& address, void* buffer, size_t size);
+	virtual void WriteBlock(RiscV::ADDRESS const& address, void const* buffer, size_t size);
+	virtual uint8_t* HostMemory(size_t& size);
+	virtual bool HostMemoryCommitted(size_t offset, size_t size);
+	virtual bool SaveState(std::ostream& os);
+	virtual bool LoadState(std::istream& is);
+
+private:
+	struct Faults;
+
+	size_t const mSize;
+	size_t const mCommitSize;
+	uint8_t* mMemory = nullptr;		// start of the first chunk inside the reservation
+	uint8_t* mReservedBase = nullptr;
+	size_t mReservedSize = 0;
+	// one bit per chunk
+	std::vector<uint64_t> mCommitted;
+	// chunks of the fallback without mmap
+	std::vector<std::unique_ptr<uint8_t[]>> mChunks;
+
+	bool IsCommitted(size_t chunk) const;
+	void SetCommitted(size_t chunk);
+	uint8_t* Chunk(size_t offset, bool create);
+};
@@ -0,0 +1,66 @@
+#include "TimerDevice.h"
+#include "VirtualMachine.h"
+
+#include <algorithm>
+#include <functional>
+
+TimerDevice::TimerDevice(VirtualMachine& vm) :
+	mVm(vm)
+{
+}
+
+uint64_t TimerDevice::Cycles() const {
+	return mVm.Cycles();
+}
+
+RiscV::WORD TimerDevice::Read(RiscV::ADDRESS const& address, size_t /*size*/) {
+	switch (address) {
+	case cTimeLow: {
+		uint64_t const now = Cycles();
+		mLatchedHigh = static_cast<uint32_t>(now >> 32);
+		return static_cast<RiscV::WORD>(static_cast<uint32_t>(now));
+	}
+	case cTimeHigh:
+		return static_cast<RiscV::WORD>(mLatchedHigh);
+	case cWait: {
+		if (mEvents.empty()) return 0;
+		std::pop_heap(mEvents.begin(), mEvents.end(), std::greater<uint64_t>());
+		uint64_t const deadline = mEvents.back();
+		mEvents.pop_back();
+		// idle until the deadline, nothing else can happen in between
+		uint64_t const now = Cycles();
+		if (deadline > now) {
+			mVm.SkipCycles(deadline - now);
+		}
+		return 1;
+	}
+	case cPending:
+		return static_cast<RiscV::WORD>(mEvents.size());
+	default:
+		return 0;
+	}
+}
+
+void TimerDevice::Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t /*size*/) {
+	if (address == cAlarm) {
+		mEvents.push_back(Cycles() + static_cast<uint32_t>(data));
+		std::push_heap(mEvents.begin(), mEvents.end(), std::greater<uint64_t>());
+	}
+}
+
+bool TimerDevice::SaveState(std::ostream& os) {
+	uint64_t const count = mEvents.size();
+	os.write(reinterpret_cast<char const*>(&count), sizeof(count));
+	os.write(reinterpret_cast<char const*>(mEvents.data()), count * sizeof(uint64_t));
+	return true;
+}
+
+bool TimerDevice::LoadState(std::istream& is) {
+	uint64_t count = 0;
+	if (!is.read(reinterpret_cast<char*>(&count), sizeof(count)) || count > BytesLeft(is) / sizeof(uint64_t)) {
+		return false;
+	}
+	mEvents.resize(static_cast<size_t>(count));
+	// the saved order already is a heap
+	return static_cast<bool>(is.read(reinterpret_cast<char*>(mEvents.data()), count * sizeof(uint64_t)));
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "IVirtualDevice.h"
+
+#include <cstdint>
+#include <vector>
+
+class VirtualMachine;
+
+// Timer with an event queue on a virtual clock, so that guests can wait without spinning.
+//
+// The clock is the virtual machine's (VirtualMachine::Cycles), the one the cycle and time counters
+// read: one cycle per instruction executed, plus the cycles skipped by waiting. Waiting does not
+// execute anything, the clock jumps straight to the earliest pending deadline, an idle guest costs
+// no host time at all. Register layout, byte offsets from the start of the device:
+//   cTimeLow   read: the clock, low word; the high word is latched for cTimeHigh at the same time
+//   cTimeHigh  read: the clock, high word
+//   cAlarm     write: an event that fires the given number of cycles from now (unsigned)
+//   cWait      read: fires the earliest event, first moving the clock to its deadline if that lies
+//              ahead, and returns 1; returns 0 without waiting if no event is pending
+//   cPending   read: number of pending events
+//
+// Under the jit engine the instruction count only advances at block boundaries, the clock then
+// lags behind inside a block.
+class TimerDevice : public IVirtualDevice
+{
+public:
+	static RiscV::ADDRESS const cTimeLow = 0x00;
+	static RiscV::ADDRESS const cTimeHigh = 0x04;
+	static RiscV::ADDRESS const cAlarm = 0x08;
+	static RiscV::ADDRESS const cWait = 0x0c;
+	static RiscV::ADDRESS const cPending = 0x10;
+	// bytes of address space to register the device with
+	static size_t const cSize = 0x14;
+
+	explicit TimerDevice(VirtualMachine& vm);
+
+	virtual RiscV::WORD Read(RiscV::ADDRESS const& address, size_t size);
+	virtual void Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t size);
+	virtual bool SaveState(std::ostream& os);
+	virtual bool LoadState(std::istream& is);
+
+	uint64_t Cycles() const;
+
+private:
+	VirtualMachine& mVm;
+	uint32_t mLatchedHigh = 0;
+	// min-heap of deadlines
+	std::vector<uint64_t> mEvents;
+};
@@ -0,0 +1,84 @@
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "RiscV.h"
+#include "Tracer.h"
+
+// Turns a binary trace written with -trace into one line per instruction:
+//   0x<pc>: <disassembly>     ; rd=<value>, data=<value>, addr=<address>
+// Instructions left out by sampling show up as a line with the number of skipped instructions.
+
+int main(int argc, char* argv[]) {
+	if (argc < 2 || argc > 3) {
+		std::cerr << "Usage:" << std::endl;
+		std::cerr << "\t" << argv[0] << " <trace file> [output file]" << std::endl;
+		return 1;
+	}
+
+	std::string fileName(argv[1]);
+	std::ifstream ifs(fileName, std::ios::binary);
+	if (!ifs.is_open()) {
+		std::cerr << "Could not open file: " << fileName << std::endl;
+		return -1;
+	}
+	if (!Tracer::ReadHeader(ifs)) {
+		std::cerr << "Invalid trace: " << fileName << std::endl;
+		return -1;
+	}
+
+	std::ofstream ofs;
+	if (argc == 3) {
+		ofs.open(argv[2], std::ios::trunc);
+		if (!ofs.is_open()) {
+			std::cerr << "Could not open file: " << argv[2] << std::endl;
+			return -1;
+		}
+	}
+	std::ostream& os = argc == 3 ? ofs : std::cout;
+
+	// records are read and disassembled a chunk at a time, the disassembly of a chunk runs in parallel
+	size_t const cChunk = 1 << 16;
+	std::vector<Tracer::Record> records(cChunk);
+	std::vector<RiscV::INSTRUCTION> instructions(cChunk);
+	std::vector<char> lines(cChunk * RiscV::cDisassemblyLength);
+	uint64_t expected = 0;
+	uint64_t count = 0;
+	while (ifs) {
+		ifs.read(reinterpret_cast<char*>(records.data()), cChunk * sizeof(Tracer::Record));
+		size_t const read = static_cast<size_t>(ifs.gcount()) / sizeof(Tracer::Record);
+		for (size_t i = 0; i < read; ++i) {
+			instructions[i] = records[i].instruction;
+		}
+		RiscV::DisassembleImage(instructions.data(), read, lines.data());
+
+		for (size_t i = 0; i < read; ++i) {
+			Tracer::Record const& record = records[i];
+			if (expected != 0 && record.index > expected) {
+				os << "      ... " << std::dec << (record.index - expected) << " instructions not traced" << "\n";
+			}
+			expected = record.index + 1;
+			++count;
+
+			os << "0x" << std::setfill('0') << std::setw(4) << std::hex << record.pc << std::dec << ": "
+				<< &lines[i * RiscV::cDisassemblyLength];
+			if (record.flags & (Tracer::cRdWritten | Tracer::cLoad | Tracer::cStore)) {
+				os << "     ;";
+				if (record.flags & Tracer::cRdWritten) {
+					os << " r" << static_cast<int>(record.rd) << "=" << record.rdValue;
+				}
+				if (record.flags & (Tracer::cLoad | Tracer::cStore)) {
+					os << ((record.flags & Tracer::cRdWritten) ? "," : "") << " data=" << record.data << ", addr=" << record.address;
+				}
+			}
+			os << "\n";
+		}
+		if (ifs.gcount() % sizeof(Tracer::Record) != 0) {
+			std::cerr << "Trace ends in the middle of a record: " << fileName << std::endl;
+		}
+	}
+	os.flush();
+	std::cerr << count << " records" << std::endl;
+	return 0;
+}
@@ -0,0 +1,186 @@
+#include "Tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+char const Tracer::cMagic[4] = { 'R', 'V', 'T', 'R' };
+
+namespace {
+
+	uint8_t AccessSize(RiscV::Handler handler) {
+		switch (handler) {
+		case RiscV::Handler::LB:
+		case RiscV::Handler::LBU:
+		case RiscV::Handler::SB:
+			return 1;
+		case RiscV::Handler::LH:
+		case RiscV::Handler::LHU:
+		case RiscV::Handler::SH:
+			return 2;
+		case RiscV::Handler::LW:
+		case RiscV::Handler::SW:
+			return 4;
+		default:
+			return 0;
+		}
+	}
+}
+
+Tracer::Tracer(std::string const& fileName, RiscV::WORD const* registers, uint64_t sampleEvery, size_t lastRecords) :
+	mFileName(fileName), mRegisters(registers), mSampleEvery(std::max<uint64_t>(sampleEvery, 1)), mLastRecords(lastRecords)
+{
+	mCapacity = 1;
+	while (mCapacity < (lastRecords != 0 ? lastRecords : cStreamRecords)) {
+		mCapacity <<= 1;
+	}
+	mRing.reset(new Record[mCapacity]);
+
+	// in last records mode the file is only created once there is something to write
+	if (mLastRecords == 0) {
+		mFile.open(mFileName, std::ios::binary | std::ios::trunc);
+		if (!mFile.is_open()) {
+			std::cerr << "Could not open file: " << mFileName << std::endl;
+			return;
+		}
+		WriteHeader();
+		mWriter = std::thread(&Tracer::WriterLoop, this);
+	}
+}
+
+Tracer::~Tracer() {
+	if (!mFaulted) {
+		Complete();
+	}
+	if (mWriter.joinable()) {
+		mStop.store(true, std::memory_order_release);
+		mWriter.join();
+	}
+}
+
+bool Tracer::is_ready() const {
+	return mLastRecords != 0 || mFile.is_open();
+}
+
+bool Tracer::WriteHeader() {
+	uint32_t const version = cVersion;
+	uint32_t const recordSize = sizeof(Record);
+	mFile.write(cMagic, sizeof(cMagic));
+	mFile.write(reinterpret_cast<char const*>(&version), sizeof(version));
+	mFile.write(reinterpret_cast<char const*>(&recordSize), sizeof(recordSize));
+	return static_cast<bool>(mFile);
+}
+
+bool Tracer::ReadHeader(std::istream& is) {
+	char magic[sizeof(cMagic)];
+	uint32_t version = 0;
+	uint32_t recordSize = 0;
+	is.read(magic, sizeof(magic));
+	is.read(reinterpret_cast<char*>(&version), sizeof(version));
+	is.read(reinterpret_cast<char*>(&recordSize), sizeof(recordSize));
+	return is && std::equal(magic, magic + sizeof(magic), cMagic) && version == cVersion && recordSize == sizeof(Record);
+}
+
+void Tracer::Count(uint64_t index, RiscV::ADDRESS pc, RiscV::INSTRUCTION instruction, RiscV::DecodedInstruction const& inst) {
+	if (mFaulted) return;
+	// registers now hold the result of the previous instruction
+	Complete();
+
+	if (mSkip != 0) {
+		--mSkip;
+		return;
+	}
+	mSkip = mSampleEvery - 1;
+
+	Record& record = mPending;
+	record.index = index;
+	record.pc = pc;
+	record.instruction = instruction;
+	record.rdValue = 0;
+	record.address = 0;
+	record.data = 0;
+	record.flags = RiscV::UsedRegisters(inst).rd >= 0 ? cRdWritten : 0;
+	record.rd = static_cast<uint8_t>(inst.rd);
+	record.size = AccessSize(inst.handler);
+	record.reserved = 0;
+	if (record.size != 0) {
+		record.address = mRegisters[inst.rs1] + inst.imm;
+		if (record.flags & cRdWritten) {
+			record.flags |= cLoad;
+		}
+		else {
+			record.flags |= cStore;
+			record.data = mRegisters[inst.rs2];
+		}
+	}
+	mHasPending = true;
+}
+
+void Tracer::Complete() {
+	if (!mHasPending) return;
+	if (mPending.flags & cRdWritten) {
+		mPending.rdValue = mRegisters[mPending.rd];
+		if (mPending.flags & cLoad) {
+			mPending.data = mPending.rdValue;
+		}
+	}
+	Push(mPending);
+	mHasPending = false;
+}
+
+void Tracer::Push(Record const& record) {
+	uint64_t const head = mHead.load(std::memory_order_relaxed);
+	if (mLastRecords == 0) {
+		// the writer is a whole ring behind, waiting keeps the trace complete
+		while (head - mTail.load(std::memory_order_acquire) >= mCapacity) {
+			std::this_thread::yield();
+		}
+	}
+	mRing[head & (mCapacity - 1)] = record;
+	mHead.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::Fault() {
+	if (mFaulted) return;
+	Complete();
+	if (mLastRecords == 0) return;
+	mFaulted = true;
+
+	mFile.open(mFileName, std::ios::binary | std::ios::trunc);
+	if (!mFile.is_open()) {
+		std::cerr << "Could not open file: " << mFileName << std::endl;
+		return;
+	}
+	WriteHeader();
+	uint64_t const head = mHead.load(std::memory_order_relaxed);
+	uint64_t const count = std::min<uint64_t>(head, mLastRecords);
+	for (uint64_t i = head - count; i < head; ++i) {
+		mFile.write(reinterpret_cast<char const*>(&mRing[i & (mCapacity - 1)]), sizeof(Record));
+	}
+	mFile.close();
+}
+
+void Tracer::WriterLoop() {
+	uint64_t tail = mTail.load(std::memory_order_relaxed);
+	for (;;) {
+		// stop is read first, every record pushed before it was set is visible afterwards
+		bool const stop = mStop.load(std::memory_order_acquire);
+		uint64_t const head = mHead.load(std::memory_order_acquire);
+		if (head == tail) {
+			if (stop) break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		// the records up to the end of the ring in one piece
+		size_t const begin = static_cast<size_t>(tail & (mCapacity - 1));
+		size_t const count = static_cast<size_t>(std::min<uint64_t>(head - tail, mCapacity - begin));
+		mFile.write(reinterpret_cast<char const*>(&mRing[begin]), count * sizeof(Record));
+		tail += count;
+		mTail.store(tail, std::memory_order_release);
+	}
+	mFile.flush();
+	if (!mFile) {
+		std::cerr << "Could not write trace: " << mFileName << std::endl;
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "RiscV.h"
+#include "Decoder.h"
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Binary execution trace of one virtual machine run, collected by the switch engine.
+//
+// Every traced instruction becomes one fixed size Record in a single producer, single consumer
+// ring buffer. In stream mode a background thread drains the ring to the file, the virtual machine
+// only waits when the writer falls a whole ring behind. With lastRecords set nothing is written while
+// running, the ring keeps the most recent records and is written once, on the first fault.
+//
+// File layout: "RVTR", uint32 version, uint32 record size, then records until the end of the file.
+// RiscV::Disassemble and the raw instruction of each record turn it back into text (VMRiscVTrace).
+class Tracer
+{
+public:
+	enum Flags : uint8_t {
+		cRdWritten = 1,		// rdValue holds rd after the instruction
+		cLoad = 2,			// address and data of a load, data is the loaded value
+		cStore = 4,			// address and data of a store, data is the whole rs2 register
+	};
+
+	struct Record {
+		uint64_t index;				// number of the instruction in the run, starting at 1
+		RiscV::ADDRESS pc;
+		RiscV::INSTRUCTION instruction;
+		RiscV::WORD rdValue;
+		RiscV::ADDRESS address;
+		RiscV::WORD data;
+		uint8_t flags;
+		uint8_t rd;
+		uint8_t size;				// bytes accessed by a load or store
+		uint8_t reserved;
+	};
+	static_assert(sizeof(Record) == 32, "trace records have a fixed size");
+
+	static char const cMagic[4];
+	static uint32_t const cVersion = 1;
+
+	// sampleEvery n traces every n-th instruction, lastRecords 0 streams the whole trace to fileName
+	Tracer(std::string const& fileName, RiscV::WORD const* registers, uint64_t sampleEvery, size_t lastRecords);
+	Tracer(Tracer const&) = delete;
+	Tracer& operator=(Tracer const&) = delete;
+	// completes the last record and waits for the writer
+	~Tracer();
+	bool is_ready() const;
+
+	// before the instruction at pc executes, index counts executed instructions including this one
+	void Count(uint64_t index, RiscV::ADDRESS pc, RiscV::INSTRUCTION instruction, RiscV::DecodedInstruction const& inst);
+	// the instruction being executed failed, in last records mode the ring is written now
+	void Fault();
+
+	static bool ReadHeader(std::istream& is);
+
+private:
+	// records in the ring while streaming, 2 MiB
+	static size_t const cStreamRecords = 1 << 16;
+
+	std::string const mFileName;
+	RiscV::WORD const* const mRegisters;
+	uint64_t const mSampleEvery;
+	size_t const mLastRecords;
+	std::ofstream mFile;
+
+	size_t mCapacity = 0;		// power of two
+	std::unique_ptr<Record[]> mRing;
+	std::atomic<uint64_t> mHead{ 0 };	// next record the virtual machine writes
+	std::atomic<uint64_t> mTail{ 0 };	// next record the writer drains
+	std::atomic<bool> mStop{ false };
+	std::thread mWriter;
+
+	// the current instruction, rd and load data are known once the next one starts
+	Record mPending = {};
+	bool mHasPending = false;
+	uint64_t mSkip = 0;
+	bool mFaulted = false;
+
+	void Complete();
+	void Push(Record const& record);
+	void WriterLoop();
+	bool WriteHeader();
+};
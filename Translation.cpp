@@ -0,0 +1,24 @@
+#include "Translation.h"
+
+namespace {
+	void HashWord(uint32_t& hash, uint32_t word) {
+		for (size_t byte = 0; byte < sizeof(word); ++byte) {
+			hash ^= (word >> (8 * byte)) & 0xff;
+			hash *= 16777619u;
+		}
+	}
+}
+
+uint32_t RiscV::HashImage(INSTRUCTION const* image, size_t count, ADDRESS base, uint32_t const* offsets) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < count; ++i) {
+		HashWord(hash, static_cast<uint32_t>(image[i]));
+	}
+	if (offsets != nullptr) {
+		HashWord(hash, static_cast<uint32_t>(base));
+		for (size_t i = 0; i < count; ++i) {
+			HashWord(hash, offsets[i]);
+		}
+	}
+	return hash;
+}
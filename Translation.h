@@ -0,0 +1,76 @@
+#pragma once
+#include "RiscV.h"
+
+#include <cstdint>
+#include <cstring>
+
+class VirtualMachine;
+
+// Ahead-of-time translation of a fixed raw image to C++ source (VMRiscVTranslate), and the runtime
+// the generated code shares with the virtual machine.
+//
+// The generated function enters the block at pc and runs basic blocks as native code, the guest
+// registers live in locals. It returns the pc to continue at when it leaves:
+//   - at an instruction the interpreter handles (print, sleep, unknown opcodes, illegal shifts,
+//     division by zero), without executing it
+//   - at a jalr target that starts no block
+//   - at a block that reads a register nobody has written yet
+//   - at a pc outside the image
+//   - at a taken jump once context->limit instructions are executed
+// Memory accesses to plain memory are inline, everything else goes through the virtual machine,
+// so devices, faults and warnings behave exactly as with the interpreters.
+namespace RiscV {
+
+	// state shared between VirtualMachine and the translated code
+	struct TranslationContext {
+		WORD* registers;
+		VirtualMachine* vm;
+		uint64_t executed;		// instructions executed by the translation in this call
+		uint64_t limit;			// taken jumps leave once executed reaches it
+		uint32_t written;		// one bit per register written, before and during the call
+		uint8_t* const* pageMemory;	// host storage per page of plain memory, see VirtualMachine
+		size_t pageCount;
+		uint8_t* pageDirty;		// stores to plain memory mark their page
+		uint8_t const* pageCode;	// stores to pages that hold instructions go through the virtual machine
+		// accesses that do not hit plain memory, pc is the index of the accessing instruction
+		WORD (*readMemory)(VirtualMachine* vm, ADDRESS address, uint32_t size, ADDRESS pc);
+		void (*writeMemory)(VirtualMachine* vm, ADDRESS address, WORD data, uint32_t size, ADDRESS pc);
+	};
+
+	typedef ADDRESS (*TranslatedCode)(TranslationContext* context, ADDRESS pc);
+
+	// what the generated source exports
+	struct Translation {
+		INSTRUCTION const* image;	// the image the translation was made from
+		uint32_t instructionCount;
+		uint32_t imageHash;		// HashImage of image and, for toolchain code, its layout
+		TranslatedCode run;
+	};
+
+	// FNV-1a over the instruction words; toolchain code (see RiscV::Relocate) also hashes the base
+	// address and the byte offset of every instruction, they decide where its jumps go
+	uint32_t HashImage(INSTRUCTION const* image, size_t count, ADDRESS base = 0, uint32_t const* offsets = nullptr);
+
+	// size is 1, 2 or 4 bytes, reads return the value zero-extended
+	inline WORD TranslatedRead(TranslationContext* context, ADDRESS address, uint32_t size, ADDRESS pc) {
+		size_t const page = static_cast<uint32_t>(address) >> cPageBits;
+		size_t const offset = static_cast<size_t>(address & cPageMask);
+		if (page < context->pageCount && offset + size <= cPageSize && context->pageMemory[page] != nullptr) {
+			uint32_t data = 0;
+			std::memcpy(&data, context->pageMemory[page] + offset, size);
+			return static_cast<WORD>(data);
+		}
+		return context->readMemory(context->vm, address, size, pc);
+	}
+
+	inline void TranslatedWrite(TranslationContext* context, ADDRESS address, WORD data, uint32_t size, ADDRESS pc) {
+		size_t const page = static_cast<uint32_t>(address) >> cPageBits;
+		size_t const offset = static_cast<size_t>(address & cPageMask);
+		if (page < context->pageCount && offset + size <= cPageSize && context->pageMemory[page] != nullptr && context->pageCode[page] == 0) {
+			std::memcpy(context->pageMemory[page] + offset, &data, size);
+			context->pageDirty[page] = 1;
+			return;
+		}
+		context->writeMemory(context->vm, address, data, size, pc);
+	}
+}
@@ -0,0 +1,468 @@
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "RiscV.h"
+#include "Decoder.h"
+#include "Translation.h"
+
+// Translates a raw instruction image ahead of time into C++ source, see Translation.h.
+//
+// Every instruction that starts a basic block gets a label: the entry, branch and jal targets, the
+// instruction behind every jump and behind every instruction left to the interpreter, and the targets
+// of auipc+jalr pairs. One switch over these labels is the lookup table for
+// entering the translation and for jalr, any other target returns to the virtual machine.
+// The source builds together with the virtual machine (VMRiscVLib) and is handed to it with
+// VirtualMachine::SetTranslation; with -main it is a program of its own that runs the image like
+// VMRiscV does, with 64 KiB of memory at address 0. Compressed images (-c) are toolchain code and are
+// relocated like the virtual machine relocates them, see RiscV::Relocate.
+
+using namespace RiscV;
+
+namespace {
+
+	// same as VirtualMachine::LoadImage
+	bool ReadImage(std::string const& fileName, bool compressed, std::vector<INSTRUCTION>& image, CodeLayout& layout) {
+		std::ifstream ifs(fileName, std::ios::binary | std::ios::ate);
+		if (!ifs.is_open()) {
+			std::cerr << "Could not open file: " << fileName << std::endl;
+			return false;
+		}
+		size_t const size = static_cast<size_t>(ifs.tellg());
+		ifs.seekg(0, std::ios::beg);
+		if (compressed) {
+			std::vector<uint8_t> code(size);
+			ifs.read(reinterpret_cast<char*>(code.data()), code.size());
+			if (!ExpandCompressed(code.data(), code.size(), image, layout.offsets)) {
+				std::cerr << "Image ends in the middle of an instruction: " << fileName << std::endl;
+				return false;
+			}
+			return true;
+		}
+		image.resize(size / cDataIncrement);
+		ifs.read(reinterpret_cast<char*>(image.data()), image.size() * cDataIncrement);
+		return true;
+	}
+
+	std::string X(int reg) {
+		return "x" + std::to_string(reg);
+	}
+
+	std::string U(int reg) {
+		return "static_cast<uint32_t>(x" + std::to_string(reg) + ")";
+	}
+
+	// a WORD literal, the most negative one cannot be written directly
+	std::string Constant(WORD value) {
+		return value == INT32_MIN ? "(-2147483647 - 1)" : std::to_string(value);
+	}
+
+	std::string Unsigned(WORD value) {
+		std::ostringstream oss;
+		oss << "0x" << std::hex << static_cast<uint32_t>(value) << "u";
+		return oss.str();
+	}
+
+	// rs1 + imm as the address of a load or store
+	std::string Address(DecodedInstruction const& inst) {
+		return "static_cast<WORD>(" + U(inst.rs1) + " + " + Unsigned(inst.imm) + ")";
+	}
+
+	bool IsBranch(Handler handler) {
+		switch (handler) {
+		case Handler::BEQ: case Handler::BNEQ: case Handler::BLT: case Handler::BGE: case Handler::BLTU: case Handler::BGEU:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// instructions the translation leaves to the interpreter
+	bool IsExit(Handler handler) {
+		switch (handler) {
+		case Handler::PRINT: case Handler::SLEEP: case Handler::CSRR: case Handler::CSR_ILLEGAL:
+		case Handler::SHIFT_ILLEGAL: case Handler::UNKNOWN: case Handler::COUNT:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// the value an instruction writes to rd, empty for everything that is not a plain computation
+	std::string Result(DecodedInstruction const& inst, size_t pc) {
+		std::string const imm = Constant(inst.imm);
+		switch (inst.handler) {
+		case Handler::ADD: return "static_cast<WORD>(" + U(inst.rs1) + " + " + U(inst.rs2) + ")";
+		case Handler::SUB: return "static_cast<WORD>(" + U(inst.rs1) + " - " + U(inst.rs2) + ")";
+		case Handler::SLL: return "static_cast<WORD>(" + U(inst.rs1) + " << (" + U(inst.rs2) + " & 0x1f))";
+		case Handler::SLT: return "(" + X(inst.rs1) + " < " + X(inst.rs2) + ") ? 1 : 0";
+		case Handler::SLTU: return "(" + U(inst.rs1) + " < " + U(inst.rs2) + ") ? 1 : 0";
+		case Handler::XOR: return X(inst.rs1) + " ^ " + X(inst.rs2);
+		case Handler::SRL: return "static_cast<WORD>(" + U(inst.rs1) + " >> (" + U(inst.rs2) + " & 0x1f))";
+		case Handler::SRA: return X(inst.rs1) + " >> (" + U(inst.rs2) + " & 0x1f)";
+		case Handler::OR: return X(inst.rs1) + " | " + X(inst.rs2);
+		case Handler::AND: return X(inst.rs1) + " & " + X(inst.rs2);
+		case Handler::MUL: return "static_cast<WORD>(static_cast<uint32_t>(static_cast<int64_t>(" + X(inst.rs1) + ") * " + X(inst.rs2) + "))";
+		case Handler::MULH: return "static_cast<WORD>(static_cast<uint64_t>(static_cast<int64_t>(" + X(inst.rs1) + ") * " + X(inst.rs2) + ") >> 32)";
+		case Handler::MULHSU: return "static_cast<WORD>(static_cast<uint64_t>(static_cast<int64_t>(" + X(inst.rs1) + ") * static_cast<int64_t>(" + U(inst.rs2) + ")) >> 32)";
+		case Handler::MULHU: return "static_cast<WORD>(static_cast<uint64_t>(" + U(inst.rs1) + ") * " + U(inst.rs2) + " >> 32)";
+		case Handler::DIV: return X(inst.rs1) + " / " + X(inst.rs2);
+		case Handler::DIVU: return "static_cast<WORD>(" + U(inst.rs1) + " / " + U(inst.rs2) + ")";
+		case Handler::REM: return X(inst.rs1) + " % " + X(inst.rs2);
+		case Handler::REMU: return "static_cast<WORD>(" + U(inst.rs1) + " % " + U(inst.rs2) + ")";
+		case Handler::ADDI: return "static_cast<WORD>(" + U(inst.rs1) + " + " + Unsigned(inst.imm) + ")";
+		case Handler::SLTI: return "(" + X(inst.rs1) + " < " + imm + ") ? 1 : 0";
+		case Handler::SLTIU: return "(" + U(inst.rs1) + " < " + Unsigned(inst.imm) + ") ? 1 : 0";
+		case Handler::XORI: return X(inst.rs1) + " ^ " + imm;
+		case Handler::ORI: return X(inst.rs1) + " | " + imm;
+		case Handler::ANDI: return X(inst.rs1) + " & " + imm;
+		case Handler::SLLI: return "static_cast<WORD>(" + U(inst.rs1) + " << " + imm + ")";
+		case Handler::SRLI: return "static_cast<WORD>(" + U(inst.rs1) + " >> " + imm + ")";
+		case Handler::SRAI: return X(inst.rs1) + " >> " + imm;
+		case Handler::LB: return "static_cast<int8_t>(TranslatedRead(context, " + Address(inst) + ", 1, " + std::to_string(pc) + "))";
+		case Handler::LH: return "static_cast<int16_t>(TranslatedRead(context, " + Address(inst) + ", 2, " + std::to_string(pc) + "))";
+		case Handler::LW: return "TranslatedRead(context, " + Address(inst) + ", 4, " + std::to_string(pc) + ")";
+		case Handler::LBU: return "TranslatedRead(context, " + Address(inst) + ", 1, " + std::to_string(pc) + ")";
+		case Handler::LHU: return "TranslatedRead(context, " + Address(inst) + ", 2, " + std::to_string(pc) + ")";
+		case Handler::LUI: return imm;
+		case Handler::AUIPC: return Constant(static_cast<WORD>(static_cast<uint32_t>(pc) + static_cast<uint32_t>(inst.imm)));
+		default: return std::string();
+		}
+	}
+
+	std::string Condition(DecodedInstruction const& inst) {
+		if (inst.rs1 == inst.rs2) {
+			bool const taken = inst.handler == Handler::BEQ || inst.handler == Handler::BGE || inst.handler == Handler::BGEU;
+			return taken ? "true" : "false";
+		}
+		switch (inst.handler) {
+		case Handler::BEQ: return X(inst.rs1) + " == " + X(inst.rs2);
+		case Handler::BNEQ: return X(inst.rs1) + " != " + X(inst.rs2);
+		case Handler::BLT: return X(inst.rs1) + " < " + X(inst.rs2);
+		case Handler::BGE: return X(inst.rs1) + " >= " + X(inst.rs2);
+		case Handler::BLTU: return U(inst.rs1) + " < " + U(inst.rs2);
+		default: return U(inst.rs1) + " >= " + U(inst.rs2);
+		}
+	}
+
+	class Translator {
+	public:
+		Translator(std::vector<INSTRUCTION> const& image, CodeLayout const& layout) : mImage(image), mLayout(layout) {
+			for (INSTRUCTION instruction : image) {
+				mDecoded.push_back(Decode(instruction));
+			}
+			if (!layout.offsets.empty()) {
+				Relocate(mDecoded, layout);
+			}
+		}
+
+		// returns the number of blocks
+		size_t Write(std::ostream& os, std::string const& source, std::string const& name, bool withMain) {
+			std::vector<bool> const leaders = FindLeaders();
+			size_t const count = mImage.size();
+			size_t blocks = 0;
+			bool indirect = false;
+
+			os << "// generated by VMRiscVTranslate from " << source << ", do not edit" << std::endl;
+			os << "#include \"Translation.h\"" << std::endl;
+			if (withMain) {
+				os << "#include \"VirtualMachine.h\"" << std::endl;
+				os << "#include \"VirtualMemory.h\"" << std::endl;
+			}
+			os << std::endl << "namespace {" << std::endl << std::endl;
+			os << "\tRiscV::INSTRUCTION const cImage[] = {";
+			for (size_t i = 0; i < count; ++i) {
+				os << (i % 8 == 0 ? "\n\t\t" : " ") << "static_cast<RiscV::INSTRUCTION>(" << Unsigned(mImage[i]) << "),";
+			}
+			os << std::endl << "\t};" << std::endl << std::endl;
+			bool const relocated = !mLayout.offsets.empty();
+			if (withMain && relocated) {
+				os << "\tuint32_t const cOffsets[] = {";
+				for (size_t i = 0; i < count; ++i) {
+					os << (i % 8 == 0 ? "\n\t\t" : " ") << mLayout.offsets[i] << "u,";
+				}
+				os << std::endl << "\t};" << std::endl << std::endl;
+			}
+
+			std::ostringstream body;
+			body << "\tRiscV::ADDRESS Run(RiscV::TranslationContext* context, RiscV::ADDRESS pc) {" << std::endl;
+			body << "\t\tusing namespace RiscV;" << std::endl;
+			body << "\t\tWORD* const registers = context->registers;" << std::endl;
+			for (size_t reg = 0; reg < cRegCount; ++reg) {
+				body << "\t\tWORD x" << reg << " = registers[" << reg << "];" << std::endl;
+			}
+			body << "\t\tuint64_t executed = 0;" << std::endl;
+			body << "\t\tuint32_t written = context->written;" << std::endl;
+			body << "\t\tgoto dispatch;" << std::endl << std::endl;
+
+			std::ostringstream code;
+			// first instruction of the current block that is not counted yet and the registers it wrote since
+			size_t counted = 0;
+			uint32_t mask = 0;
+			bool open = false;
+			// the bookkeeping for leaving in front of pc, only on a path that leaves
+			auto pending = [&](size_t pc) {
+				std::string text;
+				if (pc > counted) text += "executed += " + std::to_string(pc - counted) + "; ";
+				if (mask != 0) text += "written |= " + Unsigned(static_cast<WORD>(mask)) + "; ";
+				return text;
+			};
+			// the same on every path
+			auto settle = [&](size_t pc) {
+				std::string const text = pending(pc);
+				counted = pc;
+				mask = 0;
+				return text;
+			};
+			// a device access may have stopped the virtual machine or changed code
+			auto checkStop = [&](size_t pc) {
+				return "\t\tif (context->limit == 0) { " + pending(pc + 1) + "pc = " + std::to_string(pc + 1) + "; goto leave; }";
+			};
+			auto jump = [&](size_t target) {
+				return "pc = " + std::to_string(target) + "; if (executed >= context->limit) goto leave; goto L_" + std::to_string(target) + ";";
+			};
+
+			char line[cDisassemblyLength];
+			for (size_t pc = 0; pc < count; ++pc) {
+				DecodedInstruction const& inst = mDecoded[pc];
+				if (leaders[pc]) {
+					std::string const fallThrough = settle(pc);
+					if (open && !fallThrough.empty()) code << "\t\t" << fallThrough.substr(0, fallThrough.size() - 1) << std::endl;
+					code << "\tL_" << pc << ":" << std::endl;
+					// the interpreter warns about registers read before they are written
+					uint32_t const reads = BlockReads(pc, leaders);
+					if (reads != 0) code << "\t\tif ((written & " << Unsigned(static_cast<WORD>(reads)) << ") != " << Unsigned(static_cast<WORD>(reads)) << ") { pc = " << pc << "; goto leave; }" << std::endl;
+					counted = pc;
+					mask = 0;
+					open = true;
+					++blocks;
+				}
+				if (!open) continue;	// unreachable without a label
+
+				Disassemble(mImage[pc], line, sizeof(line));
+				code << "\t\t// 0x" << std::hex << std::setw(4) << std::setfill('0') << pc << std::dec << ": " << line << std::endl;
+				if (LeavesToInterpreter(pc)) {
+					code << "\t\t" << settle(pc) << "pc = " << pc << "; goto leave;" << std::endl;
+					open = false;
+					continue;
+				}
+				std::string const result = Result(inst, pc);
+				std::string const rd = X(inst.rd);
+				uint32_t const rdBit = 1u << inst.rd;
+				switch (inst.handler) {
+				case Handler::DIV: case Handler::DIVU: case Handler::REM: case Handler::REMU: {
+					// the interpreter warns about division by zero
+					code << "\t\tif (" << X(inst.rs2) << " == 0) { " << pending(pc) << "pc = " << pc << "; goto leave; }" << std::endl;
+					code << "\t\t" << rd << " = " << result << ";" << std::endl;
+					mask |= rdBit;
+					break;
+				}
+				case Handler::SB: case Handler::SH: case Handler::SW: {
+					size_t const size = inst.handler == Handler::SB ? 1 : inst.handler == Handler::SH ? 2 : 4;
+					code << "\t\tTranslatedWrite(context, " << Address(inst) << ", " << X(inst.rs2) << ", " << size << ", " << pc << ");" << std::endl;
+					code << checkStop(pc) << std::endl;
+					break;
+				}
+				case Handler::JAL:
+					code << "\t\t" << rd << " = " << (pc + 1) << ";" << std::endl;
+					mask |= rdBit;
+					code << "\t\t" << settle(pc + 1) << jump(static_cast<size_t>(static_cast<uint32_t>(inst.imm))) << std::endl;
+					open = false;
+					break;
+				case Handler::JALR:
+					// the target before the link, rd may be rs1
+					code << "\t\tpc = static_cast<WORD>(" << U(inst.rs1) << " + " << Unsigned(inst.imm) << ");" << std::endl;
+					code << "\t\tif (static_cast<uint32_t>(pc) >= " << count << "u) { " << pending(pc) << "pc = " << pc << "; goto leave; }" << std::endl;
+					code << "\t\t" << rd << " = " << (pc + 1) << ";" << std::endl;
+					mask |= rdBit;
+					code << "\t\t" << settle(pc + 1) << "goto indirect;" << std::endl;
+					indirect = true;
+					open = false;
+					break;
+				case Handler::JR:
+					code << "\t\tpc = static_cast<WORD>(" << U(inst.rs1) << " + " << Unsigned(inst.imm) << ");" << std::endl;
+					code << "\t\tif (static_cast<uint32_t>(pc) >= " << count << "u) { " << pending(pc) << "pc = " << pc << "; goto leave; }" << std::endl;
+					code << "\t\t" << settle(pc + 1) << "goto indirect;" << std::endl;
+					indirect = true;
+					open = false;
+					break;
+				case Handler::NOP:
+					break;
+				default:
+					if (IsBranch(inst.handler)) {
+						std::string const taken = settle(pc + 1);
+						if (!taken.empty()) code << "\t\t" << taken.substr(0, taken.size() - 1) << std::endl;
+						code << "\t\tif (" << Condition(inst) << ") { " << jump(static_cast<size_t>(static_cast<uint32_t>(inst.imm))) << " }" << std::endl;
+					}
+					else if (result.empty()) {
+						code << "\t\t" << settle(pc) << "pc = " << pc << "; goto leave;" << std::endl;
+						open = false;
+					}
+					else {
+						code << "\t\t" << rd << " = " << result << ";" << std::endl;
+						mask |= rdBit;
+						if (inst.handler >= Handler::LB && inst.handler <= Handler::LHU) code << checkStop(pc) << std::endl;
+					}
+					break;
+				}
+			}
+			if (indirect) {
+				body << "\tindirect:" << std::endl;
+				body << "\t\tif (executed >= context->limit) goto leave;" << std::endl;
+			}
+			body << "\tdispatch:" << std::endl;
+			body << "\t\tswitch (pc) {" << std::endl;
+			for (size_t pc = 0; pc < count; ++pc) {
+				if (leaders[pc]) body << "\t\tcase " << pc << ": goto L_" << pc << ";" << std::endl;
+			}
+			body << "\t\tdefault: goto leave;" << std::endl;
+			body << "\t\t}" << std::endl << std::endl;
+
+			os << body.str() << code.str() << std::endl;
+			os << "\tleave:" << std::endl;
+			for (size_t reg = 0; reg < cRegCount; ++reg) {
+				os << "\t\tregisters[" << reg << "] = x" << reg << ";" << std::endl;
+			}
+			os << "\t\tcontext->executed = executed;" << std::endl;
+			os << "\t\tcontext->written = written;" << std::endl;
+			os << "\t\treturn pc;" << std::endl;
+			os << "\t}" << std::endl;
+			os << "}" << std::endl << std::endl;
+
+			os << "extern \"C\" RiscV::Translation const " << name << " = { cImage, " << count << "u, " << Unsigned(static_cast<WORD>(HashImage(mImage.data(), count, mLayout.base, relocated ? mLayout.offsets.data() : nullptr)))
+				<< ", &Run };" << std::endl;
+			if (withMain) {
+				os << std::endl;
+				os << "int main() {" << std::endl;
+				if (relocated) {
+					os << "\tRiscV::CodeLayout layout;" << std::endl;
+					os << "\tlayout.base = " << Unsigned(static_cast<WORD>(mLayout.base)) << ";" << std::endl;
+					os << "\tlayout.offsets.assign(cOffsets, cOffsets + " << count << ");" << std::endl;
+					os << "\tVirtualMachine vm(std::vector<RiscV::INSTRUCTION>(cImage, cImage + " << count << "), RiscV::cRegCount, false, layout);" << std::endl;
+				}
+				else {
+					os << "\tVirtualMachine vm(std::vector<RiscV::INSTRUCTION>(cImage, cImage + " << count << "), RiscV::cRegCount, false);" << std::endl;
+				}
+				os << "\tVirtualMemory memory(RiscV::cMemDataSize * RiscV::cDataIncrement);" << std::endl;
+				os << "\tif (!vm.is_ready() || !vm.RegisterDevice(&memory, 0, static_cast<RiscV::ADDRESS>(RiscV::cMemDataSize * RiscV::cDataIncrement) - 1) || !vm.SetTranslation(&" << name << ")) {" << std::endl;
+				os << "\t\treturn -1;" << std::endl;
+				os << "\t}" << std::endl;
+				os << "\tvm.Run(VirtualMachine::Engine::Translated);" << std::endl;
+				os << "\treturn 0;" << std::endl;
+				os << "}" << std::endl;
+			}
+			return blocks;
+		}
+
+	private:
+		std::vector<INSTRUCTION> const& mImage;
+		CodeLayout const& mLayout;
+		std::vector<DecodedInstruction> mDecoded;
+
+		// registers the block at begin reads before writing them itself
+		uint32_t BlockReads(size_t begin, std::vector<bool> const& leaders) const {
+			uint32_t reads = 0;
+			uint32_t writes = 0;
+			for (size_t pc = begin; pc < mDecoded.size() && (pc == begin || !leaders[pc]); ++pc) {
+				RegisterUse const use = UsedRegisters(mDecoded[pc]);
+				for (int reg : { use.rs1, use.rs2 }) {
+					if (reg >= 0 && !(writes & (1u << reg))) reads |= 1u << reg;
+				}
+				if (use.rd >= 0) writes |= 1u << use.rd;
+			}
+			return reads;
+		}
+
+		// left to the interpreter, which also reports leaving the image with the right pc
+		bool LeavesToInterpreter(size_t pc) const {
+			DecodedInstruction const& inst = mDecoded[pc];
+			if (IsExit(inst.handler) || pc + 1 == mDecoded.size()) return true;
+			return (IsBranch(inst.handler) || inst.handler == Handler::JAL) && static_cast<uint32_t>(inst.imm) >= mDecoded.size();
+		}
+
+		std::vector<bool> FindLeaders() const {
+			size_t const count = mDecoded.size();
+			std::vector<bool> leaders(count + 1, false);
+			leaders[0] = true;
+			for (size_t pc = 0; pc < count; ++pc) {
+				DecodedInstruction const& inst = mDecoded[pc];
+				if (IsBranch(inst.handler) || inst.handler == Handler::JAL) {
+					size_t const target = static_cast<size_t>(static_cast<uint32_t>(inst.imm));
+					if (target < count) leaders[target] = true;
+				}
+				if (EndsBasicBlock(inst.handler) || LeavesToInterpreter(pc)) {
+					leaders[pc + 1] = true;
+				}
+			}
+
+			// jalr returns behind calls, which are leaders already, or lands at the target of an auipc+jalr pair
+			for (size_t pc = 0; pc + 1 < count; ++pc) {
+				DecodedInstruction const& first = mDecoded[pc];
+				DecodedInstruction const& second = mDecoded[pc + 1];
+				if (first.handler == Handler::AUIPC && second.handler == Handler::JALR && second.rs1 == first.rd) {
+					uint32_t const target = static_cast<uint32_t>(pc) + static_cast<uint32_t>(first.imm) + static_cast<uint32_t>(second.imm);
+					if (target < count) leaders[target] = true;
+				}
+			}
+			leaders.resize(count);
+			return leaders;
+		}
+	};
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		std::cerr << "Usage:" << std::endl;
+		std::cerr << "\t" << argv[0] << " <riscv binaryfile> <output.cpp> [-c] [-name <identifier>] [-main]" << std::endl;
+		std::cerr << "\t-c\tthe raw image is RV32C code linked at address 0, 16 and 32 bit instructions mixed" << std::endl;
+		std::cerr << "\t-name\tname of the exported RiscV::Translation, Translation by default" << std::endl;
+		std::cerr << "\t-main\tadd a main function that runs the image like VMRiscV with 64 KiB of memory" << std::endl;
+		return 1;
+	}
+
+	bool compressed = false;
+	bool withMain = false;
+	std::string name = "Translation";
+	for (int i = 3; i < argc; ++i) {
+		if (strcmp(argv[i], "-c") == 0) {
+			compressed = true;
+		}
+		else if (strcmp(argv[i], "-main") == 0) {
+			withMain = true;
+		}
+		else if (strcmp(argv[i], "-name") == 0 && i + 1 < argc) {
+			name = argv[++i];
+		}
+		else {
+			std::cerr << "Unknown option: " << argv[i] << std::endl;
+			return 3;
+		}
+	}
+
+	std::vector<INSTRUCTION> image;
+	CodeLayout layout;
+	if (!ReadImage(argv[1], compressed, image, layout)) {
+		return -1;
+	}
+	if (image.empty()) {
+		std::cerr << "Image is empty: " << argv[1] << std::endl;
+		return -1;
+	}
+
+	std::ofstream ofs(argv[2], std::ios::trunc);
+	if (!ofs.is_open()) {
+		std::cerr << "Could not open file: " << argv[2] << std::endl;
+		return -1;
+	}
+	size_t const blocks = Translator(image, layout).Write(ofs, argv[1], name, withMain);
+	if (!ofs) {
+		std::cerr << "Could not write file: " << argv[2] << std::endl;
+		return -1;
+	}
+	std::cout << "translated " << image.size() << " instructions in " << blocks << " blocks to " << argv[2] << std::endl;
+	return 0;
+}
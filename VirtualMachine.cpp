@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <fstream>
 #include <iostream>
@@ -7,32 +8,119 @@
 #include "VirtualMachine.h"
 #include "IVirtualDevice.h"
 
-VirtualMachine::VirtualMachine(std::string const& fileName, size_t regCount, bool verbose) : 
+VirtualMachine::VirtualMachine(std::string const& fileName, size_t regCount, bool verbose, bool compressed) : 
 	mInstructionMemory(nullptr), mRegCount(regCount), mPc(0), mVerbose(verbose) 
 {
+	if (ElfFile::IsElf(fileName)) {
+		LoadElf(fileName);
+		return;
+	}
+	std::vector<RiscV::INSTRUCTION> image;
+	RiscV::CodeLayout layout;
+	if (LoadImage(fileName, image, layout, compressed)) {
+		Load(image, layout);
+	}
+}
+
+VirtualMachine::VirtualMachine(std::vector<RiscV::INSTRUCTION> const& image, size_t regCount, bool verbose, RiscV::CodeLayout const& layout) :
+	mInstructionMemory(nullptr), mRegCount(regCount), mPc(0), mVerbose(verbose)
+{
+	Load(image, layout);
+}
+
+bool VirtualMachine::LoadImage(std::string const& fileName, std::vector<RiscV::INSTRUCTION>& image, RiscV::CodeLayout& layout, bool compressed) {
 	std::ifstream ifs(fileName, std::ios::binary | std::ios::ate);
 	if (!ifs.is_open()) {
 		std::cerr << "Could not open file: " << fileName << std::endl;
-		return;
+		return false;
 	}
 	std::streamoff fileByteCount = ifs.tellg();
 	/*if ((fileByteCount & 1) != 0) {
 		std::cerr << "Invalid binary" << std::endl;
 		return;
 	}*/
-	mInstructionSize = static_cast<size_t>(fileByteCount / RiscV::cDataIncrement);
 	ifs.seekg(0, std::ios::beg);
-	mInstructionMemory = new RiscV::INSTRUCTION[mInstructionSize];
-	ifs.read(reinterpret_cast<char*>(mInstructionMemory), fileByteCount);
+	layout = RiscV::CodeLayout();
+	if (compressed) {
+		// linked at address 0
+		std::vector<uint8_t> code(static_cast<size_t>(fileByteCount));
+		ifs.read(reinterpret_cast<char*>(code.data()), code.size());
+		if (!RiscV::ExpandCompressed(code.data(), code.size(), image, layout.offsets)) {
+			std::cerr << "Image ends in the middle of an instruction: " << fileName << std::endl;
+			return false;
+		}
+		return true;
+	}
+	image.resize(static_cast<size_t>(fileByteCount / RiscV::cDataIncrement));
+	ifs.read(reinterpret_cast<char*>(image.data()), image.size() * RiscV::cDataIncrement);
 	ifs.close();
+	return true;
+}
+
+void VirtualMachine::Load(std::vector<RiscV::INSTRUCTION> const& image, RiscV::CodeLayout const& layout) {
+	ReleaseImage();
+	mInstructionSize = image.size();
+	RiscV::INSTRUCTION* instructionMemory = new RiscV::INSTRUCTION[mInstructionSize];
+	std::copy(image.begin(), image.end(), instructionMemory);
+	mInstructionMemory = instructionMemory;
+	mCodeLayout = layout;
+	Decode();
+}
+
+// a read of one of the custom csrs, these need the event counters of the interpreters
+static bool ReadsEventCounter(RiscV::DecodedInstruction const& inst) {
+	return inst.handler == RiscV::Handler::CSRR && inst.imm >= RiscV::CsrType::CSR_LOADS;
+}
+
+void VirtualMachine::Decode() {
+	// compiled, translated and threaded code belong to the previous image
+	mJit.reset();
+	mTranslation = nullptr;
+	for (size_t i = 0; i < cThreadedLoops; ++i) {
+		mThreadedCode[i].clear();
+		mStaleThreadedCode[i].clear();
+	}
+
+	// decode every instruction once, Run() only works on the decoded form
+	mDecodedInstructions.clear();
+	mDecodedInstructions.reserve(mInstructionSize);
+	mCountsEvents = false;
+	for (size_t i = 0; i < mInstructionSize; ++i) {
+		mDecodedInstructions.push_back(RiscV::Decode(mInstructionMemory[i]));
+		if (ReadsEventCounter(mDecodedInstructions.back())) mCountsEvents = true;
+	}
+	if (!mCodeLayout.offsets.empty()) {
+		RiscV::Relocate(mDecodedInstructions, mCodeLayout);
+	}
 
 	for (size_t i = 0; i < RiscV::cRegCount; ++i) {
 		mRegisterFileWritten[i] = false;
 	}
+	// the zero register of toolchain code, Relocate keeps everything from writing it
+	if (!mCodeLayout.offsets.empty()) {
+		mRegisterFile[0] = 0;
+		mRegisterFileWritten[0] = true;
+	}
+	mRegistersAnalyzed = false;
+	if (mProfiler) {
+		mProfiler.reset(new Profiler(mInstructionSize));
+	}
 }
 
 VirtualMachine::~VirtualMachine() {
-	delete[] mInstructionMemory;
+	ReleaseImage();
+}
+
+void VirtualMachine::ReleaseImage() {
+	// an ELF image belongs to the file mapping
+	if (!mImageMapped) {
+		delete[] mInstructionMemory;
+	}
+	mImageMapped = false;
+	mElf.reset();
+	mInstructionMemory = nullptr;
+	mInstructionSize = 0;
+	mCodeLayout = RiscV::CodeLayout();
 }
 
 bool VirtualMachine::is_ready() const {
@@ -40,17 +128,93 @@ bool VirtualMachine::is_ready() const {
 }
 
 bool VirtualMachine::RegisterDevice(IVirtualDevice* device, RiscV::ADDRESS begin, RiscV::ADDRESS end) {
+	if (!MoveSegments(device, begin, end)) {
+		return false;
+	}
 	TVirtualDeviceInsertResult result = mVirtualDeviceMap.insert(TVirtualDeviceMap::value_type(AddressRange(begin, end), device));
 	assert(result.second);
+	if (result.second) {
+		MapPages(device, begin, end);
+	}
 	return result.second;
 }
 
+void VirtualMachine::MapPages(IVirtualDevice* device, RiscV::ADDRESS begin, RiscV::ADDRESS end) {
+	// the high pages look the new device up again on their next access
+	for (std::unique_ptr<PageLeaf>& leaf : mHighPages) {
+		if (leaf) std::fill(leaf->resolved, leaf->resolved + cLeafPages, 0);
+	}
+	if (begin < 0) return;
+	size_t const dirtyPages = std::min((static_cast<size_t>(end) >> RiscV::cPageBits) + 1, cMaxPages);
+	if (mPageDirty.size() < dirtyPages) {
+		mPageDirty.resize(dirtyPages, 0);
+		mPageCode.resize(dirtyPages, 0);
+	}
+
+	size_t const pageSize = RiscV::cPageSize;
+	size_t const firstPage = (static_cast<size_t>(begin) + pageSize - 1) >> RiscV::cPageBits;
+	size_t const lastPage = std::min((static_cast<size_t>(end) + 1) >> RiscV::cPageBits, cMaxPages);	// exclusive
+	if (firstPage >= lastPage) {
+		// no page is completely covered, accesses keep going through the device map
+		return;
+	}
+	if (mPageMemory.size() < lastPage) {
+		mPageMemory.resize(lastPage, nullptr);
+		mPageDevices.resize(lastPage, PageDevice{ nullptr, 0 });
+	}
+
+	size_t hostSize = 0;
+	uint8_t* host = device->HostMemory(hostSize);
+	for (size_t page = firstPage; page < lastPage; ++page) {
+		size_t const offset = (page << RiscV::cPageBits) - static_cast<size_t>(begin);
+		if (host != nullptr && offset + pageSize <= hostSize) {
+			mPageMemory[page] = host + offset;
+			mPageDevices[page] = PageDevice{ nullptr, 0 };
+		}
+		else {
+			mPageMemory[page] = nullptr;
+			mPageDevices[page] = PageDevice{ device, begin };
+		}
+	}
+}
+
+// messages are formatted separately and written in one piece,
+// std::cerr is shared by all virtual machines of a Scheduler
 void VirtualMachine::PrintWarning(std::string const& message) {
-	std::cerr << "warning at pc 0x" << std::setfill('0') << std::setw(4) << std::hex << mPc << ": "
-		<< message << std::endl;
+	std::ostringstream oss;
+	oss << "warning at pc 0x" << std::setfill('0') << std::setw(4) << std::hex << mPc << ": " << message << std::endl;
+	mConsole->Flush();
+	std::cerr << oss.str();
+}
+
+void VirtualMachine::Fault(std::string const& message) {
+	PrintWarning(message);
+	if (mTracer) mTracer->Fault();
+	if (mStopOnFault && !mFinished) {
+		Stop(StopReason::Fault);
+		mFaultPc = mPc;
+		mFaultMessage = message;
+		// the engines leave at their next budget check
+		mBudgetEnd = 0;
+		mJitContext.limit = 0;
+		mTranslationContext.limit = 0;
+	}
+}
+
+void VirtualMachine::Stop(StopReason reason) {
+	if (mFinished) return;
+	mFinished = true;
+	mStopReason = reason;
 }
 
-RiscV::WORD VirtualMachine::ReadRegisterFile(size_t idx) {
+void VirtualMachine::PrintInfo(std::string const& message) {
+	std::ostringstream oss;
+	oss << "info at pc 0x" << std::setfill('0') << std::setw(4) << std::hex << mPc << ": " << message << std::endl;
+	mConsole->Flush();
+	std::cerr << oss.str();
+}
+
+void VirtualMachine::CheckRegisterRead(size_t idx) {
 	if (idx >= mRegCount) {
 		std::ostringstream oss;
 		oss << "using higher register index than allowed index " << (mRegCount - 1);
@@ -61,17 +225,40 @@ RiscV::WORD VirtualMachine::ReadRegisterFile(size_t idx) {
 		oss << "register index " << idx << " has not been used yet and has undefined value";
 		PrintWarning(oss.str());
 	}
-	return mRegisterFile[idx];
 }
 
-void VirtualMachine::WriteRegisterFile(size_t idx, RiscV::WORD const& data) {
+void VirtualMachine::CheckRegisterWrite(size_t idx) {
 	if (idx >= mRegCount) {
 		std::ostringstream oss;
 		oss << "using higher register index than allowed index " << (mRegCount - 1);
 		PrintWarning(oss.str());
 	}
-	mRegisterFile[idx] = data;
-	mRegisterFileWritten[idx] = true;
+}
+
+void VirtualMachine::AnalyzeRegisters() {
+	mRegistersAnalyzed = true;
+	RiscV::RegisterCheck check = RiscV::CheckRegisters(mDecodedInstructions, mPc, mRegisterFileWritten, mRegCount);
+	std::vector<RiscV::RegisterFinding> const& findings = check.findings;
+	mCheckRegisters = !findings.empty();
+	mIndirectTargets.swap(check.indirectTargets);
+
+	// the same findings would come up as warnings again and again while running, list them once
+	size_t const cMaxReported = 20;
+	std::ostringstream oss;
+	for (size_t i = 0; i < findings.size() && i < cMaxReported; ++i) {
+		oss << "warning at pc 0x" << std::setfill('0') << std::setw(4) << std::hex << findings[i].pc << std::dec << ": register index " << findings[i].reg;
+		if (findings[i].outOfRange) {
+			oss << " is higher than allowed index " << (mRegCount - 1) << std::endl;
+		}
+		else {
+			oss << " may be read before it is written" << std::endl;
+		}
+	}
+	if (findings.size() > cMaxReported) {
+		oss << "warning: " << (findings.size() - cMaxReported) << " more register findings" << std::endl;
+	}
+	mConsole->Flush();
+	std::cerr << oss.str();
 }
 
 VirtualMachine::TVirtualDeviceMap::iterator VirtualMachine::GetVirtualDevice(RiscV::ADDRESS address) {
@@ -82,33 +269,258 @@ VirtualMachine::TVirtualDeviceMap::iterator VirtualMachine::GetVirtualDevice(Ris
 	return iter;
 }
 
-RiscV::WORD VirtualMachine::ReadMemory(RiscV::ADDRESS address) {
+VirtualMachine::PageLeaf& VirtualMachine::HighPage(size_t page, size_t& slot) {
+	size_t const index = (page - cMaxPages) >> cLeafBits;
+	if (mHighPages.empty()) {
+		mHighPages.resize(((size_t(1) << (32 - RiscV::cPageBits)) - cMaxPages) >> cLeafBits);
+	}
+	if (!mHighPages[index]) {
+		mHighPages[index].reset(new PageLeaf());
+	}
+	PageLeaf& leaf = *mHighPages[index];
+	slot = (page - cMaxPages) & (cLeafPages - 1);
+	if (leaf.resolved[slot]) return leaf;
+
+	// like MapPages, only a page the device covers completely gets an entry
+	leaf.resolved[slot] = 1;
+	leaf.memory[slot] = nullptr;
+	leaf.devices[slot] = PageDevice{ nullptr, 0 };
+	RiscV::ADDRESS const address = static_cast<RiscV::ADDRESS>(static_cast<uint32_t>(page << RiscV::cPageBits));
+	TVirtualDeviceMap::iterator iter = GetVirtualDevice(address);
+	if (iter == mVirtualDeviceMap.end() || static_cast<int64_t>(address) + static_cast<int64_t>(RiscV::cPageSize) - 1 > iter->first.End()) {
+		return leaf;
+	}
+	size_t hostSize = 0;
+	uint8_t* host = iter->second->HostMemory(hostSize);
+	size_t const offset = static_cast<size_t>(static_cast<int64_t>(address) - iter->first.Begin());
+	if (host != nullptr && offset + RiscV::cPageSize <= hostSize) {
+		leaf.memory[slot] = host + offset;
+	}
+	else {
+		leaf.devices[slot] = PageDevice{ iter->second, iter->first.Begin() };
+	}
+	return leaf;
+}
+
+RiscV::WORD VirtualMachine::ReadDeviceMap(RiscV::ADDRESS address, size_t size) {
+	size_t const page = static_cast<uint32_t>(address) >> RiscV::cPageBits;
+	size_t const offset = static_cast<size_t>(address & RiscV::cPageMask);
+	if (page >= cMaxPages && offset + size <= RiscV::cPageSize) {
+		size_t slot = 0;
+		PageLeaf const& leaf = HighPage(page, slot);
+		if (leaf.memory[slot] != nullptr) {
+			uint32_t data = 0;
+			std::memcpy(&data, leaf.memory[slot] + offset, size);
+			return static_cast<RiscV::WORD>(data);
+		}
+		if (leaf.devices[slot].device != nullptr) {
+			return leaf.devices[slot].device->Read(address - leaf.devices[slot].begin, size);
+		}
+	}
+
 	TVirtualDeviceMap::iterator iter = GetVirtualDevice(address);
 	if (iter == mVirtualDeviceMap.end()) {
 		std::ostringstream oss;
 		oss << "read from undefined memory address 0x" << std::setfill('0') << std::setw(4) << std::hex << address;
-		PrintWarning(oss.str());
+		Fault(oss.str());
 		return 0;
 	}
-	return iter->second->Read(address - iter->first.Begin());
+	if (static_cast<int64_t>(address) + static_cast<int64_t>(size) - 1 <= iter->first.End()) {
+		return iter->second->Read(address - iter->first.Begin(), size);
+	}
+
+	// the access continues behind the end of the device, assemble it byte by byte
+	uint32_t data = 0;
+	for (size_t i = 0; i < size; ++i) {
+		data |= static_cast<uint32_t>(ReadDeviceMap(address + static_cast<RiscV::ADDRESS>(i), 1)) << (8 * i);
+	}
+	return static_cast<RiscV::WORD>(data);
 }
 
-void VirtualMachine::WriteMemory(RiscV::ADDRESS address, RiscV::WORD const& data) {
+void VirtualMachine::WriteDeviceMap(RiscV::ADDRESS address, RiscV::WORD const& data, size_t size) {
+	size_t const page = static_cast<uint32_t>(address) >> RiscV::cPageBits;
+	size_t const offset = static_cast<size_t>(address & RiscV::cPageMask);
+	if (page >= cMaxPages && offset + size <= RiscV::cPageSize) {
+		size_t slot = 0;
+		PageLeaf& leaf = HighPage(page, slot);
+		if (leaf.memory[slot] != nullptr) {
+			std::memcpy(leaf.memory[slot] + offset, &data, size);
+			leaf.dirty[slot] = 1;
+			return;
+		}
+		if (leaf.devices[slot].device != nullptr) {
+			leaf.devices[slot].device->Write(address - leaf.devices[slot].begin, data, size);
+			leaf.dirty[slot] = 1;
+			return;
+		}
+	}
+
 	TVirtualDeviceMap::iterator iter = GetVirtualDevice(address);
 	if (iter == mVirtualDeviceMap.end()) {
 		std::ostringstream oss;
 		oss << "write to undefined memory address 0x" << std::setfill('0') << std::setw(4) << std::hex << address;
-		PrintWarning(oss.str());
+		Fault(oss.str());
 		return;
 	}
-	iter->second->Write(address - iter->first.Begin(), data);
+	if (static_cast<int64_t>(address) + static_cast<int64_t>(size) - 1 <= iter->first.End()) {
+		iter->second->Write(address - iter->first.Begin(), data, size);
+		MarkDirty(address, size);
+		return;
+	}
+
+	for (size_t i = 0; i < size; ++i) {
+		WriteDeviceMap(address + static_cast<RiscV::ADDRESS>(i), static_cast<uint32_t>(data) >> (8 * i) & 0xff, 1);
+	}
+}
+
+void VirtualMachine::MarkDirty(RiscV::ADDRESS address, size_t size) {
+	if (size == 0) return;
+	size_t const first = static_cast<uint32_t>(address) >> RiscV::cPageBits;
+	size_t const last = std::min((static_cast<size_t>(static_cast<uint32_t>(address)) + size - 1) >> RiscV::cPageBits,
+		(size_t(1) << (32 - RiscV::cPageBits)) - 1);
+	for (size_t page = first; page <= last; ++page) {
+		if (page < mPageDirty.size()) {
+			mPageDirty[page] = 1;
+			if (mPageCode[page] == cCodeValid) InvalidateCode(page);
+		}
+		else if (page >= cMaxPages) {
+			size_t slot = 0;
+			HighPage(page, slot).dirty[slot] = 1;
+		}
+	}
+}
+
+bool VirtualMachine::PageDirty(size_t page) const {
+	if (page < mPageDirty.size()) return mPageDirty[page] != 0;
+	if (page < cMaxPages) return true;
+	// a leaf that does not exist yet has not been written
+	size_t const index = (page - cMaxPages) >> cLeafBits;
+	return index < mHighPages.size() && mHighPages[index] && mHighPages[index]->dirty[(page - cMaxPages) & (cLeafPages - 1)] != 0;
+}
+
+void VirtualMachine::ClearDirty() {
+	std::fill(mPageDirty.begin(), mPageDirty.end(), 0);
+	for (std::unique_ptr<PageLeaf>& leaf : mHighPages) {
+		if (leaf) std::fill(leaf->dirty, leaf->dirty + cLeafPages, 0);
+	}
+}
+
+bool VirtualMachine::MapInstructions(RiscV::ADDRESS base, size_t count) {
+	if (!is_ready()) return false;
+	if (!mCodeLayout.offsets.empty()) {
+		std::cerr << "Toolchain code is relocated while loading and cannot be mapped into memory" << std::endl;
+		return false;
+	}
+	count = std::max(count, mInstructionSize);
+	int64_t const end = static_cast<int64_t>(base) + static_cast<int64_t>(count * sizeof(RiscV::INSTRUCTION));
+	std::vector<RiscV::INSTRUCTION> image(count);
+	if (base < 0 || base % sizeof(RiscV::INSTRUCTION) != 0 || count == 0 || end > static_cast<int64_t>(cMaxPages << RiscV::cPageBits) ||
+		!ReadBlock(base, image.data(), count * sizeof(RiscV::INSTRUCTION))) {
+		std::cerr << "Instructions at 0x" << std::hex << base << std::dec << " do not fit the registered memory" << std::endl;
+		return false;
+	}
+	std::copy(mInstructionMemory, mInstructionMemory + mInstructionSize, image.begin());
+	WriteBlock(base, image.data(), image.size() * sizeof(RiscV::INSTRUCTION));
+
+	// from now on the image is a copy of the memory, refreshed page by page
+	RiscV::ADDRESS const pc = mPc;
+	Load(image);
+	mPc = pc;
+	mCodeBase = base;
+	for (size_t page = static_cast<size_t>(base) >> RiscV::cPageBits; page <= static_cast<size_t>(end - 1) >> RiscV::cPageBits; ++page) {
+		mPageCode[page] = cCodeValid;
+	}
+	return true;
+}
+
+void VirtualMachine::InvalidateCode(size_t page) {
+	mPageCode[page] = cCodeStale;
+	mStaleCodePages.push_back(page);
+	// the engines leave at their next budget check, Run decodes the page and continues
+	if (mBudgetEnd != 0) {
+		mResumeBudgetEnd = mBudgetEnd;
+		mBudgetEnd = 0;
+	}
+	mJitContext.limit = 0;
+	mTranslationContext.limit = 0;
+}
+
+bool VirtualMachine::RefreshCode() {
+	if (mStaleCodePages.empty()) return false;
+	// the image is our own copy since MapInstructions
+	RiscV::INSTRUCTION* const image = const_cast<RiscV::INSTRUCTION*>(mInstructionMemory);
+	int64_t const codeEnd = static_cast<int64_t>(mInstructionSize);
+	for (size_t page : mStaleCodePages) {
+		mPageCode[page] = cCodeValid;
+		int64_t const pageBegin = static_cast<int64_t>(page << RiscV::cPageBits) - mCodeBase;
+		RiscV::ADDRESS const begin = static_cast<RiscV::ADDRESS>(std::max<int64_t>(pageBegin / static_cast<int64_t>(sizeof(RiscV::INSTRUCTION)), 0));
+		RiscV::ADDRESS const end = static_cast<RiscV::ADDRESS>(std::min<int64_t>((pageBegin + static_cast<int64_t>(RiscV::cPageSize)) / static_cast<int64_t>(sizeof(RiscV::INSTRUCTION)), codeEnd));
+		ReadBlock(mCodeBase + begin * static_cast<RiscV::ADDRESS>(sizeof(RiscV::INSTRUCTION)), image + begin, (end - begin) * sizeof(RiscV::INSTRUCTION));
+		for (RiscV::ADDRESS i = begin; i < end; ++i) {
+			mDecodedInstructions[i] = RiscV::Decode(image[i]);
+			if (ReadsEventCounter(mDecodedInstructions[i])) mCountsEvents = true;
+		}
+
+		// a threaded entry also depends on the instruction behind it for fusion
+		for (size_t i = 0; i < cThreadedLoops; ++i) {
+			if (!mThreadedCode[i].empty()) mStaleThreadedCode[i].push_back(std::make_pair(std::max(begin - 1, 0), end));
+		}
+		if (mJit && !mJit->Invalidate(begin, end)) {
+			mJit.reset();
+		}
+	}
+	mStaleCodePages.clear();
+	// translated once for the image it was made from
+	mTranslation = nullptr;
+
+	// the register analysis only knew the old code, check again from here without a report,
+	// the findings come up as warnings once they execute
+	if (mRegistersAnalyzed) {
+		RiscV::RegisterCheck check = RiscV::CheckRegisters(mDecodedInstructions, mPc, mRegisterFileWritten, mRegCount);
+		mCheckRegisters = !check.findings.empty();
+		mIndirectTargets.swap(check.indirectTargets);
+	}
+	if (mBudgetEnd == 0 && !mFinished) {
+		mBudgetEnd = mResumeBudgetEnd;
+	}
+	return true;
+}
+
+bool VirtualMachine::ReadBlock(RiscV::ADDRESS address, void* buffer, size_t size) {
+	uint8_t* bytes = static_cast<uint8_t*>(buffer);
+	while (size > 0) {
+		TVirtualDeviceMap::iterator iter = GetVirtualDevice(address);
+		if (iter == mVirtualDeviceMap.end()) return false;
+		size_t const chunk = std::min(size, static_cast<size_t>(iter->first.End() - address) + 1);
+		iter->second->ReadBlock(address - iter->first.Begin(), bytes, chunk);
+		address += static_cast<RiscV::ADDRESS>(chunk);
+		bytes += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+bool VirtualMachine::WriteBlock(RiscV::ADDRESS address, void const* buffer, size_t size) {
+	uint8_t const* bytes = static_cast<uint8_t const*>(buffer);
+	while (size > 0) {
+		TVirtualDeviceMap::iterator iter = GetVirtualDevice(address);
+		if (iter == mVirtualDeviceMap.end()) return false;
+		size_t const chunk = std::min(size, static_cast<size_t>(iter->first.End() - address) + 1);
+		iter->second->WriteBlock(address - iter->first.Begin(), bytes, chunk);
+		MarkDirty(address, chunk);
+		address += static_cast<RiscV::ADDRESS>(chunk);
+		bytes += chunk;
+		size -= chunk;
+	}
+	return true;
 }
 
 bool VirtualMachine::SetPc(RiscV::ADDRESS pc) {
 	bool pcOutOfRange = pc >= mInstructionSize;
 	if (pcOutOfRange) {
+		Stop(StopReason::PcOutOfRange);
 		std::string warning = "program counter went out of range (0d" + std::to_string(pc) + "), stopping virtual machine";
-		PrintWarning(warning);
+		Fault(warning);
 	}
 	else {
 		mPc = pc;
@@ -116,523 +528,656 @@ bool VirtualMachine::SetPc(RiscV::ADDRESS pc) {
 	return !pcOutOfRange;
 }
 
+RiscV::WORD VirtualMachine::ReadCounter(uint32_t csr) const {
+	using namespace RiscV::CsrType;
+	uint64_t value = 0;
+	switch (csr) {
+	case CSR_CYCLE: case CSR_CYCLEH:
+	case CSR_TIME: case CSR_TIMEH:
+		// the engines count an instruction before they execute it
+		value = Cycles() - 1;
+		break;
+	case CSR_INSTRET: case CSR_INSTRETH:
+		value = mExecutedInstructions - 1;
+		break;
+	case CSR_LOADS: case CSR_LOADSH:
+		value = mLoads;
+		break;
+	case CSR_STORES: case CSR_STORESH:
+		value = mStores;
+		break;
+	case CSR_BRANCHES: case CSR_BRANCHESH:
+		value = mTakenBranches;
+		break;
+	}
+	bool const high = csr == CSR_CYCLEH || csr == CSR_TIMEH || csr == CSR_INSTRETH ||
+		csr == CSR_LOADSH || csr == CSR_STORESH || csr == CSR_BRANCHESH;
+	return static_cast<RiscV::WORD>(static_cast<uint32_t>(high ? value >> 32 : value));
+}
+
+RiscV::WORD VirtualMachine::ShiftRightArithmetic(RiscV::WORD value, RiscV::WORD shamt) {
+	// the vacated bits are filled with copies of the most-significant bit
+	if (value < 0 && shamt > 0) {
+		return value >> shamt | ~(~0U >> shamt);
+	}
+	return value >> shamt;
+}
+
 using namespace RiscV;
 
-void VirtualMachine::Run() {
+void VirtualMachine::Run(Engine engine) {
+	// the host or a snapshot may have written code since the last run
+	RefreshCode();
+	if (!mRegistersAnalyzed) {
+		AnalyzeRegisters();
+	}
+	// the engines do not look at the host clock, a console that flushes on time is polled between
+	// slices of this many instructions
+	uint64_t const cPollSlice = 1 << 20;
+	uint64_t const budgetEnd = mBudgetEnd;
+	bool const poll = mConsole->FlushesOnTime();
+	do {
+		if (poll) mBudgetEnd = std::min(budgetEnd, mExecutedInstructions + cPollSlice);
+		// only the switch engine knows how to print, profile and trace instructions
+		if (mVerbose || mProfiler || mTracer || engine == Engine::Switch) {
+			RunSwitch();
+		}
+		// only the interpreters keep the event counters
+		else if (engine == Engine::Threaded || mCountsEvents) {
+			RunThreaded();
+		}
+		else if (engine == Engine::Translated) {
+			RunTranslated();
+		}
+		else {
+			RunJit();
+		}
+		if (poll) mConsole->Poll();
+		// the engines come back after a store to code
+	} while ((RefreshCode() || poll) && !Finished() && mExecutedInstructions < budgetEnd);
+	mBudgetEnd = budgetEnd;
+	if (Finished()) {
+		mConsole->Flush();
+	}
+}
 
-	// run until either PC oversteps all instructions or 
-	// a sleep statement was reached
-	while (mPc < mInstructionSize) {
+void VirtualMachine::SetConsole(ConsoleDevice* console) {
+	mConsole->Flush();
+	mConsole = console != nullptr ? console : mOwnConsole.get();
+}
 
-		RiscV::INSTRUCTION inst = mInstructionMemory[mPc];
-		if(mVerbose) std::cout << std::endl << "0x" << std::setfill('0') << std::setw(4) << std::hex << mPc << ": ";
-		
+bool VirtualMachine::RunSlice(Engine engine, uint64_t budget) {
+	if (Finished()) return false;
+	mBudgetEnd = mExecutedInstructions + budget;
+	Run(engine);
+	mBudgetEnd = UINT64_MAX;
+	return !Finished();
+}
 
-		// first get all parts of the instruction
-		// some of these variables might be invalid for the current instruction,
-		// but like this the logic inside the switch-case can be reduced
+VirtualMachine::StepResult VirtualMachine::Step(uint64_t budget, Engine engine) {
+	uint64_t const executed = mExecutedInstructions;
+	if (!Finished() && budget > 0) {
+		mBudgetEnd = mExecutedInstructions + budget;
+		mStopOnFault = true;
+		Run(engine);
+		mStopOnFault = false;
+		mBudgetEnd = UINT64_MAX;
+	}
 
-		RiscV::BYTE opcode = RiscV::MaskOpcode(inst);
-		RiscV::BYTE f3 = RiscV::MaskFunct3(inst);
-		RiscV::BYTE f7 = RiscV::MaskFunct7(inst);
-		RiscV::BYTE rd = RiscV::MaskRd(inst);
-		RiscV::BYTE rs1 = RiscV::MaskRs1(inst);
-		RiscV::BYTE rs2 = RiscV::MaskRs2(inst);
+	StepResult result = { StopReason::Budget, mExecutedInstructions - executed, mPc };
+	if (Finished()) {
+		// an image that starts outside of itself never ran
+		result.reason = mFinished ? mStopReason : StopReason::PcOutOfRange;
+		if (result.reason == StopReason::Fault) result.pc = mFaultPc;
+	}
+	return result;
+}
 
-		// I-Type immediates
+std::string const& VirtualMachine::FaultMessage() const {
+	return mFaultMessage;
+}
 
-		RiscV::WORD imm_11to0 = (inst & 0xfff00000) >> 20;
-		RiscV::WORD f6 = (inst & 0xfc000000) >> 26;
-		RiscV::WORD shamt = (inst & 0x3f00000) >> 20;
+RiscV::ADDRESS VirtualMachine::Pc() const {
+	return mPc;
+}
 
-		// S-Type immediates
+RiscV::WORD VirtualMachine::Register(size_t idx) const {
+	return idx < RiscV::cRegCount ? mRegisterFile[idx] : 0;
+}
 
-		RiscV::BYTE imm_4to0 = (inst & 0xf80) >> 7;
-		RiscV::BYTE imm_11to5 = (inst & 0xfe000000) >> 25;
+void VirtualMachine::SetRegister(size_t idx, RiscV::WORD value) {
+	if (idx >= RiscV::cRegCount) return;
+	mRegisterFile[idx] = value;
+	mRegisterFileWritten[idx] = true;
+}
 
-		// B-Type immediates
+bool VirtualMachine::EnableProfiling(std::string const& symbolFile) {
+	mProfiler.reset(new Profiler(mInstructionSize));
+	return symbolFile.empty() || mProfiler->LoadSymbols(symbolFile);
+}
 
-		RiscV::BYTE imm11b = (inst & (1 << 31)) >> 31;       
-		RiscV::BYTE imm10b = (inst & (1 << 7)) >> 7;         
-		RiscV::BYTE imm_9to4 = (inst & 0x7E000000) >> 25;     
-		RiscV::BYTE imm_3to0 = (inst & 0xF00) >> 8;     
+bool VirtualMachine::WriteProfile(std::string const& fileName) const {
+	if (!mProfiler) return false;
+	std::vector<AddressRange> devices;
+	for (auto const& entry : mVirtualDeviceMap) {
+		devices.push_back(entry.first);
+	}
+	return mProfiler->Write(fileName, mInstructionMemory, mDecodedInstructions, devices);
+}
 
+bool VirtualMachine::EnableTrace(std::string const& fileName, uint64_t sampleEvery, size_t lastRecords) {
+	mTracer.reset(new Tracer(fileName, mRegisterFile, sampleEvery, lastRecords));
+	return mTracer->is_ready();
+}
 
-		// U-Type immediates
+bool VirtualMachine::Finished() const {
+	return mFinished || mPc < 0 || static_cast<size_t>(mPc) >= mInstructionSize;
+}
 
-		RiscV::WORD imm_31to12 = (inst & 0xfffff000) >> 12;
+uint64_t VirtualMachine::ExecutedInstructions() const {
+	return mExecutedInstructions;
+}
 
-		// J-Type immediates
-		
-		RiscV::BYTE imm19 = (inst & (1 << 31)) >> 31;
-		RiscV::BYTE imm_1811 = (inst & 0xFF000) >> 12;
-		RiscV::BYTE imm10j = (inst & (1 << 20)) >> 20;
-		RiscV::WORD imm_9to0 = (inst & 0x7FE00000) >> 21;
+uint64_t VirtualMachine::Cycles() const {
+	return mExecutedInstructions + mSkippedCycles;
+}
 
-		bool executeJump = false;
+void VirtualMachine::SkipCycles(uint64_t cycles) {
+	mSkippedCycles += cycles;
+}
 
-		switch (opcode) {
-		case RiscV::PType::OP_TYPE_SLEEP: {
-			std::cerr << "info at pc 0x" << std::setfill('0') << std::setw(4) << std::hex << mPc << ": sleep instruction reached, ending execution" << std::endl;
-			return;
+uint64_t VirtualMachine::FusionHits(RiscV::Fusion fusion) const {
+	return mFusionHits[static_cast<size_t>(fusion)];
+}
+
+void VirtualMachine::RunSwitch() {
+	typedef void (VirtualMachine::*Loop)();
+	// indexed by register checks, verbose, trace, profile and event counting, in that bit order
+	static Loop const cLoops[] = {
+		&VirtualMachine::RunSwitchLoop<Policy<false, false, false, false, false>>, &VirtualMachine::RunSwitchLoop<Policy<false, false, false, false, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<false, false, false, true, false>>, &VirtualMachine::RunSwitchLoop<Policy<false, false, false, true, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<false, false, true, false, false>>, &VirtualMachine::RunSwitchLoop<Policy<false, false, true, false, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<false, false, true, true, false>>, &VirtualMachine::RunSwitchLoop<Policy<false, false, true, true, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<false, true, false, false, false>>, &VirtualMachine::RunSwitchLoop<Policy<false, true, false, false, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<false, true, false, true, false>>, &VirtualMachine::RunSwitchLoop<Policy<false, true, false, true, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<false, true, true, false, false>>, &VirtualMachine::RunSwitchLoop<Policy<false, true, true, false, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<false, true, true, true, false>>, &VirtualMachine::RunSwitchLoop<Policy<false, true, true, true, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<true, false, false, false, false>>, &VirtualMachine::RunSwitchLoop<Policy<true, false, false, false, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<true, false, false, true, false>>, &VirtualMachine::RunSwitchLoop<Policy<true, false, false, true, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<true, false, true, false, false>>, &VirtualMachine::RunSwitchLoop<Policy<true, false, true, false, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<true, false, true, true, false>>, &VirtualMachine::RunSwitchLoop<Policy<true, false, true, true, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<true, true, false, false, false>>, &VirtualMachine::RunSwitchLoop<Policy<true, true, false, false, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<true, true, false, true, false>>, &VirtualMachine::RunSwitchLoop<Policy<true, true, false, true, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<true, true, true, false, false>>, &VirtualMachine::RunSwitchLoop<Policy<true, true, true, false, true>>,
+		&VirtualMachine::RunSwitchLoop<Policy<true, true, true, true, false>>, &VirtualMachine::RunSwitchLoop<Policy<true, true, true, true, true>>,
+	};
+
+	for (;;) {
+		bool const checked = mCheckRegisters;
+		size_t const index = (checked ? 16 : 0) | (mVerbose ? 8 : 0) | (mTracer ? 4 : 0) | (mProfiler ? 2 : 0) | (mCountsEvents ? 1 : 0);
+		(this->*cLoops[index])();
+		// a loop without register checks also leaves once a jalr turned them on
+		if (Finished() || mExecutedInstructions >= mBudgetEnd || checked == mCheckRegisters) return;
+	}
+}
+
+template <class P>
+void VirtualMachine::RunSwitchLoop() {
+
+	// run until either PC oversteps all instructions or 
+	// a sleep statement was reached
+	while (mPc < mInstructionSize) {
+		if (!ExecuteOne<P>()) return;
+		if (mExecutedInstructions >= mBudgetEnd) return;
+	}
+}
+
+bool VirtualMachine::ExecuteOne() {
+	return mCheckRegisters ? ExecuteOne<CheckedPolicy>() : ExecuteOne<UncheckedPolicy>();
+}
+
+template <class P>
+bool VirtualMachine::ExecuteOne() {
+	DecodedInstruction const& inst = mDecodedInstructions[mPc];
+	RiscV::ADDRESS const pc = mPc;
+	++mExecutedInstructions;
+	if (P::cProfile) mProfiler->Count(pc, inst, mRegisterFile);
+	if (P::cTrace) mTracer->Count(mExecutedInstructions, pc, mInstructionMemory[pc], inst);
+	if (P::cVerbose) std::cout << std::endl << "0x" << std::setfill('0') << std::setw(4) << std::hex << mPc << ": ";
+
+	// all fields were extracted once at load time,
+	// the decoded handler already accounts for opcode, f3 and f7
+	RiscV::BYTE const rd = inst.rd;
+	RiscV::BYTE const rs1 = inst.rs1;
+	RiscV::BYTE const rs2 = inst.rs2;
+	RiscV::WORD const imm = inst.imm;
+
+	bool executeJump = false;
+
+	switch (inst.handler) {
+	case Handler::SLEEP: {
+		PrintInfo("sleep instruction reached, ending execution");
+		Stop(StopReason::Sleep);
+		return false;
+	}
+	case Handler::CSRR: {
+		RiscV::WORD const value = ReadCounter(static_cast<uint32_t>(imm));
+		WriteRegisterFile<P>(rd, value);
+		if (P::cVerbose) std::cout << "csrr" << " r" << (int)rd << ",0x" << std::hex << imm << std::dec << "     ; res=" << value;
+		break;
+	}
+	case Handler::CSR_ILLEGAL: {
+		Fault("illegal csr access, only reading the counters is supported");
+		break;
+	}
+	case Handler::PRINT: {
+		// for the date of this implementation, string == int
+		mConsole->Print(ReadRegisterFile<P>(rs1));
+		// the instruction trace goes to std::cout, keep the value on its line
+		if (P::cVerbose) mConsole->Flush();
+		break;
+	}
+	case Handler::ADD: {
+		RiscV::WORD res = ReadRegisterFile<P>(rs1) + ReadRegisterFile<P>(rs2);
+		WriteRegisterFile<P>(rd, res);
+		if (P::cVerbose) std::cout << "add" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2 << "     ; res=" << res;
+		break;
+	}
+	case Handler::SUB: {
+		RiscV::WORD res = ReadRegisterFile<P>(rs1) - ReadRegisterFile<P>(rs2);
+		WriteRegisterFile<P>(rd, res);
+		if (P::cVerbose) std::cout << "sub" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::SLL: {
+		// shift left logical: shift x[rs1] left by x[rs2] bit positions, result into rd
+		// only bits 4:0 of x[rs2] are the shift amount, upper bits are ignored
+		RiscV::WORD valRs1 = ReadRegisterFile<P>(rs1);
+		RiscV::WORD valRs2 = ReadRegisterFile<P>(rs2);
+		RiscV::BYTE shamt = (valRs2 & 0x1F); // take the lower 5 bits of value as shamt
+		WriteRegisterFile<P>(rd, valRs1 << shamt);
+		if (P::cVerbose) std::cout << "sll" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::SLT: {
+		// compare rs1 and rs2 as signed numbers
+		// write 1 to rd ir rs1 < rs2, write 0 to rd if rs1 > rs2
+		RiscV::WORD res = (ReadRegisterFile<P>(rs1) < ReadRegisterFile<P>(rs2)) ? 1 : 0;
+		WriteRegisterFile<P>(rd, res);
+		if (P::cVerbose) std::cout << "slt" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::SLTU: {
+		// compare rs1 and rs2 as unsigned numbers
+		RiscV::WORD res = ((uint32_t)ReadRegisterFile<P>(rs1) < (uint32_t)ReadRegisterFile<P>(rs2)) ? 1 : 0;
+		WriteRegisterFile<P>(rd, res);
+		if (P::cVerbose) std::cout << "sltu" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::XOR: {
+		RiscV::WORD res = ReadRegisterFile<P>(rs1) ^ ReadRegisterFile<P>(rs2);
+		WriteRegisterFile<P>(rd, res);
+		if (P::cVerbose) std::cout << "xor" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::SRL: {
+		// shift logical right: shift x[rs1] right by x[rs2] bit positions, result into rd
+		// only bits 4:0 of x[rs2] are the shift amount, upper bits are ignored
+		RiscV::WORD valRs1 = ReadRegisterFile<P>(rs1);
+		RiscV::BYTE shamt = (ReadRegisterFile<P>(rs2) & 0x1F);
+		WriteRegisterFile<P>(rd, (unsigned)valRs1 >> shamt);
+		if (P::cVerbose) std::cout << "srl" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::SRA: {
+		// shift arithmetic right: shift x[rs1] right by x[rs2] bit positions, result into rd
+		// only bits 4:0 of x[rs2] are the shift amount, upper bits are ignored
+		// the vacated bits are filled with copies of x[rs1] most-significant bit
+		RiscV::WORD valRs1 = ReadRegisterFile<P>(rs1);
+		RiscV::BYTE shamt = (ReadRegisterFile<P>(rs2) & 0x1F);
+		WriteRegisterFile<P>(rd, ShiftRightArithmetic(valRs1, shamt));
+		if (P::cVerbose) std::cout << "sra" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::OR: {
+		RiscV::WORD res = ReadRegisterFile<P>(rs1) | ReadRegisterFile<P>(rs2);
+		WriteRegisterFile<P>(rd, res);
+		if (P::cVerbose) std::cout << "or" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::AND: {
+		RiscV::WORD res = ReadRegisterFile<P>(rs1) & ReadRegisterFile<P>(rs2);
+		WriteRegisterFile<P>(rd, res);
+		if (P::cVerbose) std::cout << "and" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::DIV: {
+		RiscV::WORD valRs1 = ReadRegisterFile<P>(rs1);
+		RiscV::WORD valRs2 = ReadRegisterFile<P>(rs2);
+		if (valRs2 == 0) {
+			PrintWarning("trying to divide through 0, not executing instruction");
+			// set result code to "error/failed"
 			break;
 		}
-		case RiscV::PType::OP_TYPE_PRINT: {
-			// print according to f3
-			if (f3 == RiscV::PType::FUNC3_INT) {
-				std::cout << (int)ReadRegisterFile(rs1) << std::endl;
-			}
-			else if (f3 == RiscV::PType::FUNC3_STRING) {
-				// for the date of this implementation, string == int
-				std::cout << ReadRegisterFile(rs1) << std::endl;
-			}
-			break;
+		WriteRegisterFile<P>(rd, valRs1 / valRs2);
+		if (P::cVerbose) std::cout << "div" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::DIVU: {
+		uint32_t valRs1 = ReadRegisterFile<P>(rs1);
+		uint32_t valRs2 = ReadRegisterFile<P>(rs2);
+		if (valRs2 == 0) {
+			PrintWarning("trying to divide through 0, setting value to 1 instead");
+			valRs2 = 1;
 		}
-		case RiscV::RType::OP_TYPE_REGISTER: {
-			if (f3 == RiscV::RType::FUNC3_ADD && f7 == RiscV::RType::FUNC7_ADD) {
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::WORD res = valRs1 + valRs2;
-				WriteRegisterFile(rd, res);
-
-				if (mVerbose) std::cout << "add" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2 << "     ; res=" << res;
-			}
-			else if (f3 == RiscV::RType::FUNC3_SUB && f7 == RiscV::RType::FUNC7_SUB) {
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::WORD res = valRs1 - valRs2;
-				WriteRegisterFile(rd, res);
-
-				if (mVerbose) std::cout << "sub" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RiscV::RType::FUNC3_SLL && f7 == RiscV::RType::FUNC7_SLL) {
-				// shift left logical: shift x[rs1] left by x[rs2] bit positions, result into rd
-				// only bits 4:0 of x[rs2] are the shift amount, upper bits are ignored
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::BYTE shamt = (valRs2 & 0x1F); // take the lower 5 bits of value as shamt
-				RiscV::WORD result = valRs1 << shamt;
-				WriteRegisterFile(rd, result);
-
-				if (mVerbose) std::cout << "sll" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_SLT && f7 == RType::FUNC7_SLT) {
-				// compare rs1 and rs2 as signed numbers
-				// write 1 to rd ir rs1 < rs2, write 0 to rd if rs1 > rs2
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::WORD res = (valRs1 < valRs2) ? 1 : 0;
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "slt" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_SLTU && f7 == RType::FUNC7_SLTU) {
-				// compare rs1 and rs2 as unsigned numbers
-				// write 1 to rd ir rs1 < rs2, write 0 to rd if rs1 > rs2
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::WORD res = ((uint32_t)valRs1 < (uint32_t)valRs2) ? 1 : 0;
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "sltu" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_XOR && f7 == RType::FUNC7_XOR) {
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::WORD res = valRs1 ^ valRs2;
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "xor" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_SRL && f7 == RType::FUNC7_SRL) {
-				// shift logical right: shift x[rs1] right by x[rs2] bit positions, result into rd
-				// only bits 4:0 of x[rs2] are the shift amount, upper bits are ignored
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::BYTE shamt = (valRs2 & 0x1F);
-				RiscV::WORD result = (unsigned)valRs1 >> shamt;
-				WriteRegisterFile(rd, result);
-
-				if (mVerbose) std::cout << "srl" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_SRA && f7 == RType::FUNC7_SRA) {
-				// shift arithmetic right: shift x[rs1] right by x[rs2] bit positions, result into rd
-				// only bits 4:0 of x[rs2] are the shift amount, upper bits are ignored
-				// the vacated bits are filled with copies of x[rs1] most-significant bit
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::BYTE shamt = (valRs2 & 0x1F);
-				RiscV::WORD result = 0;
-
-				if (valRs1 < 0 && shamt > 0) {
-					result = valRs1 >> shamt | ~(~0U >> shamt);
-				}
-				else {
-					result = valRs1 >> shamt;
-				}
-				
-				WriteRegisterFile(rd, result);
-				if (mVerbose) std::cout << "sra" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_OR && f7 == RType::FUNC7_OR) {
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::WORD res = valRs1 | valRs2;
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "or" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_AND && f7 == RType::FUNC7_AND) {
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::WORD res = valRs1 & valRs2;
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "and" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_DIV && f7 == RType::FUNC7_DIV) {
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				if (valRs2 == 0) {
-					PrintWarning("trying to divide through 0, not executing instruction");
-					// set result code to "error/failed"
-					break;
-				}
-				RiscV::WORD res = valRs1 / valRs2;
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "div" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_DIVU && f7 == RType::FUNC7_DIVU) {
-				uint32_t valRs1 = ReadRegisterFile(rs1);
-				uint32_t valRs2 = ReadRegisterFile(rs2);
-				if (valRs2 == 0) {
-					PrintWarning("trying to divide through 0, setting value to 1 instead");
-					valRs2 = 1;
-				}
-				RiscV::WORD res = valRs1 / valRs2;
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "divu" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_REM && f7 == RType::FUNC7_REM) {
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				if (valRs2 == 0) {
-					PrintWarning("trying to modulo through 0, setting value to 1 instead");
-					valRs2 = 1;
-				}
-				RiscV::WORD res = valRs1 % valRs2;
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "rem" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_REMU && f7 == RType::FUNC7_REMU) {
-				uint32_t valRs1 = ReadRegisterFile(rs1);
-				uint32_t valRs2 = ReadRegisterFile(rs2);
-				if (valRs2 == 0) {
-					PrintWarning("trying to modulo through 0, setting value to 1 instead");
-					valRs2 = 1;
-				}
-				RiscV::WORD res = valRs1 % valRs2;
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "remu" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_MUL && f7 == RType::FUNC7_MUL) {
-				// multiplication creates a WORD + WORD = 64 Bit value
-				// mul returns the lower 32 Bit of the 64 Bit result
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::WORD res = ((int64_t)valRs1 * (int64_t)valRs2) & 0xFFFFFFFF;
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "mul" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_MULH && f7 == RType::FUNC7_MULH) {
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				int64_t mult = (int64_t)valRs1 * (int64_t)valRs2;
-				RiscV::WORD res = (mult & 0xFFFFFFFF00000000) >> 32; // take upper 32 bits of 64 bit result 
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "mulh" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_MULHSU && f7 == RType::FUNC7_MULHSU) {
-				//rs1 as signed and rs2 as unsigned number, else like mulh
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::WORD res = (((int64_t)valRs1 * (uint64_t)valRs2) & 0xFFFFFFFF00000000) >> 32; // take upper 32 bits of 64 bit result 
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "mulhsu" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			else if (f3 == RType::FUNC3_MULHU && f7 == RType::FUNC7_MULHU) {
-				// rs1 and rs2 as unsigned number, else like mulh
-				RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-				RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-				RiscV::WORD res = (((uint64_t)valRs1 * (uint64_t)valRs2) & 0xFFFFFFFF00000000) >> 32; // take upper 32 bits of 64 bit result 
-				WriteRegisterFile(rd, res);
-				if (mVerbose) std::cout << "mulhu" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
-			}
-			break;
+		WriteRegisterFile<P>(rd, valRs1 / valRs2);
+		if (P::cVerbose) std::cout << "divu" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::REM: {
+		RiscV::WORD valRs1 = ReadRegisterFile<P>(rs1);
+		RiscV::WORD valRs2 = ReadRegisterFile<P>(rs2);
+		if (valRs2 == 0) {
+			PrintWarning("trying to modulo through 0, setting value to 1 instead");
+			valRs2 = 1;
+		}
+		WriteRegisterFile<P>(rd, valRs1 % valRs2);
+		if (P::cVerbose) std::cout << "rem" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::REMU: {
+		uint32_t valRs1 = ReadRegisterFile<P>(rs1);
+		uint32_t valRs2 = ReadRegisterFile<P>(rs2);
+		if (valRs2 == 0) {
+			PrintWarning("trying to modulo through 0, setting value to 1 instead");
+			valRs2 = 1;
 		}
+		WriteRegisterFile<P>(rd, valRs1 % valRs2);
+		if (P::cVerbose) std::cout << "remu" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::MUL: {
+		// multiplication creates a WORD + WORD = 64 Bit value
+		// mul returns the lower 32 Bit of the 64 Bit result
+		RiscV::WORD res = ((int64_t)ReadRegisterFile<P>(rs1) * (int64_t)ReadRegisterFile<P>(rs2)) & 0xFFFFFFFF;
+		WriteRegisterFile<P>(rd, res);
+		if (P::cVerbose) std::cout << "mul" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::MULH: {
+		int64_t mult = (int64_t)ReadRegisterFile<P>(rs1) * (int64_t)ReadRegisterFile<P>(rs2);
+		WriteRegisterFile<P>(rd, (mult & 0xFFFFFFFF00000000) >> 32); // take upper 32 bits of 64 bit result 
+		if (P::cVerbose) std::cout << "mulh" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::MULHSU: {
+		//rs1 as signed and rs2 as unsigned number, else like mulh
+		RiscV::WORD valRs1 = ReadRegisterFile<P>(rs1);
+		RiscV::WORD valRs2 = ReadRegisterFile<P>(rs2);
+		WriteRegisterFile<P>(rd, (((int64_t)valRs1 * (int64_t)(uint32_t)valRs2) & 0xFFFFFFFF00000000) >> 32); // take upper 32 bits of 64 bit result 
+		if (P::cVerbose) std::cout << "mulhsu" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::MULHU: {
+		// rs1 and rs2 as unsigned number, else like mulh
+		RiscV::WORD valRs1 = ReadRegisterFile<P>(rs1);
+		RiscV::WORD valRs2 = ReadRegisterFile<P>(rs2);
+		WriteRegisterFile<P>(rd, (((uint64_t)(uint32_t)valRs1 * (uint64_t)(uint32_t)valRs2) & 0xFFFFFFFF00000000) >> 32); // take upper 32 bits of 64 bit result 
+		if (P::cVerbose) std::cout << "mulhu" << " r" << (int)rd << ",r" << (int)rs1 << ",r" << (int)rs2;
+		break;
+	}
+	case Handler::SLLI: {
+		WriteRegisterFile<P>(rd, ReadRegisterFile<P>(rs1) << imm);
+		if (P::cVerbose) std::cout << "slli" << " r" << (int)rd << ",r" << (int)rs1 << "," << (int)imm;
+		break;
+	}
+	case Handler::SRLI: {
+		// shift right logical
+		WriteRegisterFile<P>(rd, (unsigned)ReadRegisterFile<P>(rs1) >> imm);
+		if (P::cVerbose) std::cout << "srli" << " r" << (int)rd << ",r" << (int)rs1 << "," << (int)imm;
+		break;
+	}
+	case Handler::SRAI: {
+		WriteRegisterFile<P>(rd, ShiftRightArithmetic(ReadRegisterFile<P>(rs1), imm));
+		if (P::cVerbose) std::cout << "srai" << " r" << (int)rd << ",r" << (int)rs1 << "," << (int)imm;
+		break;
+	}
+	case Handler::SHIFT_ILLEGAL: {
+		// for rv32I, shift immediates are only legal when shamt[5]==0
+		PrintWarning("illegal shift amount, rd=rs1");
+		WriteRegisterFile<P>(rd, ReadRegisterFile<P>(rs1));
+		break;
+	}
+	case Handler::ADDI: {
+		WriteRegisterFile<P>(rd, ReadRegisterFile<P>(rs1) + imm);
+		if (P::cVerbose) std::cout << "addi" << " r" << (int)rd << ",r" << (int)rs1 << "," << imm;
+		break;
+	}
+	case Handler::SLTI: {
+		WriteRegisterFile<P>(rd, (ReadRegisterFile<P>(rs1) < imm) ? 1 : 0);
+		if (P::cVerbose) std::cout << "slti" << " r" << (int)rd << ",r" << (int)rs1 << "," << (int)imm;
+		break;
+	}
+	case Handler::SLTIU: {
+		WriteRegisterFile<P>(rd, ((uint32_t)ReadRegisterFile<P>(rs1) < (uint32_t)imm) ? 1 : 0);
+		if (P::cVerbose) std::cout << "sltiu" << " r" << (int)rd << ",r" << (int)rs1 << "," << (int)imm;
+		break;
+	}
+	case Handler::XORI: {
+		WriteRegisterFile<P>(rd, ReadRegisterFile<P>(rs1) ^ imm);
+		if (P::cVerbose) std::cout << "xori" << " r" << (int)rd << ",r" << (int)rs1 << "," << imm;
+		break;
+	}
+	case Handler::ORI: {
+		WriteRegisterFile<P>(rd, ReadRegisterFile<P>(rs1) | imm);
+		if (P::cVerbose) std::cout << "ori" << " r" << (int)rd << ",r" << (int)rs1 << "," << imm;
+		break;
+	}
+	case Handler::ANDI: {
+		WriteRegisterFile<P>(rd, ReadRegisterFile<P>(rs1) & imm);
+		if (P::cVerbose) std::cout << "andi" << " r" << (int)rd << ",r" << (int)rs1 << "," << imm;
+		break;
+	}
+	case Handler::LB: {
+		WORD addr = ReadRegisterFile<P>(rs1) + imm;
+		WORD data = static_cast<int8_t>(ReadMemory<P>(addr, 1));	// sign-extend the byte
+		WriteRegisterFile<P>(rd, data);
+		if (P::cVerbose) std::cout << "lb" << " r" << (int)rd << ",[r" << (int)rs1 << "]+" << (int)imm << "     ; data=" << data << ", addr=" << addr;
+		break;
+	}
+	case Handler::LH: {
+		WORD addr = ReadRegisterFile<P>(rs1) + imm;
+		WORD data = static_cast<int16_t>(ReadMemory<P>(addr, 2));	// sign-extend the halfword
+		WriteRegisterFile<P>(rd, data);
+		if (P::cVerbose) std::cout << "lh" << " r" << (int)rd << ",[r" << (int)rs1 << "]+" << (int)imm << "     ; data=" << data << ", addr=" << addr;
+		break;
+	}
+	case Handler::LW: {
+		WORD addr = ReadRegisterFile<P>(rs1) + imm;	// get target address from rs1
+		WORD data = ReadMemory<P>(addr, 4);		// read the data from memory
+		WriteRegisterFile<P>(rd, data);
+		if (P::cVerbose) std::cout << "lw" << " r" << (int)rd << ",[r" << (int)rs1 << "]+" << (int)imm << "     ; data=" << data << ", addr=" << addr;
+		break;
+	}
+	case Handler::LBU: {
+		WORD addr = ReadRegisterFile<P>(rs1) + imm;
+		WORD data = ReadMemory<P>(addr, 1);
+		WriteRegisterFile<P>(rd, data);
+		if (P::cVerbose) std::cout << "lbu" << " r" << (int)rd << ",[r" << (int)rs1 << "]+" << (int)imm << "     ; data=" << data << ", addr=" << addr;
+		break;
+	}
+	case Handler::LHU: {
+		WORD addr = ReadRegisterFile<P>(rs1) + imm;
+		WORD data = ReadMemory<P>(addr, 2);
+		WriteRegisterFile<P>(rd, data);
+		if (P::cVerbose) std::cout << "lhu" << " r" << (int)rd << ",[r" << (int)rs1 << "]+" << (int)imm << "     ; data=" << data << ", addr=" << addr;
+		break;
+	}
+	case Handler::SB: {
+		// store the least significant byte of rs2
+		WORD addr = ReadRegisterFile<P>(rs1) + imm;
+		WORD data = ReadRegisterFile<P>(rs2);
+		WriteMemory<P>(addr, data, 1);
+		if (P::cVerbose) std::cout << "sb" << " r" << (int)rs2 << ",[r" << (int)rs1 << "]+" << imm << "     ; data=" << data << ", " << "addr=" << addr;
+		break;
+	}
+	case Handler::SH: {
+		// store the two least significant bytes of rs2
+		WORD addr = ReadRegisterFile<P>(rs1) + imm;
+		WORD data = ReadRegisterFile<P>(rs2);
+		WriteMemory<P>(addr, data, 2);
+		if (P::cVerbose) std::cout << "sh" << " r" << (int)rs2 << ",[r" << (int)rs1 << "]+" << imm << "     ; data=" << data << ", " << "addr=" << addr;
+		break;
+	}
+	case Handler::SW: {
+		// in RISCV, rs2 holds the data and rs1 holds the address in memory
+		// store the four ls bytes of rs2 to memory at addres rs1 + offset
+		WORD addr = ReadRegisterFile<P>(rs1) + imm;
+		WORD data = ReadRegisterFile<P>(rs2);
+		WriteMemory<P>(addr, data, 4);
+		if (P::cVerbose) std::cout << "sw" << " r" << (int)rs2 << ",[r" << (int)rs1 << "]+" << imm << "     ; data=" << data << ", " << "addr=" << addr;
+		break;
+	}
+	case Handler::JALR: {
+		// JALR: jumps to the address in rs1 + offset
+		executeJump = true;
+		RiscV::WORD addr = ReadRegisterFile<P>(rs1) + imm;
+
+		WriteRegisterFile<P>(rd, mPc + 1); // save the address of the next instruction to rd
+		if (!SetPc(addr)) return false;
+		if (!P::cCheckRegisters) CheckIndirectTarget();
+		if (P::cVerbose) std::cout << "jalr" << " r" << (int)rd << ",#" << addr << "     ; new PC=" << mPc;
+		break;
+	}
+	case Handler::JR: {
+		// JR: jalr without link
+		executeJump = true;
+		RiscV::WORD addr = ReadRegisterFile<P>(rs1) + imm;
+		if (!SetPc(addr)) return false;
+		if (!P::cCheckRegisters) CheckIndirectTarget();
+		if (P::cVerbose) std::cout << "jr" << " r" << (int)rs1 << ",#" << addr << "     ; new PC=" << mPc;
+		break;
+	}
+	case Handler::BEQ: {
+		executeJump = ReadRegisterFile<P>(rs1) == ReadRegisterFile<P>(rs2);
+		if (executeJump && !TakeBranch<P>(imm)) return false;
+		if (P::cVerbose) std::cout << "beq" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << imm << "    ; new PC=" << mPc;
+		break;
+	}
+	case Handler::BNEQ: {
+		executeJump = ReadRegisterFile<P>(rs1) != ReadRegisterFile<P>(rs2);
+		if (executeJump && !TakeBranch<P>(imm)) return false;
+		if (P::cVerbose) std::cout << "bneq" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << imm << "   ; new PC=" << mPc;
+		break;
+	}
+	case Handler::BLT: {
+		executeJump = ReadRegisterFile<P>(rs1) < ReadRegisterFile<P>(rs2);
+		if (executeJump && !TakeBranch<P>(imm)) return false;
+		if (P::cVerbose) std::cout << "blt" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << imm << "    ; new PC=" << mPc;
+		break;
+	}
+	case Handler::BGE: {
+		executeJump = ReadRegisterFile<P>(rs1) >= ReadRegisterFile<P>(rs2);
+		if (executeJump && !TakeBranch<P>(imm)) return false;
+		if (P::cVerbose) std::cout << "bge" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << imm << "    ; new PC=" << mPc;
+		break;
+	}
+	case Handler::BLTU: {
+		executeJump = (uint32_t)ReadRegisterFile<P>(rs1) < (uint32_t)ReadRegisterFile<P>(rs2);
+		if (executeJump && !TakeBranch<P>(imm)) return false;
+		if (P::cVerbose) std::cout << "bltu" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << imm << "   ; new PC=" << mPc;
+		break;
+	}
+	case Handler::BGEU: {
+		executeJump = (uint32_t)ReadRegisterFile<P>(rs1) >= (uint32_t)ReadRegisterFile<P>(rs2);
+		if (executeJump && !TakeBranch<P>(imm)) return false;
+		if (P::cVerbose) std::cout << "bgeu" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << imm << "   ; new PC=" << mPc;
+		break;
+	}
+	case Handler::LUI: {
+		WriteRegisterFile<P>(rd, imm);
+		if (P::cVerbose) std::cout << "lui" << " r" << (int)rd << "," << imm;
+		break;
+	}
+	case Handler::AUIPC: {
+		// the pc is an instruction index, the upper immediate is added to it unchanged
+		WriteRegisterFile<P>(rd, mPc + imm);
+		if (P::cVerbose) std::cout << "auipc" << " r" << (int)rd << "," << imm;
+		break;
+	}
+	case Handler::JAL: {
+		// JAL: jump directly to given offset
+		executeJump = true;
+		WriteRegisterFile<P>(rd, mPc + 1); // save the address of the next instruction to rd
+		if (!SetPc(imm)) return false;	// set program counter to target == jump to target
+		if (P::cVerbose) std::cout << "jal" << " r" << (int)rd << ",#" << imm << "       ; new PC=" << mPc;
+		break;
+	}
+	case Handler::NOP:
+		break;
+	default:
+		Fault("unknown opcode");
+		break;
+	}
+
+	if (P::cProfile && executeJump) mProfiler->CountJump(pc, inst, mPc);
 
-			case IType::OP_TYPE_IMMEDIATE: {
-				if (f3 == IType::FUNC3_SLLI || f3 == IType::FUNC3_SRLI || f3 == IType::FUNC3_SRAI) {
-
-					if (f3 == IType::FUNC3_SLLI && f6 == IType::FUNC6_SLLI) {
-						RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-						RiscV::WORD result = 0;
-						// for rv32I, instruction is only legal when shamt[5]==0 
-						if (((shamt & 0x10) >> 5) == 0) { 
-							result = valRs1 << shamt;
-						}
-						else {
-							PrintWarning("illegal shift amount, rd=rs1");
-							result = valRs1;
-						}
-						WriteRegisterFile(rd, result);
-
-						if (mVerbose) std::cout << "slli" << " r" << (int)rd << ",r" << (int)rs1 << "," << (int)shamt;
-					}
-					else if (f3 == IType::FUNC3_SRLI && f6 == IType::FUNC6_SRLI) {
-						// shift right logical
-						RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-						RiscV::WORD valRs2 = ReadRegisterFile(rs2);
-						RiscV::WORD result = 0;
-
-						// for rv32I, instruction is only legal when shamt[5]==0 
-						if (((shamt & 0x10) >> 5) == 0) {
-							result = (unsigned)valRs1 >> shamt;
-						}
-						else {
-							PrintWarning("illegal shift amount, rd=rs1");
-							result = valRs1;
-						}
-						
-						WriteRegisterFile(rd, result);
-						if (mVerbose) std::cout << "srli" << " r" << (int)rd << ",r" << (int)rs1 << "," << (int)shamt;
-					}
-					else if (f3 == IType::FUNC3_SRAI && f6 == IType::FUNC6_SRAI) {
-						RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-						RiscV::WORD result = 0;
-						// for rv32I, instruction is only legal when shamt[5]==0 
-						if (((shamt & 0x10) >> 5) == 0) {
-
-							// see SRA
-							if (valRs1 < 0 && shamt > 0) {
-								result = valRs1 >> shamt | ~(~0U >> shamt);
-							}
-							else {
-								result = valRs1 >> shamt;
-							}
-						}
-						else {
-							PrintWarning("illegal shift amount, rd=rs1");
-							result = valRs1;
-						}
-						WriteRegisterFile(rd, result);
-						if (mVerbose) std::cout << "srai" << " r" << (int)rd << ",r" << (int)rs1 << "," << (int)shamt;
-					}
-				}
-				else {
-					if (f3 == IType::FUNC3_ADDI) {
-						RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-						RiscV::WORD res = valRs1 + imm_11to0;
-						WriteRegisterFile(rd, res);
-						if (mVerbose) std::cout << "addi" << " r" << (int)rd << ",r" << (int)rs1 << "," << imm_11to0;
-					}
-					else if (f3 == IType::FUNC3_SLTI) {
-						RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-						RiscV::WORD res = (valRs1 < imm_11to0) ? 1 : 0;
-						WriteRegisterFile(rd, res);
-						if (mVerbose) std::cout << "slti" << " r" << (int)rd << ",r" << (int)rs1 << "," << (int)imm_11to0;
-					}
-					else if (f3 == IType::FUNC3_SLTIU) {
-						RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-						RiscV::WORD res = ((uint32_t)valRs1 < (uint32_t)imm_11to0) ? 1 : 0;
-						WriteRegisterFile(rd, res);
-						if (mVerbose) std::cout << "sltiu" << " r" << (int)rd << ",r" << (int)rs1 << "," << (int)imm_11to0;
-					}
-					else if (f3 == IType::FUNC3_XORI) {
-						RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-						RiscV::WORD res = valRs1 ^ imm_11to0;
-						WriteRegisterFile(rd, res);
-						if (mVerbose) std::cout << "xori" << " r" << (int)rd << ",r" << (int)rs1 << "," << imm_11to0;
-					}
-					else if (f3 == IType::FUNC3_ORI) {
-						RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-						RiscV::WORD res = valRs1 | imm_11to0;
-						WriteRegisterFile(rd, res);
-						if (mVerbose) std::cout << "ori" << " r" << (int)rd << ",r" << (int)rs1 << "," << imm_11to0;
-					}
-					else if (f3 == IType::FUNC3_ANDI) {
-						RiscV::WORD valRs1 = ReadRegisterFile(rs1);
-						RiscV::WORD res = valRs1 & imm_11to0;
-						WriteRegisterFile(rd, res);
-						if (mVerbose) std::cout << "andi" << " r" << (int)rd << ",r" << (int)rs1 << "," << imm_11to0;
-					}
-				}
-				break;
-			}
-
-			case IType::OP_TYPE_LOAD: {
-				// for the date of implementation, only lw is needed
-				// for the future, the IVirtualDevice's "Read()" needs to be given a parameter 
-				// for how many bytes should be read from memory or exist in multiple versions
-				/*if (f3 == IType::FUNC3_LB) {
-
-				}
-				else if (f3 == IType::FUNC3_LH) {
-
-				}
-				else if (f3 == IType::FUNC3_LW) {
-
-				}
-				else if (f3 == IType::FUNC3_LBU) {
-
-				}
-				else if (f3 == IType::FUNC3_LHU) {
-
-				}*/
-
-				WORD addr = ReadRegisterFile(rs1) + imm_11to0;	// get target address from rs1
-				WORD data = ReadMemory(addr);		// read the data from memory
-				WriteRegisterFile(rd, data);
-				if (mVerbose) std::cout << "lw" << " r" << (int)rd << ",[r" << (int)rs1 << "]+" << (int)imm_11to0 << "     ; data=" << data << ", addr=" << addr;
-				break;
-			}
-
-			case IType::OP_JALR: {
-				if (f3 == IType::FUNC3_JALR) {
-					// JALR: jumps to the address in rs1 + offset
-
-					executeJump = true;
-					//RiscV::WORD alignedOffset = imm_11to0 & ~0x1; // set the least bit to 0
-					//RiscV::BYTE addr = ReadRegisterFile(rs1) + alignedOffset;
-					RiscV::BYTE addr = ReadRegisterFile(rs1) + imm_11to0;
-
-					WriteRegisterFile(rd, mPc); // save the current PC into rd before jump
-					if (!SetPc(addr)) return;
-
-					if (mVerbose) std::cout << "jalr" << " r" << (int)rd << ",#" << (int)addr << "     ; new PC=" << mPc;
-				}
-				break;
-			}
-
-			case SType::OP_TYPE_STORE: {
-				// first recreate immediate!!!
-				WORD imm = (imm_11to5 << 5) | imm_4to0; // offset
-
-				// for the date of implementation, only sw is needed
-				// for the future, the IVirtualDevice's "Write()" needs to be given a parameter 
-				// for how many bytes should be written to memory or exist in multiple versions
-				/*if (f3 == SType::FUNC3_SB) {
-
-				}
-				else if (f3 == SType::FUNC3_SH) {
-
-				}
-				else if (f3 == SType::FUNC3_SW) {
-
-				}*/
-
-				// in RISCV, rs2 holds the data and rs1 holds the address in memory
-				// store the four ls bytes of rs2 to memory at addres rs1 + offset
-				WORD addr = ReadRegisterFile(rs1) + imm;
-				WORD data = ReadRegisterFile(rs2);
-				WriteMemory(addr, data);
-				if (mVerbose) std::cout << "sw" << " r" << (int)rs2 << ",[r" << (int)rs1 << "]+" << imm << "     ; data=" << data << ", " << "addr=" << addr;
-
-				break;
-			}
-
-			case BType::OP_TYPE_BRANCH: {
-
-				// first recreate immediate!!!
-				WORD offset = ((imm11b << 11) | (imm10b << 10) | (imm_9to4 << 4) | imm_3to0 );
-
-				WORD valRs1 = ReadRegisterFile(rs1);
-				WORD valRs2 = ReadRegisterFile(rs2);
-				executeJump = true;
-				
-				// check which instruction was done
-				if (f3 == BType::FUNC3_BEQ) {
-					if (valRs1 == valRs2) {
-						if (!SetPc(offset)) return;
-					}
-					else {
-						// since the condition was not true, do not jump
-						executeJump = false;
-					}
-					if (mVerbose) std::cout << "beq" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << offset <<  "    ; new PC=" << mPc;
-				}
-				else if (f3 == BType::FUNC3_BNEQ) {
-					if (valRs1 != valRs2) {
-						if (!SetPc(offset)) return;
-					}
-					else {
-						// since the condition was not true, do not jump and move to next pc
-						executeJump = false;
-					}
-					if (mVerbose) std::cout << "bneq" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << offset << "   ; new PC=" << mPc;
-				}
-				else if (f3 == BType::FUNC3_BLT) {
-					if (valRs1 < valRs2) {
-						if (!SetPc(offset)) return;
-					}
-					else {
-						executeJump = false;
-					}
-					if (mVerbose) std::cout << "blt" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << offset << "    ; new PC=" << mPc;
-				}
-				else if (f3 == BType::FUNC3_BGE) {
-					if (valRs1 >= valRs2) {
-						if (!SetPc(offset)) return;
-					}
-					else {
-						executeJump = false;
-					}
-					if (mVerbose) std::cout << "bge" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << offset << "    ; new PC=" << mPc;
-				}
-				else if (f3 == BType::FUNC3_BLTU) {
-					if ((uint32_t)valRs1 == (uint32_t)valRs2) {
-						if (!SetPc(offset)) return;
-					}
-					else {
-						executeJump = false;
-					}
-					if (mVerbose) std::cout << "bltu" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << offset << "   ; new PC=" << mPc;
-				}
-				else if (f3 == BType::FUNC3_BGEU) {
-					if ((uint32_t)valRs1 >= (uint32_t)valRs2) {
-						if (!SetPc(offset)) return;
-					}
-					else {
-						executeJump = false;
-					}
-					if (mVerbose) std::cout << "bgeu" << " r" << (int)rs1 << ",r" << (int)rs2 << ",#" << offset << "   ; new PC=" << mPc;
-				}
-				break;
-			}
-
-			case UType::OP_LUI: {
-				RiscV::WORD upperIm = (imm_31to12 << 12);
-				WriteRegisterFile(rd, upperIm);
-				if (mVerbose) std::cout << "lui" << " r" << (int)rd << "," << upperIm;
-				break;
-			}
-
-			case JType::OP_JAL: {
-				// JAL: jump directly to given offset
-				
-				// first recreate immediate!!!
-				// J-Type has 20-bit immediate
-				WORD offset = (imm19 << 18) | (imm_1811 << 11) | (imm10j << 10) | imm_9to0;
-				executeJump = true;
-
-				WriteRegisterFile(rd, mPc + 1); // save the address of the next instruction to rd
-				if (!SetPc(offset)) return;	// set program counter to target == jump to target
-				if (mVerbose) std::cout << "jal" << " r" << (int)rd << ",#" << offset << "       ; new PC=" << mPc;;
-				break;
-			}
-			default:
-				PrintWarning("unknown opcode");
-				break;
+	// if there was no valid jump instruction, move on to the next PC
+	if (!executeJump) {
+		return SetPc(mPc + 1);
+	}
+	// a jalr turned the register checks on, the caller continues with the checked policy
+	return P::cCheckRegisters || !mCheckRegisters;
+}
+
+RiscV::WORD VirtualMachine::JitReadMemory(VirtualMachine* vm, RiscV::ADDRESS address, uint32_t size, RiscV::ADDRESS pc) {
+	vm->mPc = pc;	// for warnings
+	return vm->ReadMemory<UncheckedPolicy>(address, size);
+}
+
+void VirtualMachine::JitWriteMemory(VirtualMachine* vm, RiscV::ADDRESS address, RiscV::WORD data, uint32_t size, RiscV::ADDRESS pc) {
+	vm->mPc = pc;	// for warnings
+	vm->WriteMemory<UncheckedPolicy>(address, data, size);
+}
+
+void VirtualMachine::RunJit() {
+	if (!mJit) {
+		mJit.reset(new ::Jit(mDecodedInstructions, &VirtualMachine::JitReadMemory, &VirtualMachine::JitWriteMemory));
+	}
+	if (!mJit->is_ready()) {
+		// no native code generation on this host
+		RunThreaded();
+		return;
+	}
+
+	mJitContext = { mRegisterFile, this, 0, mPageMemory.data(), mPageMemory.size(), 0, mPageDirty.data(), mPageCode.data() };
+
+	while (mPc >= 0 && static_cast<size_t>(mPc) < mInstructionSize) {
+		if (mExecutedInstructions >= mBudgetEnd) return;
+
+		Jit::Block block = mJit->Lookup(mPc);
+		if (block == nullptr && mJit->CountEntry(mPc)) {
+			block = mJit->Compile(mPc, mRegisterFileWritten, mRegCount);
 		}
 
-		// if there was no valid jump instruction, move on to the next PC
-		if (!executeJump) {
-			if (!SetPc(mPc + 1)) return;
+		if (block != nullptr) {
+			mJitContext.executed = 0;
+			mJitContext.limit = mBudgetEnd - mExecutedInstructions;
+			RiscV::ADDRESS next = block(&mJitContext);
+			mExecutedInstructions += mJitContext.executed;
+			if (!SetPc(next)) return;
+			// the block may have ended with a jalr
+			CheckIndirectTarget();
+			continue;
 		}
+
+		// interpret up to the end of the basic block, or up to the first instruction
+		// the compiler leaves to the interpreter, so that the next pc can start a block
+		bool blockEnd = false;
+		do {
+			DecodedInstruction const& inst = mDecodedInstructions[mPc];
+			blockEnd = EndsBasicBlock(inst.handler) || !mJit->IsSupportedInstruction(inst);
+			if (!ExecuteOne() && Finished()) return;
+		} while (!blockEnd);
 	}
 }
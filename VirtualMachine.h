@@ -1,44 +1,390 @@
 #pragma once
 #include "RiscV.h"
 #include "AddressRange.h"
+#include "ConsoleDevice.h"
+#include "Decoder.h"
+#include "ElfFile.h"
+#include "IVirtualDevice.h"
+#include "Jit.h"
+#include "MappedMemory.h"
+#include "Profiler.h"
+#include "RegisterCheck.h"
+#include "Tracer.h"
+#include "Translation.h"
+#include <cstring>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <string>
-
-class IVirtualDevice;
+#include <vector>
 
 class VirtualMachine
 {
 public:
-	VirtualMachine(std::string const& fileName, size_t regCount, bool verbose);
+	enum class Engine {
+		Switch,		// one central switch over the decoded handler, supports verbose mode
+		Threaded,	// every handler dispatches directly to the next one
+		Jit,		// interpreter that compiles hot basic blocks to native code
+		Translated	// code translated ahead of time, see SetTranslation; threaded without one
+	};
+
+	// fileName is either a raw image of instructions or an ELF32 RISC-V executable; compressed reads
+	// a raw image as RV32C code of mixed 16 and 32 bit instructions, ELF executables say so in their
+	// header. Compressed instructions are expanded while loading, every instruction takes one index.
+	// ELF executables and compressed images are toolchain code, their pc relative branches and jumps
+	// are relocated to indices (RiscV::Relocate), raw images use this machine's absolute indices.
+	VirtualMachine(std::string const& fileName, size_t regCount, bool verbose, bool compressed = false);
+	// runs an image that is already in memory, e.g. one binary shared by many instances
+	VirtualMachine(std::vector<RiscV::INSTRUCTION> const& image, size_t regCount, bool verbose,
+		RiscV::CodeLayout const& layout = RiscV::CodeLayout());
+	// layout gets the offsets of a compressed image, none for a raw one
+	static bool LoadImage(std::string const& fileName, std::vector<RiscV::INSTRUCTION>& image, RiscV::CodeLayout& layout, bool compressed = false);
 	~VirtualMachine();
 	bool is_ready() const;
+	// an ELF segment that lies inside the new range is copied into the device and replaces the
+	// segment's own mapping, a range that covers only part of a segment is rejected
 	bool RegisterDevice(IVirtualDevice* device, RiscV::ADDRESS begin, RiscV::ADDRESS end);
-	void Run();
+	void Run(Engine engine = Engine::Switch);
+	// runs for about budget instructions, the budget is checked at jumps and block exits,
+	// returns false once the program has ended
+	bool RunSlice(Engine engine, uint64_t budget);
+	bool Finished() const;
+	uint64_t ExecutedInstructions() const;
+	// the virtual clock: one cycle per executed instruction plus the cycles a waiting guest skipped
+	// (TimerDevice); the cycle and time counters read it and snapshots keep it
+	uint64_t Cycles() const;
+	void SkipCycles(uint64_t cycles);
+
+	enum class StopReason {
+		Budget,			// the budget is used up, the next Step continues where this one stopped
+		Sleep,			// the program executed sleep
+		PcOutOfRange,	// a jump or the last instruction left the image
+		Fault			// unknown opcode or access to undefined memory
+	};
+	struct StepResult {
+		StopReason reason;
+		uint64_t executed;		// instructions executed by this call
+		RiscV::ADDRESS pc;		// next instruction, or the sleep, the last instruction or the fault that ended the program
+	};
+	// For hosts that run guests cooperatively: executes at most budget instructions and returns
+	// why it stopped. Unlike Run, the first fault ends the program. The switch engine stops right
+	// at the budget and right behind a fault, the threaded, jit and translated engines check both
+	// at jumps and block exits like RunSlice, so they may run past the budget and finish the basic
+	// block of a fault. Once the program has ended every call returns the same reason again.
+	StepResult Step(uint64_t budget, Engine engine = Engine::Switch);
+	// warning of the fault that ended a Step, empty otherwise
+	std::string const& FaultMessage() const;
+
+	RiscV::ADDRESS Pc() const;
+	RiscV::WORD Register(size_t idx) const;
+	// a register set by the host counts as written for the register checks, set inputs before
+	// the first Step or Run
+	void SetRegister(size_t idx, RiscV::WORD value);
+	// number of times the threaded engine executed a fused pair
+	uint64_t FusionHits(RiscV::Fusion fusion) const;
+
+	// counts executions per pc, taken branches, memory accesses and call paths until the report
+	// is written, runs with a profiler always use the switch engine; symbolFile is optional
+	bool EnableProfiling(std::string const& symbolFile = std::string());
+	bool WriteProfile(std::string const& fileName) const;
+
+	// binary trace of pc, instruction, rd and memory access per executed instruction, written by a
+	// background thread; sampleEvery n keeps every n-th instruction, lastRecords n keeps only the last
+	// n instructions and writes them on the first fault. Runs with a trace use the switch engine.
+	bool EnableTrace(std::string const& fileName, uint64_t sampleEvery = 1, size_t lastRecords = 0);
+
+	// the print instruction writes to this console, by default to one of the virtual machine's own
+	// that flushes every 4 KiB; warnings flush it first so that stdout and stderr stay in order.
+	// A console registered as a device takes its place so that both kinds of output share one buffer.
+	void SetConsole(ConsoleDevice* console);
+
+	// host side bulk access to guest memory, false if part of the range has no device
+	bool ReadBlock(RiscV::ADDRESS address, void* buffer, size_t size);
+	bool WriteBlock(RiscV::ADDRESS address, void const* buffer, size_t size);
+
+	// Unified memory: copies the instruction image into the address space at base, from then on
+	// instruction index i is the word at base + 4 * i and fetches see the guest's own stores, e.g.
+	// of a loader or of overlays. count instructions are executable, at least the image, the slots
+	// behind it start out with whatever the memory holds. The decoded form stays cached per page, a
+	// store to an executable page decodes that page again: the switch engine runs the new code right
+	// behind the store, the threaded and jit engines from their next jump on. The range has to lie in
+	// registered devices within the lowest 256 MiB; toolchain code (ELF executables, compressed
+	// images) cannot be mapped. Call it before the first Run.
+	bool MapInstructions(RiscV::ADDRESS base, size_t count = 0);
+
+	// Native code for the image made by VMRiscVTranslate, used by Engine::Translated. Rejected
+	// unless it was made from exactly the loaded image (after MapInstructions, if used). Jumps the
+	// translation has no code for, instructions it leaves out and blocks that read registers not
+	// written yet run on the interpreter; a store to mapped code drops the translation for good and
+	// the threaded engine takes over.
+	bool SetTranslation(RiscV::Translation const* translation);
+
+	// Snapshots hold registers, pc, the instruction image, the plain memory of every device with
+	// host memory and the state of devices that implement IVirtualDevice::SaveState.
+	// An incremental snapshot only holds the memory pages written since the previous snapshot and
+	// has to be loaded on top of the state it was taken from. Devices have to be registered the
+	// same way as when the snapshot was taken.
+	bool SaveSnapshot(std::string const& fileName, bool incremental);
+	bool LoadSnapshot(std::string const& fileName);
 
 private:
 	bool mVerbose = false;
+	uint64_t mExecutedInstructions = 0;
+	uint64_t mBudgetEnd = UINT64_MAX;	// Run returns once mExecutedInstructions reaches it
+	uint64_t mSkippedCycles = 0;		// the clock jumped ahead while the guest waited, see Cycles
+	// event counters the guest reads through the custom csrs in RiscV::CsrType, kept by the
+	// interpreters only and only under a counting policy, which they pick when mCountsEvents is
+	// set; an image that reads them does not run on the jit or the translation
+	uint64_t mLoads = 0;
+	uint64_t mStores = 0;
+	uint64_t mTakenBranches = 0;
+	bool mCountsEvents = false;
+	// the value of a counter csr, decoding only lets counters through
+	RiscV::WORD ReadCounter(uint32_t csr) const;
+	bool mFinished = false;
+	StopReason mStopReason = StopReason::PcOutOfRange;
+	// set during Step, a fault ends the program
+	bool mStopOnFault = false;
+	RiscV::ADDRESS mFaultPc = 0;
+	std::string mFaultMessage;
+	// ends the program unless it has already ended
+	void Stop(StopReason reason);
+	uint64_t mFusionHits[static_cast<size_t>(RiscV::Fusion::COUNT)] = {};
+
+	// The instrumentation of the interpreters as compile time switches, every combination gets its
+	// own execution loop. RunSwitch and RunThreaded pick the instantiation from the configuration
+	// at the start of a run, a run without -v, -trace or -profile and without register checks
+	// executes none of their tests. Only an image that reads the event counters counts its loads,
+	// stores and taken branches.
+	template <bool CheckRegisters, bool Verbose, bool Trace, bool Profile, bool CountEvents = false>
+	struct Policy {
+		static bool const cCheckRegisters = CheckRegisters;
+		static bool const cVerbose = Verbose;
+		static bool const cTrace = Trace;
+		static bool const cProfile = Profile;
+		static bool const cCountEvents = CountEvents;
+	};
+	typedef Policy<true, false, false, false> CheckedPolicy;
+	typedef Policy<false, false, false, false> UncheckedPolicy;
+	typedef Policy<true, false, false, false, true> CountingCheckedPolicy;
+	typedef Policy<false, false, false, false, true> CountingUncheckedPolicy;
+
+	void RunSwitch();
+	template <class P> void RunSwitchLoop();
+	// false once execution has to stop, or under a policy without register checks once a jalr
+	// turned them on
+	template <class P> bool ExecuteOne();
+	// ExecuteOne with the policy of the current register checks
+	bool ExecuteOne();
+	void RunThreaded();
+	template <class P> void RunThreadedLoop();
+	// threaded code of RunThreaded, label addresses or handler numbers, built on the first run,
+	// one per instantiation as the label addresses differ, indexed by ThreadedLoop
+	static size_t const cThreadedLoops = 4;
+	std::vector<uintptr_t> mThreadedCode[cThreadedLoops];
+	// index ranges of mThreadedCode to translate again, the guest stored to their code
+	std::vector<std::pair<RiscV::ADDRESS, RiscV::ADDRESS>> mStaleThreadedCode[cThreadedLoops];
+	template <class P> static size_t ThreadedLoop();
+	void RunJit();
+
+	std::unique_ptr<ConsoleDevice> mOwnConsole{ new ConsoleDevice() };
+	ConsoleDevice* mConsole = mOwnConsole.get();
+	std::unique_ptr<Profiler> mProfiler;
+	std::unique_ptr<Tracer> mTracer;
+	// out of range pc, unknown opcode or unmapped memory
+	void Fault(std::string const& message);
+
+	std::unique_ptr<Jit> mJit;
+	Jit::Context mJitContext = {};
+	static RiscV::WORD JitReadMemory(VirtualMachine* vm, RiscV::ADDRESS address, uint32_t size, RiscV::ADDRESS pc);
+	static void JitWriteMemory(VirtualMachine* vm, RiscV::ADDRESS address, RiscV::WORD data, uint32_t size, RiscV::ADDRESS pc);
+
+	RiscV::Translation const* mTranslation = nullptr;
+	RiscV::TranslationContext mTranslationContext = {};
+	void RunTranslated();
 
 	typedef std::map<AddressRange, IVirtualDevice*> TVirtualDeviceMap;
 	typedef std::pair<TVirtualDeviceMap::iterator, bool> TVirtualDeviceInsertResult;
 	TVirtualDeviceMap::iterator GetVirtualDevice(RiscV::ADDRESS address);
 
-	RiscV::INSTRUCTION* mInstructionMemory;
+	// page table in front of the device map, one entry per RiscV::cPageBits sized page
+	// pages of plain memory point straight into the host storage, pages fully covered by
+	// any other device call it directly, everything else falls back to the device map
+	struct PageDevice {
+		IVirtualDevice* device;
+		RiscV::ADDRESS begin;	// start of the device range
+	};
+	// the flat table the engines index directly covers the pages below this limit
+	static size_t const cMaxPages = 1 << 16;
+	std::vector<uint8_t*> mPageMemory;
+	std::vector<PageDevice> mPageDevices;
+	// pages written since the last snapshot, covers every page a device reaches into
+	std::vector<uint8_t> mPageDirty;
+	void MapPages(IVirtualDevice* device, RiscV::ADDRESS begin, RiscV::ADDRESS end);
+	// marks the pages of a store as written, stores to code pages also invalidate their decode
+	void MarkDirty(RiscV::ADDRESS address, size_t size);
+	bool PageDirty(size_t page) const;
+	void ClearDirty();
+
+	// the rest of the 32-bit address space (high heaps and stacks) behind the slow path of the
+	// memory accesses, in leaves of cLeafPages pages allocated on the first access to one of
+	// them; an entry is looked up in the device map on the first access to its page
+	static size_t const cLeafBits = 10;
+	static size_t const cLeafPages = size_t(1) << cLeafBits;
+	struct PageLeaf {
+		uint8_t* memory[cLeafPages] = {};
+		PageDevice devices[cLeafPages] = {};
+		uint8_t resolved[cLeafPages] = {};
+		uint8_t dirty[cLeafPages] = {};
+	};
+	std::vector<std::unique_ptr<PageLeaf>> mHighPages;
+	// page is at least cMaxPages, slot gets its index in the leaf
+	PageLeaf& HighPage(size_t page, size_t& slot);
+
+	// pages that hold instructions since MapInstructions, same size as mPageDirty; a store to a valid
+	// page makes it stale and sends the engines back to Run, which decodes the page again
+	static uint8_t const cCodeValid = 1;
+	static uint8_t const cCodeStale = 2;
+	std::vector<uint8_t> mPageCode;
+	std::vector<size_t> mStaleCodePages;
+	RiscV::ADDRESS mCodeBase = 0;
+	// mBudgetEnd while the engines are sent back for a stale page
+	uint64_t mResumeBudgetEnd = UINT64_MAX;
+	void InvalidateCode(size_t page);
+	// decodes the stale pages again, false if there were none
+	bool RefreshCode();
+
+	void Load(std::vector<RiscV::INSTRUCTION> const& image, RiscV::CodeLayout const& layout = RiscV::CodeLayout());
+	void Decode();
+	void ReleaseImage();
+
+	// ELF executables: the executable segment is the instruction image, relocated for its link address
+	// (RiscV::Relocate), execution starts at the entry point; every other segment is copied into the
+	// devices registered for its range, segments without a device get a copy-on-write mapping of the
+	// file (MappedMemory) as device of their own
+	bool LoadElf(std::string const& fileName);
+	bool MoveSegments(IVirtualDevice* device, RiscV::ADDRESS begin, RiscV::ADDRESS end);
+	struct SegmentMemory {
+		std::unique_ptr<MappedMemory> memory;
+		RiscV::ADDRESS begin;
+		RiscV::ADDRESS end;
+	};
+	std::vector<SegmentMemory> mSegmentMemory;
+	// keeps the file mapped that mInstructionMemory points into
+	std::unique_ptr<ElfFile> mElf;
+	// mInstructionMemory points into mElf, a compressed executable segment is expanded into memory of its own
+	bool mImageMapped = false;
+	// toolchain code (ELF or RV32C): its indices do not match addresses and its decoded control
+	// flow is relocated; no offsets for this machine's own images
+	RiscV::CodeLayout mCodeLayout;
+
+	RiscV::INSTRUCTION const* mInstructionMemory;
 	size_t mInstructionSize = 0;
+	std::vector<RiscV::DecodedInstruction> mDecodedInstructions;
 	TVirtualDeviceMap mVirtualDeviceMap;
 
-	RiscV::WORD ReadMemory(RiscV::ADDRESS address);
-	void WriteMemory(RiscV::ADDRESS address, RiscV::WORD const& data);
+	// byte addressed, size is 1, 2 or 4 bytes, reads return the value zero-extended;
+	// a counting policy counts the access for the event counters
+	template <class P> RiscV::WORD ReadMemory(RiscV::ADDRESS address, size_t size);
+	template <class P> void WriteMemory(RiscV::ADDRESS address, RiscV::WORD const& data, size_t size);
+	RiscV::WORD ReadDeviceMap(RiscV::ADDRESS address, size_t size);
+	void WriteDeviceMap(RiscV::ADDRESS address, RiscV::WORD const& data, size_t size);
 
 	size_t const mRegCount;
 	RiscV::WORD mRegisterFile[RiscV::cRegCount] = {};
 	bool mRegisterFileWritten[RiscV::cRegCount] = {};
-	RiscV::WORD ReadRegisterFile(size_t idx);
-	void WriteRegisterFile(size_t idx, RiscV::WORD const& data);
+	template <class P> RiscV::WORD ReadRegisterFile(size_t idx);
+	template <class P> void WriteRegisterFile(size_t idx, RiscV::WORD const& data);
+	// the warnings for register indices out of range and reads before the first write
+	void CheckRegisterRead(size_t idx);
+	void CheckRegisterWrite(size_t idx);
+	// RiscV::CheckRegisters runs before the first instruction executes and reports what it finds,
+	// a clean image runs without the checks above
+	bool mCheckRegisters = true;
+	bool mRegistersAnalyzed = false;
+	std::vector<uint8_t> mIndirectTargets;
+	void AnalyzeRegisters();
+	// after a jalr, a target the analysis did not account for turns the checks back on
+	void CheckIndirectTarget();
 
 	RiscV::ADDRESS mPc;
 	bool SetPc(RiscV::ADDRESS pc);
+	// SetPc for a taken conditional branch
+	template <class P> bool TakeBranch(RiscV::ADDRESS pc);
+
+	static RiscV::WORD ShiftRightArithmetic(RiscV::WORD value, RiscV::WORD shamt);
 
 	void PrintWarning(std::string const& message);
+	void PrintInfo(std::string const& message);
 };
 
+template <class P>
+inline RiscV::WORD VirtualMachine::ReadRegisterFile(size_t idx) {
+	if (P::cCheckRegisters) CheckRegisterRead(idx);
+	return mRegisterFile[idx];
+}
+
+template <class P>
+inline void VirtualMachine::WriteRegisterFile(size_t idx, RiscV::WORD const& data) {
+	if (P::cCheckRegisters) CheckRegisterWrite(idx);
+	mRegisterFile[idx] = data;
+	mRegisterFileWritten[idx] = true;
+}
+
+inline void VirtualMachine::CheckIndirectTarget() {
+	if (!mCheckRegisters && !mIndirectTargets[mPc]) mCheckRegisters = true;
+}
+
+template <class P>
+inline bool VirtualMachine::TakeBranch(RiscV::ADDRESS pc) {
+	if (P::cCountEvents) ++mTakenBranches;
+	return SetPc(pc);
+}
+
+template <class P>
+inline size_t VirtualMachine::ThreadedLoop() {
+	return (P::cCheckRegisters ? 1 : 0) | (P::cCountEvents ? 2 : 0);
+}
+
+// memory accesses are inline so that both interpreters reduce plain memory to one copy,
+// accesses that cross a page boundary take the slow path
+template <class P>
+inline RiscV::WORD VirtualMachine::ReadMemory(RiscV::ADDRESS address, size_t size) {
+	if (P::cCountEvents) ++mLoads;
+	size_t const page = static_cast<uint32_t>(address) >> RiscV::cPageBits;
+	size_t const offset = static_cast<size_t>(address & RiscV::cPageMask);
+	if (page < mPageMemory.size() && offset + size <= RiscV::cPageSize) {
+		if (mPageMemory[page] != nullptr) {
+			// guest and host are both little endian
+			uint32_t data = 0;
+			std::memcpy(&data, mPageMemory[page] + offset, size);
+			return static_cast<RiscV::WORD>(data);
+		}
+		if (mPageDevices[page].device != nullptr) {
+			return mPageDevices[page].device->Read(address - mPageDevices[page].begin, size);
+		}
+	}
+	return ReadDeviceMap(address, size);
+}
+
+template <class P>
+inline void VirtualMachine::WriteMemory(RiscV::ADDRESS address, RiscV::WORD const& data, size_t size) {
+	if (P::cCountEvents) ++mStores;
+	size_t const page = static_cast<uint32_t>(address) >> RiscV::cPageBits;
+	size_t const offset = static_cast<size_t>(address & RiscV::cPageMask);
+	if (page < mPageMemory.size() && offset + size <= RiscV::cPageSize) {
+		if (mPageMemory[page] != nullptr) {
+			std::memcpy(mPageMemory[page] + offset, &data, size);
+			mPageDirty[page] = 1;
+			if (mPageCode[page] == cCodeValid) InvalidateCode(page);
+			return;
+		}
+		if (mPageDevices[page].device != nullptr) {
+			mPageDevices[page].device->Write(address - mPageDevices[page].begin, data, size);
+			mPageDirty[page] = 1;
+			if (mPageCode[page] == cCodeValid) InvalidateCode(page);
+			return;
+		}
+	}
+	WriteDeviceMap(address, data, size);
+}
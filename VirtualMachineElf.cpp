@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "VirtualMachine.h"
+
+bool VirtualMachine::LoadElf(std::string const& fileName) {
+	std::unique_ptr<ElfFile> elf(new ElfFile(fileName));
+	if (!elf->is_ready()) {
+		return false;
+	}
+
+	std::vector<ElfFile::Segment> const& segments = elf->Segments();
+	auto const text = std::find_if(segments.begin(), segments.end(), [](ElfFile::Segment const& segment) { return segment.executable; });
+	if (text == segments.end() || std::count_if(text, segments.end(), [](ElfFile::Segment const& segment) { return segment.executable; }) != 1) {
+		std::cerr << "ELF executable needs exactly one executable segment: " << fileName << std::endl;
+		return false;
+	}
+	// compressed code is expanded to one instruction per index, offsets maps the byte offsets to them
+	std::vector<RiscV::INSTRUCTION> expanded;
+	RiscV::CodeLayout layout;
+	layout.base = text->address;
+	std::vector<uint32_t>& offsets = layout.offsets;
+	if (elf->Compressed() && !RiscV::ExpandCompressed(elf->Data(*text), text->fileSize, expanded, offsets)) {
+		std::cerr << "ELF executable segment ends in the middle of an instruction: " << fileName << std::endl;
+		return false;
+	}
+	int64_t const entry = static_cast<int64_t>(elf->Entry()) - text->address;
+	auto const entryOffset = std::lower_bound(offsets.begin(), offsets.end(), static_cast<uint32_t>(entry));
+	bool const entryValid = elf->Compressed() ?
+		entry >= 0 && entryOffset != offsets.end() && *entryOffset == entry :
+		text->offset % sizeof(RiscV::INSTRUCTION) == 0 && entry >= 0 && entry < text->fileSize && entry % sizeof(RiscV::INSTRUCTION) == 0;
+	if (!entryValid) {
+		std::cerr << "ELF entry point is not an instruction of the executable segment: " << fileName << std::endl;
+		return false;
+	}
+
+	// every segment lies either completely inside registered devices or outside all of them
+	std::vector<bool> covered;
+	for (ElfFile::Segment const& segment : segments) {
+		int64_t const begin = segment.address;
+		int64_t const end = begin + segment.memorySize - 1;
+		int64_t coveredBytes = 0;
+		for (auto const& entry : mVirtualDeviceMap) {
+			int64_t const from = std::max<int64_t>(begin, entry.first.Begin());
+			int64_t const to = std::min<int64_t>(end, entry.first.End());
+			coveredBytes += std::max<int64_t>(to - from + 1, 0);
+		}
+		if (end > INT32_MAX || (coveredBytes != 0 && coveredBytes != end - begin + 1)) {
+			std::cerr << "ELF segment at 0x" << std::hex << segment.address << std::dec
+				<< " does not fit the registered devices: " << fileName << std::endl;
+			return false;
+		}
+		covered.push_back(coveredBytes != 0);
+	}
+
+	for (size_t i = 0; i < segments.size(); ++i) {
+		ElfFile::Segment const& segment = segments[i];
+		RiscV::ADDRESS const end = segment.address + static_cast<RiscV::ADDRESS>(segment.memorySize - 1);
+		if (covered[i]) {
+			WriteBlock(segment.address, elf->Data(segment), segment.fileSize);
+			std::vector<uint8_t> const zeros(std::min<size_t>(segment.memorySize - segment.fileSize, RiscV::cPageSize), 0);
+			for (size_t done = segment.fileSize; done < segment.memorySize; done += zeros.size()) {
+				WriteBlock(segment.address + static_cast<RiscV::ADDRESS>(done), zeros.data(), std::min(zeros.size(), segment.memorySize - done));
+			}
+			continue;
+		}
+
+		SegmentMemory memory{ std::unique_ptr<MappedMemory>(new MappedMemory(*elf, segment)), segment.address, end };
+		if (!memory.memory->is_ready()) {
+			std::cerr << "Could not map ELF segment at 0x" << std::hex << segment.address << std::dec << ": " << fileName << std::endl;
+			return false;
+		}
+		mVirtualDeviceMap.insert(TVirtualDeviceMap::value_type(AddressRange(memory.begin, memory.end), memory.memory.get()));
+		MapPages(memory.memory.get(), memory.begin, memory.end);
+		mSegmentMemory.push_back(std::move(memory));
+	}
+
+	if (elf->Compressed()) {
+		RiscV::ADDRESS const pc = static_cast<RiscV::ADDRESS>(entryOffset - offsets.begin());
+		Load(expanded, layout);
+		mElf = std::move(elf);
+		mPc = pc;
+		return true;
+	}
+	// the instruction image is executed straight from the file mapping
+	ReleaseImage();
+	mInstructionMemory = reinterpret_cast<RiscV::INSTRUCTION const*>(elf->Data(*text));
+	mInstructionSize = text->fileSize / sizeof(RiscV::INSTRUCTION);
+	mElf = std::move(elf);
+	mImageMapped = true;
+	mCodeLayout.base = text->address;
+	for (size_t i = 0; i < mInstructionSize; ++i) {
+		mCodeLayout.offsets.push_back(static_cast<uint32_t>(i * sizeof(RiscV::INSTRUCTION)));
+	}
+	Decode();
+	mPc = static_cast<RiscV::ADDRESS>(entry / sizeof(RiscV::INSTRUCTION));
+	return true;
+}
+
+bool VirtualMachine::MoveSegments(IVirtualDevice* device, RiscV::ADDRESS begin, RiscV::ADDRESS end) {
+	for (SegmentMemory const& segment : mSegmentMemory) {
+		if (segment.end >= begin && segment.begin <= end && (segment.begin < begin || segment.end > end)) {
+			std::cerr << "Device range covers only part of the ELF segment at 0x" << std::hex << segment.begin << std::dec << std::endl;
+			return false;
+		}
+	}
+
+	for (auto iter = mSegmentMemory.begin(); iter != mSegmentMemory.end();) {
+		if (iter->end < begin || iter->begin > end) {
+			++iter;
+			continue;
+		}
+		size_t size = 0;
+		uint8_t const* host = iter->memory->HostMemory(size);
+		device->WriteBlock(iter->begin - begin, host, size);
+		mVirtualDeviceMap.erase(AddressRange(iter->begin, iter->end));
+		iter = mSegmentMemory.erase(iter);
+	}
+	return true;
+}
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "VirtualMachine.h"
+
+// Snapshot file layout, all values little endian:
+//
+//   "RVSN", uint32 version, uint8 incremental
+//   WORD registers[cRegCount], uint8 written[cRegCount], ADDRESS pc, uint64 executed,
+//   uint64 skipped cycles, uint64 loads, uint64 stores, uint64 taken branches, uint8 finished
+//   full snapshots only: uint32 instruction count, INSTRUCTION image[count],
+//   ADDRESS code base, uint32 offset count (0 or instruction count), uint32 offsets[offset count]
+//   uint32 memory records, each: ADDRESS address, uint32 size, size bytes
+//   uint32 device records, each: uint32 device index (map order), uint32 size, size bytes
+
+namespace {
+
+	char const cSnapshotMagic[4] = { 'R', 'V', 'S', 'N' };
+	uint32_t const cSnapshotVersion = 4;
+
+	template <typename T>
+	void Put(std::ostream& os, T const& value) {
+		os.write(reinterpret_cast<char const*>(&value), sizeof(value));
+	}
+
+	template <typename T>
+	bool Get(std::istream& is, T& value) {
+		return static_cast<bool>(is.read(reinterpret_cast<char*>(&value), sizeof(value)));
+	}
+
+	struct MemoryRecord {
+		RiscV::ADDRESS address;
+		uint32_t size;
+		uint8_t const* data;
+	};
+}
+
+bool VirtualMachine::SaveSnapshot(std::string const& fileName, bool incremental) {
+	std::ofstream ofs(fileName, std::ios::binary | std::ios::trunc);
+	if (!ofs.is_open()) {
+		std::cerr << "Could not open file: " << fileName << std::endl;
+		return false;
+	}
+
+	ofs.write(cSnapshotMagic, sizeof(cSnapshotMagic));
+	Put(ofs, cSnapshotVersion);
+	Put(ofs, static_cast<uint8_t>(incremental ? 1 : 0));
+
+	ofs.write(reinterpret_cast<char const*>(mRegisterFile), sizeof(mRegisterFile));
+	for (size_t i = 0; i < RiscV::cRegCount; ++i) {
+		Put(ofs, static_cast<uint8_t>(mRegisterFileWritten[i] ? 1 : 0));
+	}
+	Put(ofs, mPc);
+	Put(ofs, mExecutedInstructions);
+	Put(ofs, mSkippedCycles);
+	Put(ofs, mLoads);
+	Put(ofs, mStores);
+	Put(ofs, mTakenBranches);
+	Put(ofs, static_cast<uint8_t>(mFinished ? 1 : 0));
+
+	if (!incremental) {
+		Put(ofs, static_cast<uint32_t>(mInstructionSize));
+		ofs.write(reinterpret_cast<char const*>(mInstructionMemory), mInstructionSize * sizeof(RiscV::INSTRUCTION));
+		Put(ofs, mCodeLayout.base);
+		Put(ofs, static_cast<uint32_t>(mCodeLayout.offsets.size()));
+		ofs.write(reinterpret_cast<char const*>(mCodeLayout.offsets.data()), mCodeLayout.offsets.size() * sizeof(uint32_t));
+	}
+
+	// plain memory page by page, only the written pages for an incremental snapshot
+	std::vector<MemoryRecord> records;
+	for (auto const& entry : mVirtualDeviceMap) {
+		size_t hostSize = 0;
+		uint8_t const* host = entry.second->HostMemory(hostSize);
+		if (host == nullptr || hostSize == 0) continue;
+
+		int64_t const begin = entry.first.Begin();
+		int64_t const end = std::min<int64_t>(entry.first.End(), begin + static_cast<int64_t>(hostSize) - 1);
+		for (int64_t pageBegin = begin & ~static_cast<int64_t>(RiscV::cPageMask); pageBegin <= end; pageBegin += RiscV::cPageSize) {
+			size_t const page = static_cast<uint32_t>(pageBegin) >> RiscV::cPageBits;
+			if (incremental && !PageDirty(page)) continue;
+
+			int64_t const from = std::max(begin, pageBegin);
+			int64_t const to = std::min(end, pageBegin + static_cast<int64_t>(RiscV::cPageSize) - 1);
+			if (!entry.second->HostMemoryCommitted(static_cast<size_t>(from - begin), static_cast<size_t>(to - from + 1))) continue;
+			records.push_back(MemoryRecord{ static_cast<RiscV::ADDRESS>(from), static_cast<uint32_t>(to - from + 1), host + (from - begin) });
+		}
+	}
+	Put(ofs, static_cast<uint32_t>(records.size()));
+	for (MemoryRecord const& record : records) {
+		Put(ofs, record.address);
+		Put(ofs, record.size);
+		ofs.write(reinterpret_cast<char const*>(record.data), record.size);
+	}
+
+	// devices that keep state of their own
+	std::vector<std::pair<uint32_t, std::string>> states;
+	uint32_t deviceIndex = 0;
+	for (auto const& entry : mVirtualDeviceMap) {
+		std::ostringstream state;
+		if (entry.second->SaveState(state)) {
+			states.push_back(std::make_pair(deviceIndex, state.str()));
+		}
+		++deviceIndex;
+	}
+	Put(ofs, static_cast<uint32_t>(states.size()));
+	for (auto const& state : states) {
+		Put(ofs, state.first);
+		Put(ofs, static_cast<uint32_t>(state.second.size()));
+		ofs.write(state.second.data(), state.second.size());
+	}
+
+	if (!ofs) {
+		std::cerr << "Could not write snapshot: " << fileName << std::endl;
+		return false;
+	}
+	ClearDirty();
+	return true;
+}
+
+bool VirtualMachine::LoadSnapshot(std::string const& fileName) {
+	std::ifstream ifs(fileName, std::ios::binary);
+	if (!ifs.is_open()) {
+		std::cerr << "Could not open file: " << fileName << std::endl;
+		return false;
+	}
+
+	char magic[sizeof(cSnapshotMagic)];
+	uint32_t version = 0;
+	uint8_t incremental = 0;
+	ifs.read(magic, sizeof(magic));
+	if (!ifs || !std::equal(magic, magic + sizeof(magic), cSnapshotMagic) || !Get(ifs, version) || version != cSnapshotVersion || !Get(ifs, incremental)) {
+		std::cerr << "Invalid snapshot: " << fileName << std::endl;
+		return false;
+	}
+
+	// read everything before touching the machine, a broken file leaves it unchanged
+	RiscV::WORD registers[RiscV::cRegCount];
+	uint8_t written[RiscV::cRegCount];
+	RiscV::ADDRESS pc = 0;
+	uint64_t executed = 0;
+	uint64_t skipped = 0;
+	uint64_t loads = 0;
+	uint64_t stores = 0;
+	uint64_t branches = 0;
+	uint8_t finished = 0;
+	ifs.read(reinterpret_cast<char*>(registers), sizeof(registers));
+	ifs.read(reinterpret_cast<char*>(written), sizeof(written));
+	Get(ifs, pc);
+	Get(ifs, executed);
+	Get(ifs, skipped);
+	Get(ifs, loads);
+	Get(ifs, stores);
+	Get(ifs, branches);
+	Get(ifs, finished);
+
+	// counts and sizes come from the file, nothing is allocated for more than it still holds
+	std::vector<RiscV::INSTRUCTION> image;
+	RiscV::CodeLayout layout;
+	if (incremental == 0) {
+		uint32_t count = 0;
+		if (Get(ifs, count) && count <= IVirtualDevice::BytesLeft(ifs) / sizeof(RiscV::INSTRUCTION)) {
+			image.resize(count);
+			ifs.read(reinterpret_cast<char*>(image.data()), count * sizeof(RiscV::INSTRUCTION));
+		}
+		else {
+			ifs.setstate(std::ios::failbit);
+		}
+		uint32_t offsetCount = 0;
+		Get(ifs, layout.base);
+		if (Get(ifs, offsetCount) && (offsetCount == 0 || offsetCount == count) && offsetCount <= IVirtualDevice::BytesLeft(ifs) / sizeof(uint32_t)) {
+			layout.offsets.resize(offsetCount);
+			ifs.read(reinterpret_cast<char*>(layout.offsets.data()), offsetCount * sizeof(uint32_t));
+		}
+		else {
+			ifs.setstate(std::ios::failbit);
+		}
+	}
+
+	// every record has at least its header
+	uint32_t const cRecordHeader = 2 * sizeof(uint32_t);
+	uint32_t recordCount = 0;
+	if (Get(ifs, recordCount) && recordCount > IVirtualDevice::BytesLeft(ifs) / cRecordHeader) {
+		ifs.setstate(std::ios::failbit);
+	}
+	std::vector<std::pair<RiscV::ADDRESS, std::vector<uint8_t>>> memory(ifs ? recordCount : 0);
+	for (auto& record : memory) {
+		uint32_t size = 0;
+		Get(ifs, record.first);
+		Get(ifs, size);
+		if (ifs && size > IVirtualDevice::BytesLeft(ifs)) ifs.setstate(std::ios::failbit);
+		if (!ifs) break;
+		record.second.resize(size);
+		ifs.read(reinterpret_cast<char*>(record.second.data()), size);
+	}
+
+	uint32_t stateCount = 0;
+	if (Get(ifs, stateCount) && stateCount > IVirtualDevice::BytesLeft(ifs) / cRecordHeader) {
+		ifs.setstate(std::ios::failbit);
+	}
+	std::vector<std::pair<uint32_t, std::string>> states(ifs ? stateCount : 0);
+	for (auto& state : states) {
+		uint32_t size = 0;
+		Get(ifs, state.first);
+		Get(ifs, size);
+		if (ifs && size > IVirtualDevice::BytesLeft(ifs)) ifs.setstate(std::ios::failbit);
+		if (!ifs) break;
+		state.second.resize(size);
+		ifs.read(&state.second[0], size);
+	}
+
+	if (!ifs) {
+		std::cerr << "Invalid snapshot: " << fileName << std::endl;
+		return false;
+	}
+
+	// compiled and threaded code depend on the image and on which registers are written
+	mJit.reset();
+	for (std::vector<uintptr_t>& code : mThreadedCode) {
+		code.clear();
+	}
+	if (incremental == 0) {
+		Load(image, layout);
+	}
+
+	std::copy(registers, registers + RiscV::cRegCount, mRegisterFile);
+	for (size_t i = 0; i < RiscV::cRegCount; ++i) {
+		mRegisterFileWritten[i] = written[i] != 0;
+	}
+	mPc = pc;
+	mExecutedInstructions = executed;
+	mSkippedCycles = skipped;
+	mLoads = loads;
+	mStores = stores;
+	mTakenBranches = branches;
+	mRegistersAnalyzed = false;
+	mFinished = finished != 0;
+
+	bool complete = true;
+	for (auto const& record : memory) {
+		complete &= WriteBlock(record.first, record.second.data(), record.second.size());
+	}
+	for (auto const& state : states) {
+		TVirtualDeviceMap::iterator iter = mVirtualDeviceMap.begin();
+		for (uint32_t i = 0; i < state.first && iter != mVirtualDeviceMap.end(); ++i) ++iter;
+		std::istringstream is(state.second);
+		complete &= iter != mVirtualDeviceMap.end() && iter->second->LoadState(is);
+	}
+	if (!complete) {
+		std::cerr << "Snapshot does not match the registered devices: " << fileName << std::endl;
+	}
+	ClearDirty();
+
+	// a program that stopped at a sleep instruction continues behind it
+	if (mFinished && mPc >= 0 && static_cast<size_t>(mPc) + 1 < mInstructionSize &&
+		mDecodedInstructions[mPc].handler == RiscV::Handler::SLEEP) {
+		++mPc;
+		mFinished = false;
+	}
+	// snapshots do not record why a program ended, a fault reads back as the pc leaving the image
+	bool const atSleep = mPc >= 0 && static_cast<size_t>(mPc) < mInstructionSize && mDecodedInstructions[mPc].handler == RiscV::Handler::SLEEP;
+	mStopReason = atSleep ? StopReason::Sleep : StopReason::PcOutOfRange;
+	mFaultMessage.clear();
+	return complete;
+}
@@ -0,0 +1,470 @@
+#include <iomanip>
+#include <iostream>
+
+#include "VirtualMachine.h"
+
+// Threaded execution engine
+//
+// Every instruction handler ends with its own dispatch to the handler of the next instruction
+// instead of returning to one central switch. With gcc/clang the decoded image is translated
+// into an array of label addresses (direct-threaded code, computed goto), every other compiler
+// falls back to a switch inside a loop with the same handler bodies.
+//
+// Pairs matched by RiscV::MatchFusion are translated into one fused handler that executes both
+// instructions with a single dispatch. The second instruction keeps its own entry, so jumps into
+// the middle of a pair still work.
+//
+// The engine has no verbose output, Run() falls back to the switch engine in verbose mode.
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+using namespace RiscV;
+
+#ifdef VM_COMPUTED_GOTO
+#define HANDLER(name) L_##name:
+#define FUSED(name) L_FUSED_##name:
+#define NEXT() { inst = &decoded[mPc]; ++mExecutedInstructions; goto *reinterpret_cast<void*>(code[mPc]); }
+#else
+// fused handlers are numbered after the plain ones
+static size_t const cFusedBase = static_cast<size_t>(Handler::COUNT);
+#define HANDLER(name) case static_cast<size_t>(Handler::name):
+#define FUSED(name) case cFusedBase + static_cast<size_t>(Fusion::name):
+#define NEXT() continue
+#endif
+
+// inside a fused handler, step to the second instruction of the pair, it is always in range
+#define SECOND(name) { ++mFusionHits[static_cast<size_t>(Fusion::name)]; ++mPc; inst = &decoded[mPc]; ++mExecutedInstructions; }
+
+// no do/while(0) wrappers here, NEXT() has to be able to "continue" the dispatch loop
+// move on to the next instruction, or leave if it is out of range
+#define ADVANCE() { if (!SetPc(mPc + 1)) return; NEXT(); }
+// continue at target, or leave if it is out of range or the instruction budget is used up
+#define JUMP(target) { if (!SetPc(target)) return; if (mExecutedInstructions >= mBudgetEnd) return; NEXT(); }
+// a taken conditional branch, counted for the branches csr under a counting policy
+#define BRANCH(target) { if (P::cCountEvents) ++mTakenBranches; JUMP(target); }
+// jalr, the target may turn the register checks back on, the unchecked loop then leaves
+#define INDIRECT_JUMP(target) { if (!SetPc(target)) return; if (!P::cCheckRegisters) { CheckIndirectTarget(); if (mCheckRegisters) return; } if (mExecutedInstructions >= mBudgetEnd) return; NEXT(); }
+
+void VirtualMachine::RunThreaded() {
+	for (;;) {
+		bool const checked = mCheckRegisters;
+		if (mCountsEvents) {
+			if (checked) {
+				RunThreadedLoop<CountingCheckedPolicy>();
+			}
+			else {
+				RunThreadedLoop<CountingUncheckedPolicy>();
+			}
+		}
+		else if (checked) {
+			RunThreadedLoop<CheckedPolicy>();
+		}
+		else {
+			RunThreadedLoop<UncheckedPolicy>();
+		}
+		if (Finished() || mExecutedInstructions >= mBudgetEnd || checked == mCheckRegisters) return;
+	}
+}
+
+template <class P>
+void VirtualMachine::RunThreadedLoop() {
+	if (static_cast<size_t>(mPc) >= mInstructionSize) return;
+
+	DecodedInstruction const* const decoded = mDecodedInstructions.data();
+	DecodedInstruction const* inst = nullptr;
+	std::vector<uintptr_t>& threadedCode = mThreadedCode[ThreadedLoop<P>()];
+
+#ifdef VM_COMPUTED_GOTO
+	// same order as RiscV::Handler
+	static void* const cHandlerLabels[] = {
+		&&L_ADD, &&L_SUB, &&L_SLL, &&L_SLT, &&L_SLTU, &&L_XOR, &&L_SRL, &&L_SRA, &&L_OR, &&L_AND,
+		&&L_MUL, &&L_MULH, &&L_MULHSU, &&L_MULHU, &&L_DIV, &&L_DIVU, &&L_REM, &&L_REMU,
+		&&L_ADDI, &&L_SLTI, &&L_SLTIU, &&L_XORI, &&L_ORI, &&L_ANDI, &&L_SLLI, &&L_SRLI, &&L_SRAI, &&L_SHIFT_ILLEGAL,
+		&&L_LB, &&L_LH, &&L_LW, &&L_LBU, &&L_LHU, &&L_SB, &&L_SH, &&L_SW,
+		&&L_JAL, &&L_JALR, &&L_JR, &&L_BEQ, &&L_BNEQ, &&L_BLT, &&L_BGE, &&L_BLTU, &&L_BGEU,
+		&&L_LUI, &&L_AUIPC,
+		&&L_PRINT, &&L_SLEEP,
+		&&L_CSRR, &&L_CSR_ILLEGAL,
+		&&L_NOP,
+		&&L_UNKNOWN,
+	};
+	static_assert(sizeof(cHandlerLabels) / sizeof(cHandlerLabels[0]) == static_cast<size_t>(Handler::COUNT),
+		"label table does not match RiscV::Handler");
+
+	// same order as RiscV::Fusion
+	static void* const cFusedLabels[] = {
+		nullptr,
+		&&L_FUSED_LUI_ADDI,
+		&&L_FUSED_SLT_BEQ, &&L_FUSED_SLT_BNEQ, &&L_FUSED_SLTU_BEQ, &&L_FUSED_SLTU_BNEQ,
+		&&L_FUSED_ADDI_LW,
+		&&L_FUSED_AUIPC_JALR,
+	};
+	static_assert(sizeof(cFusedLabels) / sizeof(cFusedLabels[0]) == static_cast<size_t>(Fusion::COUNT),
+		"label table does not match RiscV::Fusion");
+
+	auto translate = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			Fusion const fusion = (i + 1 < mInstructionSize) ? MatchFusion(decoded[i], decoded[i + 1]) : Fusion::NONE;
+			threadedCode[i] = reinterpret_cast<uintptr_t>((fusion != Fusion::NONE)
+				? cFusedLabels[static_cast<size_t>(fusion)]
+				: cHandlerLabels[static_cast<size_t>(decoded[i].handler)]);
+		}
+	};
+#else
+	auto translate = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			Fusion const fusion = (i + 1 < mInstructionSize) ? MatchFusion(decoded[i], decoded[i + 1]) : Fusion::NONE;
+			threadedCode[i] = (fusion != Fusion::NONE)
+				? cFusedBase + static_cast<size_t>(fusion)
+				: static_cast<size_t>(decoded[i].handler);
+		}
+	};
+#endif
+
+	// translate the decoded image into threaded code on the first run, and again where the guest
+	// stored to its code since then
+	std::vector<std::pair<ADDRESS, ADDRESS>>& stale = mStaleThreadedCode[ThreadedLoop<P>()];
+	if (threadedCode.empty()) {
+		threadedCode.resize(mInstructionSize);
+		translate(0, mInstructionSize);
+	}
+	for (auto const& range : stale) {
+		translate(range.first, range.second);
+	}
+	stale.clear();
+
+#ifdef VM_COMPUTED_GOTO
+	uintptr_t const* const code = threadedCode.data();
+
+	NEXT();
+	{
+		{
+#else
+	uintptr_t const* const ops = threadedCode.data();
+
+	for (;;) {
+		inst = &decoded[mPc];
+		++mExecutedInstructions;
+
+		switch (ops[mPc]) {
+#endif
+		HANDLER(ADD) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) + ReadRegisterFile<P>(inst->rs2));
+			ADVANCE();
+		}
+		HANDLER(SUB) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) - ReadRegisterFile<P>(inst->rs2));
+			ADVANCE();
+		}
+		HANDLER(SLL) {
+			WORD valRs1 = ReadRegisterFile<P>(inst->rs1);
+			WriteRegisterFile<P>(inst->rd, valRs1 << (ReadRegisterFile<P>(inst->rs2) & 0x1F));
+			ADVANCE();
+		}
+		HANDLER(SLT) {
+			WriteRegisterFile<P>(inst->rd, (ReadRegisterFile<P>(inst->rs1) < ReadRegisterFile<P>(inst->rs2)) ? 1 : 0);
+			ADVANCE();
+		}
+		HANDLER(SLTU) {
+			WriteRegisterFile<P>(inst->rd, ((uint32_t)ReadRegisterFile<P>(inst->rs1) < (uint32_t)ReadRegisterFile<P>(inst->rs2)) ? 1 : 0);
+			ADVANCE();
+		}
+		HANDLER(XOR) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) ^ ReadRegisterFile<P>(inst->rs2));
+			ADVANCE();
+		}
+		HANDLER(SRL) {
+			WORD valRs1 = ReadRegisterFile<P>(inst->rs1);
+			WriteRegisterFile<P>(inst->rd, (unsigned)valRs1 >> (ReadRegisterFile<P>(inst->rs2) & 0x1F));
+			ADVANCE();
+		}
+		HANDLER(SRA) {
+			WORD valRs1 = ReadRegisterFile<P>(inst->rs1);
+			WriteRegisterFile<P>(inst->rd, ShiftRightArithmetic(valRs1, ReadRegisterFile<P>(inst->rs2) & 0x1F));
+			ADVANCE();
+		}
+		HANDLER(OR) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) | ReadRegisterFile<P>(inst->rs2));
+			ADVANCE();
+		}
+		HANDLER(AND) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) & ReadRegisterFile<P>(inst->rs2));
+			ADVANCE();
+		}
+		HANDLER(MUL) {
+			WORD valRs1 = ReadRegisterFile<P>(inst->rs1);
+			WORD valRs2 = ReadRegisterFile<P>(inst->rs2);
+			WriteRegisterFile<P>(inst->rd, ((int64_t)valRs1 * (int64_t)valRs2) & 0xFFFFFFFF);
+			ADVANCE();
+		}
+		HANDLER(MULH) {
+			WORD valRs1 = ReadRegisterFile<P>(inst->rs1);
+			WORD valRs2 = ReadRegisterFile<P>(inst->rs2);
+			WriteRegisterFile<P>(inst->rd, (((int64_t)valRs1 * (int64_t)valRs2) & 0xFFFFFFFF00000000) >> 32);
+			ADVANCE();
+		}
+		HANDLER(MULHSU) {
+			WORD valRs1 = ReadRegisterFile<P>(inst->rs1);
+			WORD valRs2 = ReadRegisterFile<P>(inst->rs2);
+			WriteRegisterFile<P>(inst->rd, (((int64_t)valRs1 * (int64_t)(uint32_t)valRs2) & 0xFFFFFFFF00000000) >> 32);
+			ADVANCE();
+		}
+		HANDLER(MULHU) {
+			WORD valRs1 = ReadRegisterFile<P>(inst->rs1);
+			WORD valRs2 = ReadRegisterFile<P>(inst->rs2);
+			WriteRegisterFile<P>(inst->rd, (((uint64_t)(uint32_t)valRs1 * (uint64_t)(uint32_t)valRs2) & 0xFFFFFFFF00000000) >> 32);
+			ADVANCE();
+		}
+		HANDLER(DIV) {
+			WORD valRs1 = ReadRegisterFile<P>(inst->rs1);
+			WORD valRs2 = ReadRegisterFile<P>(inst->rs2);
+			if (valRs2 == 0) {
+				PrintWarning("trying to divide through 0, not executing instruction");
+			}
+			else {
+				WriteRegisterFile<P>(inst->rd, valRs1 / valRs2);
+			}
+			ADVANCE();
+		}
+		HANDLER(DIVU) {
+			uint32_t valRs1 = ReadRegisterFile<P>(inst->rs1);
+			uint32_t valRs2 = ReadRegisterFile<P>(inst->rs2);
+			if (valRs2 == 0) {
+				PrintWarning("trying to divide through 0, setting value to 1 instead");
+				valRs2 = 1;
+			}
+			WriteRegisterFile<P>(inst->rd, valRs1 / valRs2);
+			ADVANCE();
+		}
+		HANDLER(REM) {
+			WORD valRs1 = ReadRegisterFile<P>(inst->rs1);
+			WORD valRs2 = ReadRegisterFile<P>(inst->rs2);
+			if (valRs2 == 0) {
+				PrintWarning("trying to modulo through 0, setting value to 1 instead");
+				valRs2 = 1;
+			}
+			WriteRegisterFile<P>(inst->rd, valRs1 % valRs2);
+			ADVANCE();
+		}
+		HANDLER(REMU) {
+			uint32_t valRs1 = ReadRegisterFile<P>(inst->rs1);
+			uint32_t valRs2 = ReadRegisterFile<P>(inst->rs2);
+			if (valRs2 == 0) {
+				PrintWarning("trying to modulo through 0, setting value to 1 instead");
+				valRs2 = 1;
+			}
+			WriteRegisterFile<P>(inst->rd, valRs1 % valRs2);
+			ADVANCE();
+		}
+		HANDLER(ADDI) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) + inst->imm);
+			ADVANCE();
+		}
+		HANDLER(SLTI) {
+			WriteRegisterFile<P>(inst->rd, (ReadRegisterFile<P>(inst->rs1) < inst->imm) ? 1 : 0);
+			ADVANCE();
+		}
+		HANDLER(SLTIU) {
+			WriteRegisterFile<P>(inst->rd, ((uint32_t)ReadRegisterFile<P>(inst->rs1) < (uint32_t)inst->imm) ? 1 : 0);
+			ADVANCE();
+		}
+		HANDLER(XORI) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) ^ inst->imm);
+			ADVANCE();
+		}
+		HANDLER(ORI) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) | inst->imm);
+			ADVANCE();
+		}
+		HANDLER(ANDI) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) & inst->imm);
+			ADVANCE();
+		}
+		HANDLER(SLLI) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) << inst->imm);
+			ADVANCE();
+		}
+		HANDLER(SRLI) {
+			WriteRegisterFile<P>(inst->rd, (unsigned)ReadRegisterFile<P>(inst->rs1) >> inst->imm);
+			ADVANCE();
+		}
+		HANDLER(SRAI) {
+			WriteRegisterFile<P>(inst->rd, ShiftRightArithmetic(ReadRegisterFile<P>(inst->rs1), inst->imm));
+			ADVANCE();
+		}
+		HANDLER(SHIFT_ILLEGAL) {
+			PrintWarning("illegal shift amount, rd=rs1");
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1));
+			ADVANCE();
+		}
+		HANDLER(LB) {
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteRegisterFile<P>(inst->rd, static_cast<int8_t>(ReadMemory<P>(addr, 1)));
+			ADVANCE();
+		}
+		HANDLER(LH) {
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteRegisterFile<P>(inst->rd, static_cast<int16_t>(ReadMemory<P>(addr, 2)));
+			ADVANCE();
+		}
+		HANDLER(LW) {
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteRegisterFile<P>(inst->rd, ReadMemory<P>(addr, 4));
+			ADVANCE();
+		}
+		HANDLER(LBU) {
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteRegisterFile<P>(inst->rd, ReadMemory<P>(addr, 1));
+			ADVANCE();
+		}
+		HANDLER(LHU) {
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteRegisterFile<P>(inst->rd, ReadMemory<P>(addr, 2));
+			ADVANCE();
+		}
+		HANDLER(SB) {
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteMemory<P>(addr, ReadRegisterFile<P>(inst->rs2), 1);
+			ADVANCE();
+		}
+		HANDLER(SH) {
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteMemory<P>(addr, ReadRegisterFile<P>(inst->rs2), 2);
+			ADVANCE();
+		}
+		HANDLER(SW) {
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteMemory<P>(addr, ReadRegisterFile<P>(inst->rs2), 4);
+			ADVANCE();
+		}
+		HANDLER(JAL) {
+			WriteRegisterFile<P>(inst->rd, mPc + 1);
+			JUMP(inst->imm);
+		}
+		HANDLER(JALR) {
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteRegisterFile<P>(inst->rd, mPc + 1);
+			INDIRECT_JUMP(addr);
+		}
+		HANDLER(JR) {
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			INDIRECT_JUMP(addr);
+		}
+		HANDLER(BEQ) {
+			if (ReadRegisterFile<P>(inst->rs1) == ReadRegisterFile<P>(inst->rs2)) BRANCH(inst->imm);
+			ADVANCE();
+		}
+		HANDLER(BNEQ) {
+			if (ReadRegisterFile<P>(inst->rs1) != ReadRegisterFile<P>(inst->rs2)) BRANCH(inst->imm);
+			ADVANCE();
+		}
+		HANDLER(BLT) {
+			if (ReadRegisterFile<P>(inst->rs1) < ReadRegisterFile<P>(inst->rs2)) BRANCH(inst->imm);
+			ADVANCE();
+		}
+		HANDLER(BGE) {
+			if (ReadRegisterFile<P>(inst->rs1) >= ReadRegisterFile<P>(inst->rs2)) BRANCH(inst->imm);
+			ADVANCE();
+		}
+		HANDLER(BLTU) {
+			if ((uint32_t)ReadRegisterFile<P>(inst->rs1) < (uint32_t)ReadRegisterFile<P>(inst->rs2)) BRANCH(inst->imm);
+			ADVANCE();
+		}
+		HANDLER(BGEU) {
+			if ((uint32_t)ReadRegisterFile<P>(inst->rs1) >= (uint32_t)ReadRegisterFile<P>(inst->rs2)) BRANCH(inst->imm);
+			ADVANCE();
+		}
+		HANDLER(LUI) {
+			WriteRegisterFile<P>(inst->rd, inst->imm);
+			ADVANCE();
+		}
+		HANDLER(AUIPC) {
+			WriteRegisterFile<P>(inst->rd, mPc + inst->imm);
+			ADVANCE();
+		}
+		HANDLER(PRINT) {
+			mConsole->Print(ReadRegisterFile<P>(inst->rs1));
+			ADVANCE();
+		}
+		HANDLER(SLEEP) {
+			PrintInfo("sleep instruction reached, ending execution");
+			Stop(StopReason::Sleep);
+			return;
+		}
+		HANDLER(CSRR) {
+			WriteRegisterFile<P>(inst->rd, ReadCounter(static_cast<uint32_t>(inst->imm)));
+			ADVANCE();
+		}
+		HANDLER(CSR_ILLEGAL) {
+			Fault("illegal csr access, only reading the counters is supported");
+			ADVANCE();
+		}
+		HANDLER(NOP) {
+			ADVANCE();
+		}
+		HANDLER(UNKNOWN) {
+			Fault("unknown opcode");
+			ADVANCE();
+		}
+		FUSED(LUI_ADDI) {
+			WriteRegisterFile<P>(inst->rd, inst->imm);
+			SECOND(LUI_ADDI);
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) + inst->imm);
+			ADVANCE();
+		}
+		FUSED(SLT_BEQ) {
+			WriteRegisterFile<P>(inst->rd, (ReadRegisterFile<P>(inst->rs1) < ReadRegisterFile<P>(inst->rs2)) ? 1 : 0);
+			SECOND(SLT_BEQ);
+			if (ReadRegisterFile<P>(inst->rs1) == ReadRegisterFile<P>(inst->rs2)) BRANCH(inst->imm);
+			ADVANCE();
+		}
+		FUSED(SLT_BNEQ) {
+			WriteRegisterFile<P>(inst->rd, (ReadRegisterFile<P>(inst->rs1) < ReadRegisterFile<P>(inst->rs2)) ? 1 : 0);
+			SECOND(SLT_BNEQ);
+			if (ReadRegisterFile<P>(inst->rs1) != ReadRegisterFile<P>(inst->rs2)) BRANCH(inst->imm);
+			ADVANCE();
+		}
+		FUSED(SLTU_BEQ) {
+			WriteRegisterFile<P>(inst->rd, ((uint32_t)ReadRegisterFile<P>(inst->rs1) < (uint32_t)ReadRegisterFile<P>(inst->rs2)) ? 1 : 0);
+			SECOND(SLTU_BEQ);
+			if (ReadRegisterFile<P>(inst->rs1) == ReadRegisterFile<P>(inst->rs2)) BRANCH(inst->imm);
+			ADVANCE();
+		}
+		FUSED(SLTU_BNEQ) {
+			WriteRegisterFile<P>(inst->rd, ((uint32_t)ReadRegisterFile<P>(inst->rs1) < (uint32_t)ReadRegisterFile<P>(inst->rs2)) ? 1 : 0);
+			SECOND(SLTU_BNEQ);
+			if (ReadRegisterFile<P>(inst->rs1) != ReadRegisterFile<P>(inst->rs2)) BRANCH(inst->imm);
+			ADVANCE();
+		}
+		FUSED(ADDI_LW) {
+			WriteRegisterFile<P>(inst->rd, ReadRegisterFile<P>(inst->rs1) + inst->imm);
+			SECOND(ADDI_LW);
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteRegisterFile<P>(inst->rd, ReadMemory<P>(addr, 4));
+			ADVANCE();
+		}
+		FUSED(AUIPC_JALR) {
+			WriteRegisterFile<P>(inst->rd, mPc + inst->imm);
+			SECOND(AUIPC_JALR);
+			WORD addr = ReadRegisterFile<P>(inst->rs1) + inst->imm;
+			WriteRegisterFile<P>(inst->rd, mPc + 1);
+			INDIRECT_JUMP(addr);
+		}
+#ifndef VM_COMPUTED_GOTO
+		default:
+			ADVANCE();
+#endif
+		}
+	}
+}
+
+#undef SECOND
+#undef INDIRECT_JUMP
+#undef BRANCH
+#undef JUMP
+#undef ADVANCE
+#undef NEXT
+#undef FUSED
+#undef HANDLER
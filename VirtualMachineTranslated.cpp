@@ -0,0 +1,55 @@
+#include <iostream>
+
+#include "VirtualMachine.h"
+
+// Engine for code translated ahead of time by VMRiscVTranslate, see Translation.h
+//
+// The translation runs until it reaches something it leaves to the virtual machine, which then
+// executes a single instruction with the interpreter and enters the translation again.
+
+bool VirtualMachine::SetTranslation(RiscV::Translation const* translation) {
+	uint32_t const* const offsets = mCodeLayout.offsets.empty() ? nullptr : mCodeLayout.offsets.data();
+	if (translation != nullptr && (translation->instructionCount != mInstructionSize ||
+		translation->imageHash != RiscV::HashImage(mInstructionMemory, mInstructionSize, mCodeLayout.base, offsets))) {
+		std::cerr << "Translation does not match the image" << std::endl;
+		return false;
+	}
+	mTranslation = translation;
+	return true;
+}
+
+void VirtualMachine::RunTranslated() {
+	// the generated code keeps all registers in locals
+	if (mTranslation == nullptr || mRegCount != RiscV::cRegCount) {
+		RunThreaded();
+		return;
+	}
+
+	mTranslationContext = { mRegisterFile, this, 0, 0, 0, mPageMemory.data(), mPageMemory.size(), mPageDirty.data(), mPageCode.data(),
+		&VirtualMachine::JitReadMemory, &VirtualMachine::JitWriteMemory };
+
+	while (mPc >= 0 && static_cast<size_t>(mPc) < mInstructionSize) {
+		if (mExecutedInstructions >= mBudgetEnd) return;
+		uint32_t written = 0;
+		for (size_t reg = 0; reg < RiscV::cRegCount; ++reg) {
+			if (mRegisterFileWritten[reg]) written |= 1u << reg;
+		}
+		mTranslationContext.executed = 0;
+		mTranslationContext.written = written;
+		mTranslationContext.limit = mBudgetEnd - mExecutedInstructions;
+		RiscV::ADDRESS const next = mTranslation->run(&mTranslationContext, mPc);
+		mExecutedInstructions += mTranslationContext.executed;
+		for (size_t reg = 0; reg < RiscV::cRegCount; ++reg) {
+			if (mTranslationContext.written & (1u << reg)) mRegisterFileWritten[reg] = true;
+		}
+
+		if (mTranslationContext.executed == 0) {
+			// nothing translated at this pc
+			if (!ExecuteOne() && Finished()) return;
+			continue;
+		}
+		if (!SetPc(next)) return;
+		// the translation may have left at a jalr target
+		CheckIndirectTarget();
+	}
+}
@@ -1,19 +1,37 @@
 #include "VirtualMemory.h"
 
-VirtualMemory::VirtualMemory(size_t const size)
+#include <cstring>
+
+VirtualMemory::VirtualMemory(size_t const size) : mSize(size)
 {
-	mMemory = new RiscV::WORD[RiscV::cMemDataSize];
+	mMemory = new uint8_t[size];
 }
 
 VirtualMemory::~VirtualMemory() {
 	delete[] mMemory;
 }
 
-RiscV::WORD VirtualMemory::Read(RiscV::ADDRESS const& address) {
-	return mMemory[address];
+// guest and host are both little endian, the bytes are copied as they are
+RiscV::WORD VirtualMemory::Read(RiscV::ADDRESS const& address, size_t size) {
+	uint32_t data = 0;
+	std::memcpy(&data, mMemory + address, size);
+	return static_cast<RiscV::WORD>(data);
+}
+
+
+void VirtualMemory::Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t size) {
+	std::memcpy(mMemory + address, &data, size);
 }
 
+void VirtualMemory::ReadBlock(RiscV::ADDRESS const& address, void* buffer, size_t size) {
+	std::memcpy(buffer, mMemory + address, size);
+}
+
+void VirtualMemory::WriteBlock(RiscV::ADDRESS const& address, void const* buffer, size_t size) {
+	std::memcpy(mMemory + address, buffer, size);
+}
 
-void VirtualMemory::Write(RiscV::ADDRESS const& address, RiscV::WORD const& data) {
-	mMemory[address] = data;
+uint8_t* VirtualMemory::HostMemory(size_t& size) {
+	size = mSize;
+	return mMemory;
 }
\ No newline at end of file
@@ -4,11 +4,16 @@
 class VirtualMemory : public IVirtualDevice
 {
 public:
+	// size in bytes
 	VirtualMemory(size_t const size);
 	~VirtualMemory();
-	virtual RiscV::WORD Read(RiscV::ADDRESS const& address);
-	virtual void Write(RiscV::ADDRESS const& address, RiscV::WORD const& data);
+	virtual RiscV::WORD Read(RiscV::ADDRESS const& address, size_t size);
+	virtual void Write(RiscV::ADDRESS const& address, RiscV::WORD const& data, size_t size);
+	virtual void ReadBlock(RiscV::ADDRESS const& address, void* buffer, size_t size);
+	virtual void WriteBlock(RiscV::ADDRESS const& address, void const* buffer, size_t size);
+	virtual uint8_t* HostMemory(size_t& size);
 private:
-	RiscV::WORD* mMemory;
+	uint8_t* mMemory;
+	size_t const mSize;
 };
 